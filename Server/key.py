@@ -1,4 +1,14 @@
 import pyDHE
+from Crypto.Cipher import AES
+from cryptography.hazmat.primitives import hashes, serialization
+from cryptography.hazmat.primitives.asymmetric import ec, x25519
+from cryptography.hazmat.primitives.kdf.hkdf import HKDF
+
+# ECDH curves and key derivation, see ta/include/my_test_ta.h
+ECDH_CURVE_X25519 = 1
+ECDH_CURVE_P256 = 2
+ECDH_HKDF_INFO = b"TZStreaming AES-128-CTR"
+ECDH_AES_KEY_SIZE = 16
 
 
 class insecure_key_storage:
@@ -20,5 +30,45 @@ class insecure_key_storage:
         return self.shared_key[client_address].encrypt(data)
 
 
+class ecdh_key:
+    """Ephemeral ECDH with one client, frames are AES-128-CTR encrypted
+    with the HKDF-SHA256 output, the same derivation the TA does."""
+
+    def __init__(self, curve):
+        self.curve = curve
+        if curve == ECDH_CURVE_X25519:
+            self.private_key = x25519.X25519PrivateKey.generate()
+            self.public_bytes = self.private_key.public_key().public_bytes(
+                serialization.Encoding.Raw, serialization.PublicFormat.Raw
+            )
+        elif curve == ECDH_CURVE_P256:
+            self.private_key = ec.generate_private_key(ec.SECP256R1())
+            self.public_bytes = self.private_key.public_key().public_bytes(
+                serialization.Encoding.X962, serialization.PublicFormat.UncompressedPoint
+            )
+        else:
+            raise ValueError(f"unknown curve {curve}")
+        self.aes_key = None
+
+    def derive(self, peer_bytes):
+        if self.curve == ECDH_CURVE_X25519:
+            peer = x25519.X25519PublicKey.from_public_bytes(peer_bytes)
+            secret = self.private_key.exchange(peer)
+        else:
+            peer = ec.EllipticCurvePublicKey.from_encoded_point(ec.SECP256R1(), peer_bytes)
+            secret = self.private_key.exchange(ec.ECDH(), peer)
+        # salt defaults to HashLen zero bytes, as in the TA
+        self.aes_key = HKDF(
+            algorithm=hashes.SHA256(), length=ECDH_AES_KEY_SIZE, salt=None, info=ECDH_HKDF_INFO
+        ).derive(secret)
+        # forward secrecy: the ephemeral key is not needed any more
+        self.private_key = None
+
+    def encrypt(self, data, seq):
+        # IV is seq as 64 bit big endian followed by a 64 bit block counter
+        cipher = AES.new(self.aes_key, AES.MODE_CTR, nonce=seq.to_bytes(8, "big"))
+        return cipher.encrypt(data)
+
+
 # https://cryptobook.nakov.com/key-exchange/dhke-examples
 # https://zhuanlan.zhihu.com/p/599518034
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <string.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/param_build.h>
+#include <openssl/rsa.h>
+#include "crypto.h"
+#include "my_test_ta.h"
+
+static EVP_PKEY *rsa_public_key(const uint8_t *n, size_t n_len, const uint8_t *e, size_t e_len)
+{
+    EVP_PKEY *pkey = NULL;
+    BIGNUM *bn_n = BN_bin2bn(n, n_len, NULL);
+    BIGNUM *bn_e = BN_bin2bn(e, e_len, NULL);
+    OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+
+    if (bn_n && bn_e && bld && ctx &&
+        OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, bn_n) &&
+        OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, bn_e) &&
+        (params = OSSL_PARAM_BLD_to_param(bld)) &&
+        EVP_PKEY_fromdata_init(ctx) > 0)
+        EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params);
+
+    EVP_PKEY_CTX_free(ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    BN_free(bn_e);
+    BN_free(bn_n);
+    return pkey;
+}
+
+size_t rsa_wrap(const uint8_t *n, size_t n_len, const uint8_t *e, size_t e_len, uint32_t scheme,
+                const uint8_t *in, size_t in_len, uint8_t *out, size_t out_sz)
+{
+    EVP_PKEY *pkey = rsa_public_key(n, n_len, e, e_len);
+    EVP_PKEY_CTX *ctx = pkey ? EVP_PKEY_CTX_new(pkey, NULL) : NULL;
+    const EVP_MD *md = scheme == TA_RSA_SCHEME_OAEP_SHA1 ? EVP_sha1() : EVP_sha256();
+    size_t len = out_sz;
+    int ok = ctx && EVP_PKEY_encrypt_init(ctx) > 0;
+
+    // OP-TEE's OAEP variants use MGF1 with the same hash
+    if (ok && scheme == TA_RSA_SCHEME_PKCS1_V1_5)
+        ok = EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0;
+    else if (ok)
+        ok = EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) > 0 &&
+             EVP_PKEY_CTX_set_rsa_oaep_md(ctx, md) > 0 &&
+             EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, md) > 0;
+    if (ok)
+        ok = EVP_PKEY_encrypt(ctx, out, &len, in, in_len) > 0;
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return ok ? len : 0;
+}
+
+static EVP_PKEY *ecdh_peer_key(uint32_t curve, const uint8_t *peer, size_t peer_len)
+{
+    EVP_PKEY *pkey = NULL;
+
+    if (curve == TA_ECDH_CURVE_X25519)
+        return EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer, peer_len);
+
+    // P-256, uncompressed point
+    char group[] = "prime256v1";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, group, 0),
+        OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, (void *)peer, peer_len),
+        OSSL_PARAM_construct_end(),
+    };
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+    if (ctx && EVP_PKEY_fromdata_init(ctx) > 0)
+        EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params);
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+static int hkdf_sha256(const uint8_t *secret, size_t secret_len, uint8_t *key, size_t key_len)
+{
+    static const uint8_t salt[32] = {0};
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    int ok = ctx && EVP_PKEY_derive_init(ctx) > 0 &&
+             EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, sizeof(salt)) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_len) > 0 &&
+             EVP_PKEY_CTX_add1_hkdf_info(ctx, (const uint8_t *)TA_ECDH_HKDF_INFO,
+                                         strlen(TA_ECDH_HKDF_INFO)) > 0 &&
+             EVP_PKEY_derive(ctx, key, &key_len) > 0;
+
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+int ecdh_agree(uint32_t curve, const uint8_t *peer, size_t peer_len,
+               uint8_t *pub, size_t *pub_len, uint8_t key[GROUP_KEY_SIZE])
+{
+    EVP_PKEY *ours = NULL;
+    EVP_PKEY *theirs = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
+    uint8_t secret[32];
+    size_t secret_len = sizeof(secret);
+    int ok = 0;
+
+    if (curve == TA_ECDH_CURVE_X25519)
+        ours = EVP_PKEY_Q_keygen(NULL, NULL, "X25519");
+    else if (curve == TA_ECDH_CURVE_P256)
+        ours = EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+    theirs = ours ? ecdh_peer_key(curve, peer, peer_len) : NULL;
+    if (!theirs)
+        goto out;
+
+    if (curve == TA_ECDH_CURVE_X25519)
+        ok = EVP_PKEY_get_raw_public_key(ours, pub, pub_len) > 0;
+    else
+        ok = EVP_PKEY_get_octet_string_param(ours, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                             pub, *pub_len, pub_len) > 0;
+    ctx = EVP_PKEY_CTX_new(ours, NULL);
+    ok = ok && ctx && EVP_PKEY_derive_init(ctx) > 0 &&
+         EVP_PKEY_derive_set_peer(ctx, theirs) > 0 &&
+         EVP_PKEY_derive(ctx, secret, &secret_len) > 0 &&
+         hkdf_sha256(secret, secret_len, key, GROUP_KEY_SIZE);
+    OPENSSL_cleanse(secret, sizeof(secret));
+
+out:
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(theirs);
+    EVP_PKEY_free(ours);
+    return ok;
+}
+
+aes_ctr::aes_ctr()
+{
+    ctx = EVP_CIPHER_CTX_new();
+}
+
+aes_ctr::~aes_ctr()
+{
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+void aes_ctr::set_key(const uint8_t key[GROUP_KEY_SIZE])
+{
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key, NULL);
+}
+
+void aes_ctr::crypt(uint64_t nonce, const void *in, size_t len, void *out)
+{
+    uint8_t iv[16] = {0};
+    int out_len;
+
+    for (int i = 0; i < 8; i++)
+        iv[i] = nonce >> (56 - 8 * i);
+    // keeps the key schedule, only the IV is reset
+    EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv);
+    EVP_EncryptUpdate(ctx, (uint8_t *)out, &out_len, (const uint8_t *)in, len);
+}
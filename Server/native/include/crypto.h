@@ -0,0 +1,41 @@
+#ifndef SERVER_CRYPTO
+#define SERVER_CRYPTO
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#define GROUP_KEY_SIZE 16 // AES-128, TA_ECDH_AES_KEY_SIZE
+#define ECDH_MAX_PUB_LEN 65
+
+// RSA encrypts in (the group key) to a client public key with the scheme the
+// client negotiated, n and e are big endian as exported by the TA.
+// Returns the cipher text length, 0 on error.
+size_t rsa_wrap(const uint8_t *n, size_t n_len, const uint8_t *e, size_t e_len, uint32_t scheme,
+                const uint8_t *in, size_t in_len, uint8_t *out, size_t out_sz);
+
+// Ephemeral ECDH with a client public key, derives the same AES key as the
+// TA (HKDF-SHA256, zero salt, TA_ECDH_HKDF_INFO). Our public key is written
+// to pub. Returns 0 on error.
+int ecdh_agree(uint32_t curve, const uint8_t *peer, size_t peer_len,
+               uint8_t *pub, size_t *pub_len, uint8_t key[GROUP_KEY_SIZE]);
+
+// AES-128-CTR with a reusable context, encryption and decryption are the same
+class aes_ctr
+{
+public:
+    aes_ctr();
+    ~aes_ctr();
+
+    void set_key(const uint8_t key[GROUP_KEY_SIZE]);
+    // IV = nonce (64 bit big endian) || 64 bit block counter from 0
+    void crypt(uint64_t nonce, const void *in, size_t len, void *out);
+
+private:
+    EVP_CIPHER_CTX *ctx;
+};
+
+// nonce of wrapped keys, frame seqs never get there
+#define KEY_WRAP_NONCE 0xffffffffffffffffull
+
+#endif
@@ -0,0 +1,812 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include "crc32c.h"
+#include "delta.h"
+#include "fanout.h"
+#include "protocol.h"
+#include "timing.h"
+#include "my_test_ta.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define MSG_MAX_PAYLOAD (1 << 12)
+// stored frames queued to a viewer at most, a slow one falls behind instead of skipping
+#define VOD_QUEUE_FRAMES 4
+// longest poll in VOD mode, new viewers start within it
+#define VOD_TICK_NS 10000000ull
+
+fanout::fanout(bool zerocopy, uint16_t frag_size, int fec_group)
+    : corrupt_pct(0), tiles(0), keyframe_interval(0), listen_fd(-1), udp_fd(-1), use_zerocopy(zerocopy), next_slot(0), seq(0), encoder(frag_size, fec_group),
+      delta(DELTA_BLOCK_SIZE), vod_mode(false)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < FRAME_SLOTS; i++)
+    {
+        slots[i].data = new char[sizeof(struct frame_header) + FRAME_MAX_PAYLOAD];
+        slots[i].len = 0;
+        slots[i].seq = 0;
+        slots[i].refs = 0;
+    }
+    // one content key for every viewer, lives as long as the server
+    RAND_bytes(group_key, sizeof(group_key));
+    cipher.set_key(group_key);
+    RAND_bytes((unsigned char *)&run_id, sizeof(run_id));
+    memset(&last_trace, 0, sizeof(last_trace));
+}
+
+fanout::~fanout()
+{
+    while (!clients.empty())
+        close_client(clients.size() - 1);
+    for (int i = 0; i < FRAME_SLOTS; i++)
+        delete[] slots[i].data;
+    OPENSSL_cleanse(group_key, sizeof(group_key));
+    if (listen_fd >= 0)
+        close(listen_fd);
+    if (udp_fd >= 0)
+        close(udp_fd);
+}
+
+void fanout::set_key(const uint8_t key[GROUP_KEY_SIZE])
+{
+    memcpy(group_key, key, sizeof(group_key));
+    cipher.set_key(group_key);
+}
+
+int fanout::open_vod(const char *dir)
+{
+    if (!vod.open(dir))
+        return 0;
+    // viewers unwrap the key the package was encrypted under
+    set_key(vod.key());
+    vod_mode = true;
+    printf("Serving %u stored frames from %s\n", vod.frame_count(), dir);
+    return 1;
+}
+
+int fanout::listen(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int sndbuf = 4 << 20;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0)
+        return 0;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listen_fd, 64) < 0)
+    {
+        perror("fanout: bind");
+        return 0;
+    }
+    // every UDP client is served from one unbound socket
+    udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (udp_fd < 0)
+        return 0;
+    setsockopt(udp_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    printf("Server running on port %d%s\n", port, use_zerocopy ? " (MSG_ZEROCOPY)" : "");
+    return 1;
+}
+
+size_t fanout::client_count() const
+{
+    return clients.size();
+}
+
+void fanout::drop_clients()
+{
+    while (!clients.empty())
+        close_client(clients.size() - 1);
+}
+
+void fanout::accept_client()
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    char name[INET_ADDRSTRLEN];
+    int one = 1;
+    int fd;
+
+    while ((fd = accept4(listen_fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK)) >= 0)
+    {
+        fanout_client *c = new fanout_client;
+        c->fd = fd;
+        inet_ntop(AF_INET, &addr.sin_addr, name, sizeof(name));
+        c->address = name;
+        c->has_group_key = false;
+        c->out_off = 0;
+        c->zc_next = 0;
+        c->drops = 0;
+        c->peer = addr;
+        c->udp = false;
+        c->vod_next = 0;
+        c->vod_clock_ns = 0;
+        c->window_frames = 0;
+        c->window_bytes = 0;
+        c->ahead_bytes = 0;
+        c->trace = false;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->zerocopy = use_zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+        clients.push_back(c);
+        printf("[*] Accepted connection from %s\n", c->address.c_str());
+        addr_len = sizeof(addr);
+    }
+}
+
+void fanout::close_client(size_t i)
+{
+    fanout_client *c = clients[i];
+
+    for (out_chunk &chunk : c->outq)
+        if (chunk.slot >= 0)
+            release_slot(chunk.slot);
+    for (auto &pending : c->zc_pending)
+        release_slot(pending.second);
+    printf("Connection with %s closed (%lu frames dropped)\n", c->address.c_str(), (unsigned long)c->drops);
+    close(c->fd);
+    delete c;
+    clients.erase(clients.begin() + i);
+}
+
+void fanout::release_slot(int slot)
+{
+    slots[slot].refs--;
+}
+
+// returns 0 once the client has gone away
+int fanout::read_messages(fanout_client *c)
+{
+    char tmp[4096];
+    struct msg_header hdr;
+    ssize_t n;
+
+    while ((n = recv(c->fd, tmp, sizeof(tmp), 0)) > 0)
+        c->rx.append(tmp, n);
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        return 0;
+
+    while (c->rx.size() >= sizeof(hdr))
+    {
+        memcpy(&hdr, c->rx.data(), sizeof(hdr));
+        if (hdr.length > MSG_MAX_PAYLOAD)
+        {
+            printf("Message of %u bytes from %s\n", hdr.length, c->address.c_str());
+            return 0;
+        }
+        if (c->rx.size() < sizeof(hdr) + hdr.length)
+            break;
+        handle_message(c, hdr.type, c->rx.data() + sizeof(hdr), hdr.length);
+        c->rx.erase(0, sizeof(hdr) + hdr.length);
+    }
+    return 1;
+}
+
+void fanout::handle_message(fanout_client *c, uint32_t type, const char *payload, uint32_t len)
+{
+    uint8_t wrapped[3072 / 8];
+    size_t wrapped_len;
+    uint32_t wrap;
+    uint32_t key_id = 0;
+
+    if (type == MSG_PUB_KEY && len >= 16)
+    {
+        uint32_t scheme, mod_len, exp_len;
+        memcpy(&key_id, payload, 4);
+        memcpy(&scheme, payload + 4, 4);
+        memcpy(&mod_len, payload + 8, 4);
+        memcpy(&exp_len, payload + 12, 4);
+        if (16 + (uint64_t)mod_len + exp_len > len)
+            return;
+        wrapped_len = rsa_wrap((const uint8_t *)payload + 16, mod_len, (const uint8_t *)payload + 16 + mod_len,
+                               exp_len, scheme, group_key, sizeof(group_key), wrapped, sizeof(wrapped));
+        if (!wrapped_len)
+        {
+            printf("Cannot wrap the group key for %s\n", c->address.c_str());
+            return;
+        }
+        wrap = TA_GROUP_WRAP_RSA;
+        printf("Public key %u set for %s\n", key_id, c->address.c_str());
+    }
+    else if (type == MSG_ECDH_PUB && len >= 8)
+    {
+        uint32_t curve, peer_len;
+        uint8_t pub[ECDH_MAX_PUB_LEN];
+        size_t pub_len = sizeof(pub);
+        uint8_t kek[GROUP_KEY_SIZE];
+        memcpy(&curve, payload, 4);
+        memcpy(&peer_len, payload + 4, 4);
+        if (8 + (uint64_t)peer_len > len ||
+            !ecdh_agree(curve, (const uint8_t *)payload + 8, peer_len, pub, &pub_len, kek))
+        {
+            printf("ECDH with %s failed\n", c->address.c_str());
+            return;
+        }
+        std::string reply((const char *)&curve, 4);
+        uint32_t reply_len = pub_len;
+        reply.append((const char *)&reply_len, 4);
+        reply.append((const char *)pub, pub_len);
+        queue_msg(c, FRAME_ECDH_PUB, 0, reply);
+
+        aes_ctr kek_cipher;
+        kek_cipher.set_key(kek);
+        kek_cipher.crypt(KEY_WRAP_NONCE, group_key, sizeof(group_key), wrapped);
+        wrapped_len = sizeof(group_key);
+        OPENSSL_cleanse(kek, sizeof(kek));
+        wrap = TA_GROUP_WRAP_ECDH;
+        printf("ECDH key agreed with %s\n", c->address.c_str());
+    }
+    else if (type == MSG_RESUME && len >= 4 + RESUME_TICKET_SIZE)
+    {
+        uint32_t next_seq;
+        memcpy(&next_seq, payload, 4);
+        resume(c, next_seq, payload + 4);
+        return;
+    }
+    else if (type == MSG_SEEK && len >= 8)
+    {
+        uint64_t pts_us;
+        memcpy(&pts_us, payload, 8);
+        if (!vod_mode || !c->has_group_key)
+            return;
+        // what is not on its way yet belongs to the old position
+        size_t keep = c->out_off > 0 ? 1 : 0;
+        for (size_t i = c->outq.size(); i-- > keep;)
+            if (c->outq[i].fd >= 0)
+                c->outq.erase(c->outq.begin() + i);
+        vod_start(c, vod.seek(pts_us));
+        stats.seeks++;
+        printf("%s seeks to %.3f s, frame %u\n", c->address.c_str(), pts_us / 1e6, c->vod_next);
+        return;
+    }
+    else if (type == MSG_PREFETCH && len >= 8)
+    {
+        memcpy(&c->window_frames, payload, 4);
+        memcpy(&c->window_bytes, payload + 4, 4);
+        printf("%s prefetches %u frames, %u bytes\n", c->address.c_str(), c->window_frames, c->window_bytes);
+        return;
+    }
+    else if (type == MSG_TRACE)
+    {
+        c->trace = true;
+        return;
+    }
+    else if (type == MSG_UDP_PORT && len >= 4)
+    {
+        uint32_t port;
+        memcpy(&port, payload, 4);
+        if (port == 0 || port > 65535)
+            return;
+        // datagrams go to the address the TCP connection came from
+        c->udp_addr = c->peer;
+        c->udp_addr.sin_port = htons(port);
+        c->udp = true;
+        printf("Sending video to %s:%u over UDP\n", c->address.c_str(), port);
+        return;
+    }
+    else
+    {
+        printf("Unknown message %u from %s\n", type, c->address.c_str());
+        return;
+    }
+
+    std::string msg((const char *)&wrap, 4);
+    msg.append((const char *)wrapped, wrapped_len);
+    queue_msg(c, FRAME_GROUP_KEY, key_id, msg);
+    c->has_group_key = true;
+    // a new viewer has nothing to patch deltas into
+    delta.force_keyframe();
+    if (vod_mode)
+        vod_start(c, 0);
+    issue_ticket(c);
+}
+
+// The ticket stands for the group key the client's TA now holds, the
+// server keeps no other per-client state for it.
+void fanout::issue_ticket(fanout_client *c)
+{
+    uint8_t ticket[RESUME_TICKET_SIZE];
+    uint32_t lifetime = TICKET_LIFETIME_S;
+    uint64_t now = monotonic_ns();
+
+    // drop expired ones now and then, a storm of reconnects leaves many
+    for (auto it = tickets.begin(); it != tickets.end();)
+        it = it->second < now ? tickets.erase(it) : std::next(it);
+    RAND_bytes(ticket, sizeof(ticket));
+    tickets[std::string((const char *)ticket, sizeof(ticket))] = now + TICKET_LIFETIME_S * 1000000000ull;
+    std::string msg((const char *)&lifetime, 4);
+    msg.append((const char *)ticket, sizeof(ticket));
+    queue_msg(c, FRAME_TICKET, 0, msg);
+}
+
+// A reconnecting client skips the key exchange and gets the frames it
+// missed that are still in a slot, oldest first.
+void fanout::resume(fanout_client *c, uint32_t next_seq, const char *ticket)
+{
+    auto it = tickets.find(std::string(ticket, RESUME_TICKET_SIZE));
+    uint32_t status = 0;
+
+    if (it != tickets.end() && it->second >= monotonic_ns())
+        status = 1;
+    if (it != tickets.end())
+        tickets.erase(it); // single use
+    queue_msg(c, FRAME_RESUMED, 0, std::string((const char *)&status, 4));
+    if (!status)
+    {
+        stats.resume_rejects++;
+        printf("Stale ticket from %s, key exchange needed\n", c->address.c_str());
+        return;
+    }
+    stats.resumes++;
+    c->has_group_key = true;
+    if (vod_mode)
+    {
+        // the store still has every frame
+        vod_start(c, next_seq < vod.frame_count() ? next_seq : 0);
+        issue_ticket(c);
+        printf("Resumed %s at stored frame %u\n", c->address.c_str(), c->vod_next);
+        return;
+    }
+    // seq - next_seq frames were missed, at most FRAME_SLOTS are still around
+    uint32_t missed = seq - next_seq;
+    int resent = 0;
+    if (missed > FRAME_SLOTS)
+        missed = FRAME_SLOTS;
+    for (uint32_t s = seq - missed; s != seq; s++)
+        for (int i = 0; i < FRAME_SLOTS; i++)
+            if (slots[i].len && slots[i].seq == s)
+            {
+                queue_slot(c, i);
+                resent++;
+            }
+    stats.resent += resent;
+    if (resent < (int)(seq - next_seq))
+        delta.force_keyframe();
+    issue_ticket(c);
+    printf("Resumed %s at frame %u, %d frames resent\n", c->address.c_str(), next_seq, resent);
+}
+
+void fanout::queue_slot(fanout_client *c, int slot)
+{
+    out_chunk chunk;
+    chunk.slot = slot;
+    chunk.fd = -1;
+    c->outq.push_back(chunk);
+    slots[slot].refs++;
+}
+
+void fanout::queue_file(fanout_client *c, uint32_t frame)
+{
+    const struct vod_index_entry *e = vod.frame(frame);
+    out_chunk chunk;
+    chunk.slot = -1;
+    chunk.fd = vod.segment_fd(e->segment);
+    chunk.offset = e->offset;
+    chunk.len = e->length;
+    c->outq.push_back(chunk);
+}
+
+void fanout::queue_msg(fanout_client *c, uint32_t type, uint32_t key_id, const std::string &payload,
+                       uint32_t frame_seq)
+{
+    struct frame_header hdr;
+    out_chunk chunk;
+
+    hdr.magic = FRAME_MAGIC;
+    hdr.type = type;
+    hdr.seq = frame_seq;
+    hdr.key_id = key_id;
+    hdr.length = payload.size();
+    hdr.pts_us = 0;
+    hdr.crc32c = crc32c(payload.data(), payload.size());
+    hdr.flags = 0;
+    chunk.slot = -1;
+    chunk.fd = -1;
+    chunk.msg.assign((const char *)&hdr, sizeof(hdr));
+    chunk.msg += payload;
+    c->outq.push_back(chunk);
+}
+
+// sends as much of the queue as the socket takes, returns -1 on error
+int fanout::flush(fanout_client *c)
+{
+    while (!c->outq.empty())
+    {
+        out_chunk &chunk = c->outq.front();
+        const char *data = chunk.slot >= 0 ? slots[chunk.slot].data : chunk.msg.data();
+        size_t len = chunk.slot >= 0 ? slots[chunk.slot].len : chunk.msg.size();
+        struct iovec iov;
+        struct msghdr msg;
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+        bool zerocopy = c->zerocopy && chunk.slot >= 0;
+        ssize_t n;
+
+        if (chunk.fd >= 0)
+        {
+            // page cache to socket, the frame is never copied to user space
+            off_t offset = chunk.offset + c->out_off;
+            n = sendfile(c->fd, chunk.fd, &offset, chunk.len - c->out_off);
+            // 0 only if the segment file shrank under us
+            if (n <= 0)
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            c->out_off += n;
+            if (c->out_off < chunk.len)
+                return 0;
+            c->outq.pop_front();
+            c->out_off = 0;
+            continue;
+        }
+        iov.iov_base = (void *)(data + c->out_off);
+        iov.iov_len = len - c->out_off;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        n = sendmsg(c->fd, &msg, flags | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0 && zerocopy && errno == ENOBUFS)
+        {
+            // out of pinned page budget, copy this one
+            zerocopy = false;
+            n = sendmsg(c->fd, &msg, flags);
+        }
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (zerocopy)
+        {
+            // the kernel reads the slot until the completion arrives
+            c->zc_pending.push_back(std::make_pair(c->zc_next++, chunk.slot));
+            slots[chunk.slot].refs++;
+        }
+        c->out_off += n;
+        if (c->out_off < len)
+            return 0;
+        if (chunk.slot >= 0)
+            release_slot(chunk.slot);
+        c->outq.pop_front();
+        c->out_off = 0;
+    }
+    return 0;
+}
+
+void fanout::reap_zerocopy(fanout_client *c)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // completions cover the id range [ee_info, ee_data]
+            uint32_t lo = serr->ee_info, hi = serr->ee_data;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                stats.zc_copied += hi - lo + 1;
+            while (!c->zc_pending.empty() && c->zc_pending.front().first - lo <= hi - lo)
+            {
+                release_slot(c->zc_pending.front().second);
+                c->zc_pending.pop_front();
+            }
+        }
+    }
+}
+
+void fanout::poll_until(uint64_t deadline_ns)
+{
+    std::vector<struct pollfd> fds;
+    uint64_t now;
+
+    while ((now = monotonic_ns()) < deadline_ns)
+    {
+        struct timespec timeout;
+        timeout.tv_sec = (deadline_ns - now) / 1000000000ull;
+        timeout.tv_nsec = (deadline_ns - now) % 1000000000ull;
+
+        fds.resize(clients.size() + 1);
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            fds[i + 1].fd = clients[i]->fd;
+            fds[i + 1].events = POLLIN | (clients[i]->outq.empty() ? 0 : POLLOUT);
+        }
+        if (ppoll(fds.data(), fds.size(), &timeout, NULL) <= 0)
+            continue;
+
+        // backwards, closing a client shifts the ones after it
+        for (size_t i = clients.size(); i-- > 0;)
+        {
+            fanout_client *c = clients[i];
+            short revents = fds[i + 1].revents;
+            // zero copy completions are reported as POLLERR
+            if ((revents & POLLERR) && c->zerocopy)
+                reap_zerocopy(c);
+            if ((revents & (POLLIN | POLLHUP)) && !read_messages(c))
+            {
+                close_client(i);
+                continue;
+            }
+            if ((revents & POLLOUT) || !c->outq.empty())
+                if (flush(c) < 0)
+                    close_client(i);
+        }
+        if (fds[0].revents & POLLIN)
+            accept_client();
+    }
+}
+
+// Tile table for FRAME_VIDEO_TILED: about equal tiles, each but the last a
+// whole number of AES blocks so it decrypts on its own. Returns its size.
+static size_t write_tile_table(char *out, size_t len, int tiles)
+{
+    size_t tile_len = (len + tiles - 1) / tiles;
+    uint32_t count = 0;
+    struct frame_tile t;
+
+    tile_len = (tile_len + FRAME_TILE_ALIGN - 1) / FRAME_TILE_ALIGN * FRAME_TILE_ALIGN;
+    if (tile_len == 0)
+        tile_len = FRAME_TILE_ALIGN;
+    for (size_t off = 0; off < len || count == 0; off += tile_len)
+    {
+        t.offset = off;
+        t.length = len - off < tile_len ? len - off : tile_len;
+        memcpy(out + 4 + count * sizeof(t), &t, sizeof(t));
+        count++;
+    }
+    memcpy(out, &count, 4);
+    return 4 + count * sizeof(t);
+}
+
+size_t fanout::encode_frame(const void *data, size_t len, uint64_t pts_us, char *out)
+{
+    struct frame_header hdr;
+    size_t table = 0;
+    uint32_t flags = 0;
+
+    // encrypt once, the header is the same for every client as well
+    last_trace.capture_us = last_trace.encode_us = realtime_us();
+    hdr.magic = FRAME_MAGIC;
+    hdr.type = tiles > 0 ? FRAME_VIDEO_TILED : FRAME_VIDEO_AES;
+    hdr.seq = seq++;
+    hdr.key_id = 0;
+    hdr.pts_us = pts_us;
+    stats.frame_bytes += len;
+    // only the blocks that changed are encrypted, see delta.h
+    if (keyframe_interval > 0)
+        data = delta.encode((const char *)data, len, hdr.seq, keyframe_interval, &len, &flags);
+    hdr.flags = flags;
+    last_trace.encrypt_us = realtime_us();
+    stats.keyframes += (flags & FRAME_FLAG_KEYFRAME) != 0;
+    stats.plain_bytes += len;
+    // tiles are ranges of the same CTR stream, the cipher text does not change
+    if (tiles > 0)
+        table = write_tile_table(out + sizeof(hdr), len, tiles);
+    hdr.length = table + len;
+    cipher.crypt(hdr.seq, data, len, out + sizeof(hdr) + table);
+    hdr.crc32c = crc32c(out + sizeof(hdr), hdr.length);
+    memcpy(out, &hdr, sizeof(hdr));
+    if (len && corrupt_pct > 0 && rand() % 100 < corrupt_pct)
+    {
+        out[sizeof(hdr) + table + rand() % len] ^= 0x01;
+        stats.corrupted++;
+    }
+    last_trace.trace_id = (uint64_t)run_id << 32 | hdr.seq;
+    last_trace.send_us = realtime_us();
+    return sizeof(hdr) + hdr.length;
+}
+
+void fanout::push_frame(const void *data, size_t len, uint64_t pts_us)
+{
+    struct frame_header hdr;
+    frame_slot *slot;
+    uint64_t t0;
+    uint64_t capture_us = realtime_us();
+    int ready = 0;
+
+    for (fanout_client *c : clients)
+        ready += c->has_group_key;
+    if (!ready || len > FRAME_MAX_VIDEO)
+        return;
+
+    slot = &slots[next_slot];
+    if (slot->refs > 0)
+        for (fanout_client *c : clients)
+            if (c->zerocopy)
+                reap_zerocopy(c);
+    if (slot->refs > 0)
+    {
+        stats.slot_full++;
+        return;
+    }
+
+    t0 = monotonic_ns();
+    slot->len = encode_frame(data, len, pts_us, slot->data);
+    memcpy(&hdr, slot->data, sizeof(hdr));
+    slot->seq = hdr.seq;
+    stats.encrypt_ns += monotonic_ns() - t0;
+    stats.frames++;
+    last_trace.capture_us = capture_us;
+    std::string trace((const char *)&last_trace, sizeof(last_trace));
+
+    t0 = monotonic_ns();
+    // over TCP ahead of the datagrams, so the client has it when the frame completes
+    for (size_t i = clients.size(); i-- > 0;)
+    {
+        fanout_client *c = clients[i];
+        if (!c->has_group_key || !c->udp || !c->trace)
+            continue;
+        queue_msg(c, FRAME_TRACE, 0, trace, hdr.seq);
+        if (flush(c) < 0)
+            close_client(i);
+    }
+    send_datagrams(slot->data, slot->len, hdr.seq, NULL);
+    for (size_t i = clients.size(); i-- > 0;)
+    {
+        fanout_client *c = clients[i];
+        if (!c->has_group_key || c->udp)
+            continue;
+        // a client still busy with older data skips this frame
+        if (!c->outq.empty())
+        {
+            c->drops++;
+            stats.drops++;
+            continue;
+        }
+        if (c->trace)
+            queue_msg(c, FRAME_TRACE, 0, trace, hdr.seq);
+        queue_slot(c, next_slot);
+        stats.sends++;
+        if (flush(c) < 0)
+            close_client(i);
+    }
+    stats.send_ns += monotonic_ns() - t0;
+    next_slot = (next_slot + 1) % FRAME_SLOTS;
+}
+
+// Fragments the encrypted frame once and sends the same datagrams to every
+// UDP client, or just to only, one sendmmsg() batch per client. Nothing
+// waits for a full socket buffer, what does not fit is lost and left to the
+// parity.
+void fanout::send_datagrams(const char *data, size_t len, uint32_t frame_seq, fanout_client *only)
+{
+    int n = 0;
+
+    for (fanout_client *c : clients)
+    {
+        if (!c->udp || !c->has_group_key || (only && c != only))
+            continue;
+        if (n == 0)
+        {
+            n = encoder.encode(data, len, frame_seq);
+            if (n == 0)
+                return;
+            dgrams.resize(n);
+        }
+        for (int k = 0; k < n; k++)
+        {
+            struct msghdr *msg = &dgrams[k].msg_hdr;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name = &c->udp_addr;
+            msg->msg_namelen = sizeof(c->udp_addr);
+            msg->msg_iov = (struct iovec *)encoder.datagram(k);
+            msg->msg_iovlen = 2;
+        }
+        int sent = 0;
+        while (sent < n)
+        {
+            int ret = sendmmsg(udp_fd, &dgrams[sent], n - sent, MSG_DONTWAIT);
+            if (ret <= 0)
+                break;
+            sent += ret;
+        }
+        stats.datagrams += sent;
+        stats.dgram_drops += n - sent;
+        stats.sends++;
+    }
+}
+
+void fanout::vod_start(fanout_client *c, uint32_t frame)
+{
+    c->vod_next = frame;
+    // the frame is due now, the ones after it at their pts
+    c->vod_clock_ns = (int64_t)monotonic_ns() - (int64_t)vod.frame(frame)->pts_us * 1000;
+    // a new position fills the window again from here
+    c->ahead.clear();
+    c->ahead_bytes = 0;
+}
+
+// Every viewer has its own position in the store and gets its frames at
+// their pts from there, the same bytes as everybody else at that position.
+// With a prefetch window the frames go out early, as long as no more than
+// the window is ahead of time, so a viewer starts with a full buffer and
+// keeps it full.
+uint64_t fanout::serve_vod()
+{
+    uint64_t now = monotonic_ns();
+    uint64_t next_ns = now + VOD_TICK_NS;
+
+    for (size_t i = clients.size(); i-- > 0;)
+    {
+        fanout_client *c = clients[i];
+        if (!c->has_group_key)
+            continue;
+        uint64_t t0 = monotonic_ns();
+        bool queued = false;
+        while (!c->ahead.empty() && c->ahead.front().first <= now)
+        {
+            c->ahead_bytes -= c->ahead.front().second;
+            c->ahead.pop_front();
+        }
+        for (;;)
+        {
+            const struct vod_index_entry *e = vod.frame(c->vod_next);
+            uint64_t due = c->vod_clock_ns + (int64_t)e->pts_us * 1000;
+            bool early = due > now;
+            if (early && (c->ahead.size() >= c->window_frames ||
+                          (c->window_bytes && c->ahead_bytes + e->length > c->window_bytes)))
+            {
+                // the window moves on when its first frame is due
+                uint64_t wake = c->ahead.empty() || due < c->ahead.front().first ? due : c->ahead.front().first;
+                if (wake < next_ns)
+                    next_ns = wake;
+                break;
+            }
+            if (c->udp)
+                send_datagrams(vod.frame_data(c->vod_next), e->length, c->vod_next, c);
+            else if (c->outq.size() < VOD_QUEUE_FRAMES + c->window_frames)
+            {
+                queue_file(c, c->vod_next);
+                queued = true;
+            }
+            else
+                break; // waits for the socket, the pts pace resumes from where it is
+            if (early)
+            {
+                c->ahead.push_back(std::make_pair(due, e->length));
+                c->ahead_bytes += e->length;
+                stats.prefetched++;
+            }
+            stats.vod_frames++;
+            stats.sends++;
+            // the end starts over, like --input, one frame time after the last
+            if (++c->vod_next == vod.frame_count())
+            {
+                uint32_t last = vod.frame_count() - 1;
+                int64_t gap = last > 0 ? vod.frame(last)->pts_us - vod.frame(last - 1)->pts_us : 0;
+                c->vod_next = 0;
+                c->vod_clock_ns = due + (gap - (int64_t)vod.frame(0)->pts_us) * 1000;
+            }
+        }
+        if (queued && flush(c) < 0)
+            close_client(i);
+        stats.send_ns += monotonic_ns() - t0;
+    }
+    return next_ns;
+}
@@ -0,0 +1,155 @@
+#ifndef FANOUT
+#define FANOUT
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "crypto.h"
+#include "delta.h"
+#include "fec.h"
+#include "vod_store.h"
+
+// Frames are encrypted once under the group key into a shared slot and
+// every client socket is handed the same bytes; only the wrapped group key
+// is per client. A slot is reused once no socket references it any more.
+#define FRAME_SLOTS 16
+#define TICKET_LIFETIME_S 60
+
+struct frame_slot
+{
+    char *data; // frame_header + cipher text
+    size_t len;
+    uint32_t seq; // frames still in a slot are resent to resuming clients
+    int refs;     // client queues and unfinished zero copy sends
+};
+
+// one entry of a client's send queue, a shared frame, a private message
+// or a stored VOD frame
+struct out_chunk
+{
+    int slot; // -1 for msg or file
+    std::string msg;
+    int fd;   // >= 0: len bytes of a segment file at offset, sent with sendfile()
+    off_t offset;
+    size_t len;
+};
+
+struct fanout_client
+{
+    int fd;
+    std::string address;
+    bool has_group_key;
+    std::string rx;              // partial client message
+    std::deque<out_chunk> outq;  // front is being sent
+    size_t out_off;              // bytes of the front chunk already sent
+    bool zerocopy;               // SO_ZEROCOPY accepted by the socket
+    uint32_t zc_next;            // id of the next MSG_ZEROCOPY send
+    std::deque<std::pair<uint32_t, int>> zc_pending; // (id, slot) not completed yet
+    uint64_t drops;              // frames skipped because the client lagged
+    struct sockaddr_in peer;
+    bool udp;                    // video goes to udp_addr as datagrams, see fec.h
+    struct sockaddr_in udp_addr;
+    uint32_t vod_next;           // next stored frame for this viewer
+    int64_t vod_clock_ns;        // monotonic - pts of the viewer's frames
+    uint32_t window_frames;      // MSG_PREFETCH, 0 sends every frame at its time
+    uint32_t window_bytes;
+    std::deque<std::pair<uint64_t, uint32_t>> ahead; // (due, length) of frames sent before their time
+    uint64_t ahead_bytes;
+    bool trace;                  // MSG_TRACE, a FRAME_TRACE goes ahead of every live frame
+};
+
+struct fanout_stats
+{
+    uint64_t frames;
+    uint64_t encrypt_ns;
+    uint64_t send_ns;
+    uint64_t sends;
+    uint64_t drops;
+    uint64_t slot_full;
+    uint64_t zc_copied; // zero copy sends the kernel fell back to copying
+    uint64_t datagrams;
+    uint64_t dgram_drops; // datagrams the socket buffer had no room for
+    uint64_t resumes;
+    uint64_t resume_rejects;
+    uint64_t resent;      // frames sent again to resumed clients
+    uint64_t corrupted;
+    uint64_t keyframes;
+    uint64_t frame_bytes; // pushed
+    uint64_t plain_bytes; // encrypted, less than frame_bytes with delta frames
+    uint64_t vod_frames;  // sent from the store
+    uint64_t prefetched;  // of them ahead of their time
+    uint64_t seeks;
+};
+
+class fanout
+{
+public:
+    fanout(bool zerocopy, uint16_t frag_size, int fec_group);
+    ~fanout();
+
+    int listen(int port);
+    // serves sockets until deadline_ns, frames are pushed by the caller
+    void poll_until(uint64_t deadline_ns);
+    // encrypts one frame under the group key and queues it to every ready client,
+    // pts_us is when it was captured
+    void push_frame(const void *data, size_t len, uint64_t pts_us);
+    // the next frame as it goes on the wire, header and cipher text, into out
+    // (FRAME_MAX_PAYLOAD after the header); returns its length
+    size_t encode_frame(const void *data, size_t len, uint64_t pts_us, char *out);
+    // replaces the group key, before any client joins
+    void set_key(const uint8_t key[GROUP_KEY_SIZE]);
+    // serves the package in dir instead of pushed frames, see vod_store.h
+    int open_vod(const char *dir);
+    // queues the stored frames that are due, returns when the next one is
+    uint64_t serve_vod();
+    size_t client_count() const;
+    // closes every client connection, to test reconnects
+    void drop_clients();
+    struct fanout_stats stats;
+    int corrupt_pct; // frames damaged after their CRC is taken, to test rejection
+    int tiles;       // FRAME_VIDEO_TILED frames of this many tiles, 0 for FRAME_VIDEO_AES
+    int keyframe_interval; // delta frames with a keyframe this often, 0 for whole frames
+
+private:
+    void accept_client();
+    void close_client(size_t i);
+    int read_messages(fanout_client *c);
+    void handle_message(fanout_client *c, uint32_t type, const char *payload, uint32_t len);
+    void queue_msg(fanout_client *c, uint32_t type, uint32_t key_id, const std::string &payload,
+                   uint32_t frame_seq = 0);
+    int flush(fanout_client *c);
+    void reap_zerocopy(fanout_client *c);
+    void release_slot(int slot);
+    void issue_ticket(fanout_client *c);
+    void resume(fanout_client *c, uint32_t next_seq, const char *ticket);
+    void queue_slot(fanout_client *c, int slot);
+    void queue_file(fanout_client *c, uint32_t frame);
+    void send_datagrams(const char *data, size_t len, uint32_t frame_seq, fanout_client *only);
+    // the viewer plays on from stored frame
+    void vod_start(fanout_client *c, uint32_t frame);
+
+    int listen_fd;
+    int udp_fd;
+    bool use_zerocopy;
+    std::vector<fanout_client *> clients;
+    frame_slot slots[FRAME_SLOTS];
+    int next_slot;
+    uint32_t seq;
+    uint8_t group_key[GROUP_KEY_SIZE];
+    aes_ctr cipher;
+    fec_encoder encoder;
+    delta_encoder delta;
+    std::vector<struct mmsghdr> dgrams;
+    std::map<std::string, uint64_t> tickets; // ticket -> expiry (monotonic ns)
+    vod_store vod;
+    bool vod_mode;
+    uint32_t run_id;                // high half of the trace IDs
+    struct frame_trace last_trace;  // stage times of the last encode_frame()
+};
+
+#endif
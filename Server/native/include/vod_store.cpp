@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include "protocol.h"
+#include "vod_store.h"
+
+bool vod_seek_point(uint32_t flags)
+{
+    if (flags & FRAME_FLAG_KEYFRAME)
+        return true;
+    return !(flags & (FRAME_FLAG_DELTA | FRAME_FLAG_PACKET));
+}
+
+// whole file into a read only mapping, NULL for an empty file
+static char *map_file(int fd, size_t *len)
+{
+    struct stat st;
+
+    *len = 0;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+        return NULL;
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *len = st.st_size;
+    return (char *)p;
+}
+
+vod_store::vod_store() : index_map(NULL), index_len(0), entries(NULL), count(0)
+{
+    memset(content_key, 0, sizeof(content_key));
+}
+
+vod_store::~vod_store()
+{
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+        if (maps[i])
+            munmap(maps[i], map_lens[i]);
+        close(fds[i]);
+    }
+    if (index_map)
+        munmap(index_map, index_len);
+    OPENSSL_cleanse(content_key, sizeof(content_key));
+}
+
+int vod_store::open(const char *dir)
+{
+    std::string base = std::string(dir) + "/";
+    struct vod_index_header hdr;
+    char name[32];
+
+    int fd = ::open((base + VOD_KEY_NAME).c_str(), O_RDONLY);
+    if (fd < 0 || read(fd, content_key, sizeof(content_key)) != sizeof(content_key))
+    {
+        printf("vod: cannot read %s%s\n", base.c_str(), VOD_KEY_NAME);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    close(fd);
+
+    fd = ::open((base + VOD_INDEX_NAME).c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        perror("vod: index");
+        return 0;
+    }
+    index_map = map_file(fd, &index_len);
+    close(fd);
+    if (!index_map || index_len < sizeof(hdr))
+    {
+        printf("vod: empty index in %s\n", dir);
+        return 0;
+    }
+    memcpy(&hdr, index_map, sizeof(hdr));
+    if (hdr.magic != VOD_INDEX_MAGIC || hdr.version != VOD_INDEX_VERSION ||
+        index_len < sizeof(hdr) + (uint64_t)hdr.frame_count * sizeof(struct vod_index_entry) || hdr.frame_count == 0)
+    {
+        printf("vod: bad index in %s\n", dir);
+        return 0;
+    }
+    entries = (const struct vod_index_entry *)((const char *)index_map + sizeof(hdr));
+    count = hdr.frame_count;
+
+    for (uint32_t s = 0; s < hdr.segment_count; s++)
+    {
+        snprintf(name, sizeof(name), VOD_SEGMENT_NAME, s);
+        fd = ::open((base + name).c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            perror(name);
+            return 0;
+        }
+        size_t len;
+        fds.push_back(fd);
+        maps.push_back(map_file(fd, &len));
+        map_lens.push_back(len);
+    }
+    // a frame outside its segment would send whatever follows
+    for (uint32_t i = 0; i < count; i++)
+        if (entries[i].segment >= hdr.segment_count || entries[i].length < sizeof(struct frame_header) ||
+            entries[i].offset + entries[i].length > map_lens[entries[i].segment])
+        {
+            printf("vod: frame %u is not in its segment\n", i);
+            return 0;
+        }
+    return 1;
+}
+
+const char *vod_store::frame_data(uint32_t i) const
+{
+    return maps[entries[i].segment] + entries[i].offset;
+}
+
+uint32_t vod_store::seek(uint64_t pts_us) const
+{
+    // last frame at or before pts_us, pts grows with the index
+    uint32_t lo = 0, hi = count;
+    while (hi - lo > 1)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].pts_us <= pts_us)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    while (lo > 0 && !vod_seek_point(entries[lo].flags))
+        lo--;
+    return lo;
+}
+
+vod_writer::vod_writer()
+    : segment_us(0), segment(NULL), segment_no(0), segment_start_us(0), offset(0)
+{
+    memset(content_key, 0, sizeof(content_key));
+}
+
+vod_writer::~vod_writer()
+{
+    if (segment)
+        fclose(segment);
+    OPENSSL_cleanse(content_key, sizeof(content_key));
+}
+
+std::string vod_writer::path(const char *name) const
+{
+    return dir + "/" + name;
+}
+
+int vod_writer::open(const char *package_dir, uint64_t segment_duration_us)
+{
+    dir = package_dir;
+    segment_us = segment_duration_us;
+    if (mkdir(package_dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror(package_dir);
+        return 0;
+    }
+    RAND_bytes(content_key, sizeof(content_key));
+    // the key to everything in the package, readable by the server only
+    int fd = ::open(path(VOD_KEY_NAME).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, content_key, sizeof(content_key)) != sizeof(content_key))
+    {
+        perror(VOD_KEY_NAME);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+int vod_writer::add(const char *frame, size_t len)
+{
+    struct frame_header hdr;
+    struct vod_index_entry e;
+    char name[32];
+
+    if (len < sizeof(hdr))
+        return 0;
+    memcpy(&hdr, frame, sizeof(hdr));
+    // segments are cut at seek points, so each one plays on its own
+    if (!segment || (vod_seek_point(hdr.flags) && hdr.pts_us - segment_start_us >= segment_us))
+    {
+        if (segment && fclose(segment) != 0)
+        {
+            segment = NULL;
+            return 0;
+        }
+        snprintf(name, sizeof(name), VOD_SEGMENT_NAME, segment_no++);
+        segment = fopen(path(name).c_str(), "wb");
+        if (!segment)
+        {
+            perror(name);
+            return 0;
+        }
+        segment_start_us = hdr.pts_us;
+        offset = 0;
+    }
+    e.pts_us = hdr.pts_us;
+    e.offset = offset;
+    e.segment = segment_no - 1;
+    e.length = len;
+    e.flags = hdr.flags;
+    if (fwrite(frame, 1, len, segment) != len)
+        return 0;
+    offset += len;
+    entries.push_back(e);
+    return 1;
+}
+
+int vod_writer::finish()
+{
+    struct vod_index_header hdr;
+
+    if (segment && fclose(segment) != 0)
+    {
+        segment = NULL;
+        return 0;
+    }
+    segment = NULL;
+    FILE *index = fopen(path(VOD_INDEX_NAME).c_str(), "wb");
+    if (!index)
+    {
+        perror(VOD_INDEX_NAME);
+        return 0;
+    }
+    hdr.magic = VOD_INDEX_MAGIC;
+    hdr.version = VOD_INDEX_VERSION;
+    hdr.frame_count = entries.size();
+    hdr.segment_count = segment_no;
+    hdr.segment_us = segment_us;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, index) == 1 &&
+              fwrite(entries.data(), sizeof(struct vod_index_entry), entries.size(), index) == entries.size();
+    return fclose(index) == 0 && ok;
+}
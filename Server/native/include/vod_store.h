@@ -0,0 +1,105 @@
+#ifndef VOD_STORE
+#define VOD_STORE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "crypto.h"
+
+// Video on demand from a directory packaged once by tzs_server --package:
+// the frames are stored exactly as they go on the wire, frame_header and
+// cipher text under one content key, in segment files of about
+// segment_us each. A segment starts with a seek point. The index has one
+// entry per frame, so seeking is a binary search over pts and serving a
+// frame is a sendfile() of a known range, no encode or crypto per viewer.
+// Viewers get the content key wrapped like the live group key. Frame seqs
+// are positions in the content, so the AES-CTR IVs are the same for
+// everybody. All files are little endian, like the wire format.
+#define VOD_INDEX_MAGIC 0x49535a54 // "TZSI"
+#define VOD_INDEX_VERSION 1
+#define VOD_INDEX_NAME "index"
+#define VOD_KEY_NAME "content.key"
+#define VOD_SEGMENT_NAME "segment_%05u.tzs"
+
+struct vod_index_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frame_count;
+    uint32_t segment_count;
+    uint64_t segment_us;
+} __attribute__((packed));
+
+struct vod_index_entry
+{
+    uint64_t pts_us;
+    uint64_t offset;  // into the segment file
+    uint32_t segment;
+    uint32_t length;  // frame_header and payload
+    uint32_t flags;   // FRAME_FLAG_xxx, copied from the header
+} __attribute__((packed));
+
+// a viewer can start at this frame: no delta or packet before it is needed
+bool vod_seek_point(uint32_t flags);
+
+// A packaged directory, index and segments mapped read only.
+class vod_store
+{
+public:
+    vod_store();
+    ~vod_store();
+
+    // returns 0 if dir is not a complete package
+    int open(const char *dir);
+    uint32_t frame_count() const { return count; }
+    const struct vod_index_entry *frame(uint32_t i) const { return &entries[i]; }
+    // for sendfile()
+    int segment_fd(uint32_t segment) const { return fds[segment]; }
+    // the stored frame, for the FEC encoder
+    const char *frame_data(uint32_t i) const;
+    // the last seek point at or before pts_us
+    uint32_t seek(uint64_t pts_us) const;
+    const uint8_t *key() const { return content_key; }
+
+private:
+    void *index_map;
+    size_t index_len;
+    const struct vod_index_entry *entries;
+    uint32_t count;
+    std::vector<int> fds;
+    std::vector<char *> maps;
+    std::vector<size_t> map_lens;
+    uint8_t content_key[GROUP_KEY_SIZE];
+};
+
+// Writes a package, frames come in already encrypted under key().
+class vod_writer
+{
+public:
+    vod_writer();
+    ~vod_writer();
+
+    // creates dir and a new content key, returns 0 on error
+    int open(const char *dir, uint64_t segment_us);
+    const uint8_t *key() const { return content_key; }
+    // frame is frame_header and payload
+    int add(const char *frame, size_t len);
+    // writes the index, returns 0 on error
+    int finish();
+
+private:
+    std::string path(const char *name) const;
+
+    std::string dir;
+    uint64_t segment_us;
+    FILE *segment;
+    uint32_t segment_no;
+    uint64_t segment_start_us;
+    uint64_t offset;
+    std::vector<struct vod_index_entry> entries;
+    uint8_t content_key[GROUP_KEY_SIZE];
+};
+
+#endif
@@ -0,0 +1,289 @@
+// Native fan-out server: every frame is encrypted once under a group key
+// and the same buffer is sent to all clients, see include/fanout.h. With
+// --package it encrypts the stream into a VOD package instead, which
+// --vod serves, see include/vod_store.h.
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include "include/fanout.h"
+#include "protocol.h"
+#include "timing.h"
+
+#define SERVER_PORT 9999
+
+void usage(const char *prog)
+{
+    printf("usage: %s [--port PORT] [--fps FPS] [--frame-size BYTES] [--input FILE] [--zerocopy]\n"
+           "          [--fec-fragment BYTES] [--fec-group N] [--storm MS]\n"
+           "          [--corrupt PCT] [--tiles N] [--keyframe FRAMES] [--motion PCT]\n"
+           "          [--package DIR [--duration SECONDS] [--segment SECONDS]] [--vod DIR]\n", prog);
+    printf("  --port PORT        listen port (default 9999)\n");
+    printf("  --fps FPS          frames per second (default 30)\n");
+    printf("  --frame-size BYTES payload per frame, at most %d (default 16384)\n", FRAME_MAX_VIDEO);
+    printf("  --input FILE       stream FILE in frame-size pieces instead of a test pattern\n");
+    printf("  --zerocopy         send with MSG_ZEROCOPY\n");
+    printf("  --fec-fragment BYTES payload per datagram for --udp clients (default %d)\n", FEC_FRAG_SIZE);
+    printf("  --fec-group N      one XOR parity datagram per N data datagrams, 0 for none (default %d)\n", FEC_GROUP);
+    printf("  --storm MS         close every client connection every MS ms, to test reconnects\n");
+    printf("  --corrupt PCT      flip a payload bit in PCT%% of frames after the CRC, to test rejection\n");
+    printf("  --tiles N          split frames into N independently decryptable tiles (max %d)\n", FRAME_MAX_TILES);
+    printf("  --keyframe FRAMES  send only the changed blocks, with a whole frame every FRAMES frames\n");
+    printf("  --motion PCT       change PCT%% of the test pattern every frame (default 0, a still image)\n");
+    printf("  --package DIR      encrypt DURATION seconds of the stream into a VOD package in DIR and exit\n");
+    printf("  --duration SECONDS length of the package (default 60)\n");
+    printf("  --segment SECONDS  segment length of the package (default 2)\n");
+    printf("  --vod DIR          serve the package in DIR, each client from its own position\n");
+}
+
+// next frame payload, loops over the input file
+size_t read_frame(FILE *input, char *frame, size_t frame_size, uint64_t frame_no, int motion_pct)
+{
+    size_t n;
+
+    if (!input)
+    {
+        // a band that moves through the pattern, like a small moving object
+        size_t band = frame_size * motion_pct / 100;
+        for (size_t i = 0; i < band; i++)
+            frame[(frame_no * band + i) % frame_size] = 'a' + frame_no % 26;
+        return frame_size;
+    }
+    n = fread(frame, 1, frame_size, input);
+    if (n == 0)
+    {
+        rewind(input);
+        n = fread(frame, 1, frame_size, input);
+    }
+    return n;
+}
+
+// Encrypts the stream once, frames and keys as they would go to clients.
+// Returns the exit status.
+int package(fanout *server, const char *dir, double duration, double segment, FILE *input, size_t frame_size,
+            double fps, int motion_pct)
+{
+    vod_writer writer;
+    char *frame = new char[frame_size];
+    char *out = new char[sizeof(struct frame_header) + FRAME_MAX_PAYLOAD];
+    uint64_t frames = duration * fps;
+    uint64_t bytes = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < frame_size; i++)
+        frame[i] = '0' + i % 10;
+    if (!writer.open(dir, segment * 1e6))
+        return 1;
+    server->set_key(writer.key());
+    for (uint64_t frame_no = 0; frame_no < frames && status == 0; frame_no++)
+    {
+        size_t len = read_frame(input, frame, frame_size, frame_no, motion_pct);
+        size_t n = server->encode_frame(frame, len, frame_no * 1e6 / fps, out);
+        if (!writer.add(out, n))
+            status = 1;
+        bytes += n;
+    }
+    if (status != 0 || !writer.finish())
+        warn("%s", dir);
+    else
+        printf("Packaged %lu frames, %lu bytes into %s\n", (unsigned long)frames, (unsigned long)bytes, dir);
+    delete[] frame;
+    delete[] out;
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    int port = SERVER_PORT;
+    double fps = 30;
+    size_t frame_size = 1 << 14;
+    const char *input_path = NULL;
+    bool zerocopy = false;
+    int frag_size = FEC_FRAG_SIZE;
+    int fec_group = FEC_GROUP;
+    int storm_ms = 0;
+    int corrupt_pct = 0;
+    int tiles = 0;
+    int keyframe_interval = 0;
+    int motion_pct = 0;
+    const char *package_dir = NULL;
+    double duration = 60;
+    double segment = 2;
+    const char *vod_dir = NULL;
+    FILE *input = NULL;
+
+    static struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"fps", required_argument, NULL, 'r'},
+        {"frame-size", required_argument, NULL, 's'},
+        {"input", required_argument, NULL, 'i'},
+        {"zerocopy", no_argument, NULL, 'z'},
+        {"fec-fragment", required_argument, NULL, 'F'},
+        {"fec-group", required_argument, NULL, 'G'},
+        {"storm", required_argument, NULL, 'S'},
+        {"corrupt", required_argument, NULL, 'C'},
+        {"tiles", required_argument, NULL, 'T'},
+        {"keyframe", required_argument, NULL, 'K'},
+        {"motion", required_argument, NULL, 'M'},
+        {"package", required_argument, NULL, 'P'},
+        {"duration", required_argument, NULL, 'D'},
+        {"segment", required_argument, NULL, 'g'},
+        {"vod", required_argument, NULL, 'V'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:r:s:i:zF:G:S:C:T:K:M:P:D:g:V:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'r':
+            fps = atof(optarg);
+            break;
+        case 's':
+            frame_size = atoi(optarg);
+            break;
+        case 'i':
+            input_path = optarg;
+            break;
+        case 'z':
+            zerocopy = true;
+            break;
+        case 'F':
+            frag_size = atoi(optarg);
+            break;
+        case 'G':
+            fec_group = atoi(optarg);
+            break;
+        case 'S':
+            storm_ms = atoi(optarg);
+            break;
+        case 'C':
+            corrupt_pct = atoi(optarg);
+            break;
+        case 'T':
+            tiles = atoi(optarg);
+            break;
+        case 'K':
+            keyframe_interval = atoi(optarg);
+            break;
+        case 'M':
+            motion_pct = atoi(optarg);
+            break;
+        case 'P':
+            package_dir = optarg;
+            break;
+        case 'D':
+            duration = atof(optarg);
+            break;
+        case 'g':
+            segment = atof(optarg);
+            break;
+        case 'V':
+            vod_dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (fps <= 0 || frame_size == 0 || frame_size > FRAME_MAX_VIDEO)
+        errx(1, "bad --fps or --frame-size");
+    if (tiles < 0 || tiles > FRAME_MAX_TILES)
+        errx(1, "bad --tiles");
+    if (keyframe_interval < 0 || motion_pct < 0 || motion_pct > 100)
+        errx(1, "bad --keyframe or --motion");
+    if (duration <= 0 || segment <= 0)
+        errx(1, "bad --duration or --segment");
+    if (frag_size <= 0 || frag_size > 65507 - (int)sizeof(struct datagram_header) || fec_group < 0)
+        errx(1, "bad --fec-fragment or --fec-group");
+    // a whole frame has to fit in FEC_MAX_FRAGMENTS datagrams, larger ones only go over TCP
+    size_t frame_len = sizeof(struct frame_header) + frame_size + (tiles ? 4 + tiles * sizeof(struct frame_tile) : 0);
+    size_t data_count = (frame_len + frag_size - 1) / frag_size;
+    if (data_count + (fec_group ? (data_count + fec_group - 1) / fec_group : 0) > FEC_MAX_FRAGMENTS)
+        printf("--fec-fragment %d is too small for --frame-size %zu, --udp clients get no frames\n", frag_size,
+               frame_size);
+    if (input_path && !(input = fopen(input_path, "rb")))
+        err(1, "%s", input_path);
+    signal(SIGPIPE, SIG_IGN);
+    // stats are usually redirected to a file
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    char *frame = new char[frame_size];
+    for (size_t i = 0; i < frame_size; i++)
+        frame[i] = '0' + i % 10;
+
+    fanout server(zerocopy, frag_size, fec_group);
+    server.corrupt_pct = corrupt_pct;
+    server.tiles = tiles;
+    server.keyframe_interval = keyframe_interval;
+    if (package_dir)
+        return package(&server, package_dir, duration, segment, input, frame_size, fps, motion_pct);
+    if (vod_dir && !server.open_vod(vod_dir))
+        errx(1, "cannot serve %s", vod_dir);
+    if (!server.listen(port))
+        errx(1, "cannot listen on port %d", port);
+
+    uint64_t period_ns = 1e9 / fps;
+    uint64_t next_ns = monotonic_ns();
+    uint64_t start_ns = next_ns;
+    uint64_t report_ns = next_ns + 1000000000ull;
+    uint64_t storm_ns = next_ns + storm_ms * 1000000ull;
+    uint64_t frame_no = 0;
+    while (1)
+    {
+        if (vod_dir)
+            server.poll_until(server.serve_vod());
+        else
+        {
+            server.poll_until(next_ns);
+            size_t len = read_frame(input, frame, frame_size, frame_no++, motion_pct);
+            // frames are "captured" on the fps schedule, not when the loop gets to them
+            server.push_frame(frame, len, (next_ns - start_ns) / 1000);
+            next_ns += period_ns;
+        }
+        if (storm_ms > 0 && monotonic_ns() >= storm_ns)
+        {
+            // every client reconnects at once
+            server.drop_clients();
+            storm_ns += storm_ms * 1000000ull;
+        }
+
+        if (monotonic_ns() >= report_ns)
+        {
+            struct fanout_stats &st = server.stats;
+            double frames = st.frames ? st.frames : 1;
+            if (vod_dir)
+                printf("%zu clients, %lu stored frames (%lu ahead of time): send %.1f us/frame, %lu seeks, "
+                       "%lu datagrams (%lu dropped), %lu resumes (%lu rejected)\n",
+                       server.client_count(), (unsigned long)st.vod_frames, (unsigned long)st.prefetched,
+                       st.vod_frames ? st.send_ns / 1e3 / st.vod_frames : 0.0, (unsigned long)st.seeks,
+                       (unsigned long)st.datagrams, (unsigned long)st.dgram_drops, (unsigned long)st.resumes,
+                       (unsigned long)st.resume_rejects);
+            else
+                printf("%zu clients, %lu frames: encrypt %.1f us/frame, send %.1f us/frame (%.2f us/client), "
+                       "%lu drops, %lu slot waits, %lu zero copy fallbacks, %lu datagrams (%lu dropped), "
+                       "%lu resumes (%lu rejected, %lu frames resent), %lu corrupted\n",
+                       server.client_count(), (unsigned long)st.frames, st.encrypt_ns / 1e3 / frames,
+                       st.send_ns / 1e3 / frames, st.sends ? st.send_ns / 1e3 / st.sends : 0.0,
+                       (unsigned long)st.drops, (unsigned long)st.slot_full, (unsigned long)st.zc_copied,
+                       (unsigned long)st.datagrams, (unsigned long)st.dgram_drops, (unsigned long)st.resumes,
+                       (unsigned long)st.resume_rejects, (unsigned long)st.resent,
+                       (unsigned long)st.corrupted);
+            if (keyframe_interval > 0 && !vod_dir)
+                printf("delta frames: %lu keyframes, %.1f%% of the frame bytes encrypted\n",
+                       (unsigned long)st.keyframes, st.frame_bytes ? 100.0 * st.plain_bytes / st.frame_bytes : 0.0);
+            memset(&st, 0, sizeof(st));
+            report_ns += 1000000000ull;
+        }
+    }
+
+    delete[] frame;
+    return 0;
+}
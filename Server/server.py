@@ -2,18 +2,140 @@
 # Date: 2024-5-4
 
 import cv2
+import os
 import socket
+import struct
 import key
 import threading
+import time
 import Crypto
 from Crypto.PublicKey import RSA
 from Crypto.PublicKey.RSA import construct
-from Crypto.Cipher import PKCS1_OAEP
+from Crypto.Cipher import PKCS1_OAEP, PKCS1_v1_5
+from Crypto.Hash import SHA1, SHA256
 
 
 # Video file
 frame_rate = 1  # fps
 video_file = "big_buck_bunny_240p_30mb.mp4"
+# > 0: send raw frames as changed blocks with a whole frame this often,
+# see host/include/delta.h
+keyframe_interval = 0
+# "h264" (libx264) or "vp8" (libvpx): encode the video instead of sending
+# independent frames, a keyframe every keyframe_interval frames (10 s if 0),
+# see host/include/video_decoder.h. Needs PyAV.
+video_codec = None
+
+# Wire format, see host/include/protocol.h (little endian)
+FRAME_MAGIC = 0x46535A54  # "TZSF"
+FRAME_VIDEO = 1
+FRAME_ECDH_PUB = 2
+FRAME_VIDEO_AES = 3
+FRAME_STREAM_INFO = 8
+FRAME_TRACE = 9
+# trace_id, capture_us, encode_us, encrypt_us, send_us (CLOCK_REALTIME)
+FRAME_TRACE_INFO = struct.Struct("<QQQQQ")
+FRAME_HEADER = struct.Struct("<IIIIIQII")  # magic, type, seq, key_id, length, pts_us, crc32c, flags
+FRAME_FLAG_KEYFRAME = 1
+FRAME_FLAG_DELTA = 2
+FRAME_FLAG_PACKET = 4
+# codec: STREAM_CODEC_xxx, encoder
+STREAM_CODECS = {"h264": (1, "libx264"), "vp8": (2, "libvpx")}
+DELTA_HEADER = struct.Struct("<IIII")  # base_seq, frame_len, block_size, block_count
+DELTA_BLOCK_SIZE = 256
+MSG_HEADER = struct.Struct("<II")  # type, length
+MSG_PUB_KEY = 1
+MSG_ECDH_PUB = 2
+MSG_TRACE = 7
+
+# RSA padding schemes, TA_RSA_SCHEME_xxx in ta/include/my_test_ta.h
+RSA_SCHEME_PKCS1_V1_5 = 0
+RSA_SCHEME_OAEP_SHA1 = 1
+RSA_SCHEME_OAEP_SHA256 = 2
+
+
+def make_crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x82F63B78 if crc & 1 else crc >> 1
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = make_crc32c_table()
+
+
+# CRC32C of a frame payload, host/include/crc32c.cpp is the fast version
+def crc32c(data):
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc = CRC32C_TABLE[(crc ^ b) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+# indexes of the blocks that differ from the previous frame
+def changed_blocks(previous, frame):
+    return [
+        i // DELTA_BLOCK_SIZE
+        for i in range(0, len(frame), DELTA_BLOCK_SIZE)
+        if previous[i : i + DELTA_BLOCK_SIZE] != frame[i : i + DELTA_BLOCK_SIZE]
+    ]
+
+
+def encode_delta(base_seq, frame, changed):
+    blocks = b"".join(frame[i * DELTA_BLOCK_SIZE : (i + 1) * DELTA_BLOCK_SIZE] for i in changed)
+    return (
+        DELTA_HEADER.pack(base_seq, len(frame), DELTA_BLOCK_SIZE, len(changed))
+        + struct.pack("<%dI" % len(changed), *changed)
+        + blocks
+    )
+
+
+class video_encoder:
+    """One encoder for all viewers, each packet is sent as one frame."""
+
+    def __init__(self, codec, width, height, gop):
+        import av
+        from fractions import Fraction
+
+        self.av = av
+        self.codec_id, encoder = STREAM_CODECS[codec]
+        self.width, self.height = width, height
+        self.context = av.CodecContext.create(encoder, "w")
+        self.context.width = width
+        self.context.height = height
+        self.context.pix_fmt = "yuv420p"
+        self.context.time_base = Fraction(1, 1000000)  # pts_us
+        self.context.gop_size = gop
+        # no reordering: a packet decodes into its picture right away
+        self.context.max_b_frames = 0
+        if encoder == "libx264":
+            self.context.options = {"preset": "ultrafast", "tune": "zerolatency"}
+        else:
+            self.context.options = {"deadline": "realtime", "lag-in-frames": "0", "cpu-used": "8"}
+        self.keyframe_due = True
+
+    def encode(self, frame, pts_us):
+        """[(packet, is_keyframe)] for a BGR frame, usually one packet."""
+        picture = self.av.VideoFrame.from_ndarray(frame, format="bgr24").reformat(format="yuv420p")
+        picture.pts = pts_us
+        if self.keyframe_due:
+            # somebody joined, they start here instead of at the next regular keyframe
+            picture.pict_type = self.av.video.frame.PictureType.I
+            self.keyframe_due = False
+        return [(bytes(packet), packet.is_keyframe) for packet in self.context.encode(picture)]
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
 
 
 def print_hex(data):
@@ -23,35 +145,40 @@ def print_hex(data):
 
 
 class rsa_pub_key:
+    frame_type = FRAME_VIDEO
+
     def __init__(self):
         self.valid = False
 
     def is_valid(self):
         return self.valid
 
-    def set_key(self, e, n):
+    def set_key(self, e, n, scheme=RSA_SCHEME_OAEP_SHA1):
         self.e = e
         self.n = n
         # print("e: ", e)
         # print("n: ", n)
         self.pubkey = construct((n, e))
-        self.cipher = PKCS1_OAEP.new(self.pubkey)
+        # the chunk size follows from the key the client negotiated
+        self.output_chunk_size = self.pubkey.size_in_bytes()
+        if scheme == RSA_SCHEME_PKCS1_V1_5:
+            self.cipher = PKCS1_v1_5.new(self.pubkey)
+            self.input_chunk_size = self.output_chunk_size - 11
+        else:
+            hash_algo = SHA256 if scheme == RSA_SCHEME_OAEP_SHA256 else SHA1
+            self.cipher = PKCS1_OAEP.new(self.pubkey, hashAlgo=hash_algo)
+            self.input_chunk_size = self.output_chunk_size - 2 * hash_algo.digest_size - 2
         self.valid = True
 
     def get_key(self):
         return self.e, self.n
 
     def encrypt(self, data):
-        # RSA key size is 1024 bits = 128 bytes
-        # devide data into chunks and encrypt each chunk
+        # devide data into chunks and encrypt each chunk, the last one
+        # may be shorter: the client takes the length from the padding
         encrypted_data = b""
-        # chunk size
-        input_chunk_size = 32
-        output_chunk_size = 128
-        # zero padding
-        data += b"\x00" * (input_chunk_size - len(data) % input_chunk_size)
-        for i in range(0, len(data), input_chunk_size):
-            chunk = data[i : i + input_chunk_size]
+        for i in range(0, len(data), self.input_chunk_size):
+            chunk = data[i : i + self.input_chunk_size]
             # print chunk in hex
             # print_hex(chunk)
             # print("chunk length: ", len(chunk))
@@ -62,6 +189,38 @@ class rsa_pub_key:
             encrypted_data += encrypted_chunk
         return encrypted_data
 
+    def encrypt_frame(self, data, seq):
+        return self.encrypt(data)
+
+
+class ecdh_frame_key:
+    frame_type = FRAME_VIDEO_AES
+
+    def __init__(self, ecdh):
+        self.ecdh = ecdh
+
+    def encrypt_frame(self, data, seq):
+        return self.ecdh.encrypt(data, seq)
+
+
+class client_record:
+    def __init__(self, client_socket, address):
+        self.socket = client_socket
+        self.address = address
+        self.seq = 0
+        # frames since the last keyframe, None until the first one, a codec
+        # stream starts there for this client
+        self.since_keyframe = None
+        # (key_id, rsa_pub_key or ecdh_frame_key) frames are encrypted for, replaced as a
+        # whole so a rotation takes effect at a frame boundary
+        self.key = None
+        # MSG_TRACE: a FRAME_TRACE with the stage times goes ahead of every frame
+        self.trace = False
+
+
+def realtime_us():
+    return time.time_ns() // 1000
+
 
 class Server:
 
@@ -77,73 +236,184 @@ class Server:
         self.client_socket_list = []
         # key
         self.server_key = key.insecure_key_storage()
+        # high half of the trace IDs, the low half is the frame number
+        self.run_id = struct.unpack("<I", os.urandom(4))[0]
+        # (trace_id, capture_us, encode_us) of the frame being sent; its encode span
+        # runs until the frame is encrypted for the client, other clients first
+        self.frame_times = None
         print("Server running...")
 
     def accept_client(self):  # thread1
         while True:
             client_socket, client_address = self.server_socket.accept()
             print(f"[*] Accepted connection from {client_address}")
-            self.client_socket_list.append(
-                (client_socket, client_address[0], rsa_pub_key())
-            )
+            client = client_record(client_socket, client_address[0])
+            self.client_socket_list.append(client)
             # launch a key exchange thread
-            thread2 = threading.Thread(
-                target=self.key_exchange,
-                args=(
-                    client_address[0],
-                    client_socket,
-                ),
-            )
+            thread2 = threading.Thread(target=self.key_exchange, args=(client,))
             thread2.start()
 
-    def key_exchange(self, client_IP, client_socket):  # thread2
-
-        received_data = b""
-        received_data = client_socket.recv(4096)
-        # get length
-        len_n = int.from_bytes(received_data[0:4], "little")
-        len_e = int.from_bytes(received_data[4:8], "little")
-        # get n and e
-        n = int.from_bytes(
-            received_data[8 : 8 + len_n], "little"
-        )  # received_data[8 : 8 + len_e]
-        e = int.from_bytes(received_data[8 + len_n : 8 + len_e + len_n], "little")
+    def key_exchange(self, client):  # thread2
+        # the client keeps sending keys when it rotates them
+        while True:
+            header = recv_exact(client.socket, MSG_HEADER.size)
+            if header is None:
+                break
+            msg_type, length = MSG_HEADER.unpack(header)
+            received_data = recv_exact(client.socket, length)
+            if received_data is None:
+                break
+            if msg_type == MSG_PUB_KEY:
+                self.set_pub_key(client, received_data)
+            elif msg_type == MSG_ECDH_PUB:
+                self.ecdh_agree(client, received_data)
+            elif msg_type == MSG_TRACE:
+                client.trace = True
+            else:
+                print(f"Unknown message {msg_type} from {client.address}")
+
+    def set_pub_key(self, client, received_data):
+        # get key id, scheme and lengths
+        key_id, scheme, len_n, len_e = struct.unpack("<IIII", received_data[0:16])
+        # get n and e, big endian octet strings as exported by the TA
+        n = int.from_bytes(received_data[16 : 16 + len_n], "big")
+        e = int.from_bytes(received_data[16 + len_n : 16 + len_n + len_e], "big")
         # print
+        print("key_id: ", key_id)
+        print("scheme: ", scheme)
         print("len_e: ", len_e)
         print("e: ", e)
         print("len_n: ", len_n)
         print("n: ", n)
-        # load into client record
-        for client_socket_t, address, rsa_key in self.client_socket_list:
-            if address == client_IP:
-                rsa_key.set_key(e, n)
-                print("Public key set for ", client_IP)
-                break
+        # load into client record, used from the next frame on
+        rsa_key = rsa_pub_key()
+        rsa_key.set_key(e, n, scheme)
+        client.key = (key_id, rsa_key)
+        print("Public key", key_id, "set for", client.address)
+
+    def ecdh_agree(self, client, received_data):
+        curve, pub_len = struct.unpack("<II", received_data[0:8])
+        ecdh = key.ecdh_key(curve)
+        ecdh.derive(received_data[8 : 8 + pub_len])
+        payload = struct.pack("<II", curve, len(ecdh.public_bytes)) + ecdh.public_bytes
+        # reply before the key is set, so the stream thread cannot send a
+        # frame ahead of it
+        client.socket.sendall(
+            FRAME_HEADER.pack(FRAME_MAGIC, FRAME_ECDH_PUB, 0, 0, len(payload), 0, crc32c(payload), 0) + payload
+        )
+        client.key = (0, ecdh_frame_key(ecdh))
+        print("ECDH key agreed with", client.address)
+
+    def send_stream_info(self, client, encoder):
+        payload = struct.pack("<III", encoder.codec_id, encoder.width, encoder.height)
+        return self.send_frame(client, FRAME_STREAM_INFO, payload, 0, 0)
+
+    def send_video(self, client, plain, flags, pts_us):
+        key_id, frame_key = client.key
+        encrypt_us = realtime_us()
+        # encode using the client's rsa public key or agreed aes key
+        encrypted_frame = frame_key.encrypt_frame(plain, client.seq)
+        if client.trace and self.frame_times:
+            trace_id, capture_us, encode_us = self.frame_times
+            times = FRAME_TRACE_INFO.pack(trace_id, capture_us, encode_us, encrypt_us, realtime_us())
+            # same seq as the frame it describes
+            if not self.send_frame(client, FRAME_TRACE, times, 0, 0):
+                return False
+        print(len(encrypted_frame), "bytes of encrypted data")
+        # print encrypted_frame in hex
+        if flags == 0:
+            print_hex(encrypted_frame)
+        sent = self.send_frame(client, frame_key.frame_type, encrypted_frame, pts_us, flags, key_id)
+        client.seq += 1
+        return sent
+
+    def send_frame(self, client, frame_type, payload, pts_us, flags, key_id=0):
+        header = FRAME_HEADER.pack(
+            FRAME_MAGIC,
+            frame_type,
+            client.seq,
+            key_id,
+            len(payload),
+            pts_us,
+            crc32c(payload),
+            flags,
+        )
+        try:
+            client.socket.sendall(header + payload)
+            return True
+        except:
+            print(f"Error sending frame to {client.address}")
+            self.client_socket_list.remove(client)
+            print(f"Connection with {client.address} closed")
+            client.socket.close()
+            return False
 
     def stream_video(self, video_file, frame_rate):  # thread3
         video_capture = cv2.VideoCapture(video_file)
+        previous = None
+        encoder = None
+        frame_no = 0
         while True:
             ret, frame = video_capture.read()
+            capture_us = realtime_us()
+            # position in the video, the client plays frames out at this pace
+            pts_us = int(video_capture.get(cv2.CAP_PROP_POS_MSEC) * 1000)
             # serialize the frame
+            encode_us = realtime_us()
             serialized_frame = cv2.imencode(".jpg", frame)[1].tobytes()
             serialized_frame = ("0123456789").encode()
-            print_hex(serialized_frame)
-            for client_socket, client_address, rsa_key in self.client_socket_list:
-                if rsa_key.is_valid():
-                    # encode using rsa public key
-                    encrypted_frame = rsa_key.encrypt(serialized_frame)
-                    print(len(encrypted_frame), "bytes of encrypted data")
-                    # print encrypted_frame in hex
-                    print_hex(encrypted_frame)
-                    try:
-                        client_socket.sendall(encrypted_frame)
-                    except:
-                        print(f"Error sending frame to {client_address}")
-                        self.client_socket_list.remove(
-                            (client_socket, client_address, rsa_key)
-                        )
-                        print(f"Connection with {client_address} closed")
-                        client_socket.close()
+            changed = None
+            packets = []
+            if video_codec:
+                if encoder is None:
+                    gop = keyframe_interval if keyframe_interval > 0 else 10 * frame_rate
+                    encoder = video_encoder(video_codec, frame.shape[1], frame.shape[0], gop)
+                if any(c.key is not None and c.since_keyframe is None for c in self.client_socket_list):
+                    encoder.keyframe_due = True
+                packets = encoder.encode(frame, pts_us)
+            elif keyframe_interval > 0:
+                # raw pixels: a small change to the image changes all of a JPEG
+                serialized_frame = frame.tobytes()
+                if previous is not None and len(previous) == len(serialized_frame):
+                    changed = changed_blocks(previous, serialized_frame)
+                    # no smaller than the frame, send a keyframe instead
+                    if len(changed) * (DELTA_BLOCK_SIZE + 4) >= len(serialized_frame):
+                        changed = None
+                previous = serialized_frame
+            else:
+                print_hex(serialized_frame)
+            self.frame_times = ((self.run_id << 32) | (frame_no & 0xFFFFFFFF), capture_us, encode_us)
+            frame_no += 1
+            for client in list(self.client_socket_list):
+                if client.key is None:
+                    continue
+                if video_codec:
+                    for packet, keyframe in packets:
+                        if client.since_keyframe is None:
+                            # nothing before a keyframe decodes
+                            if not keyframe or not self.send_stream_info(client, encoder):
+                                break
+                        client.since_keyframe = 0 if keyframe else client.since_keyframe + 1
+                        flags = FRAME_FLAG_PACKET | (FRAME_FLAG_KEYFRAME if keyframe else 0)
+                        if not self.send_video(client, packet, flags, pts_us):
+                            break
+                    continue
+                plain, flags = serialized_frame, 0
+                if keyframe_interval > 0:
+                    # the client patches the frame before this one, which it got
+                    # unless it just joined
+                    if (
+                        changed is None
+                        or client.since_keyframe is None
+                        or client.since_keyframe + 1 >= keyframe_interval
+                    ):
+                        flags = FRAME_FLAG_KEYFRAME
+                        client.since_keyframe = 0
+                    else:
+                        plain = encode_delta(client.seq - 1, serialized_frame, changed)
+                        flags = FRAME_FLAG_DELTA
+                        client.since_keyframe += 1
+                self.send_video(client, plain, flags, pts_us)
 
             cv2.imshow("Server Video", frame)
             cv2.waitKey(int(1000 / frame_rate))
@@ -26,6 +26,8 @@
  */
 
 #include <err.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -44,6 +46,9 @@
 #define DECODE			0
 #define ENCODE			1
 
+#define SEEK_TEST_SIZE		(256 * 1024)
+#define SEEK_TEST_SESSIONS	4
+
 clock_t start_time, end_time;
 
 
@@ -188,6 +193,185 @@ void decrypt_buffer(struct test_ctx *ctx, char *in, char *out, size_t sz)
 			 res, origin);
 }
 
+void seek_ctr(struct test_ctx *ctx, uint64_t block, uint64_t frame,
+	      uint32_t how)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE);
+	op.params[0].value.a = (uint32_t)block;
+	op.params[0].value.b = (uint32_t)(block >> 32);
+	op.params[1].value.a = (uint32_t)frame;
+	op.params[1].value.b = (uint32_t)(frame >> 32);
+	op.params[2].value.a = how;
+
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_SEEK,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(SEEK) failed 0x%x origin 0x%x",
+			res, origin);
+}
+
+/*
+ * Decipher len bytes at offset of a stream ciphered from the session IV,
+ * without touching what comes before: seek to the block holding offset
+ * and drop the bytes of that block before it.
+ */
+void decrypt_range(struct test_ctx *ctx, char *in, char *out,
+		   size_t offset, size_t len)
+{
+	size_t lead = offset % AES_BLOCK_SIZE;
+	char block[AES_BLOCK_SIZE];
+	size_t n;
+
+	seek_ctr(ctx, offset / AES_BLOCK_SIZE, 0, TA_AES_SEEK_STREAM);
+	if (lead) {
+		n = AES_BLOCK_SIZE - lead;
+		if (n > len)
+			n = len;
+		cipher_buffer(ctx, in + offset - lead, block, lead + n);
+		memcpy(out, block + lead, n);
+		offset += n;
+		out += n;
+		len -= n;
+	}
+	if (len)
+		cipher_buffer(ctx, in + offset, out, len);
+}
+
+static double elapsed_ms(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 +
+	       (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/* A session ready to decipher content under the test key and a zero IV */
+static void prepare_range_session(struct test_ctx *ctx)
+{
+	char iv[AES_BLOCK_SIZE];
+
+	prepare_tee_session(ctx);
+	prepare_aes(ctx, DECODE);
+	set_key(ctx);
+	memset(iv, 0, sizeof(iv));
+	set_iv(ctx, iv, AES_BLOCK_SIZE);
+}
+
+struct range_job {
+	struct test_ctx ctx;
+	char *in;
+	char *out;
+	size_t offset;
+	size_t len;
+};
+
+static void *range_worker(void *arg)
+{
+	struct range_job *job = arg;
+
+	decrypt_range(&job->ctx, job->in, job->out, job->offset, job->len);
+	return NULL;
+}
+
+/*
+ * Random access: from one session, decipher the tail and an unaligned
+ * range in the middle straight away, and check them against a sequential
+ * decipher of the whole content. Then give each of SEEK_TEST_SESSIONS
+ * sessions its own slice of the content to decipher at the same time.
+ */
+void seek_test(void)
+{
+	struct range_job jobs[SEEK_TEST_SESSIONS];
+	pthread_t threads[SEEK_TEST_SESSIONS];
+	struct test_ctx ctx;
+	struct timespec t0;
+	char iv[AES_BLOCK_SIZE];
+	char *plain, *cipher, *out;
+	size_t slice, offset, len;
+	double ms;
+	int i;
+
+	plain = malloc(SEEK_TEST_SIZE);
+	cipher = malloc(SEEK_TEST_SIZE);
+	out = malloc(SEEK_TEST_SIZE);
+	if (!plain || !cipher || !out)
+		errx(1, "out of memory");
+	srand(1);
+	for (i = 0; i < SEEK_TEST_SIZE; i++)
+		plain[i] = rand();
+
+	prepare_tee_session(&ctx);
+	prepare_aes(&ctx, ENCODE);
+	set_key(&ctx);
+	memset(iv, 0, sizeof(iv));
+	set_iv(&ctx, iv, AES_BLOCK_SIZE);
+	cipher_buffer(&ctx, plain, cipher, SEEK_TEST_SIZE);
+	terminate_tee_session(&ctx);
+
+	prepare_range_session(&ctx);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	cipher_buffer(&ctx, cipher, out, SEEK_TEST_SIZE);
+	ms = elapsed_ms(&t0);
+	printf("Seek test: sequential %d KiB in %.3f ms: %s\n",
+	       SEEK_TEST_SIZE / 1024, ms,
+	       memcmp(plain, out, SEEK_TEST_SIZE) ? "Failure" : "Success");
+
+	memset(out, 0, SEEK_TEST_SIZE);
+	offset = SEEK_TEST_SIZE - AES_TEST_BUFFER_SIZE;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	decrypt_range(&ctx, cipher, out, offset, AES_TEST_BUFFER_SIZE);
+	ms = elapsed_ms(&t0);
+	printf("Seek test: last %d bytes in %.3f ms: %s\n",
+	       AES_TEST_BUFFER_SIZE, ms,
+	       memcmp(plain + offset, out, AES_TEST_BUFFER_SIZE) ?
+	       "Failure" : "Success");
+
+	/* backwards and off a block boundary, on the same session */
+	offset = SEEK_TEST_SIZE / 3 + 5;
+	len = 1000;
+	decrypt_range(&ctx, cipher, out, offset, len);
+	printf("Seek test: %zu bytes at %zu: %s\n", len, offset,
+	       memcmp(plain + offset, out, len) ? "Failure" : "Success");
+	terminate_tee_session(&ctx);
+
+	/* slices need not be block aligned either */
+	memset(out, 0, SEEK_TEST_SIZE);
+	slice = SEEK_TEST_SIZE / SEEK_TEST_SESSIONS + 7;
+	for (i = 0; i < SEEK_TEST_SESSIONS; i++) {
+		prepare_range_session(&jobs[i].ctx);
+		jobs[i].in = cipher;
+		jobs[i].offset = i * slice;
+		jobs[i].out = out + jobs[i].offset;
+		jobs[i].len = i == SEEK_TEST_SESSIONS - 1 ?
+			      SEEK_TEST_SIZE - jobs[i].offset : slice;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < SEEK_TEST_SESSIONS; i++)
+		if (pthread_create(&threads[i], NULL, range_worker, &jobs[i]))
+			errx(1, "pthread_create failed");
+	for (i = 0; i < SEEK_TEST_SESSIONS; i++)
+		pthread_join(threads[i], NULL);
+	ms = elapsed_ms(&t0);
+	printf("Seek test: %d sessions in parallel in %.3f ms: %s\n",
+	       SEEK_TEST_SESSIONS, ms,
+	       memcmp(plain, out, SEEK_TEST_SIZE) ? "Failure" : "Success");
+	for (i = 0; i < SEEK_TEST_SESSIONS; i++)
+		terminate_tee_session(&jobs[i].ctx);
+
+	free(plain);
+	free(cipher);
+	free(out);
+}
+
 void encrypt_and_decrypt_test(struct test_ctx *ctx)
 {
 	char plaintext[] = "Hello, world!";
@@ -274,5 +458,7 @@ int main(void) {
 	}
 
     terminate_tee_session(&ctx);
+
+    seek_test();
     return 0;
 }
\ No newline at end of file
@@ -38,6 +38,8 @@
 #define AES128_KEY_BYTE_SIZE		(AES128_KEY_BIT_SIZE / 8)
 #define AES256_KEY_BIT_SIZE		256
 #define AES256_KEY_BYTE_SIZE		(AES256_KEY_BIT_SIZE / 8)
+#define AES_BLOCK_BYTE_SIZE		16
+#define AES_TEXT_MAX			128	/* per text in the session scratch */
 
 /*
  * Ciphering context: each opened session relates to a cipehring operation.
@@ -52,13 +54,21 @@ struct aes_cipher {
 	uint32_t key_size;		/* AES key size in byte */
 	TEE_OperationHandle op_handle;	/* AES ciphering operation */
 	TEE_ObjectHandle key_handle;	/* transient object to load the key */
+	uint8_t iv[AES_BLOCK_BYTE_SIZE];	/* last IV set, seeks count from it */
+	bool iv_set;
 };
 
-// hold session-specific data
+// hold session-specific data, the commands above take it as an aes_cipher
+// scratch is reserved when the session opens, commands allocate nothing
 struct aes_session {
-    uint8_t *ciphertext;
+    struct aes_cipher cipher;
+    uint8_t *scratch;           // ciphertext, then plaintext
+    uint8_t *ciphertext;        // last TA_COMMAND_ENCRYPT result
     uint32_t ciphertext_len;
-    TEE_ObjectHandle key_handle;
+    uint8_t *plaintext;
+    TEE_ObjectHandle key_handle; // hardcoded key, loaded on first use
+    TEE_OperationHandle enc_handle; // TA_COMMAND_ENCRYPT, keyed with it
+    TEE_OperationHandle dec_handle; // TA_COMMAND_DECRYPT, keyed with it
 };
 
 
@@ -138,7 +148,7 @@ static TEE_Result alloc_resources(void *session, uint32_t param_types,
 	struct aes_cipher *sess;
 	TEE_Attribute attr;
 	TEE_Result res;
-	char *key;
+	uint8_t key[AES256_KEY_BYTE_SIZE];
 
 	/* Get ciphering context from session ID */
 	DMSG("Session %p: get ciphering resources", session);
@@ -205,12 +215,7 @@ static TEE_Result alloc_resources(void *session, uint32_t param_types,
 	 * dummy key in the operation so that operation can be reset
 	 * when updating the key.
 	 */
-	key = TEE_Malloc(sess->key_size, 0);
-	if (!key) {
-		res = TEE_ERROR_OUT_OF_MEMORY;
-		goto err;
-	}
-
+	TEE_MemFill(key, 0, sizeof(key));
 	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, sess->key_size);
 
 	res = TEE_PopulateTransientObject(sess->key_handle, &attr, 1);
@@ -340,6 +345,79 @@ static TEE_Result reset_aes_iv(void *session, uint32_t param_types,
 	 */
 	TEE_CipherInit(sess->op_handle, iv, iv_sz);
 
+	sess->iv_set = iv_sz == sizeof(sess->iv);
+	if (sess->iv_set)
+		TEE_MemMove(sess->iv, iv, iv_sz);
+
+	return TEE_SUCCESS;
+}
+
+/* ctr = ctr + n, for a big endian counter of len bytes */
+static void ctr_add(uint8_t *ctr, size_t len, uint64_t n)
+{
+	int i;
+
+	for (i = len - 1; i >= 0 && n; i--) {
+		n += ctr[i];
+		ctr[i] = n & 0xff;
+		n >>= 8;
+	}
+}
+
+/*
+ * Process command TA_AES_CMD_SEEK. API in aes_ta.h
+ *
+ * CTR keystream block k only depends on the key and IV + k, so a seek is
+ * a new counter block for TEE_CipherInit(): nothing before it is ciphered
+ * and the operation keeps its key. Sessions with the same key and IV can
+ * so decrypt different ranges of the same content at once.
+ */
+static TEE_Result seek_aes_ctr(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	struct aes_cipher *sess;
+	uint8_t ctr[AES_BLOCK_BYTE_SIZE];
+	uint64_t block;
+	uint64_t frame;
+	int i;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: seek", session);
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (sess->op_handle == TEE_HANDLE_NULL ||
+	    sess->algo != TEE_ALG_AES_CTR || !sess->iv_set)
+		return TEE_ERROR_BAD_STATE;
+
+	block = ((uint64_t)params[0].value.b << 32) | params[0].value.a;
+	frame = ((uint64_t)params[1].value.b << 32) | params[1].value.a;
+
+	TEE_MemMove(ctr, sess->iv, sizeof(ctr));
+	switch (params[2].value.a) {
+	case TA_AES_SEEK_STREAM:
+		/* carries into the high half like the cipher itself */
+		ctr_add(ctr, sizeof(ctr), block);
+		break;
+	case TA_AES_SEEK_FRAME:
+		for (i = 0; i < 8; i++)
+			ctr[i] = frame >> (56 - 8 * i);
+		ctr_add(ctr + 8, 8, block);
+		break;
+	default:
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	TEE_CipherInit(sess->op_handle, ctr, sizeof(ctr));
+
 	return TEE_SUCCESS;
 }
 
@@ -406,63 +484,72 @@ static TEE_Result load_hardcoded_aes_key(TEE_ObjectHandle *key_handle, uint32_t
 }
 
 
-static TEE_Result encrypt_data(TEE_ObjectHandle key_handle, const uint8_t *plaintext, uint32_t plaintext_len, uint8_t *ciphertext, uint32_t *ciphertext_len) {
+static TEE_Result prepare_hardcoded_op(TEE_OperationHandle *op_handle, uint32_t mode, TEE_ObjectHandle key_handle) {
     TEE_Result res;
-    TEE_OperationHandle op_handle = TEE_HANDLE_NULL;
 
-    // Allocate the operation
-    res = TEE_AllocateOperation(&op_handle, TEE_ALG_AES_ECB_NOPAD, TEE_MODE_ENCRYPT, 256);
+    res = TEE_AllocateOperation(op_handle, TEE_ALG_AES_ECB_NOPAD, mode, AES256_KEY_BIT_SIZE);
     if (res != TEE_SUCCESS) {
         EMSG("Failed to allocate operation handle: 0x%08x", res);
+        *op_handle = TEE_HANDLE_NULL;
         return res;
     }
 
-    // Set the key
-    res = TEE_SetOperationKey(op_handle, key_handle);
+    res = TEE_SetOperationKey(*op_handle, key_handle);
     if (res != TEE_SUCCESS) {
         EMSG("Failed to set key: 0x%08x", res);
-        TEE_FreeOperation(op_handle);
-        return res;
+        TEE_FreeOperation(*op_handle);
+        *op_handle = TEE_HANDLE_NULL;
     }
+    return res;
+}
 
-    // Perform the encryption
-    res = TEE_CipherDoFinal(op_handle, (void *)plaintext, plaintext_len, ciphertext, ciphertext_len);
+// key and both operations once per session, the commands only reinit them
+static TEE_Result prepare_hardcoded_key(struct aes_session *sess) {
+    TEE_Result res;
+
+    if (sess->dec_handle != TEE_HANDLE_NULL)
+        return TEE_SUCCESS;
+
+    res = load_hardcoded_aes_key(&sess->key_handle, AES256_KEY_BYTE_SIZE);
+    if (res == TEE_SUCCESS)
+        res = prepare_hardcoded_op(&sess->enc_handle, TEE_MODE_ENCRYPT, sess->key_handle);
+    if (res == TEE_SUCCESS)
+        res = prepare_hardcoded_op(&sess->dec_handle, TEE_MODE_DECRYPT, sess->key_handle);
     if (res != TEE_SUCCESS) {
-        EMSG("Encryption failed: 0x%08x", res);
+        if (sess->enc_handle != TEE_HANDLE_NULL)
+            TEE_FreeOperation(sess->enc_handle);
+        if (sess->key_handle != TEE_HANDLE_NULL)
+            TEE_FreeTransientObject(sess->key_handle);
+        sess->enc_handle = TEE_HANDLE_NULL;
+        sess->key_handle = TEE_HANDLE_NULL;
     }
-
-    // Free the operation
-    TEE_FreeOperation(op_handle);
     return res;
 }
 
-static TEE_Result decrypt_data(TEE_ObjectHandle key_handle, const uint8_t *ciphertext, uint32_t ciphertext_len, uint8_t *plaintext, uint32_t *plaintext_len) {
+static TEE_Result encrypt_data(TEE_OperationHandle op_handle, const uint8_t *plaintext, uint32_t plaintext_len, uint8_t *ciphertext, uint32_t *ciphertext_len) {
     TEE_Result res;
-    TEE_OperationHandle op_handle = TEE_HANDLE_NULL;
 
-    // Allocate the operation for decryption
-    res = TEE_AllocateOperation(&op_handle, TEE_ALG_AES_ECB_NOPAD, TEE_MODE_DECRYPT, 256);
-    if (res != TEE_SUCCESS) {
-        EMSG("Failed to allocate operation handle for decryption: 0x%08x", res);
-        return res;
-    }
+    // ECB takes no IV, this only returns the operation to its initial state
+    TEE_CipherInit(op_handle, NULL, 0);
 
-    // Set the key for decryption
-    res = TEE_SetOperationKey(op_handle, key_handle);
+    // Perform the encryption
+    res = TEE_CipherDoFinal(op_handle, (void *)plaintext, plaintext_len, ciphertext, ciphertext_len);
     if (res != TEE_SUCCESS) {
-        EMSG("Failed to set key for decryption: 0x%08x", res);
-        TEE_FreeOperation(op_handle);
-        return res;
+        EMSG("Encryption failed: 0x%08x", res);
     }
+    return res;
+}
+
+static TEE_Result decrypt_data(TEE_OperationHandle op_handle, const uint8_t *ciphertext, uint32_t ciphertext_len, uint8_t *plaintext, uint32_t *plaintext_len) {
+    TEE_Result res;
+
+    TEE_CipherInit(op_handle, NULL, 0);
 
     // Perform the decryption
     res = TEE_CipherDoFinal(op_handle, (void *)ciphertext, ciphertext_len, plaintext, plaintext_len);
     if (res != TEE_SUCCESS) {
         EMSG("Decryption failed: 0x%08x", res);
     }
-
-    // Free the operation
-    TEE_FreeOperation(op_handle);
     return res;
 }
 
@@ -505,10 +592,20 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types, TEE_Param params[4], v
     struct aes_session *sess = TEE_Malloc(sizeof(struct aes_session), TEE_MALLOC_FILL_ZERO);
     if (!sess)
         return TEE_ERROR_OUT_OF_MEMORY;
+    sess->scratch = TEE_Malloc(2 * AES_TEXT_MAX, TEE_MALLOC_FILL_ZERO);
+    if (!sess->scratch) {
+        TEE_Free(sess);
+        return TEE_ERROR_OUT_OF_MEMORY;
+    }
 
     sess->key_handle = TEE_HANDLE_NULL; // Initialize to NULL
-    sess->ciphertext = NULL;
+    sess->enc_handle = TEE_HANDLE_NULL;
+    sess->dec_handle = TEE_HANDLE_NULL;
+    sess->cipher.key_handle = TEE_HANDLE_NULL;
+    sess->cipher.op_handle = TEE_HANDLE_NULL;
+    sess->ciphertext = sess->scratch;
     sess->ciphertext_len = 0;
+    sess->plaintext = sess->scratch + AES_TEXT_MAX;
 
     *session = sess; // Store the pointer to the session structure
     return TEE_SUCCESS;
@@ -533,10 +630,20 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types, TEE_Param params[4], v
 void TA_CloseSessionEntryPoint(void *session) {
     struct aes_session *sess = (struct aes_session *)session;
     if (sess) {
+        if (sess->cipher.key_handle != TEE_HANDLE_NULL)
+            TEE_FreeTransientObject(sess->cipher.key_handle);
+        if (sess->cipher.op_handle != TEE_HANDLE_NULL)
+            TEE_FreeOperation(sess->cipher.op_handle);
+        if (sess->enc_handle != TEE_HANDLE_NULL)
+            TEE_FreeOperation(sess->enc_handle);
+        if (sess->dec_handle != TEE_HANDLE_NULL)
+            TEE_FreeOperation(sess->dec_handle);
         if (sess->key_handle != TEE_HANDLE_NULL)
             TEE_FreeTransientObject(sess->key_handle);
-        if (sess->ciphertext != NULL)
-            TEE_Free(sess->ciphertext);
+        if (sess->scratch != NULL) {
+            TEE_MemFill(sess->scratch, 0, 2 * AES_TEXT_MAX);
+            TEE_Free(sess->scratch);
+        }
         TEE_Free(sess);
     }
 }
@@ -561,34 +668,30 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session, uint32_t cmd, uint32_t para
 		return reset_aes_iv(session, param_types, params);
 	case TA_AES_CMD_CIPHER:
 		return cipher_buffer(session, param_types, params);
+	case TA_AES_CMD_SEEK:
+		return seek_aes_ctr(session, param_types, params);
 	case TA_COMMAND_ENCRYPT:
     {
 		// TEE_GetSystemTime(&start_time); // Start time
         const char *text_to_encrypt = "Hello, world!";
         uint32_t text_size = strlen(text_to_encrypt) + 1;  // +1 to include the null terminator
-        uint8_t ciphertext[128];
-        uint32_t ciphertext_len = sizeof(ciphertext);
+        uint32_t ciphertext_len = AES_TEXT_MAX;
 
-        // Load the hardcoded key
-        TEE_ObjectHandle key_handle = TEE_HANDLE_NULL;
-        res = load_hardcoded_aes_key(&key_handle, AES256_KEY_BYTE_SIZE);
+        // Load the hardcoded key and its operations, kept for the session
+        res = prepare_hardcoded_key(sess);
         if (res != TEE_SUCCESS) {
             return res;
         }
 
-        // Encrypt the text
-        res = encrypt_data(key_handle, (uint8_t *)text_to_encrypt, text_size, ciphertext, &ciphertext_len);
+        // Encrypt the text into the session scratch
+        sess->ciphertext_len = 0;
+        res = encrypt_data(sess->enc_handle, (uint8_t *)text_to_encrypt, text_size, sess->ciphertext, &ciphertext_len);
         if (res == TEE_SUCCESS) {
             DMSG("Encrypted text successfully");
-            // Optionally, send ciphertext back to the normal world or process it further here
+            sess->ciphertext_len = ciphertext_len;
         } else {
             EMSG("Failed to encrypt text: 0x%08x", res);
         }
-
-        // Free the key handle
-        if (key_handle != TEE_HANDLE_NULL) {
-            TEE_FreeTransientObject(key_handle);
-        }
 		// TEE_GetSystemTime(&end_time); // End time
         // EMSG("Encryption took %u milliseconds.", end_time.millis - start_time.millis);
 		// params[3].value.a = start_time.seconds;
@@ -602,12 +705,11 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session, uint32_t cmd, uint32_t para
         // Start timing
         // TEE_GetSystemTime(&start_time);
 
-        if (sess->ciphertext == NULL || sess->key_handle == TEE_HANDLE_NULL)
+        if (sess->ciphertext_len == 0 || sess->dec_handle == TEE_HANDLE_NULL)
             return TEE_ERROR_BAD_STATE;
 
-        uint8_t plaintext[128]; // Adjust size as necessary
-        uint32_t plaintext_len = sizeof(plaintext);
-        res = decrypt_data(sess->key_handle, sess->ciphertext, sess->ciphertext_len, plaintext, &plaintext_len);
+        uint32_t plaintext_len = AES_TEXT_MAX;
+        res = decrypt_data(sess->dec_handle, sess->ciphertext, sess->ciphertext_len, sess->plaintext, &plaintext_len);
         
         // End timing
         // TEE_GetSystemTime(&end_time);
@@ -618,7 +720,7 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session, uint32_t cmd, uint32_t para
 			// params[3].value.b = start_time.millis;
 			// params[3].value.c = end_time.seconds;
 			// params[3].value.d = end_time.millis;
-            DMSG("Decrypted text: %s", plaintext);
+            DMSG("Decrypted text: %s", sess->plaintext);
         } else {
             EMSG("Decryption failed: 0x%x", res);
         }
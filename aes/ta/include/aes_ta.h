@@ -82,4 +82,22 @@
 #define TA_AES_CMD_ENCRYPT_TEXT   4 
 #define TA_COMMAND_ENCRYPT        5
 #define TA_COMMAND_DECRYPT 		  6
+
+/*
+ * TA_AES_CMD_SEEK - Move the CTR counter without ciphering up to it
+ * param[0] (value) a: block offset low 32 bits, b: high 32 bits
+ * param[1] (value) a: frame index low 32 bits, b: high 32 bits
+ * param[2] (value) a: TA_AES_SEEK_STREAM/_FRAME, b: unused
+ * param[3] unused
+ *
+ * CTR only, after TA_AES_CMD_SET_IV. The next TA_AES_CMD_CIPHER starts at
+ * the given 16 byte block: of the stream that starts at the IV (STREAM),
+ * or of a frame whose IV is frame index (64 bit big endian) || IV low 64
+ * bits (FRAME), as in the stream protocol. Any byte offset is the block
+ * offset / 16 with the first offset % 16 output bytes dropped.
+ */
+#define TA_AES_CMD_SEEK			7
+
+#define TA_AES_SEEK_STREAM		0
+#define TA_AES_SEEK_FRAME		1
 #endif /* __AES_TA_H */
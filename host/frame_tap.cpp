@@ -0,0 +1,89 @@
+// Example consumer of the client's shared-memory frame ring: reports the
+// frame rate and publish-to-read latency, and can record the frames.
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "include/frame_ring.h"
+#include "include/timing.h"
+
+void usage(const char *prog)
+{
+    printf("usage: %s [--ring NAME] [--out FILE]\n", prog);
+    printf("  --ring NAME  ring the client publishes to with --sink (default tzs-frames)\n");
+    printf("  --out FILE   append every frame to FILE\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ring_name = "tzs-frames";
+    const char *out_path = NULL;
+    FILE *out = NULL;
+
+    static struct option options[] = {
+        {"ring", required_argument, NULL, 'r'},
+        {"out", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:o:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            ring_name = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    frame_ring_reader ring;
+    if (!ring.open(ring_name))
+        errx(1, "cannot attach to ring %s", ring_name);
+    if (out_path && !(out = fopen(out_path, "wb")))
+        err(1, "%s", out_path);
+
+    uint64_t frames = 0, bytes = 0, torn = 0, latency_ns = 0;
+    uint64_t report_ns = monotonic_ns() + 1000000000ull;
+    struct frame_view view;
+    int ret;
+    while ((ret = ring.next(&view, 100)) >= 0)
+    {
+        if (ret == 1)
+        {
+            latency_ns += monotonic_ns() - view.publish_ns;
+            // the frame is used in place, and only counts if it is still intact afterwards
+            if (out)
+                fwrite(view.data, 1, view.length, out);
+            if (ring.validate(&view))
+            {
+                frames++;
+                bytes += view.length;
+            }
+            else
+            {
+                torn++;
+            }
+        }
+        if (monotonic_ns() >= report_ns)
+        {
+            printf("%lu frames, %.3f MB, %.1f us latency, %lu lost, %lu overwritten while read\n",
+                   (unsigned long)frames, bytes / 1e6, frames ? latency_ns / 1e3 / frames : 0.0,
+                   (unsigned long)ring.lost, (unsigned long)torn);
+            frames = bytes = torn = latency_ns = 0;
+            report_ns += 1000000000ull;
+        }
+    }
+    printf("ring closed by the client\n");
+    if (out)
+        fclose(out);
+    return 0;
+}
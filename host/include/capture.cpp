@@ -0,0 +1,142 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "capture.h"
+#include "timing.h"
+
+capture_writer::capture_writer() : fp(NULL), start_ns(0)
+{
+}
+
+capture_writer::~capture_writer()
+{
+    close();
+}
+
+int capture_writer::open(const char *path)
+{
+    struct capture_file_header hdr;
+
+    fp = fopen(path, "wb");
+    if (!fp)
+    {
+        perror("capture: fopen");
+        return 0;
+    }
+    // recv() sized records are small, keep them out of the hot path
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    hdr.magic = CAPTURE_MAGIC;
+    hdr.version = CAPTURE_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    start_ns = monotonic_ns();
+    printf("Capturing stream to %s\n", path);
+    return 1;
+}
+
+void capture_writer::write(uint32_t type, const void *data, uint32_t length)
+{
+    struct capture_record_header rec;
+
+    if (!fp)
+        return;
+    rec.type = type;
+    rec.length = length;
+    rec.offset_ns = monotonic_ns() - start_ns;
+    fwrite(&rec, sizeof(rec), 1, fp);
+    fwrite(data, 1, length, fp);
+}
+
+void capture_writer::close()
+{
+    if (fp)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+capture_reader::capture_reader() : map(NULL), map_len(0), pos(0)
+{
+}
+
+capture_reader::~capture_reader()
+{
+    close();
+}
+
+int capture_reader::open(const char *path)
+{
+    struct capture_file_header hdr;
+    struct stat st;
+    void *addr;
+    int fd;
+
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("replay: open");
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr))
+    {
+        printf("replay: %s is not a capture file\n", path);
+        ::close(fd);
+        return 0;
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        perror("replay: mmap");
+        return 0;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    map = (const char *)addr;
+    map_len = st.st_size;
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.magic != CAPTURE_MAGIC || hdr.version != CAPTURE_VERSION)
+    {
+        printf("replay: %s has bad magic 0x%x or version %u\n", path, hdr.magic, hdr.version);
+        close();
+        return 0;
+    }
+    pos = sizeof(hdr);
+    return 1;
+}
+
+int capture_reader::next(uint32_t *type, const char **data, uint32_t *length, uint64_t *offset_ns)
+{
+    struct capture_record_header rec;
+
+    if (!map || pos + sizeof(rec) > map_len)
+        return 0;
+    memcpy(&rec, map + pos, sizeof(rec));
+    if (rec.length > map_len - pos - sizeof(rec))
+    {
+        printf("replay: truncated record at offset %zu\n", pos);
+        return 0;
+    }
+    *type = rec.type;
+    *length = rec.length;
+    *offset_ns = rec.offset_ns;
+    *data = map + pos + sizeof(rec);
+    pos += sizeof(rec) + rec.length;
+    return 1;
+}
+
+void capture_reader::close()
+{
+    if (map)
+    {
+        munmap((void *)map, map_len);
+        map = NULL;
+    }
+    map_len = 0;
+    pos = 0;
+}
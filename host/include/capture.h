@@ -0,0 +1,67 @@
+#ifndef CAPTURE
+#define CAPTURE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+// Capture file layout (little endian):
+//   capture_file_header
+//   { capture_record_header, payload[length] } ...
+#define CAPTURE_MAGIC 0x43535a54 // "TZSC"
+#define CAPTURE_VERSION 4 // 2: frame_header carries pts_us, 3: and crc32c, 4: and flags
+
+// record types
+#define CAPTURE_RECORD_KEY_ID 1    // id of the persistent TA key the stream was encrypted for
+#define CAPTURE_RECORD_HANDSHAKE 2 // bytes sent to the server during the key exchange
+#define CAPTURE_RECORD_DATA 3      // bytes returned by one recv() call
+#define CAPTURE_RECORD_ROTATE 4    // key id (u32) and object id of a rotated-in key
+
+struct capture_file_header
+{
+    uint32_t magic;
+    uint32_t version;
+} __attribute__((packed));
+
+struct capture_record_header
+{
+    uint32_t type;
+    uint32_t length;
+    uint64_t offset_ns; // time since the capture was started
+} __attribute__((packed));
+
+class capture_writer
+{
+public:
+    capture_writer();
+    ~capture_writer();
+
+    int open(const char *path);
+    void write(uint32_t type, const void *data, uint32_t length);
+    void close();
+
+private:
+    FILE *fp;
+    uint64_t start_ns;
+};
+
+// Reads a capture back through a read-only mapping, so replay speed
+// does not depend on the disk.
+class capture_reader
+{
+public:
+    capture_reader();
+    ~capture_reader();
+
+    int open(const char *path);
+    // returns 1 and fills the record, 0 at the end of the capture
+    int next(uint32_t *type, const char **data, uint32_t *length, uint64_t *offset_ns);
+    void close();
+
+private:
+    const char *map;
+    size_t map_len;
+    size_t pos;
+};
+
+#endif
@@ -8,22 +8,67 @@
 #include <string>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include "capture.h"
+#include "client.h"
+#include "crc32c.h"
+#include "fec.h"
+#include "loss_injector.h"
+#include "protocol.h"
+#include "timing.h"
 // #include <opencv2/core.hpp>
 // #include <opencv2/highgui.hpp>
 #define PAYLOAD_SIZE 8
-#define BUFFER_SIZE 1 << 16
+#define BUFFER_SIZE FRAME_MAX_PAYLOAD
+#define RX_BUFFER_SIZE (2 * (BUFFER_SIZE) + sizeof(struct frame_header))
+#define DATAGRAM_BUFFER_SIZE (1 << 16)
 using namespace std;
 
 // Server
 
 int server_port = 9999;
 string server_addr = "10.128.0.6";
-int client_socket;
+int client_socket = -1;
 char *buffer;
 
+// frames dropped before the TEE because the payload did not match its CRC
+uint64_t crc_errors;
+
+// Session resumption
+string resume_ticket;
+
+// Reassembly: stream bytes are appended to rx_buf and frames are handed out
+// in place, so buffer points into rx_buf and is valid until the next frame.
+char *rx_buf;
+size_t rx_head, rx_tail;
+// first bytes of the frame at rx_head, of the last recv(), of the last frame handed out
+uint64_t rx_start_ns, rx_last_ns, frame_start_ns;
+
+// UDP transport: video frames arrive as FEC protected datagrams, control
+// frames keep coming over the TCP connection
+int udp_socket = -1;
+uint32_t udp_port;
+fec_decoder *fec;
+loss_injector *injector;
+char *dgram_buf;
+
+// Capture / replay
+capture_writer capture;
+capture_reader replay;
+bool replaying = false;
+bool replay_realtime = true;
+uint64_t replay_start_ns;
+string replay_key;
+void (*replay_key_hook)(uint32_t key_id, const char *object_id);
+
 int open_connection()
 {
     // Create a socket client
+    if (client_socket >= 0)
+        close(client_socket);
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
     struct sockaddr_in server_address;
     server_address.sin_family = AF_INET;
@@ -32,8 +77,9 @@ int open_connection()
     if (connect(client_socket, (struct sockaddr *)&server_address, sizeof(server_address)) != -1)
     {
         printf("Connected to the server\n");
-        buffer = new char[BUFFER_SIZE];
-        memset(buffer, 0, sizeof(buffer));
+        if (!rx_buf)
+            rx_buf = new char[RX_BUFFER_SIZE];
+        rx_head = rx_tail = 0;
         return 1;
     }
     else
@@ -43,28 +89,413 @@ int open_connection()
     }
 }
 
-int receive_frame()
+// after open_connection(), asks the server to send video frames as datagrams
+int open_udp(const struct loss_config *loss)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int rcvbuf = 4 << 20; // a frame arrives as one burst of datagrams
+    uint32_t port;
+
+    udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+    if (udp_socket < 0 || bind(udp_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(udp_socket, (struct sockaddr *)&addr, &addr_len) < 0)
+    {
+        perror("udp");
+        return 0;
+    }
+    setsockopt(udp_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    fec = new fec_decoder;
+    dgram_buf = new char[DATAGRAM_BUFFER_SIZE];
+    if (loss && (loss->loss_pct > 0 || loss->jitter_ms > 0))
+    {
+        injector = new loss_injector(loss);
+        printf("Injecting %.1f%% loss in bursts of %d, %d ms jitter\n", loss->loss_pct, loss->burst, loss->jitter_ms);
+    }
+    port = ntohs(addr.sin_port);
+    udp_port = port;
+    if (!send_message(MSG_UDP_PORT, &port, 4))
+        return 0;
+    printf("Receiving frames on UDP port %u\n", port);
+    return 1;
+}
+
+void print_receive_stats()
+{
+    if (crc_errors)
+        printf("%lu frames dropped for a bad CRC32C (%s)\n", (unsigned long)crc_errors, crc32c_impl_name());
+    if (!fec)
+        return;
+    printf("UDP: %lu frames, %lu rebuilt from parity, %lu lost, %lu late datagrams, %lu bad datagrams\n",
+           (unsigned long)fec->stats.frames, (unsigned long)fec->stats.recovered, (unsigned long)fec->stats.lost,
+           (unsigned long)fec->stats.late, (unsigned long)fec->stats.bad);
+    if (injector)
+        printf("Injected loss: %lu of %lu datagrams dropped\n", (unsigned long)injector->dropped,
+               (unsigned long)injector->received);
+}
+
+void set_resume_ticket(const char *ticket, size_t len)
+{
+    resume_ticket.assign(ticket, len);
+}
+
+bool have_resume_ticket()
+{
+    return !resume_ticket.empty();
+}
+
+// a new connection for a session that lost its own, frames keep their UDP port
+int reconnect()
+{
+    if (!open_connection())
+        return 0;
+    if (udp_socket >= 0 && !send_message(MSG_UDP_PORT, &udp_port, 4))
+        return 0;
+    return 1;
+}
+
+// 1 if the server took the ticket and continues at next_seq, 0 if it
+// wants a key exchange, -1 if the connection failed again
+int resume_session(uint32_t next_seq)
+{
+    char msg[4 + RESUME_TICKET_SIZE];
+    struct frame_header hdr;
+    uint32_t status;
+    int count;
+
+    if (resume_ticket.size() != RESUME_TICKET_SIZE)
+        return 0;
+    memcpy(msg, &next_seq, 4);
+    memcpy(msg + 4, resume_ticket.data(), RESUME_TICKET_SIZE);
+    // single use, whatever the answer is
+    resume_ticket.clear();
+    if (!send_message(MSG_RESUME, msg, sizeof(msg)))
+        return -1;
+    count = receive_frame(&hdr);
+    if (count < 0)
+        return -1;
+    if (hdr.type != FRAME_RESUMED || count < 4)
+        return 0;
+    memcpy(&status, buffer, 4);
+    return status == 1;
+}
+
+int open_replay(const char *path, bool realtime)
+{
+    uint32_t type, len;
+    uint64_t offset_ns;
+    const char *data;
+
+    if (!replay.open(path))
+        return 0;
+    if (!replay.next(&type, &data, &len, &offset_ns) || type != CAPTURE_RECORD_KEY_ID)
+    {
+        printf("replay: %s does not start with a key id\n", path);
+        return 0;
+    }
+    replay_key.assign(data, len);
+    replaying = true;
+    replay_realtime = realtime;
+    if (!rx_buf)
+        rx_buf = new char[RX_BUFFER_SIZE];
+    rx_head = rx_tail = 0;
+    return 1;
+}
+
+const char *replay_key_id()
+{
+    return replay_key.c_str();
+}
+
+int start_capture(const char *path, const char *key_id)
+{
+    if (!capture.open(path))
+        return 0;
+    capture.write(CAPTURE_RECORD_KEY_ID, key_id, strlen(key_id));
+    return 1;
+}
+
+void stop_capture()
+{
+    capture.close();
+}
+
+void set_replay_key_hook(void (*hook)(uint32_t key_id, const char *object_id))
+{
+    replay_key_hook = hook;
+}
+
+void capture_key_rotation(uint32_t key_id, const char *object_id)
+{
+    char rec[4 + 64];
+    size_t len = strlen(object_id);
+
+    if (len > sizeof(rec) - 4)
+        len = sizeof(rec) - 4;
+    memcpy(rec, &key_id, 4);
+    memcpy(rec + 4, object_id, len);
+    capture.write(CAPTURE_RECORD_ROTATE, rec, 4 + len);
+}
+
+static int replay_chunk(char *dst, size_t space)
+{
+    uint32_t type, len;
+    uint64_t offset_ns;
+    const char *data;
+
+    while (replay.next(&type, &data, &len, &offset_ns))
+    {
+        if (type == CAPTURE_RECORD_ROTATE && len > 4 && replay_key_hook)
+        {
+            uint32_t key_id;
+            memcpy(&key_id, data, 4);
+            string object_id(data + 4, len - 4);
+            replay_key_hook(key_id, object_id.c_str());
+        }
+        if (type != CAPTURE_RECORD_DATA)
+            continue;
+
+        if (replay_realtime)
+            sleep_until_ns(replay_start_ns + offset_ns);
+        if (len > space)
+        {
+            printf("replay: record of %u bytes does not fit\n", len);
+            return -1;
+        }
+        // recv() copies into the buffer as well, keep the same cost here
+        memcpy(dst, data, len);
+        return len;
+    }
+    return 0;
+}
+
+// append one recv() (or one captured recv()) to the reassembly buffer
+static int fill_rx()
+{
+    int count;
+    bool empty = rx_head == rx_tail;
+
+    if (rx_head > 0)
+    {
+        memmove(rx_buf, rx_buf + rx_head, rx_tail - rx_head);
+        rx_tail -= rx_head;
+        rx_head = 0;
+    }
+    if (replaying)
+    {
+        count = replay_chunk(rx_buf + rx_tail, RX_BUFFER_SIZE - rx_tail);
+    }
+    else
+    {
+        size_t space = RX_BUFFER_SIZE - rx_tail;
+        count = recv(client_socket, rx_buf + rx_tail, space < BUFFER_SIZE ? space : BUFFER_SIZE, 0);
+        if (count > 0)
+            capture.write(CAPTURE_RECORD_DATA, rx_buf + rx_tail, count);
+    }
+    if (count > 0)
+    {
+        rx_tail += count;
+        rx_last_ns = monotonic_ns();
+        if (empty)
+            rx_start_ns = rx_last_ns;
+    }
+    return count;
+}
+
+static bool payload_intact(const struct frame_header *hdr, const char *payload)
+{
+    if (crc32c(payload, hdr->length) == hdr->crc32c)
+        return true;
+    crc_errors++;
+    printf("Frame %u: CRC32C mismatch, dropped\n", hdr->seq);
+    return false;
+}
+
+// 1 with the next frame in rx_buf, 0 if it is not complete yet, -1 if the
+// stream is out of sync. Frames with a corrupt payload are skipped.
+static int parse_rx_frame(struct frame_header *hdr)
+{
+    for (;;)
+    {
+        if (rx_tail - rx_head < sizeof(*hdr))
+            return 0;
+        memcpy(hdr, rx_buf + rx_head, sizeof(*hdr));
+        if (hdr->magic != FRAME_MAGIC || hdr->length > BUFFER_SIZE)
+        {
+            printf("Bad frame header (magic 0x%x, %u bytes)\n", hdr->magic, hdr->length);
+            return -1;
+        }
+        if (rx_tail - rx_head < sizeof(*hdr) + hdr->length)
+            return 0;
+
+        buffer = rx_buf + rx_head + sizeof(*hdr);
+        rx_head += sizeof(*hdr) + hdr->length;
+        // what is left came with the last recv()
+        frame_start_ns = rx_start_ns;
+        rx_start_ns = rx_last_ns;
+        if (payload_intact(hdr, buffer))
+            return 1;
+    }
+}
+
+// true if the decoder handed out a frame that passes the checks
+static bool take_fec_frame(char *frame, uint32_t frame_len, struct frame_header *hdr)
+{
+    if (!frame)
+        return false;
+    if (frame_len < sizeof(*hdr))
+        return false;
+    memcpy(hdr, frame, sizeof(*hdr));
+    if (hdr->magic != FRAME_MAGIC || hdr->length != frame_len - sizeof(*hdr) || hdr->length > BUFFER_SIZE)
+    {
+        printf("Bad datagram frame (magic 0x%x, %u bytes)\n", hdr->magic, hdr->length);
+        return false;
+    }
+    // the frame lives in the decoder until the next datagram
+    buffer = frame + sizeof(*hdr);
+    frame_start_ns = fec->first_ns;
+    return payload_intact(hdr, buffer);
+}
+
+// feeds one datagram to the decoder, true once it completes a frame
+static bool take_datagram(const char *dgram, size_t len, struct frame_header *hdr)
+{
+    uint32_t frame_len;
+    char *frame = fec->add(dgram, len, &frame_len);
+
+    return take_fec_frame(frame, frame_len, hdr);
+}
+
+static int receive_datagram_frame(struct frame_header *hdr)
+{
+    struct pollfd fds[2];
+    int wait_ms, fec_wait_ms, ret;
+    uint32_t frame_len;
+    ssize_t n;
+
+    for (;;)
+    {
+        if ((ret = parse_rx_frame(hdr)) != 0)
+            return ret < 0 ? -1 : hdr->length;
+        // a frame whose last datagrams stay away is rebuilt from parity
+        if (take_fec_frame(fec->recover_stalled(monotonic_ns(), &frame_len), frame_len, hdr))
+            return hdr->length;
+        wait_ms = -1;
+        if (injector)
+            while ((n = injector->pop(dgram_buf, DATAGRAM_BUFFER_SIZE, &wait_ms)) > 0)
+                if (take_datagram(dgram_buf, n, hdr))
+                    return hdr->length;
+        fec_wait_ms = fec->stall_wait_ms(monotonic_ns());
+        if (fec_wait_ms >= 0 && (wait_ms < 0 || fec_wait_ms < wait_ms))
+            wait_ms = fec_wait_ms;
+
+        fds[0].fd = client_socket;
+        fds[0].events = POLLIN;
+        fds[1].fd = udp_socket;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, wait_ms) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && fill_rx() <= 0)
+            return -1;
+        if (fds[1].revents & POLLIN)
+            while ((n = recv(udp_socket, dgram_buf, DATAGRAM_BUFFER_SIZE, MSG_DONTWAIT)) > 0)
+            {
+                if (injector)
+                    injector->push(dgram_buf, n);
+                else if (take_datagram(dgram_buf, n, hdr))
+                    return hdr->length;
+            }
+    }
+}
+
+int receive_frame(struct frame_header *hdr)
 {
     // cv::namedWindow("Client", cv::WINDOW_AUTOSIZE);
     // cv::Mat rawData(1, count, CV_8UC1, (void *)buffer);
     // cv::Mat decoded_frame = cv::imdecode(rawData, cv::IMREAD_COLOR);
     // cv::imshow("Client", decoded_frame);
     // cv::waitKey(25);
-    int count = recv(client_socket, buffer, BUFFER_SIZE, 0);
-    return count;
+    int ret;
+
+    if (udp_socket >= 0)
+        return receive_datagram_frame(hdr);
+    while ((ret = parse_rx_frame(hdr)) == 0)
+        if (fill_rx() <= 0)
+            return -1;
+    return ret < 0 ? -1 : hdr->length;
+}
+
+uint64_t frame_arrival_ns()
+{
+    return frame_start_ns;
 }
 
-void send_pub_key(void *modulus, int mod_len, void *exponent, int exp_len)
+// 0 if the connection is gone, the caller reconnects or gives up
+int send_message(uint32_t type, const void *payload, uint32_t len)
+{
+    struct msg_header hdr;
+    char *msg = new char[sizeof(hdr) + len];
+    int ok;
+    hdr.type = type;
+    hdr.length = len;
+    memcpy(msg, &hdr, sizeof(hdr));
+    memcpy(msg + sizeof(hdr), payload, len);
+    ok = send(client_socket, msg, sizeof(hdr) + len, 0) != -1;
+    if (!ok)
+        printf("send of message %u failed: %s\n", type, strerror(errno));
+    delete[] msg;
+    return ok;
+}
+
+int send_pub_key(uint32_t key_id, uint32_t scheme, void *modulus, int mod_len, void *exponent, int exp_len)
 {
     // combine into one message
-    char *msg = new char[mod_len + exp_len + 10];
-    // endianess unsolved!!!!!
-    memcpy(msg, &mod_len, 4);
-    memcpy(msg + 4, &exp_len, 4);
-    memcpy(msg + 8, modulus, mod_len);
-    memcpy(msg + 8 + mod_len, exponent, exp_len);
-    if (send(client_socket, msg, mod_len + exp_len + 8, 0) != -1)
+    struct msg_header hdr;
+    int len = sizeof(hdr) + 16 + mod_len + exp_len;
+    int ok = 1;
+    char *msg = new char[len];
+    hdr.type = MSG_PUB_KEY;
+    hdr.length = len - sizeof(hdr);
+    // little endian on both ends
+    memcpy(msg, &hdr, sizeof(hdr));
+    memcpy(msg + sizeof(hdr), &key_id, 4);
+    memcpy(msg + sizeof(hdr) + 4, &scheme, 4);
+    memcpy(msg + sizeof(hdr) + 8, &mod_len, 4);
+    memcpy(msg + sizeof(hdr) + 12, &exp_len, 4);
+    // modulus and exponent are big endian octet strings from the TA
+    memcpy(msg + sizeof(hdr) + 16, modulus, mod_len);
+    memcpy(msg + sizeof(hdr) + 16 + mod_len, exponent, exp_len);
+    if (replaying)
+    {
+        // nothing to send, but the TA key must be the one the stream was captured with
+        uint32_t type, rec_len;
+        uint64_t offset_ns;
+        const char *data;
+        if (!replay.next(&type, &data, &rec_len, &offset_ns) || type != CAPTURE_RECORD_HANDSHAKE ||
+            rec_len != (uint32_t)len || memcmp(data, msg, len) != 0)
+            errx(1, "\nreplay: public key does not match the captured handshake"
+                    " (same --key-bits and --scheme as the capture?)\n");
+        replay_start_ns = monotonic_ns() - offset_ns;
+        printf("Public key matches the capture.\n");
+    }
+    else if (send(client_socket, msg, len, 0) != -1)
     {
-        printf("Public key sent to server.\n");
+        capture.write(CAPTURE_RECORD_HANDSHAKE, msg, len);
+        printf("Public key %u sent to server.\n", key_id);
     }
-}
\ No newline at end of file
+    else
+    {
+        printf("send of public key %u failed: %s\n", key_id, strerror(errno));
+        ok = 0;
+    }
+    delete[] msg;
+    return ok;
+}
@@ -1,9 +1,33 @@
 #ifndef CLIENT
 #define CLIENT
 
+#include <stdint.h>
+#include <string>
+#include "loss_injector.h"
+#include "protocol.h"
+
 int open_connection();
-int receive_frame();
-void send_pub_key(void *modulus, int mod_len, void *exponent, int exp_len);
+int open_udp(const struct loss_config *loss);
+int reconnect();
+void set_resume_ticket(const char *ticket, size_t len);
+bool have_resume_ticket();
+int resume_session(uint32_t next_seq);
+void print_receive_stats();
+int open_replay(const char *path, bool realtime);
+const char *replay_key_id();
+int start_capture(const char *path, const char *key_id);
+void stop_capture();
+void set_replay_key_hook(void (*hook)(uint32_t key_id, const char *object_id));
+void capture_key_rotation(uint32_t key_id, const char *object_id);
+int receive_frame(struct frame_header *hdr);
+// when the first bytes (TCP) or datagram (UDP) of the last received frame arrived
+uint64_t frame_arrival_ns();
+// both return 0 if the send failed, the connection is then gone
+int send_message(uint32_t type, const void *payload, uint32_t len);
+int send_pub_key(uint32_t key_id, uint32_t scheme, void *modulus, int mod_len, void *exponent, int exp_len);
 extern char *buffer;
+// where open_connection() connects to
+extern int server_port;
+extern std::string server_addr;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // reflected Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static uint32_t table[256];
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t crc64 = crc;
+    uint64_t v;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = crc64;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+static bool crc32c_hw_available()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#define CRC32C_HW_NAME "sse4.2"
+#elif defined(__aarch64__)
+__attribute__((target("arch=armv8-a+crc"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t v;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+static bool crc32c_hw_available()
+{
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+
+#define CRC32C_HW_NAME "armv8 crc"
+#endif
+
+static const char *impl_name;
+
+static crc32c_fn pick_crc32c()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[i] = crc;
+    }
+#ifdef CRC32C_HW_NAME
+    if (crc32c_hw_available())
+    {
+        impl_name = CRC32C_HW_NAME;
+        return crc32c_hw;
+    }
+#endif
+    impl_name = "table";
+    return crc32c_table;
+}
+
+static crc32c_fn crc32c_impl = pick_crc32c();
+
+uint32_t crc32c(const void *data, size_t len)
+{
+    return ~crc32c_impl(~0u, (const uint8_t *)data, len);
+}
+
+const char *crc32c_impl_name()
+{
+    return impl_name;
+}
@@ -0,0 +1,13 @@
+#ifndef CRC32C
+#define CRC32C
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli) of a frame payload, checked before the frame gets
+// anywhere near the TEE. Uses the SSE4.2 or ARMv8 CRC32 instructions when
+// the CPU has them, picked once at startup, and a lookup table otherwise.
+uint32_t crc32c(const void *data, size_t len);
+const char *crc32c_impl_name();
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include "decrypt_engine.h"
+#include "tile_workers.h"
+
+template <class Policy>
+size_t decrypt_frame(struct tee_attrs *ta, const struct frame_header *hdr, char *in, char *out)
+{
+    // cipher_len is a constant here, so no runtime division
+    size_t blocks = hdr->length / Policy::cipher_len;
+    size_t plain = 0;
+
+    if (hdr->length % Policy::cipher_len != 0 || blocks > Policy::batch)
+    {
+        printf("Frame %u: %u bytes is not a whole number of %zu byte blocks\n",
+               hdr->seq, hdr->length, Policy::cipher_len);
+        return DECRYPT_FAILED;
+    }
+    for (size_t i = 0; i < blocks; i++)
+    {
+        size_t n = rsa_decrypt(ta, in + i * Policy::cipher_len, Policy::cipher_len,
+                               out + plain, Policy::plain_len, hdr->key_id);
+        if (n == DECRYPT_FAILED)
+            return DECRYPT_FAILED;
+        plain += n;
+    }
+    return plain;
+}
+
+// the TA decrypts a whole CTR frame in one call
+template <>
+size_t decrypt_frame<aes_ctr_policy>(struct tee_attrs *ta, const struct frame_header *hdr, char *in, char *out)
+{
+    return aes_decrypt_frame(ta, in, hdr->length, out, FRAME_MAX_LEN, hdr->seq);
+}
+
+// Tiles go to the tile workers. Without them the cipher text is one CTR
+// stream from block 0 and decrypts in a single call, like FRAME_VIDEO_AES.
+template <>
+size_t decrypt_frame<aes_ctr_tiled_policy>(struct tee_attrs *ta, const struct frame_header *hdr, char *in,
+                                           char *out)
+{
+    const struct frame_tile *tiles = (const struct frame_tile *)(in + 4);
+    uint32_t count = 0;
+    size_t table, len, end = 0;
+
+    if (hdr->length >= 4)
+        memcpy(&count, in, 4);
+    table = 4 + (size_t)count * sizeof(struct frame_tile);
+    if (count == 0 || count > FRAME_MAX_TILES || hdr->length < table)
+    {
+        printf("Frame %u: bad tile table\n", hdr->seq);
+        return DECRYPT_FAILED;
+    }
+    len = hdr->length - table;
+    // the tile table comes on top of FRAME_MAX_PAYLOAD, the plain text does not
+    if (len > FRAME_MAX_LEN)
+    {
+        printf("Frame %u: %zu bytes of tiles do not fit a %d byte frame\n", hdr->seq, len, FRAME_MAX_LEN);
+        return DECRYPT_FAILED;
+    }
+    // back to back from 0 to len: no two sessions write the same plain text,
+    // and no gap keeps the previous frame's plain text in the output
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (tiles[i].offset % FRAME_TILE_ALIGN != 0 || tiles[i].offset != end ||
+            tiles[i].length > len - tiles[i].offset)
+        {
+            printf("Frame %u: tile %u at %u+%u is not aligned or does not follow the previous one\n", hdr->seq, i,
+                   tiles[i].offset, tiles[i].length);
+            return DECRYPT_FAILED;
+        }
+        end = tiles[i].offset + tiles[i].length;
+    }
+    if (end != len)
+    {
+        printf("Frame %u: tiles cover %zu of %zu bytes\n", hdr->seq, end, len);
+        return DECRYPT_FAILED;
+    }
+    if (ta->tiles)
+        return ta->tiles->decrypt(hdr->seq, tiles, count, in + table, len, out);
+    return aes_decrypt_frame(ta, in + table, len, out, FRAME_MAX_LEN, hdr->seq);
+}
+
+template size_t decrypt_frame<rsa1024_pkcs1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa1024_oaep_sha1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa1024_oaep_sha256>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa2048_pkcs1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa2048_oaep_sha1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa2048_oaep_sha256>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa3072_pkcs1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa3072_oaep_sha1>(struct tee_attrs *, const struct frame_header *, char *, char *);
+template size_t decrypt_frame<rsa3072_oaep_sha256>(struct tee_attrs *, const struct frame_header *, char *, char *);
+
+template <class Policy>
+static struct decrypt_engine make_engine(const char *name)
+{
+    struct decrypt_engine e = {name, Policy::frame_type, Policy::key_bits, Policy::scheme,
+                               Policy::cipher_len, Policy::plain_len, Policy::alignment,
+                               Policy::batch, decrypt_frame<Policy>};
+    return e;
+}
+
+static const struct decrypt_engine engines[] = {
+    make_engine<rsa1024_pkcs1>("rsa1024-pkcs1"),
+    make_engine<rsa1024_oaep_sha1>("rsa1024-oaep-sha1"),
+    make_engine<rsa1024_oaep_sha256>("rsa1024-oaep-sha256"),
+    make_engine<rsa2048_pkcs1>("rsa2048-pkcs1"),
+    make_engine<rsa2048_oaep_sha1>("rsa2048-oaep-sha1"),
+    make_engine<rsa2048_oaep_sha256>("rsa2048-oaep-sha256"),
+    make_engine<rsa3072_pkcs1>("rsa3072-pkcs1"),
+    make_engine<rsa3072_oaep_sha1>("rsa3072-oaep-sha1"),
+    make_engine<rsa3072_oaep_sha256>("rsa3072-oaep-sha256"),
+    make_engine<aes_ctr_policy>("aes128-ctr"),
+    make_engine<aes_ctr_tiled_policy>("aes128-ctr-tiled"),
+};
+
+const struct decrypt_engine *find_decrypt_engine(uint32_t frame_type, uint32_t key_bits, uint32_t scheme)
+{
+    for (const struct decrypt_engine &e : engines)
+    {
+        if (e.frame_type != frame_type)
+            continue;
+        if (frame_type != FRAME_VIDEO || (e.key_bits == key_bits && e.scheme == scheme))
+            return &e;
+    }
+    return NULL;
+}
@@ -0,0 +1,95 @@
+#ifndef DECRYPT_ENGINE
+#define DECRYPT_ENGINE
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "tee.h"
+
+#define FRAME_MAX_LEN FRAME_MAX_VIDEO // plain text of one frame
+#define FRAME_ALIGNMENT 64      // plain text buffers start on a cache line
+
+// Cipher policies carry everything the frame loop needs to know about a
+// mode as constants, so each kernel below is compiled for exactly one mode
+// and the numbers are checked here instead of kept in sync by hand.
+template <uint32_t KeyBits, uint32_t Scheme>
+struct rsa_policy
+{
+    static constexpr uint32_t frame_type = FRAME_VIDEO;
+    static constexpr uint32_t key_bits = KeyBits;
+    static constexpr uint32_t scheme = Scheme;
+    static constexpr size_t hash_len = Scheme == TA_RSA_SCHEME_OAEP_SHA1     ? 20
+                                       : Scheme == TA_RSA_SCHEME_OAEP_SHA256 ? 32
+                                                                             : 0;
+    static constexpr size_t cipher_len = KeyBits / 8;
+    // RFC 8017: k - 11 for PKCS#1 v1.5, k - 2 hLen - 2 for OAEP
+    static constexpr size_t plain_len = hash_len ? cipher_len - 2 * hash_len - 2 : cipher_len - 11;
+    static constexpr size_t alignment = FRAME_ALIGNMENT;
+    static constexpr size_t batch = FRAME_MAX_LEN / cipher_len; // most blocks in one frame
+
+    static_assert(KeyBits % 8 == 0 && KeyBits <= RSA_MAX_KEY_SIZE, "unsupported RSA key size");
+    static_assert(Scheme <= TA_RSA_SCHEME_OAEP_SHA256, "unknown RSA scheme");
+    static_assert(cipher_len > 2 * hash_len + 2 && plain_len < cipher_len, "key too small for the padding");
+    static_assert(batch * plain_len <= FRAME_MAX_LEN, "plain text of a full frame must fit the output buffer");
+};
+
+struct aes_ctr_policy
+{
+    static constexpr uint32_t frame_type = FRAME_VIDEO_AES;
+    static constexpr uint32_t key_bits = TA_ECDH_AES_KEY_SIZE * 8;
+    static constexpr uint32_t scheme = 0;
+    static constexpr size_t cipher_len = 16; // AES block, CTR output is the input length
+    static constexpr size_t plain_len = 16;
+    static constexpr size_t alignment = FRAME_ALIGNMENT;
+    static constexpr size_t batch = FRAME_MAX_LEN / cipher_len;
+
+    static_assert(key_bits == 128, "the TA derives AES-128 keys");
+};
+
+// the same cipher text behind a tile table, see struct frame_tile
+struct aes_ctr_tiled_policy : aes_ctr_policy
+{
+    static constexpr uint32_t frame_type = FRAME_VIDEO_TILED;
+
+    static_assert(FRAME_TILE_ALIGN % cipher_len == 0, "tiles must start on an AES block");
+};
+
+typedef rsa_policy<1024, TA_RSA_SCHEME_PKCS1_V1_5> rsa1024_pkcs1;
+typedef rsa_policy<1024, TA_RSA_SCHEME_OAEP_SHA1> rsa1024_oaep_sha1;
+typedef rsa_policy<1024, TA_RSA_SCHEME_OAEP_SHA256> rsa1024_oaep_sha256;
+typedef rsa_policy<2048, TA_RSA_SCHEME_PKCS1_V1_5> rsa2048_pkcs1;
+typedef rsa_policy<2048, TA_RSA_SCHEME_OAEP_SHA1> rsa2048_oaep_sha1;
+typedef rsa_policy<2048, TA_RSA_SCHEME_OAEP_SHA256> rsa2048_oaep_sha256;
+typedef rsa_policy<3072, TA_RSA_SCHEME_PKCS1_V1_5> rsa3072_pkcs1;
+typedef rsa_policy<3072, TA_RSA_SCHEME_OAEP_SHA1> rsa3072_oaep_sha1;
+typedef rsa_policy<3072, TA_RSA_SCHEME_OAEP_SHA256> rsa3072_oaep_sha256;
+
+// Decrypts one frame payload into out (FRAME_MAX_LEN bytes), returns the
+// number of plain text bytes or DECRYPT_FAILED. Instantiated in
+// decrypt_engine.cpp only.
+template <class Policy>
+size_t decrypt_frame(struct tee_attrs *ta, const struct frame_header *hdr, char *in, char *out);
+template <>
+size_t decrypt_frame<aes_ctr_policy>(struct tee_attrs *ta, const struct frame_header *hdr, char *in, char *out);
+template <>
+size_t decrypt_frame<aes_ctr_tiled_policy>(struct tee_attrs *ta, const struct frame_header *hdr, char *in,
+                                           char *out);
+
+struct decrypt_engine
+{
+    const char *name;
+    uint32_t frame_type;
+    uint32_t key_bits;
+    uint32_t scheme;
+    size_t cipher_len;
+    size_t plain_len;
+    size_t alignment;
+    size_t batch;
+    size_t (*decrypt)(struct tee_attrs *ta, const struct frame_header *hdr, char *in, char *out);
+};
+
+// Looked up once when the keys are set up, NULL if the mode is not built in.
+// The AES frame types ignore key_bits and scheme.
+const struct decrypt_engine *find_decrypt_engine(uint32_t frame_type, uint32_t key_bits, uint32_t scheme);
+
+#endif
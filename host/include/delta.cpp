@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include "delta.h"
+
+delta_encoder::delta_encoder(uint32_t block_size)
+    : block_size(block_size), have_previous(false), keyframe_due(true), previous_seq(0), keyframe_seq(0)
+{
+}
+
+void delta_encoder::force_keyframe()
+{
+    keyframe_due = true;
+}
+
+const char *delta_encoder::encode(const char *frame, size_t len, uint32_t seq, int keyframe_interval,
+                                  size_t *out_len, uint32_t *flags)
+{
+    struct delta_header dh;
+    size_t blocks = (len + block_size - 1) / block_size;
+    bool keyframe = keyframe_due || !have_previous || previous.size() != len ||
+                    seq - keyframe_seq >= (uint32_t)keyframe_interval;
+
+    if (!keyframe)
+    {
+        std::vector<uint32_t> changed;
+        for (size_t i = 0; i < blocks; i++)
+        {
+            size_t off = i * block_size;
+            size_t n = len - off < block_size ? len - off : block_size;
+            if (memcmp(frame + off, previous.data() + off, n) != 0)
+                changed.push_back(i);
+        }
+        size_t size = sizeof(dh) + changed.size() * (4 + (size_t)block_size);
+        // a delta no smaller than the frame might as well be a keyframe
+        keyframe = size >= len;
+        if (!keyframe)
+        {
+            dh.base_seq = previous_seq;
+            dh.frame_len = len;
+            dh.block_size = block_size;
+            dh.block_count = changed.size();
+            delta.resize(size);
+            char *p = delta.data();
+            memcpy(p, &dh, sizeof(dh));
+            p += sizeof(dh);
+            memcpy(p, changed.data(), changed.size() * 4);
+            p += changed.size() * 4;
+            for (uint32_t i : changed)
+            {
+                size_t off = (size_t)i * block_size;
+                size_t n = len - off < block_size ? len - off : block_size;
+                memcpy(p, frame + off, n);
+                p += n;
+            }
+            *out_len = p - delta.data();
+            *flags = FRAME_FLAG_DELTA;
+        }
+    }
+    previous.assign(frame, frame + len);
+    have_previous = true;
+    previous_seq = seq;
+    if (!keyframe)
+        return delta.data();
+
+    keyframe_due = false;
+    keyframe_seq = seq;
+    *out_len = len;
+    *flags = FRAME_FLAG_KEYFRAME;
+    return frame;
+}
+
+delta_decoder::delta_decoder() : reference(NULL), reference_len(0), reference_seq(0), have_reference(false)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+delta_decoder::~delta_decoder()
+{
+    delete[] reference;
+}
+
+size_t delta_decoder::apply(const struct frame_header *hdr, char *frame, size_t n)
+{
+    struct delta_header dh;
+
+    if (!(hdr->flags & (FRAME_FLAG_KEYFRAME | FRAME_FLAG_DELTA)))
+        return n;
+    if (!reference)
+        reference = new char[FRAME_MAX_VIDEO];
+    stats.plain_bytes += n;
+
+    if (hdr->flags & FRAME_FLAG_KEYFRAME)
+    {
+        memcpy(reference, frame, n);
+        reference_len = n;
+        reference_seq = hdr->seq;
+        have_reference = true;
+        stats.keyframes++;
+        stats.frame_bytes += n;
+        return n;
+    }
+
+    if (n < sizeof(dh))
+        return 0;
+    memcpy(&dh, frame, sizeof(dh));
+    if (!have_reference || dh.base_seq != reference_seq || dh.frame_len != reference_len || dh.block_size == 0)
+    {
+        // showing it on the wrong base would be worse than waiting
+        stats.broken++;
+        return 0;
+    }
+    size_t blocks = ((size_t)dh.frame_len + dh.block_size - 1) / dh.block_size;
+    const char *index = frame + sizeof(dh);
+    const char *data = index + (size_t)dh.block_count * 4;
+    if (dh.block_count > blocks || data > frame + n)
+    {
+        stats.broken++;
+        return 0;
+    }
+    for (uint32_t k = 0; k < dh.block_count; k++)
+    {
+        uint32_t i;
+        memcpy(&i, index + k * 4, 4);
+        size_t off = (size_t)i * dh.block_size;
+        size_t len = i < blocks && dh.frame_len - off < dh.block_size ? dh.frame_len - off : dh.block_size;
+        if (i >= blocks || data + len > frame + n)
+        {
+            // the blocks before are in already, only a keyframe repairs that
+            have_reference = false;
+            stats.broken++;
+            return 0;
+        }
+        memcpy(reference + off, data, len);
+        data += len;
+    }
+    reference_seq = hdr->seq;
+    memcpy(frame, reference, reference_len);
+    stats.deltas++;
+    stats.frame_bytes += reference_len;
+    return reference_len;
+}
+
+void delta_decoder::print_stats()
+{
+    if (!stats.keyframes && !stats.deltas && !stats.broken)
+        return;
+    printf("Delta: %lu keyframes, %lu deltas, %lu waited for a keyframe; decrypted %lu bytes for %lu shown "
+           "(%.1f%%)\n",
+           (unsigned long)stats.keyframes, (unsigned long)stats.deltas, (unsigned long)stats.broken,
+           (unsigned long)stats.plain_bytes, (unsigned long)stats.frame_bytes,
+           stats.frame_bytes ? 100.0 * stats.plain_bytes / stats.frame_bytes : 0.0);
+}
@@ -0,0 +1,78 @@
+#ifndef DELTA
+#define DELTA
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "protocol.h"
+
+// Delta frames: the server compares each frame with the one before on a
+// grid of block_size byte blocks and only the changed blocks are encrypted,
+// so a static camera or a slide costs the TEE next to nothing. The plain
+// text of a FRAME_FLAG_DELTA frame is a delta_header, block_count block
+// indexes and then the blocks, the frame's last block may be short. A
+// FRAME_FLAG_KEYFRAME frame is a whole frame, sent every keyframe_interval
+// frames, when a viewer joins, or when the delta would be no smaller.
+// A viewer that missed the base frame waits for the next keyframe.
+#define DELTA_BLOCK_SIZE 256
+
+struct delta_header
+{
+    uint32_t base_seq;  // frame the blocks are patched into
+    uint32_t frame_len; // same as the base frame
+    uint32_t block_size;
+    uint32_t block_count;
+} __attribute__((packed));
+
+class delta_encoder
+{
+public:
+    delta_encoder(uint32_t block_size);
+
+    // Returns the plain text to encrypt for frame seq, frame itself for a
+    // keyframe or a delta valid until the next call, and sets flags.
+    const char *encode(const char *frame, size_t len, uint32_t seq, int keyframe_interval, size_t *out_len,
+                       uint32_t *flags);
+    // the next frame is a keyframe
+    void force_keyframe();
+
+private:
+    uint32_t block_size;
+    std::vector<char> previous;
+    std::vector<char> delta;
+    bool have_previous;
+    bool keyframe_due;
+    uint32_t previous_seq;
+    uint32_t keyframe_seq;
+};
+
+struct delta_stats
+{
+    uint64_t keyframes;
+    uint64_t deltas;
+    uint64_t broken;      // deltas whose base frame was not the last one shown
+    uint64_t plain_bytes; // decrypted
+    uint64_t frame_bytes; // shown
+};
+
+class delta_decoder
+{
+public:
+    delta_decoder();
+    ~delta_decoder();
+
+    // frame holds n decrypted bytes and has room for FRAME_MAX_VIDEO. On
+    // return it holds the whole frame; returns its length, or 0 if the
+    // frame cannot be rebuilt yet. Frames without a delta flag pass as is.
+    size_t apply(const struct frame_header *hdr, char *frame, size_t n);
+    void print_stats();
+
+private:
+    char *reference; // the last frame shown
+    uint32_t reference_len;
+    uint32_t reference_seq;
+    bool have_reference;
+    struct delta_stats stats;
+};
+
+#endif
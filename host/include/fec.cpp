@@ -0,0 +1,285 @@
+#include <string.h>
+#include "fec.h"
+#include "timing.h"
+
+static void xor_into(char *dst, const char *src, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+// sequence numbers wrap, a is older than b
+static bool seq_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+fec_encoder::fec_encoder(uint16_t frag_size, int group) : frag_size(frag_size), group(group)
+{
+}
+
+int fec_encoder::encode(const char *frame, uint32_t len, uint32_t seq)
+{
+    int data_count = (len + frag_size - 1) / frag_size;
+    int parity_count = group > 0 ? (data_count + group - 1) / group : 0;
+    int n = data_count + parity_count;
+
+    if (data_count == 0 || n > FEC_MAX_FRAGMENTS)
+        return 0;
+    headers.resize(n);
+    iov.resize(2 * n);
+    parity.assign((size_t)parity_count * frag_size, 0);
+
+    for (int k = 0; k < n; k++)
+    {
+        struct datagram_header *h = &headers[k];
+        h->magic = DATAGRAM_MAGIC;
+        h->frame_seq = seq;
+        h->frame_len = len;
+        h->index = k;
+        h->data_count = data_count;
+        h->parity_count = parity_count;
+        h->frag_size = frag_size;
+        iov[2 * k].iov_base = h;
+        iov[2 * k].iov_len = sizeof(*h);
+        if (k < data_count)
+        {
+            size_t off = (size_t)k * frag_size;
+            size_t frag_len = len - off < frag_size ? len - off : frag_size;
+            iov[2 * k + 1].iov_base = (void *)(frame + off);
+            iov[2 * k + 1].iov_len = frag_len;
+            // a short last fragment counts as zero padded
+            if (parity_count)
+                xor_into(&parity[(size_t)(k % parity_count) * frag_size], frame + off, frag_len);
+        }
+        else
+        {
+            iov[2 * k + 1].iov_base = &parity[(size_t)(k - data_count) * frag_size];
+            iov[2 * k + 1].iov_len = frag_size;
+        }
+    }
+    return n;
+}
+
+const struct iovec *fec_encoder::datagram(int k) const
+{
+    return &iov[2 * k];
+}
+
+fec_decoder::fec_decoder() : first_ns(0), delivered_any(false), last_delivered(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < FEC_WINDOW; i++)
+        window[i].used = false;
+}
+
+size_t fec_decoder::frag_len(const struct pending_frame *f, int index) const
+{
+    if (index == f->hdr.data_count - 1)
+        return f->hdr.frame_len - (size_t)index * f->hdr.frag_size;
+    return f->hdr.frag_size;
+}
+
+struct fec_decoder::pending_frame *fec_decoder::find_slot(const struct datagram_header *hdr)
+{
+    struct pending_frame *f = NULL;
+
+    for (int i = 0; i < FEC_WINDOW; i++)
+    {
+        struct pending_frame *w = &window[i];
+        if (w->used && w->seq == hdr->frame_seq)
+            return w;
+        // a free slot, or else the oldest frame is given up on
+        if (!f || (f->used && (!w->used || seq_before(w->seq, f->seq))))
+            f = w;
+    }
+    f->used = true;
+    f->seq = hdr->frame_seq;
+    f->hdr = *hdr;
+    f->data_missing = hdr->data_count;
+    f->used_parity = false;
+    f->first_ns = monotonic_ns();
+    f->last_ns = f->first_ns;
+    f->waited = false;
+    f->have.assign(hdr->data_count + hdr->parity_count, false);
+    f->data.resize((size_t)hdr->data_count * hdr->frag_size);
+    f->parity.resize((size_t)hdr->parity_count * hdr->frag_size);
+    return f;
+}
+
+void fec_decoder::try_recover(struct pending_frame *f, int group_index)
+{
+    int data_count = f->hdr.data_count;
+    int parity_count = f->hdr.parity_count;
+    size_t frag_size = f->hdr.frag_size;
+    int missing = -1;
+
+    if (!f->have[data_count + group_index])
+        return;
+    for (int i = group_index; i < data_count; i += parity_count)
+    {
+        if (f->have[i])
+            continue;
+        if (missing >= 0)
+            return; // more than one gone, XOR cannot help
+        missing = i;
+    }
+    if (missing < 0)
+        return;
+
+    // parity ^ every other fragment of the group = the missing one
+    char *dst = &f->data[missing * frag_size];
+    memcpy(dst, &f->parity[group_index * frag_size], frag_len(f, missing));
+    for (int i = group_index; i < data_count; i += parity_count)
+        if (i != missing)
+        {
+            size_t n = frag_len(f, i) < frag_len(f, missing) ? frag_len(f, i) : frag_len(f, missing);
+            xor_into(dst, &f->data[i * frag_size], n);
+        }
+    f->have[missing] = true;
+    f->data_missing--;
+    f->used_parity = true;
+}
+
+void fec_decoder::recover(struct pending_frame *f)
+{
+    for (int g = 0; g < f->hdr.parity_count && f->data_missing > 0; g++)
+        try_recover(f, g);
+}
+
+// hands out the oldest complete frame, older incomplete ones are lost
+char *fec_decoder::deliver(uint32_t *len)
+{
+    struct pending_frame *f = NULL;
+
+    for (int i = 0; i < FEC_WINDOW; i++)
+    {
+        struct pending_frame *w = &window[i];
+        if (w->used && w->data_missing == 0 && (!f || seq_before(w->seq, f->seq)))
+            f = w;
+    }
+    if (!f)
+        return NULL;
+
+    // frames between the last delivered one and this are lost, including
+    // any still being reassembled
+    if (delivered_any)
+        stats.lost += f->seq - last_delivered - 1;
+    for (int i = 0; i < FEC_WINDOW; i++)
+        if (window[i].used && seq_before(window[i].seq, f->seq))
+            window[i].used = false;
+    stats.frames++;
+    stats.recovered += f->used_parity;
+    delivered_any = true;
+    last_delivered = f->seq;
+    first_ns = f->first_ns;
+    f->used = false;
+    *len = f->hdr.frame_len;
+    return f->data.data();
+}
+
+char *fec_decoder::add(const char *dgram, size_t dgram_len, uint32_t *len)
+{
+    struct datagram_header hdr;
+    struct pending_frame *f;
+
+    if (dgram_len < sizeof(hdr))
+    {
+        stats.bad++;
+        return NULL;
+    }
+    memcpy(&hdr, dgram, sizeof(hdr));
+    size_t payload_len = dgram_len - sizeof(hdr);
+    int total = hdr.data_count + hdr.parity_count;
+    if (hdr.magic != DATAGRAM_MAGIC || hdr.data_count == 0 || total > FEC_MAX_FRAGMENTS ||
+        hdr.index >= total || hdr.frag_size == 0 ||
+        hdr.frame_len > (size_t)hdr.data_count * hdr.frag_size ||
+        hdr.frame_len <= (size_t)(hdr.data_count - 1) * hdr.frag_size)
+    {
+        stats.bad++;
+        return NULL;
+    }
+    // spare parity of the frame just delivered
+    if (delivered_any && hdr.frame_seq == last_delivered)
+        return NULL;
+    // a newer frame was already played, this one is too late to matter
+    if (delivered_any && seq_before(hdr.frame_seq, last_delivered))
+    {
+        stats.late++;
+        return NULL;
+    }
+
+    f = find_slot(&hdr);
+    if (f->hdr.frame_len != hdr.frame_len || f->hdr.data_count != hdr.data_count ||
+        f->hdr.parity_count != hdr.parity_count || f->hdr.frag_size != hdr.frag_size)
+    {
+        stats.bad++;
+        return NULL;
+    }
+    if (f->have[hdr.index])
+        return NULL;
+    if (hdr.index < hdr.data_count)
+    {
+        if (payload_len != frag_len(f, hdr.index))
+        {
+            stats.bad++;
+            return NULL;
+        }
+        memcpy(&f->data[(size_t)hdr.index * hdr.frag_size], dgram + sizeof(hdr), payload_len);
+        f->data_missing--;
+    }
+    else
+    {
+        if (payload_len != hdr.frag_size)
+        {
+            stats.bad++;
+            return NULL;
+        }
+        memcpy(&f->parity[(size_t)(hdr.index - hdr.data_count) * hdr.frag_size], dgram + sizeof(hdr), payload_len);
+    }
+    f->have[hdr.index] = true;
+    f->last_ns = monotonic_ns();
+    f->waited = false;
+
+    // a missing fragment may only be reordered, parity is used once an
+    // older frame would otherwise be skipped for this complete one
+    if (f->data_missing == 0)
+        for (int i = 0; i < FEC_WINDOW; i++)
+            if (window[i].used && window[i].data_missing > 0 && seq_before(window[i].seq, f->seq))
+                recover(&window[i]);
+    return deliver(len);
+}
+
+char *fec_decoder::recover_stalled(uint64_t now_ns, uint32_t *len)
+{
+    for (int i = 0; i < FEC_WINDOW; i++)
+    {
+        struct pending_frame *w = &window[i];
+        if (w->used && w->data_missing > 0 && !w->waited && now_ns - w->last_ns >= FEC_RECOVER_WAIT_NS)
+        {
+            // once per datagram, or a frame parity cannot help keeps poll() spinning
+            w->waited = true;
+            recover(w);
+        }
+    }
+    return deliver(len);
+}
+
+int fec_decoder::stall_wait_ms(uint64_t now_ns) const
+{
+    int wait_ms = -1;
+
+    for (int i = 0; i < FEC_WINDOW; i++)
+    {
+        const struct pending_frame *w = &window[i];
+        if (w->used && w->data_missing == 0)
+            return 0; // complete behind an older one add() handed out
+        if (!w->used || w->waited)
+            continue;
+        uint64_t due = w->last_ns + FEC_RECOVER_WAIT_NS;
+        int ms = due > now_ns ? (int)((due - now_ns + 999999) / 1000000) : 0;
+        if (wait_ms < 0 || ms < wait_ms)
+            wait_ms = ms;
+    }
+    return wait_ms;
+}
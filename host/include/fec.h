@@ -0,0 +1,107 @@
+#ifndef FEC
+#define FEC
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+
+// UDP transport: every frame (frame_header + payload, encrypted on its own)
+// is cut into datagrams of at most frag_size payload bytes, followed by XOR
+// parity datagrams. Data fragment i belongs to parity group
+// i % parity_count, so one lost fragment per group is rebuilt and short
+// bursts of loss spread over several groups. A frame never depends on
+// datagrams of another frame. Fields are little endian.
+#define DATAGRAM_MAGIC 0x44535a54 // "TZSD"
+#define FEC_FRAG_SIZE 1200        // fits a 1280 byte IPv6 minimum MTU with headers
+#define FEC_GROUP 4               // data fragments per parity fragment
+#define FEC_MAX_FRAGMENTS 256
+
+struct datagram_header
+{
+    uint32_t magic;
+    uint32_t frame_seq;    // frame_header seq, datagrams of one frame share it
+    uint32_t frame_len;    // frame_header + payload bytes
+    uint16_t index;        // < data_count: data fragment, otherwise parity index + data_count
+    uint16_t data_count;
+    uint16_t parity_count;
+    uint16_t frag_size;    // every data fragment but the last and every parity fragment
+} __attribute__((packed));
+
+class fec_encoder
+{
+public:
+    fec_encoder(uint16_t frag_size, int group);
+
+    // Cuts frame into datagrams, returns how many. The iovecs point into
+    // frame and into the encoder, valid until the next encode().
+    int encode(const char *frame, uint32_t len, uint32_t seq);
+    // header and payload iovec of datagram k
+    const struct iovec *datagram(int k) const;
+
+private:
+    uint16_t frag_size;
+    int group;
+    std::vector<struct datagram_header> headers;
+    std::vector<char> parity;
+    std::vector<struct iovec> iov;
+};
+
+struct fec_stats
+{
+    uint64_t frames;    // delivered
+    uint64_t recovered; // delivered thanks to parity
+    uint64_t lost;      // never completed, including discarded late ones
+    uint64_t late;      // datagrams of frames older than the last delivered one
+    uint64_t bad;       // malformed datagrams
+};
+
+#define FEC_WINDOW 8 // frames reassembled at the same time
+// A fragment may only be late, so parity rebuilds it once a later frame is
+// complete or the frame saw nothing for this long
+#define FEC_RECOVER_WAIT_NS 10000000ull
+
+class fec_decoder
+{
+public:
+    fec_decoder();
+
+    // Feeds one datagram. Returns the oldest complete frame, valid until
+    // the next call, NULL if there is none. *len is the frame length.
+    char *add(const char *dgram, size_t dgram_len, uint32_t *len);
+    // Rebuilds frames that waited FEC_RECOVER_WAIT_NS since their last
+    // datagram, then returns like add()
+    char *recover_stalled(uint64_t now_ns, uint32_t *len);
+    // ms until recover_stalled() has something to try, -1 for never
+    int stall_wait_ms(uint64_t now_ns) const;
+    struct fec_stats stats;
+    uint64_t first_ns; // when the first datagram of the frame add() returned arrived
+
+private:
+    struct pending_frame
+    {
+        bool used;
+        uint32_t seq;
+        struct datagram_header hdr;
+        int data_missing;
+        bool used_parity;
+        uint64_t first_ns;
+        uint64_t last_ns;         // last datagram, for recover_stalled()
+        bool waited;              // recover_stalled() tried since then
+        std::vector<bool> have;   // data_count + parity_count
+        std::vector<char> data;   // data_count * frag_size
+        std::vector<char> parity; // parity_count * frag_size
+    };
+
+    struct pending_frame *find_slot(const struct datagram_header *hdr);
+    void try_recover(struct pending_frame *f, int group_index);
+    void recover(struct pending_frame *f);
+    char *deliver(uint32_t *len);
+    size_t frag_len(const struct pending_frame *f, int index) const;
+
+    struct pending_frame window[FEC_WINDOW];
+    bool delivered_any;
+    uint32_t last_delivered;
+};
+
+#endif
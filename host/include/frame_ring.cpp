@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "frame_ring.h"
+#include "timing.h"
+
+// shared between processes, so not FUTEX_PRIVATE_FLAG
+static void futex_wake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void futex_wait(std::atomic<uint32_t> *word, uint32_t val, int timeout_ms)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000l;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static struct frame_ring_slot *ring_slot(struct frame_ring_header *hdr, uint64_t frame_no)
+{
+    char *base = (char *)hdr + sizeof(*hdr);
+    return (struct frame_ring_slot *)(base + (frame_no % hdr->slot_count) * hdr->slot_stride);
+}
+
+frame_ring_writer::frame_ring_writer() : hdr(NULL), map_len(0), next(0)
+{
+    name[0] = 0;
+}
+
+frame_ring_writer::~frame_ring_writer()
+{
+    close();
+}
+
+int frame_ring_writer::open(const char *ring_name, uint32_t slot_count, uint32_t slot_size)
+{
+    uint64_t stride = (sizeof(struct frame_ring_slot) + slot_size + FRAME_RING_ALIGN - 1) & ~(uint64_t)(FRAME_RING_ALIGN - 1);
+    int fd;
+
+    snprintf(name, sizeof(name), "%s%s", ring_name[0] == '/' ? "" : "/", ring_name);
+    map_len = sizeof(struct frame_ring_header) + slot_count * stride;
+    // a stale ring of a crashed client must not be reused with its old head
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        perror("frame ring: shm_open");
+        return 0;
+    }
+    if (ftruncate(fd, map_len) < 0)
+    {
+        perror("frame ring: ftruncate");
+        ::close(fd);
+        shm_unlink(name);
+        return 0;
+    }
+    void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("frame ring: mmap");
+        shm_unlink(name);
+        return 0;
+    }
+
+    // ftruncate() zero fills, so every slot starts out empty (seq 0)
+    hdr = (struct frame_ring_header *)map;
+    hdr->version = FRAME_RING_VERSION;
+    hdr->slot_count = slot_count;
+    hdr->slot_size = slot_size;
+    hdr->slot_stride = stride;
+    hdr->magic.store(FRAME_RING_MAGIC, std::memory_order_release);
+    next = 0;
+    printf("Publishing frames to /dev/shm%s (%u slots of %u bytes)\n", name, slot_count, slot_size);
+    return 1;
+}
+
+bool frame_ring_writer::is_open() const
+{
+    return hdr != NULL;
+}
+
+char *frame_ring_writer::begin()
+{
+    struct frame_ring_slot *s = ring_slot(hdr, next);
+
+    s->seq.store(2 * next + 1, std::memory_order_relaxed);
+    // the odd seq has to be visible before any of the payload changes
+    std::atomic_thread_fence(std::memory_order_release);
+    return (char *)(s + 1);
+}
+
+void frame_ring_writer::commit(uint32_t length, uint32_t frame_seq)
+{
+    struct frame_ring_slot *s = ring_slot(hdr, next);
+
+    s->length = length;
+    s->frame_seq = frame_seq;
+    s->publish_ns = monotonic_ns();
+    s->seq.store(2 * next + 2, std::memory_order_release);
+    next++;
+    hdr->head.store(next, std::memory_order_release);
+    hdr->wake.fetch_add(1, std::memory_order_release);
+    // readers map the ring read-only and cannot register as waiters, one
+    // wake per frame is cheap enough
+    futex_wake(&hdr->wake);
+}
+
+void frame_ring_writer::close()
+{
+    if (!hdr)
+        return;
+    hdr->closed.store(1, std::memory_order_release);
+    hdr->wake.fetch_add(1, std::memory_order_release);
+    futex_wake(&hdr->wake);
+    munmap(hdr, map_len);
+    // readers keep their mapping, new ones cannot attach any more
+    shm_unlink(name);
+    hdr = NULL;
+}
+
+frame_ring_reader::frame_ring_reader() : lost(0), hdr(NULL), map_len(0), cursor(0)
+{
+}
+
+frame_ring_reader::~frame_ring_reader()
+{
+    close();
+}
+
+int frame_ring_reader::open(const char *ring_name)
+{
+    char name[64];
+    struct stat st;
+    int fd;
+
+    snprintf(name, sizeof(name), "%s%s", ring_name[0] == '/' ? "" : "/", ring_name);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        perror("frame ring: shm_open");
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct frame_ring_header))
+    {
+        ::close(fd);
+        return 0;
+    }
+    map_len = st.st_size;
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("frame ring: mmap");
+        return 0;
+    }
+    hdr = (struct frame_ring_header *)map;
+    if (hdr->magic.load(std::memory_order_acquire) != FRAME_RING_MAGIC || hdr->version != FRAME_RING_VERSION ||
+        sizeof(*hdr) + hdr->slot_count * hdr->slot_stride > map_len)
+    {
+        printf("frame ring: %s is not a frame ring\n", name);
+        close();
+        return 0;
+    }
+    // start with the next frame, not with whatever is still in the ring
+    cursor = hdr->head.load(std::memory_order_acquire);
+    lost = 0;
+    return 1;
+}
+
+struct frame_ring_slot *frame_ring_reader::slot(uint64_t frame_no) const
+{
+    return ring_slot(hdr, frame_no);
+}
+
+int frame_ring_reader::next(struct frame_view *view, int timeout_ms)
+{
+    for (;;)
+    {
+        uint32_t wake = hdr->wake.load(std::memory_order_acquire);
+        uint64_t head = hdr->head.load(std::memory_order_acquire);
+
+        if (cursor < head)
+        {
+            // too far behind, skip to the oldest frame still in the ring
+            if (head - cursor > hdr->slot_count)
+            {
+                lost += head - hdr->slot_count - cursor;
+                cursor = head - hdr->slot_count;
+            }
+            struct frame_ring_slot *s = slot(cursor);
+            uint64_t seq = s->seq.load(std::memory_order_acquire);
+            if (seq != 2 * cursor + 2)
+            {
+                // overwritten since head was read
+                lost++;
+                cursor++;
+                continue;
+            }
+            view->data = (const char *)(s + 1);
+            view->length = s->length;
+            view->frame_seq = s->frame_seq;
+            view->publish_ns = s->publish_ns;
+            view->frame_no = cursor;
+            cursor++;
+            if (!validate(view))
+            {
+                lost++;
+                continue;
+            }
+            return 1;
+        }
+        if (hdr->closed.load(std::memory_order_acquire))
+            return -1;
+        if (timeout_ms <= 0)
+            return 0;
+
+        // sleeps only if nothing was published since wake was read
+        futex_wait(&hdr->wake, wake, timeout_ms);
+        if (hdr->head.load(std::memory_order_acquire) == head && !hdr->closed.load(std::memory_order_acquire))
+            return 0;
+    }
+}
+
+bool frame_ring_reader::validate(const struct frame_view *view) const
+{
+    // the reads of the frame have to complete before seq is checked again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(view->frame_no)->seq.load(std::memory_order_relaxed) == 2 * view->frame_no + 2;
+}
+
+void frame_ring_reader::close()
+{
+    if (hdr)
+        munmap(hdr, map_len);
+    hdr = NULL;
+}
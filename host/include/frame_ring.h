@@ -0,0 +1,95 @@
+#ifndef FRAME_RING
+#define FRAME_RING
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Decrypted frames published to POSIX shared memory (/dev/shm/<name>) for
+// other local processes. One writer, any number of readers, no locks:
+// every slot carries a sequence number that is odd while the writer is in
+// it (a seqlock), so readers use frames in place and check afterwards that
+// they were not overwritten. Readers never slow the writer down; a reader
+// that falls more than slot_count frames behind loses frames.
+#define FRAME_RING_MAGIC 0x52535a54 // "TZSR"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS 16
+#define FRAME_RING_ALIGN 64
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring atomics must work across processes");
+
+struct frame_ring_header
+{
+    std::atomic<uint32_t> magic; // written last, the ring is ready once it is set
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;  // payload bytes per slot
+    uint64_t slot_stride;
+    std::atomic<uint64_t> head;     // frames published so far
+    std::atomic<uint32_t> wake;     // futex word readers sleep on, bumped on every publish
+    std::atomic<uint32_t> closed;   // the writer has gone away
+} __attribute__((aligned(FRAME_RING_ALIGN)));
+
+struct frame_ring_slot
+{
+    std::atomic<uint64_t> seq; // 2n + 1 while frame n is written, 2n + 2 once it is complete
+    uint32_t length;
+    uint32_t frame_seq;  // frame_header seq
+    uint64_t publish_ns; // CLOCK_MONOTONIC, comparable across processes
+} __attribute__((aligned(FRAME_RING_ALIGN)));
+
+class frame_ring_writer
+{
+public:
+    frame_ring_writer();
+    ~frame_ring_writer();
+
+    int open(const char *name, uint32_t slot_count, uint32_t slot_size);
+    bool is_open() const;
+    // Returns the slot the next frame is written into in place, up to
+    // slot_size bytes. Readers skip the slot until commit().
+    char *begin();
+    void commit(uint32_t length, uint32_t frame_seq);
+    void close();
+
+private:
+    struct frame_ring_header *hdr;
+    size_t map_len;
+    char name[64];
+    uint64_t next;
+};
+
+struct frame_view
+{
+    const char *data; // inside the mapping, valid until frame_ring_reader::validate() fails
+    uint32_t length;
+    uint32_t frame_seq;
+    uint64_t publish_ns;
+    uint64_t frame_no;
+};
+
+class frame_ring_reader
+{
+public:
+    frame_ring_reader();
+    ~frame_ring_reader();
+
+    int open(const char *name);
+    // 1 with the next frame, 0 if none arrived within timeout_ms, -1 once the
+    // writer closed the ring
+    int next(struct frame_view *view, int timeout_ms);
+    // true if the frame was not overwritten while the view was used
+    bool validate(const struct frame_view *view) const;
+    void close();
+
+    uint64_t lost; // frames overwritten before this reader got to them
+
+private:
+    struct frame_ring_slot *slot(uint64_t frame_no) const;
+
+    struct frame_ring_header *hdr;
+    size_t map_len;
+    uint64_t cursor;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include "frame_trace.h"
+#include "timing.h"
+
+struct trace_event
+{
+    std::atomic<uint64_t> ready; // claim index + 1 once written, 0 while it is
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    uint64_t trace_id; // 0 if the server sent none
+    uint32_t seq;
+    uint32_t stage;
+};
+
+// whichever of a frame's FRAME_TRACE and its arrival comes first waits
+// here for the other, UDP frames can beat their FRAME_TRACE on TCP
+struct pending_trace
+{
+    uint32_t seq;
+    bool server; // send_ns is set, else arrive_ns
+    bool valid;
+    uint64_t trace_id;
+    uint64_t send_ns; // on our clock
+    uint64_t arrive_ns;
+};
+
+static const char *stage_names[TRACE_STAGES] = {"encode", "encrypt", "network", "receive", "tee", "decode",
+                                                "playout"};
+// stages whose spans overlap from frame to frame, written as async events
+static const bool stage_async[TRACE_STAGES] = {false, false, true, false, false, false, true};
+
+static struct trace_event *ring;
+static std::atomic<uint64_t> head;
+static std::string trace_path;
+static int64_t realtime_offset_ns; // REALTIME - MONOTONIC
+static uint64_t start_ns;
+// only touched by the receive thread
+static struct pending_trace pending[TRACE_PENDING];
+static uint64_t skewed; // server send after our receive, clocks out of sync
+static volatile sig_atomic_t dump_requested;
+
+static void request_dump(int)
+{
+    dump_requested = 1;
+}
+
+int trace_open(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 0;
+    fclose(f);
+    trace_path = path;
+    ring = new trace_event[TRACE_EVENTS];
+    for (int i = 0; i < TRACE_EVENTS; i++)
+        ring[i].ready.store(0, std::memory_order_relaxed);
+    start_ns = monotonic_ns();
+    realtime_offset_ns = (int64_t)realtime_us() * 1000 - (int64_t)monotonic_ns();
+
+    // SA_RESTART: a blocking recv() goes on, the dump happens at the next frame
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_dump;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    return 1;
+}
+
+bool trace_enabled()
+{
+    return ring != NULL;
+}
+
+static void record(enum trace_stage stage, uint32_t seq, uint64_t trace_id, uint64_t begin_ns, uint64_t end_ns)
+{
+    uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+    struct trace_event *e = &ring[i & (TRACE_EVENTS - 1)];
+
+    // readers skip it until ready says which event it holds
+    e->ready.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e->begin_ns = begin_ns;
+    e->end_ns = end_ns;
+    e->trace_id = trace_id;
+    e->seq = seq;
+    e->stage = stage;
+    e->ready.store(i + 1, std::memory_order_release);
+}
+
+static void network(uint32_t seq, uint64_t trace_id, uint64_t send_ns, uint64_t arrive_ns)
+{
+    if (send_ns <= arrive_ns)
+        record(TRACE_NETWORK, seq, trace_id, send_ns, arrive_ns);
+    else
+        skewed++;
+}
+
+void trace_record(enum trace_stage stage, uint32_t seq, uint64_t begin_ns, uint64_t end_ns)
+{
+    if (ring)
+        record(stage, seq, 0, begin_ns, end_ns);
+}
+
+static uint64_t server_ns(uint64_t realtime_us)
+{
+    return (int64_t)realtime_us * 1000 - realtime_offset_ns;
+}
+
+void trace_server(uint32_t seq, const struct frame_trace *t)
+{
+    if (!ring)
+        return;
+    struct pending_trace *p = &pending[seq % TRACE_PENDING];
+    record(TRACE_SERVER_ENCODE, seq, t->trace_id, server_ns(t->encode_us), server_ns(t->encrypt_us));
+    record(TRACE_SERVER_ENCRYPT, seq, t->trace_id, server_ns(t->encrypt_us), server_ns(t->send_us));
+    if (p->valid && p->seq == seq && !p->server)
+    {
+        network(seq, t->trace_id, server_ns(t->send_us), p->arrive_ns);
+        p->valid = false;
+        return;
+    }
+    p->seq = seq;
+    p->server = true;
+    p->valid = true;
+    p->trace_id = t->trace_id;
+    p->send_ns = server_ns(t->send_us);
+}
+
+void trace_received(uint32_t seq, uint64_t begin_ns, uint64_t end_ns)
+{
+    if (!ring)
+        return;
+    struct pending_trace *p = &pending[seq % TRACE_PENDING];
+    uint64_t trace_id = 0;
+
+    if (p->valid && p->seq == seq && p->server)
+    {
+        trace_id = p->trace_id;
+        network(seq, trace_id, p->send_ns, begin_ns);
+        p->valid = false;
+    }
+    else
+    {
+        p->seq = seq;
+        p->server = false;
+        p->valid = true;
+        p->arrive_ns = begin_ns;
+    }
+    record(TRACE_RECEIVE, seq, trace_id, begin_ns, end_ns);
+}
+
+void trace_poll()
+{
+    if (!dump_requested)
+        return;
+    dump_requested = 0;
+    int n = trace_dump();
+    if (n >= 0)
+        printf("Trace: %d events written to %s\n", n, trace_path.c_str());
+}
+
+static void write_event(FILE *f, const struct trace_event *e)
+{
+    const char *name = stage_names[e->stage];
+    // server stages get their own process, the rest is us
+    int pid = e->stage <= TRACE_SERVER_ENCRYPT ? 1 : 2;
+    double ts = ((int64_t)e->begin_ns - (int64_t)start_ns) / 1e3;
+    double dur = (e->end_ns - e->begin_ns) / 1e3;
+    char args[96];
+
+    if (e->trace_id)
+        snprintf(args, sizeof(args), "{\"seq\":%u,\"trace_id\":\"0x%016llx\"}", e->seq,
+                 (unsigned long long)e->trace_id);
+    else
+        snprintf(args, sizeof(args), "{\"seq\":%u}", e->seq);
+    if (stage_async[e->stage])
+    {
+        // nestable async spans may overlap, each frame gets its own row;
+        // they pair up by category and id, so the stage is the category
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":%u,\"pid\":%d,\"tid\":%u,"
+                   "\"ts\":%.3f,\"args\":%s}",
+                name, name, e->seq, pid, e->stage, ts, args);
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":%u,\"pid\":%d,\"tid\":%u,"
+                   "\"ts\":%.3f}",
+                name, name, e->seq, pid, e->stage, ts + dur);
+    }
+    else
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,"
+                   "\"dur\":%.3f,\"args\":%s}",
+                name, name, pid, e->stage, ts, dur, args);
+}
+
+int trace_dump()
+{
+    if (!ring)
+        return -1;
+    FILE *f = fopen(trace_path.c_str(), "w");
+    if (!f)
+        return -1;
+
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+    int count = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"skewed_network_spans\":%llu},\"traceEvents\":[",
+            (unsigned long long)skewed);
+    fprintf(f, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"server\"}}");
+    fprintf(f, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"client\"}}");
+    for (int stage = 0; stage < TRACE_STAGES; stage++)
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                stage <= TRACE_SERVER_ENCRYPT ? 1 : 2, stage, stage_names[stage]);
+    for (uint64_t i = begin; i < end; i++)
+    {
+        const struct trace_event *slot = &ring[i & (TRACE_EVENTS - 1)];
+        struct trace_event e;
+
+        // a copy that was not overwritten while it was taken
+        uint64_t ready = slot->ready.load(std::memory_order_acquire);
+        e.begin_ns = slot->begin_ns;
+        e.end_ns = slot->end_ns;
+        e.trace_id = slot->trace_id;
+        e.seq = slot->seq;
+        e.stage = slot->stage;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (ready != i + 1 || slot->ready.load(std::memory_order_relaxed) != ready || e.stage >= TRACE_STAGES ||
+            e.end_ns < e.begin_ns)
+            continue;
+        write_event(f, &e);
+        count++;
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0)
+        return -1;
+    return count;
+}
@@ -0,0 +1,46 @@
+#ifndef FRAME_TRACING
+#define FRAME_TRACING
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// Per-frame latency tracing (--trace FILE). Every stage a frame goes
+// through records its begin and end on CLOCK_MONOTONIC into one ring,
+// from whichever thread runs it, without locks: a writer claims a slot
+// with one atomic add and overwrites the oldest event. The server's
+// FRAME_TRACE timestamps are on its CLOCK_REALTIME and are moved onto ours
+// by our own REALTIME - MONOTONIC offset, so the network span is only as
+// good as the clock sync between the two boxes. The ring is written as
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) at exit and
+// on SIGUSR1: one lane per stage, the frame seq and server trace ID in
+// the args of each event.
+#define TRACE_EVENTS 65536 // a power of two
+#define TRACE_PENDING 64   // server timestamps waiting for their frame
+
+enum trace_stage
+{
+    TRACE_SERVER_ENCODE,  // JPEG, codec or delta encode
+    TRACE_SERVER_ENCRYPT,
+    TRACE_NETWORK,        // server send to the first bytes here
+    TRACE_RECEIVE,        // first bytes, or first datagram, to the whole frame
+    TRACE_TEE,            // the frame's TEEC_InvokeCommand()s
+    TRACE_DECODE,         // delta patch or codec decode
+    TRACE_PLAYOUT,        // waiting in the playout buffer until presented
+    TRACE_STAGES,
+};
+
+// starts recording, path is where trace_dump() writes; 0 if it cannot be written
+int trace_open(const char *path);
+bool trace_enabled();
+void trace_record(enum trace_stage stage, uint32_t seq, uint64_t begin_ns, uint64_t end_ns);
+// a FRAME_TRACE payload, ahead of frame seq
+void trace_server(uint32_t seq, const struct frame_trace *t);
+// frame seq is complete, it began arriving at begin_ns
+void trace_received(uint32_t seq, uint64_t begin_ns, uint64_t end_ns);
+// writes the file if SIGUSR1 asked for it since the last call
+void trace_poll();
+// returns the number of events written, -1 on error
+int trace_dump();
+
+#endif
@@ -0,0 +1,11 @@
+#include "hex_dump.h"
+
+void hex_dump(FILE *f, const char *data, int count)
+{
+    fprintf(f, "=================\n%d bytes:\n", count);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(f, "%02x:", data[i]);
+    }
+    fprintf(f, "\n");
+}
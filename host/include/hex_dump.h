@@ -0,0 +1,10 @@
+#ifndef HEX_DUMP
+#define HEX_DUMP
+
+#include <stdio.h>
+
+// what the client prints for every presented frame, except under
+// --perf-record or --perf-baseline
+void hex_dump(FILE *f, const char *data, int count);
+
+#endif
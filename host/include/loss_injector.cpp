@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <string.h>
+#include "loss_injector.h"
+#include "timing.h"
+
+loss_injector::loss_injector(const struct loss_config *cfg) : received(0), dropped(0), cfg(*cfg), burst_left(0)
+{
+    if (this->cfg.burst < 1)
+        this->cfg.burst = 1;
+}
+
+void loss_injector::push(const char *dgram, size_t len)
+{
+    received++;
+    // a burst starts with loss_pct / burst so the average stays at loss_pct
+    if (burst_left == 0 && rand_r(&cfg.seed) < cfg.loss_pct / 100 / cfg.burst * RAND_MAX)
+        burst_left = cfg.burst;
+    if (burst_left > 0)
+    {
+        burst_left--;
+        dropped++;
+        return;
+    }
+
+    uint64_t due_ns = monotonic_ns();
+    if (cfg.jitter_ms > 0)
+        due_ns += (uint64_t)(rand_r(&cfg.seed) % (cfg.jitter_ms * 1000 + 1)) * 1000;
+    delayed.insert(std::make_pair(due_ns, std::string(dgram, len)));
+}
+
+size_t loss_injector::pop(char *out, size_t space, int *wait_ms)
+{
+    uint64_t now = monotonic_ns();
+
+    *wait_ms = -1;
+    if (delayed.empty())
+        return 0;
+    auto first = delayed.begin();
+    if (first->first > now)
+    {
+        // rounded up, waking early would only spin
+        *wait_ms = (first->first - now + 999999) / 1000000;
+        return 0;
+    }
+    size_t len = first->second.size() < space ? first->second.size() : space;
+    memcpy(out, first->second.data(), len);
+    delayed.erase(first);
+    *wait_ms = delayed.empty() ? -1 : 0;
+    return len;
+}
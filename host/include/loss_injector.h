@@ -0,0 +1,41 @@
+#ifndef LOSS_INJECTOR
+#define LOSS_INJECTOR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+
+// Sits between the UDP socket and the FEC decoder and makes a loopback
+// link behave like a bad one: datagrams are dropped in bursts and held back
+// for a random delay, which also reorders them. Seeded, so a run can be
+// repeated.
+struct loss_config
+{
+    double loss_pct; // average share of datagrams dropped
+    int burst;       // datagrams lost in a row once a loss starts
+    int jitter_ms;   // extra delay, uniform in [0, jitter_ms]
+    unsigned seed;
+};
+
+class loss_injector
+{
+public:
+    loss_injector(const struct loss_config *cfg);
+
+    // drops the datagram or queues it until its delay is over
+    void push(const char *dgram, size_t len);
+    // Copies the next due datagram into out and returns its length, 0 if
+    // none is due. *wait_ms is how long until the next one, -1 if none.
+    size_t pop(char *out, size_t space, int *wait_ms);
+
+    uint64_t received;
+    uint64_t dropped;
+
+private:
+    struct loss_config cfg;
+    int burst_left;
+    std::multimap<uint64_t, std::string> delayed; // due time -> datagram
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include "perf_report.h"
+#include "timing.h"
+
+struct perf_metric
+{
+    const char *name;
+    double perf_metrics::*value;
+    bool higher_is_better;
+    const char *tolerance; // written by perf_write()
+};
+
+static const struct perf_metric metrics[] = {
+    // a few times the run to run spread of a replay on an idle machine
+    {"frames_per_s", &perf_metrics::frames_per_s, true, "15%"},
+    {"mb_per_s", &perf_metrics::mb_per_s, true, "15%"},
+    // near 0 when the loop is right, a percentage of it means nothing;
+    // one allocation every 20 frames already fails
+    {"allocs_per_frame", &perf_metrics::allocs_per_frame, false, "0.05"},
+    {"p99_ms", &perf_metrics::p99_ms, false, "30%"},
+};
+#define METRICS (sizeof(metrics) / sizeof(metrics[0]))
+
+static std::atomic<bool> counting;
+static std::atomic<uint64_t> allocs;
+static uint64_t *latency_ns; // only touched by the receive thread
+static uint32_t samples;
+static uint64_t arrived_ns[PERF_PENDING];
+static uint32_t arrived_seq[PERF_PENDING];
+
+#ifdef TZS_COUNT_ALLOCS
+// every thread's operator new, coroutine frames and containers included;
+// only in the mock TEE client and tzs_microbench, see CMakeLists.txt
+void *operator new(size_t size)
+{
+    if (counting.load(std::memory_order_relaxed))
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+#endif
+
+void perf_count_allocs(bool on)
+{
+    if (on)
+        allocs = 0;
+    counting = on;
+}
+
+uint64_t perf_allocs()
+{
+    return allocs;
+}
+
+void perf_start()
+{
+    // allocated before counting starts
+    latency_ns = new uint64_t[PERF_SAMPLES];
+    samples = 0;
+    for (int i = 0; i < PERF_PENDING; i++)
+        arrived_ns[i] = 0;
+    perf_count_allocs(true);
+}
+
+bool perf_enabled()
+{
+    return latency_ns != NULL;
+}
+
+void perf_arrived(uint32_t seq, uint64_t begin_ns)
+{
+    if (!latency_ns)
+        return;
+    arrived_seq[seq % PERF_PENDING] = seq;
+    arrived_ns[seq % PERF_PENDING] = begin_ns;
+}
+
+void perf_done(uint32_t seq)
+{
+    uint32_t i = seq % PERF_PENDING;
+
+    if (!latency_ns || !arrived_ns[i] || arrived_seq[i] != seq)
+        return;
+    if (samples < PERF_SAMPLES)
+        latency_ns[samples++] = monotonic_ns() - arrived_ns[i];
+    arrived_ns[i] = 0;
+}
+
+void perf_finish(uint64_t frames, uint64_t bytes, double secs, struct perf_metrics *m)
+{
+    counting = false;
+    m->frames_per_s = frames / secs;
+    m->mb_per_s = bytes / secs / 1e6;
+#ifdef TZS_COUNT_ALLOCS
+    m->allocs_per_frame = frames ? (double)allocs / frames : 0;
+#else
+    m->allocs_per_frame = -1;
+#endif
+    m->p99_ms = 0;
+    if (samples)
+    {
+        uint32_t k = samples * 99 / 100;
+        std::nth_element(latency_ns, latency_ns + k, latency_ns + samples);
+        m->p99_ms = latency_ns[k] / 1e6;
+    }
+}
+
+int perf_write(const char *path, const struct perf_metrics *m)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f)
+        return 0;
+    fprintf(f, "# metric value tolerance, written by --perf-record\n");
+    for (size_t i = 0; i < METRICS; i++)
+        if (m->*metrics[i].value >= 0)
+            fprintf(f, "%-17s %.4f %s\n", metrics[i].name, m->*metrics[i].value, metrics[i].tolerance);
+    return fclose(f) == 0;
+}
+
+int perf_check(const char *path, const struct perf_metrics *m)
+{
+    char line[256], name[64], tolerance[32];
+    double baseline;
+    int ok = 1;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+    printf("%-17s %12s %12s %12s\n", "metric", "baseline", "this run", "limit");
+    while (fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "#")] = 0;
+        if (sscanf(line, "%63s %lf %31s", name, &baseline, tolerance) != 3)
+            continue;
+        size_t i;
+        for (i = 0; i < METRICS && strcmp(metrics[i].name, name); i++)
+            ;
+        if (i == METRICS)
+        {
+            printf("%-17s unknown, ignored\n", name);
+            continue;
+        }
+        double slack = atof(tolerance);
+        if (strchr(tolerance, '%'))
+            slack = baseline * slack / 100;
+        double value = m->*metrics[i].value;
+        if (value < 0)
+        {
+            printf("%-17s not measured by this build, ignored\n", name);
+            continue;
+        }
+        double limit = metrics[i].higher_is_better ? baseline - slack : baseline + slack;
+        bool regressed = metrics[i].higher_is_better ? value < limit : value > limit;
+        printf("%-17s %12.4f %12.4f %12.4f%s\n", name, baseline, value, limit, regressed ? "  REGRESSED" : "");
+        if (regressed)
+            ok = 0;
+    }
+    fclose(f);
+    return ok;
+}
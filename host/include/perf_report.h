@@ -0,0 +1,44 @@
+#ifndef PERF_REPORT
+#define PERF_REPORT
+
+#include <stdint.h>
+
+// What the perf suite (host/perf/run_perf.sh) holds a run to: frames/s and
+// MB/s of the receive loop, operator new calls per frame while it runs and
+// the p99 latency from a frame's first bytes to its decoded picture. A
+// baseline file has one metric per line,
+//   NAME VALUE TOLERANCE
+// TOLERANCE is a percentage of VALUE (25%) or an absolute amount (0.5),
+// and only a change for the worse beyond it fails; '#' starts a comment.
+// A metric below 0 was not measured and is neither written nor checked.
+#define PERF_SAMPLES (1 << 17) // latencies kept, the first frames of longer runs
+#define PERF_PENDING 64        // frames between arrival and picture
+
+struct perf_metrics
+{
+    double frames_per_s;
+    double mb_per_s;
+    double allocs_per_frame;
+    double p99_ms;
+};
+
+// operator new calls from the last perf_count_allocs(true) on, in any
+// thread. Only counted when built with TZS_COUNT_ALLOCS, which replaces the
+// global operator new; otherwise 0, and allocs_per_frame is -1.
+void perf_count_allocs(bool on);
+uint64_t perf_allocs();
+// counting from here on, call before the receive loop
+void perf_start();
+bool perf_enabled();
+// frame seq is complete, its first bytes came at begin_ns
+void perf_arrived(uint32_t seq, uint64_t begin_ns);
+// frame seq is decoded
+void perf_done(uint32_t seq);
+void perf_finish(uint64_t frames, uint64_t bytes, double secs, struct perf_metrics *m);
+// writes m as a baseline with the default tolerances, 0 on error
+int perf_write(const char *path, const struct perf_metrics *m);
+// prints each metric next to the baseline; 1 if none regressed, 0 if one
+// did, -1 if path cannot be read
+int perf_check(const char *path, const struct perf_metrics *m);
+
+#endif
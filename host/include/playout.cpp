@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_trace.h"
+#include "playout.h"
+#include "sched_profile.h"
+#include "timing.h"
+
+playout::playout(size_t frame_size, int slots, size_t alignment, int min_delay_ms, int rebuffer_ms,
+                 present_fn present, void *arg)
+    : present(present), present_arg(arg), stopping(false), have_base(false), base_ns(0),
+      min_delay_ns((int64_t)min_delay_ms * 1000000), rebuffer_ns((int64_t)rebuffer_ms * 1000000),
+      delay_ns((int64_t)min_delay_ms * 1000000), transit_count(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < slots; i++)
+    {
+        buffers.push_back((char *)aligned_alloc(alignment, frame_size));
+        free_buffers.push_back(buffers.back());
+    }
+    worker = std::thread(&playout::run, this);
+}
+
+playout::~playout()
+{
+    stop();
+    for (char *b : buffers)
+        free(b);
+}
+
+char *playout::acquire()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (free_buffers.empty())
+    {
+        stats.early++;
+        return NULL;
+    }
+    char *data = free_buffers.back();
+    free_buffers.pop_back();
+    return data;
+}
+
+// called with the lock held
+void playout::adapt(int64_t transit_ns)
+{
+    int64_t worst = transit_ns;
+    int64_t target;
+
+    transits[transit_count++ % PLAYOUT_WINDOW] = transit_ns;
+    for (int i = 0; i < transit_count && i < PLAYOUT_WINDOW; i++)
+        if (transits[i] > worst)
+            worst = transits[i];
+    target = worst + PLAYOUT_MARGIN_MS * 1000000ll;
+    if (target < min_delay_ns)
+        target = min_delay_ns;
+    if (target > PLAYOUT_MAX_DELAY_MS * 1000000ll)
+        target = PLAYOUT_MAX_DELAY_MS * 1000000ll;
+
+    // a late frame is a visible stall, a few ms more latency is not
+    if (target > delay_ns)
+        delay_ns = target;
+    else
+        delay_ns -= (delay_ns - target) / 16;
+    stats.delay_ns = delay_ns;
+    if ((uint64_t)delay_ns > stats.max_delay_ns)
+        stats.max_delay_ns = delay_ns;
+}
+
+void playout::submit(char *data, uint32_t len, uint32_t seq, uint64_t pts_us)
+{
+    int64_t now = monotonic_ns();
+    int64_t pts_ns = pts_us * 1000;
+    entry e;
+
+    std::lock_guard<std::mutex> guard(lock);
+    // the first frame, or a server restart, anchors pts to our clock
+    if (!have_base || now - (base_ns + pts_ns) > PLAYOUT_RESYNC_MS * 1000000ll ||
+        (base_ns + pts_ns) - now > PLAYOUT_RESYNC_MS * 1000000ll)
+    {
+        if (have_base)
+            stats.resyncs++;
+        have_base = true;
+        base_ns = now - pts_ns;
+        transit_count = 0;
+    }
+    int64_t transit_ns = now - (base_ns + pts_ns);
+    // past its time with nothing left to show: the picture froze until now
+    bool in_time = transit_ns <= delay_ns;
+    bool stall = !in_time && queue.empty() && stats.presented;
+    adapt(transit_ns);
+    if (stall)
+    {
+        // build up a cushion before going on
+        stats.stalls++;
+        if (transit_ns + rebuffer_ns > delay_ns)
+            delay_ns = transit_ns + rebuffer_ns;
+        if (delay_ns > PLAYOUT_MAX_DELAY_MS * 1000000ll)
+            delay_ns = PLAYOUT_MAX_DELAY_MS * 1000000ll;
+        stats.delay_ns = delay_ns;
+        if ((uint64_t)delay_ns > stats.max_delay_ns)
+            stats.max_delay_ns = delay_ns;
+    }
+
+    e.data = data;
+    e.len = len;
+    e.seq = seq;
+    e.due_base_ns = base_ns + pts_ns;
+    e.submit_ns = now;
+    e.in_time = in_time;
+    queue.push_back(e);
+    ready.notify_one();
+}
+
+void playout::release(char *data)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    free_buffers.push_back(data);
+}
+
+void playout::run()
+{
+    sched_enter(SCHED_STAGE_PLAYOUT);
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;)
+    {
+        ready.wait(guard, [this] { return !queue.empty() || stopping; });
+        if (queue.empty())
+            return;
+        entry e = queue.front();
+        int64_t due = e.due_base_ns + delay_ns;
+        guard.unlock();
+
+        int64_t now = monotonic_ns();
+        // submit() may raise the delay while this frame waits for it
+        while (now < due)
+        {
+            sleep_until_ns(due);
+            now = monotonic_ns();
+            guard.lock();
+            due = e.due_base_ns + delay_ns;
+            guard.unlock();
+        }
+
+        guard.lock();
+        queue.pop_front();
+        bool late = now - due > PLAYOUT_MARGIN_MS * 1000000ll;
+        // showing a stale frame only delays the next one as well
+        if (late && !queue.empty() && queue.front().due_base_ns + delay_ns <= now)
+        {
+            stats.skipped++;
+            free_buffers.push_back(e.data);
+            continue;
+        }
+        guard.unlock();
+
+        present(e.data, e.len, e.seq, present_arg);
+        trace_record(TRACE_PLAYOUT, e.seq, e.submit_ns, now);
+
+        guard.lock();
+        uint64_t error = now > due ? now - due : due - now;
+        stats.presented++;
+        stats.hits += e.in_time;
+        stats.depth_sum += queue.size();
+        if (queue.size() > stats.max_depth)
+            stats.max_depth = queue.size();
+        stats.late += late;
+        stats.error_ns += error;
+        if (error > stats.max_error_ns)
+            stats.max_error_ns = error;
+        free_buffers.push_back(e.data);
+    }
+}
+
+void playout::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        ready.notify_one();
+    }
+    if (worker.joinable())
+        worker.join();
+}
+
+void playout::print_stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    double presented = stats.presented ? stats.presented : 1;
+
+    printf("Playout: %lu presented, %lu late, %lu skipped, %lu early (buffer full), %lu resyncs\n",
+           (unsigned long)stats.presented, (unsigned long)stats.late, (unsigned long)stats.skipped,
+           (unsigned long)stats.early, (unsigned long)stats.resyncs);
+    printf("Playout: timing error %.3f ms mean, %.3f ms max; buffer depth %.1f ms now, %.1f ms max\n",
+           stats.error_ns / 1e6 / presented, stats.max_error_ns / 1e6, stats.delay_ns / 1e6,
+           stats.max_delay_ns / 1e6);
+    printf("Playout: %.1f frames buffered ahead mean, %lu max; %.1f%% there in time, %lu stalls\n",
+           stats.depth_sum / presented, (unsigned long)stats.max_depth, 100.0 * stats.hits / presented,
+           (unsigned long)stats.stalls);
+}
@@ -0,0 +1,104 @@
+#ifndef PLAYOUT
+#define PLAYOUT
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Jitter buffer between decryption and presentation. Frames are decrypted
+// into buffers of the playout stage and presented by its own thread at
+// base + pts + delay on CLOCK_MONOTONIC, where base maps the server's
+// capture clock onto ours and delay is the buffer depth. The depth follows
+// the worst arrival delay of the last PLAYOUT_WINDOW frames, so uneven
+// network and TEE latency is absorbed instead of shown as stutter: it grows
+// at once when a frame would have been late and shrinks slowly.
+// A VOD server can send frames ahead of their time (MSG_PREFETCH), they
+// wait here, so the buffer is sized for that window on top of the default.
+// Every buffer is a full frame, so the window is capped at
+// PLAYOUT_MAX_PREFETCH frames, 96 MiB of buffers with 1 MiB frames.
+// A frame that arrives after its time with nothing left to show is a stall;
+// rebuffer adds that much depth on top, so the next hiccup is absorbed.
+#define PLAYOUT_SLOTS 32
+#define PLAYOUT_MAX_PREFETCH 96
+#define PLAYOUT_WINDOW 256
+#define PLAYOUT_MAX_DELAY_MS 1000
+#define PLAYOUT_MARGIN_MS 2      // on top of the worst delay seen
+#define PLAYOUT_RESYNC_MS 5000   // pts jumps further than this restart the clock mapping
+
+struct playout_stats
+{
+    uint64_t presented;
+    uint64_t late;         // presented after their time
+    uint64_t skipped;      // late while the next frame was due as well, dropped to catch up
+    uint64_t early;        // arrived while every buffer held an earlier frame, dropped
+    uint64_t resyncs;
+    uint64_t error_ns;     // sum of |presented - due| over presented frames
+    uint64_t max_error_ns;
+    uint64_t delay_ns;     // current depth
+    uint64_t max_delay_ns;
+    uint64_t hits;         // presented frames that were there before their time
+    uint64_t stalls;       // arrived late to an empty buffer
+    uint64_t depth_sum;    // frames queued behind each presented one
+    uint64_t max_depth;
+};
+
+class playout
+{
+public:
+    typedef void (*present_fn)(const char *data, uint32_t len, uint32_t seq, void *arg);
+
+    // slots frame buffers, min_delay_ms is the startup buffering
+    playout(size_t frame_size, int slots, size_t alignment, int min_delay_ms, int rebuffer_ms, present_fn present,
+            void *arg);
+    ~playout();
+
+    // Buffer to decrypt a frame into, NULL if all are in use (the frame is
+    // counted early and should be dropped).
+    char *acquire();
+    // queues the frame written to an acquire()d buffer
+    void submit(char *data, uint32_t len, uint32_t seq, uint64_t pts_us);
+    // gives back an acquire()d buffer whose frame failed to decrypt
+    void release(char *data);
+    // presents what is still queued, then stops the thread
+    void stop();
+    void print_stats();
+
+private:
+    struct entry
+    {
+        char *data;
+        uint32_t len;
+        uint32_t seq;
+        int64_t due_base_ns; // base + pts, the delay is added when it is presented
+        int64_t submit_ns;
+        bool in_time;        // arrived before its time at the depth then
+    };
+
+    void run();
+    void adapt(int64_t transit_ns);
+
+    present_fn present;
+    void *present_arg;
+    std::vector<char *> buffers;
+    std::vector<char *> free_buffers;
+    std::deque<entry> queue;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::thread worker;
+    bool stopping;
+
+    bool have_base;
+    int64_t base_ns;
+    int64_t min_delay_ns;
+    int64_t rebuffer_ns;
+    int64_t delay_ns;
+    int64_t transits[PLAYOUT_WINDOW]; // arrival - (base + pts) of recent frames
+    int transit_count;
+    struct playout_stats stats;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <stdint.h>
+
+// Wire format shared with Server/server.py, all fields are little endian.
+
+// server -> client: frame_header followed by length payload bytes
+#define FRAME_MAGIC 0x46535a54 // "TZSF"
+#define FRAME_VIDEO 1     // RSA blocks for the key in key_id
+#define FRAME_ECDH_PUB 2  // curve, pub_len, server public key
+#define FRAME_VIDEO_AES 3 // AES-128-CTR, IV is seq (64 bit big endian) || 0^64
+#define FRAME_GROUP_KEY 4 // wrap (TA_GROUP_WRAP_xxx), wrapped group key for FRAME_VIDEO_AES
+#define FRAME_TICKET 5    // lifetime_s, ticket: resumes the session on a new connection
+#define FRAME_RESUMED 6   // status (1 resumed, 0 rejected), answer to MSG_RESUME
+#define FRAME_VIDEO_TILED 7 // tile_count, frame_tile[tile_count], FRAME_VIDEO_AES cipher text
+#define FRAME_STREAM_INFO 8 // codec (STREAM_CODEC_xxx), width, height: the packets that follow
+#define FRAME_TRACE 9       // frame_trace of the video frame with the same seq, sent ahead of it
+
+struct frame_header
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t seq;
+    uint32_t key_id; // key the payload was encrypted for
+    uint32_t length;
+    uint64_t pts_us; // capture time of a video frame on the server clock, 0 for the others
+    uint32_t crc32c; // of the payload bytes, see crc32c.h
+    uint32_t flags;  // FRAME_FLAG_xxx of a video frame
+} __attribute__((packed));
+
+#define FRAME_FLAG_KEYFRAME 1 // a whole frame that later delta frames build on
+#define FRAME_FLAG_DELTA 2    // the plain text is a delta against an earlier frame, see delta.h
+#define FRAME_FLAG_PACKET 4   // the plain text is one encoded packet, see video_decoder.h
+
+// FRAME_STREAM_INFO codecs, a keyframe packet is an IDR or VP8 key frame
+#define STREAM_CODEC_H264 1 // Annex B, parameter sets in band on every keyframe
+#define STREAM_CODEC_VP8 2
+
+// One tile of a FRAME_VIDEO_TILED frame, offset and length into the cipher
+// text. Offsets are multiples of the AES block, so a tile decrypts on its
+// own from CTR block offset / 16, on any TEE session holding the group key.
+// The plain text of a tile lands at the same offset, no copy to composite.
+// Tiles follow each other without gaps and cover the whole cipher text.
+#define FRAME_MAX_TILES 64
+#define FRAME_TILE_ALIGN 16
+
+struct frame_tile
+{
+    uint32_t offset;
+    uint32_t length;
+} __attribute__((packed));
+
+// Server side stage times of one video frame, after MSG_TRACE. Times are
+// CLOCK_REALTIME in us; the trace ID is the same for every client.
+struct frame_trace
+{
+    uint64_t trace_id;   // server run << 32 | source frame number
+    uint64_t capture_us;
+    uint64_t encode_us;  // encoding (JPEG, codec or delta) started
+    uint64_t encrypt_us; // encoded, encryption started
+    uint64_t send_us;    // encrypted, handed to the socket
+} __attribute__((packed));
+
+#define FRAME_MAX_VIDEO (1 << 20) // video bytes in one frame, a 1080p JPEG fits
+#define FRAME_MAX_PAYLOAD (FRAME_MAX_VIDEO + 4 + FRAME_MAX_TILES * sizeof(struct frame_tile))
+
+// client -> server: msg_header followed by length payload bytes
+#define MSG_PUB_KEY 1  // key_id, scheme, mod_len, exp_len, modulus, exponent
+#define MSG_ECDH_PUB 2 // curve, pub_len, client public key
+#define MSG_UDP_PORT 3 // port, video frames go to this UDP port instead (see fec.h)
+#define MSG_RESUME 4   // next_seq, ticket: first message of a reconnect instead of a key exchange
+#define MSG_SEEK 5     // pts_us (64 bit): VOD only, play on from the last keyframe at or before it
+#define MSG_PREFETCH 6 // frames, bytes (0 for any): VOD only, how far frames may be sent ahead of their time
+#define MSG_TRACE 7    // no payload: send a FRAME_TRACE ahead of every live video frame
+
+// A ticket stands for the group key the server wrapped for this client,
+// which the TA still holds, so frames can continue without a new key
+// exchange. Tickets are single use, every resume issues the next one.
+#define RESUME_TICKET_SIZE 16
+
+struct msg_header
+{
+    uint32_t type;
+    uint32_t length;
+} __attribute__((packed));
+
+#endif
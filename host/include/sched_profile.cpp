@@ -0,0 +1,289 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "sched_profile.h"
+
+#define ISOLATED_CPUS "/sys/devices/system/cpu/isolated"
+
+static const char *stage_names[SCHED_STAGES] = {"net", "tee", "playout"};
+
+static struct sched_profile current;
+static bool active;
+static bool fifo_denied;
+// what the process started with, for stages without CPUs and background threads
+static cpu_set_t startup_cpus;
+static int startup_policy;
+static struct sched_param startup_param;
+static bool have_startup;
+static std::atomic<bool> warned[SCHED_STAGES + 1];
+
+static void save_startup()
+{
+    if (have_startup)
+        return;
+    if (sched_getaffinity(0, sizeof(startup_cpus), &startup_cpus) < 0)
+        err(1, "sched_getaffinity");
+    pthread_getschedparam(pthread_self(), &startup_policy, &startup_param);
+    have_startup = true;
+}
+
+// "0+2-3", or "0,2-3" from sysfs; end is where the list stops
+static int parse_cpus(const char *s, const char *end, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (s < end)
+    {
+        char *p;
+        long first = strtol(s, &p, 10), last = first;
+        if (p == s || first < 0)
+            return 0;
+        if (p < end && *p == '-')
+        {
+            s = p + 1;
+            last = strtol(s, &p, 10);
+            if (p == s || last < first)
+                return 0;
+        }
+        if (last >= CPU_SETSIZE)
+            return 0;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        s = p;
+        if (s < end && *s != '+' && *s != ',')
+            return 0;
+        if (s < end)
+            s++;
+    }
+    return 1;
+}
+
+static void format_cpus(const cpu_set_t *set, char *buf, size_t len)
+{
+    size_t n = 0;
+
+    buf[0] = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < len; cpu++)
+    {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last > cpu)
+            n += snprintf(buf + n, len - n, "%s%d-%d", n ? "," : "", cpu, last);
+        else
+            n += snprintf(buf + n, len - n, "%s%d", n ? "," : "", cpu);
+        cpu = last;
+    }
+    if (!buf[0])
+        snprintf(buf, len, "none");
+}
+
+// isolcpus= cores, usually not in the startup set; empty if there are none
+static void isolated_cpus(cpu_set_t *set)
+{
+    char line[256];
+    FILE *f = fopen(ISOLATED_CPUS, "r");
+
+    CPU_ZERO(set);
+    if (!f)
+        return;
+    if (fgets(line, sizeof(line), f))
+    {
+        size_t len = strcspn(line, "\n");
+        if (!parse_cpus(line, line + len, set))
+            CPU_ZERO(set);
+    }
+    fclose(f);
+}
+
+// the i-th CPU of set, -1 if it has fewer
+static int nth_cpu(const cpu_set_t *set, int i)
+{
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, set) && i-- == 0)
+            return cpu;
+    return -1;
+}
+
+static void spread(struct sched_profile *p, const cpu_set_t *cpus)
+{
+    int n = CPU_COUNT(cpus);
+
+    if (n < 2)
+        return;
+    CPU_SET(nth_cpu(cpus, 0), &p->cpus[SCHED_STAGE_NET]);
+    // with two cores playout shares with net, it is mostly asleep
+    CPU_SET(nth_cpu(cpus, n > 2 ? 1 : 0), &p->cpus[SCHED_STAGE_PLAYOUT]);
+    for (int i = n > 2 ? 2 : 1; i < n; i++)
+        CPU_SET(nth_cpu(cpus, i), &p->cpus[SCHED_STAGE_TEE]);
+}
+
+static void isolated(struct sched_profile *p)
+{
+    cpu_set_t iso;
+    int n;
+
+    isolated_cpus(&iso);
+    n = CPU_COUNT(&iso);
+    if (n == 0)
+    {
+        spread(p, &startup_cpus);
+        return;
+    }
+    CPU_SET(nth_cpu(&iso, 0), &p->cpus[SCHED_STAGE_PLAYOUT]);
+    for (int i = n > 1 ? 1 : 0; i < n; i++)
+        CPU_SET(nth_cpu(&iso, i), &p->cpus[SCHED_STAGE_TEE]);
+    p->cpus[SCHED_STAGE_NET] = startup_cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &iso))
+            CPU_CLR(cpu, &p->cpus[SCHED_STAGE_NET]);
+    if (CPU_COUNT(&p->cpus[SCHED_STAGE_NET]) == 0)
+        p->cpus[SCHED_STAGE_NET] = startup_cpus;
+}
+
+int sched_parse(const char *spec, struct sched_profile *profile)
+{
+    struct sched_profile *p = profile;
+
+    save_startup();
+    memset(p, 0, sizeof(*p));
+    snprintf(p->name, sizeof(p->name), "%s", spec);
+    if (!strcmp(spec, "none"))
+        return 1;
+    if (!strcmp(spec, "spread"))
+    {
+        spread(p, &startup_cpus);
+        return 1;
+    }
+    if (!strcmp(spec, "isolated") || !strcmp(spec, "realtime"))
+    {
+        isolated(p);
+        if (!strcmp(spec, "realtime"))
+        {
+            p->priority[SCHED_STAGE_PLAYOUT] = SCHED_PRIO_PLAYOUT;
+            p->priority[SCHED_STAGE_TEE] = SCHED_PRIO_TEE;
+        }
+        return 1;
+    }
+
+    // STAGE=CPUS[@PRIO],...
+    const char *s = spec;
+    while (*s)
+    {
+        const char *end = s + strcspn(s, ",");
+        const char *eq = strchr(s, '=');
+        const char *at;
+        int stage;
+
+        if (!eq || eq > end)
+            return 0;
+        for (stage = 0; stage < SCHED_STAGES; stage++)
+            if (strlen(stage_names[stage]) == (size_t)(eq - s) && !strncmp(s, stage_names[stage], eq - s))
+                break;
+        if (stage == SCHED_STAGES)
+            return 0;
+        at = strchr(eq, '@');
+        if (at && at < end)
+        {
+            p->priority[stage] = atoi(at + 1);
+            if (p->priority[stage] < sched_get_priority_min(SCHED_FIFO) ||
+                p->priority[stage] > sched_get_priority_max(SCHED_FIFO))
+                return 0;
+        }
+        else
+            at = end;
+        if (!parse_cpus(eq + 1, at, &p->cpus[stage]))
+            return 0;
+        s = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+void sched_use(const struct sched_profile *profile)
+{
+    int max = 0;
+
+    save_startup();
+    current = *profile;
+    active = strcmp(current.name, "none") != 0;
+    for (int i = 0; i <= SCHED_STAGES; i++)
+        warned[i] = false;
+
+    // try the highest priority on a thread of its own, so a missing
+    // permission is known and reported before any stage needs it
+    for (int i = 0; i < SCHED_STAGES; i++)
+        if (current.priority[i] > max)
+            max = current.priority[i];
+    fifo_denied = false;
+    if (max > 0)
+    {
+        std::thread probe([max]() {
+            struct sched_param param;
+            param.sched_priority = max;
+            fifo_denied = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0;
+        });
+        probe.join();
+        if (fifo_denied)
+            warnx("SCHED_FIFO %d is not permitted (needs CAP_SYS_NICE or RLIMIT_RTPRIO), "
+                  "every stage stays SCHED_OTHER", max);
+    }
+}
+
+int sched_enter(enum sched_stage stage)
+{
+    const cpu_set_t *cpus = &startup_cpus;
+    int policy = startup_policy;
+    struct sched_param param = startup_param;
+    int ok = 1;
+
+    // none still restores the startup placement, for a thread placed by an earlier profile
+    if (!have_startup)
+        return 1;
+    if (stage < SCHED_STAGES)
+    {
+        if (CPU_COUNT(&current.cpus[stage]) > 0)
+            cpus = &current.cpus[stage];
+        if (current.priority[stage] > 0 && !fifo_denied)
+        {
+            policy = SCHED_FIFO;
+            param.sched_priority = current.priority[stage];
+        }
+    }
+    // threads inherit both from whoever started them, so both are always set
+    if (pthread_setaffinity_np(pthread_self(), sizeof(*cpus), cpus) != 0)
+        ok = 0;
+    if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
+        ok = 0;
+    if (!ok && !warned[stage].exchange(true))
+        warnx("cannot place a %s thread as the scheduling profile says",
+              stage < SCHED_STAGES ? stage_names[stage] : "background");
+    return ok;
+}
+
+void sched_print()
+{
+    char all[128], iso[128], cpus[128];
+    cpu_set_t isolated;
+
+    save_startup();
+    isolated_cpus(&isolated);
+    format_cpus(&startup_cpus, all, sizeof(all));
+    format_cpus(&isolated, iso, sizeof(iso));
+    printf("Scheduling profile %s (CPUs %s, isolated %s)", current.name[0] ? current.name : "none", all, iso);
+    for (int i = 0; i < SCHED_STAGES && active; i++)
+    {
+        if (CPU_COUNT(&current.cpus[i]) > 0)
+            format_cpus(&current.cpus[i], cpus, sizeof(cpus));
+        else
+            snprintf(cpus, sizeof(cpus), "%s", all);
+        printf("%s %s on %s", i ? "," : ":", stage_names[i], cpus);
+        if (current.priority[i] > 0)
+            printf(fifo_denied ? " SCHED_OTHER (FIFO %d denied)" : " SCHED_FIFO %d", current.priority[i]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,54 @@
+#ifndef SCHED_PROFILE
+#define SCHED_PROFILE
+
+#include <sched.h>
+
+// Where the client's threads run. OP-TEE runs the secure world side of a
+// TEEC_InvokeCommand() on the core of the calling thread, so placing the
+// TEE threads places the TA as well. Threads belong to a stage and call
+// sched_enter() for it when they start:
+//   net      main thread: receive, FEC, delta and codec decode, the sink
+//   tee      tee_invoker and tile_workers threads
+//   playout  the playout thread, presents frames on time
+// Anything else (connect, key rotation) keeps the placement the process
+// started with. A stage has a CPU set, empty to keep the startup one, and
+// a SCHED_FIFO priority, 0 for SCHED_OTHER. Built in profiles:
+//   none      nothing is changed (default)
+//   spread    net, playout and tee on cores of their own: cpu 0, cpu 1,
+//             the rest
+//   isolated  tee and playout on the isolcpus= cores, net on the others;
+//             spread if none are isolated
+//   realtime  isolated, with SCHED_FIFO for playout and tee
+// or a list of STAGE=CPUS[@PRIO], CPUS as 0+2-3, e.g.
+//   net=0,tee=2-3@40,playout=1@50
+// SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO; without it the stage
+// stays SCHED_OTHER, is warned about once and reported as such.
+enum sched_stage
+{
+    SCHED_STAGE_NET,
+    SCHED_STAGE_TEE,
+    SCHED_STAGE_PLAYOUT,
+    SCHED_STAGES,
+    SCHED_STAGE_BACKGROUND = SCHED_STAGES, // startup placement
+};
+
+#define SCHED_PRIO_PLAYOUT 50
+#define SCHED_PRIO_TEE 40
+
+struct sched_profile
+{
+    char name[64];
+    cpu_set_t cpus[SCHED_STAGES];
+    int priority[SCHED_STAGES];
+};
+
+// fills profile from a name or a STAGE=CPUS list, 0 if spec is neither
+int sched_parse(const char *spec, struct sched_profile *profile);
+// the profile sched_enter() applies from now on
+void sched_use(const struct sched_profile *profile);
+// places the calling thread, returns 0 if some of it could not be applied
+int sched_enter(enum sched_stage stage);
+// one line: the profile, the CPUs and isolated CPUs, each stage
+void sched_print();
+
+#endif
@@ -0,0 +1,373 @@
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include "tee.h"
+
+const char *rsa_scheme_name(uint32_t scheme)
+{
+    switch (scheme)
+    {
+    case TA_RSA_SCHEME_OAEP_SHA1:
+        return "oaep-sha1";
+    case TA_RSA_SCHEME_OAEP_SHA256:
+        return "oaep-sha256";
+    default:
+        return "pkcs1";
+    }
+}
+
+bool quiet = false;
+
+void init_tee_session(struct tee_attrs *ta)
+{
+    TEEC_UUID uuid = TA_MY_TEST_UUID;
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    /* Initialize a context connecting us to the TEE */
+    res = TEEC_InitializeContext(NULL, &ta->ctx);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InitializeContext failed with code 0x%x\n", res);
+
+    /* Open a session with the TA, choosing key size and padding */
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].value.a = ta->key_bits;
+    op.params[0].value.b = ta->scheme;
+    res = TEEC_OpenSession(&ta->ctx, &ta->sess, &uuid,
+                           TEEC_LOGIN_PUBLIC, NULL, &op, &origin);
+    if (res == TEEC_ERROR_ACCESS_CONFLICT)
+        errx(1, "\nThe TA holds keys of another --key-bits or --scheme for a client still running\n");
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_Opensession failed with code 0x%x origin 0x%x\n", res, origin);
+    ta->shared_keys = op.params[1].value.a != 0;
+    ta->instance_sessions = op.params[1].value.b;
+}
+
+// a shared TA instance (TA_SHARED_KEYS 1) keeps the keys of the session that
+// provisioned them, another client's commands that would replace them fail
+static void check_key_owner(TEEC_Result res)
+{
+    if (res == TEEC_ERROR_ACCESS_CONFLICT)
+        errx(1, "\nThe shared TA instance holds the keys of a client still running\n");
+}
+
+void terminate_tee_session(struct tee_attrs *ta)
+{
+    TEEC_CloseSession(&ta->sess);
+    TEEC_FinalizeContext(&ta->ctx);
+}
+
+void prepare_op(TEEC_Operation *op, char *in, size_t in_sz, char *out, size_t out_sz)
+{
+    memset(op, 0, sizeof(*op));
+
+    op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                                      TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_NONE, TEEC_NONE);
+    op->params[0].tmpref.buffer = in;
+    op->params[0].tmpref.size = in_sz;
+    op->params[1].tmpref.buffer = out;
+    op->params[1].tmpref.size = out_sz;
+}
+
+void prepare_op_out_out(TEEC_Operation *op, void *out1, size_t out1_sz, void *out2, size_t out2_sz)
+{
+    memset(op, 0, sizeof(*op));
+
+    op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_MEMREF_TEMP_OUTPUT,
+                                      TEEC_NONE, TEEC_NONE);
+    op->params[0].tmpref.buffer = out1;
+    op->params[0].tmpref.size = out1_sz;
+    op->params[1].tmpref.buffer = out2;
+    op->params[1].tmpref.size = out2_sz;
+}
+
+void rsa_gen_keys(struct tee_attrs *ta)
+{
+    TEEC_Result res;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_GENKEYS, NULL, NULL);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_GENKEYS) failed %#x\n", res);
+    if (!quiet)
+        printf("\n=========== Keys already generated. ==========\n");
+}
+
+void rsa_store_key(struct tee_attrs *ta, const char *id)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)id;
+    op.params[0].tmpref.size = strlen(id);
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_STORE_KEY, &op, &origin);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_STORE_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    printf("\n=========== Keys stored as %s. ==========\n", id);
+}
+
+void rsa_load_key(struct tee_attrs *ta, const char *id)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)id;
+    op.params[0].tmpref.size = strlen(id);
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_LOAD_KEY, &op, &origin);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_LOAD_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    printf("\n=========== Keys %s loaded. ==========\n", id);
+}
+
+void rsa_load_pending_key(struct tee_attrs *ta, const char *id, uint32_t key_id)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)id;
+    op.params[0].tmpref.size = strlen(id);
+    op.params[1].value.a = key_id;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_LOAD_PENDING_KEY, &op, &origin);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_LOAD_PENDING_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    printf("\n=========== Key %u staged from %s. ==========\n", key_id, id);
+}
+
+void rsa_encrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+    if (!quiet)
+        printf("\n============ RSA ENCRYPT CA SIDE ============\n");
+    prepare_op(&op, in, in_sz, out, out_sz);
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_ENCRYPT,
+                             &op, &origin);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_ENCRYPT) failed 0x%x origin 0x%x\n",
+             res, origin);
+    if (!quiet)
+        printf("\nThe text sent was encrypted: %s\n", out);
+}
+
+size_t rsa_decrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz,
+                   uint32_t key_id)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+    if (!quiet)
+        printf("\n============ RSA DECRYPT CA SIDE ============\n");
+    prepare_op(&op, in, in_sz, out, out_sz);
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                                     TEEC_MEMREF_TEMP_OUTPUT,
+                                     TEEC_VALUE_INPUT, TEEC_NONE);
+    op.params[2].value.a = key_id;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_DECRYPT, &op, &origin);
+    if (res != TEEC_SUCCESS)
+    {
+        printf("TEEC_InvokeCommand(TA_RSA_CMD_DECRYPT) failed 0x%x origin 0x%x\n", res, origin);
+        return DECRYPT_FAILED;
+    }
+    if (!quiet)
+        printf("\nThe text sent was decrypted: %s\n", (char *)op.params[1].tmpref.buffer);
+    return op.params[1].tmpref.size;
+}
+
+void rsa_drop_crt(struct tee_attrs *ta)
+{
+    TEEC_Result res;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_DROP_CRT, NULL, NULL);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_DROP_CRT) failed %#x\n", res);
+}
+
+void rsa_get_pub_key(struct tee_attrs *ta, pub_key *pk)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    prepare_op_out_out(&op, pk->exponent, pk->exponentLen, pk->modulus, pk->modulusLen);
+    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_GET_PUB_KEY, &op, &origin);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_GET_PUB_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    pk->exponentLen = op.params[0].tmpref.size;
+    pk->modulusLen = op.params[1].tmpref.size;
+    if (quiet)
+        return;
+    printf("\n============== Public key ==============\n");
+    // print exponent and modulus
+    printf("Exponent %zu bytes:\n", op.params[0].tmpref.size);
+    for (uint32_t i = 0; i < pk->exponentLen; i++)
+    {
+        printf("%02x:", ((char *)pk->exponent)[i]);
+    }
+    printf("\n");
+    printf("Modulus %zu bytes:\n", op.params[1].tmpref.size);
+    for (uint32_t i = 0; i < pk->modulusLen; i++)
+    {
+        printf("%02x:", ((char *)pk->modulus)[i]);
+    }
+    printf("\n");
+}
+
+size_t ecdh_gen_key(struct tee_attrs *ta, uint32_t curve, uint8_t *pub, size_t pub_sz)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].value.a = curve;
+    op.params[1].tmpref.buffer = pub;
+    op.params[1].tmpref.size = pub_sz;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_ECDH_CMD_GEN_KEY, &op, &origin);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_ECDH_CMD_GEN_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    return op.params[1].tmpref.size;
+}
+
+void ecdh_derive(struct tee_attrs *ta, const uint8_t *peer, size_t peer_sz)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)peer;
+    op.params[0].tmpref.size = peer_sz;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_ECDH_CMD_DERIVE, &op, &origin);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_ECDH_CMD_DERIVE) failed 0x%x origin 0x%x\n",
+             res, origin);
+}
+
+size_t aes_decrypt_frame(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz, uint32_t seq,
+                         uint32_t block)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    prepare_op(&op, in, in_sz, out, out_sz);
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                                     TEEC_MEMREF_TEMP_OUTPUT,
+                                     TEEC_VALUE_INPUT, TEEC_NONE);
+    op.params[2].value.a = seq;
+    op.params[2].value.b = block;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_AES_CMD_DECRYPT_FRAME, &op, &origin);
+    if (res != TEEC_SUCCESS)
+    {
+        printf("TEEC_InvokeCommand(TA_AES_CMD_DECRYPT_FRAME) failed 0x%x origin 0x%x\n", res, origin);
+        return DECRYPT_FAILED;
+    }
+    return op.params[1].tmpref.size;
+}
+
+void aes_load_group_key(struct tee_attrs *ta, char *wrapped, size_t len, uint32_t wrap, uint32_t key_id)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = wrapped;
+    op.params[0].tmpref.size = len;
+    op.params[1].value.a = wrap;
+    op.params[1].value.b = key_id;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_AES_CMD_LOAD_GROUP_KEY, &op, &origin);
+    check_key_owner(res);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_AES_CMD_LOAD_GROUP_KEY) failed 0x%x origin 0x%x\n",
+             res, origin);
+    printf("\n=========== Group key loaded. ==========\n");
+}
+
+void share_keys(struct tee_attrs *ta, uint8_t token[TA_SHARE_TOKEN_SIZE])
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = token;
+    op.params[0].tmpref.size = TA_SHARE_TOKEN_SIZE;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_CMD_SHARE_KEYS, &op, &origin);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_CMD_SHARE_KEYS) failed 0x%x origin 0x%x\n", res, origin);
+}
+
+void attach_keys(struct tee_attrs *ta, const uint8_t token[TA_SHARE_TOKEN_SIZE])
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)token;
+    op.params[0].tmpref.size = TA_SHARE_TOKEN_SIZE;
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_CMD_ATTACH_KEYS, &op, &origin);
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_CMD_ATTACH_KEYS) failed 0x%x origin 0x%x\n", res, origin);
+}
+
+int ta_arena_stats(struct tee_attrs *ta, struct ta_arena_stats *st)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE);
+
+    res = TEEC_InvokeCommand(&ta->sess, TA_CMD_ARENA_STATS, &op, &origin);
+    if (res == TEEC_ERROR_NOT_SUPPORTED)
+        return 0;
+    if (res != TEEC_SUCCESS)
+        errx(1, "\nTEEC_InvokeCommand(TA_CMD_ARENA_STATS) failed 0x%x origin 0x%x\n", res, origin);
+    st->size = op.params[0].value.a;
+    st->high_water = op.params[0].value.b;
+    st->allocs = op.params[1].value.a;
+    st->refused = op.params[1].value.b;
+    return 1;
+}
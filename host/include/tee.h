@@ -0,0 +1,103 @@
+#ifndef TEE
+#define TEE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+#include "my_test_ta.h"
+
+// Thin wrappers around the TA commands, they exit on any TEE error except
+// for the per-frame ones (rsa_decrypt, aes_decrypt_frame): those return
+// DECRYPT_FAILED, one bad frame must not end the stream.
+#define DECRYPT_FAILED ((size_t)-1)
+
+#define RSA_MAX_KEY_SIZE 3072
+#define RSA_MAX_CIPHER_LEN (RSA_MAX_KEY_SIZE / 8)
+#define ECDH_MAX_PUB_LEN 65 // P-256 uncompressed point
+
+// public key
+#define BigIntSizeInU32(n) ((((n) + 31) / 32) + 2)
+
+class pub_key
+{
+public:
+    uint32_t exponentLen;
+    uint32_t *exponent;
+    uint32_t modulusLen;
+    uint32_t *modulus;
+
+    pub_key()
+    {
+        exponentLen = BigIntSizeInU32(RSA_MAX_KEY_SIZE) * sizeof(uint32_t);
+        exponent = new uint32_t[exponentLen];
+        modulusLen = BigIntSizeInU32(RSA_MAX_KEY_SIZE) * sizeof(uint32_t);
+        modulus = new uint32_t[modulusLen];
+    }
+
+    ~pub_key()
+    {
+        delete[] exponent;
+        delete[] modulus;
+    }
+};
+
+class tile_workers;
+
+struct tee_attrs
+{
+    TEEC_Context ctx;
+    TEEC_Session sess;
+    uint32_t key_bits; // negotiated when the session is opened
+    uint32_t scheme;   // TA_RSA_SCHEME_xxx
+    tile_workers *tiles; // more sessions for FRAME_VIDEO_TILED, NULL for none
+    bool shared_keys;    // the TA instance and its keys are shared by all sessions
+    uint32_t instance_sessions; // open on the instance when this one was
+};
+
+// don't print per operation, used by the benchmark
+extern bool quiet;
+
+const char *rsa_scheme_name(uint32_t scheme);
+void init_tee_session(struct tee_attrs *ta);
+void terminate_tee_session(struct tee_attrs *ta);
+void prepare_op(TEEC_Operation *op, char *in, size_t in_sz, char *out, size_t out_sz);
+void prepare_op_out_out(TEEC_Operation *op, void *out1, size_t out1_sz, void *out2, size_t out2_sz);
+void rsa_gen_keys(struct tee_attrs *ta);
+void rsa_store_key(struct tee_attrs *ta, const char *id);
+void rsa_load_key(struct tee_attrs *ta, const char *id);
+void rsa_load_pending_key(struct tee_attrs *ta, const char *id, uint32_t key_id);
+void rsa_encrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz);
+// returns the number of plain text bytes or DECRYPT_FAILED
+size_t rsa_decrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz,
+                   uint32_t key_id = TA_RSA_KEY_ID_ACTIVE);
+void rsa_drop_crt(struct tee_attrs *ta);
+void rsa_get_pub_key(struct tee_attrs *ta, pub_key *pk);
+// returns the length of the public key written to pub
+size_t ecdh_gen_key(struct tee_attrs *ta, uint32_t curve, uint8_t *pub, size_t pub_sz);
+void ecdh_derive(struct tee_attrs *ta, const uint8_t *peer, size_t peer_sz);
+// returns the number of plain text bytes or DECRYPT_FAILED
+// block is the CTR block the cipher text starts at, non-zero for a tile
+size_t aes_decrypt_frame(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz, uint32_t seq,
+                         uint32_t block = 0);
+// group content key from the fan-out server, wrapped for this client
+void aes_load_group_key(struct tee_attrs *ta, char *wrapped, size_t len, uint32_t wrap, uint32_t key_id);
+// on a shared instance, a token from the session that provisioned the keys;
+// sessions attached with it decrypt with those keys until that one closes
+void share_keys(struct tee_attrs *ta, uint8_t token[TA_SHARE_TOKEN_SIZE]);
+void attach_keys(struct tee_attrs *ta, const uint8_t token[TA_SHARE_TOKEN_SIZE]);
+
+// the session's scratch arena in the TA, see ta/arena_ta.h
+struct ta_arena_stats
+{
+    uint32_t size;
+    uint32_t high_water;
+    uint32_t allocs;
+    uint32_t refused;
+};
+// 0 if the TA does not report it (an older TA, or the mock TEE)
+int ta_arena_stats(struct tee_attrs *ta, struct ta_arena_stats *st);
+
+#endif
@@ -0,0 +1,140 @@
+#include "frame_trace.h"
+#include "sched_profile.h"
+#include "tee_async.h"
+#include "timing.h"
+
+tee_call::tee_call(tee_invoker *invoker, std::function<size_t()> fn) : invoker(invoker)
+{
+    job.fn = fn;
+    job.result = 0;
+    job.done = false;
+}
+
+void tee_call::await_suspend(std::coroutine_handle<> waiter)
+{
+    job.waiter = waiter;
+    invoker->submit(&job);
+}
+
+tee_invoker::tee_invoker(int threads) : stopping(false)
+{
+    for (int i = 0; i < threads; i++)
+        workers.push_back(std::thread(&tee_invoker::run, this));
+}
+
+tee_invoker::~tee_invoker()
+{
+    drain();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+tee_call tee_invoker::invoke(std::function<size_t()> fn)
+{
+    return tee_call(this, fn);
+}
+
+tee_call tee_invoker::decrypt(struct tee_attrs *ta, const struct decrypt_engine *engine,
+                              const struct frame_header *hdr, char *in, char *out)
+{
+    // the header is copied, the caller's may be reused before the call runs
+    struct frame_header h = *hdr;
+    return tee_call(this, [=]() mutable {
+        uint64_t t0 = monotonic_ns();
+        size_t n = engine->decrypt(ta, &h, in, out);
+        trace_record(TRACE_TEE, h.seq, t0, monotonic_ns());
+        return n;
+    });
+}
+
+tee_call tee_invoker::rsa_encrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz)
+{
+    return tee_call(this, [=]() {
+        ::rsa_encrypt(ta, in, in_sz, out, out_sz);
+        return out_sz;
+    });
+}
+
+tee_call tee_invoker::rsa_decrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz,
+                                  uint32_t key_id)
+{
+    return tee_call(this, [=]() { return ::rsa_decrypt(ta, in, in_sz, out, out_sz, key_id); });
+}
+
+void tee_invoker::submit(tee_job *job)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued.push_back(job);
+        submitted.push_back(job);
+    }
+    work.notify_one();
+}
+
+void tee_invoker::run()
+{
+    sched_enter(SCHED_STAGE_TEE);
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;)
+    {
+        work.wait(guard, [this] { return !queued.empty() || stopping; });
+        if (queued.empty())
+            return;
+        tee_job *job = queued.front();
+        queued.pop_front();
+        guard.unlock();
+
+        size_t result = job->fn();
+
+        guard.lock();
+        job->result = result;
+        job->done = true;
+        finished.notify_all();
+    }
+}
+
+int tee_invoker::poll()
+{
+    std::vector<tee_job *> ready;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // in order: a finished job waits for the older ones
+        while (!submitted.empty() && submitted.front()->done)
+        {
+            ready.push_back(submitted.front());
+            submitted.pop_front();
+        }
+    }
+    // a resumed coroutine may submit again or end and free the job
+    for (tee_job *job : ready)
+        job->waiter.resume();
+    return ready.size();
+}
+
+int tee_invoker::wait()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] { return submitted.empty() || submitted.front()->done; });
+    }
+    return poll();
+}
+
+void tee_invoker::drain()
+{
+    while (wait() > 0)
+        ;
+}
+
+size_t tee_invoker::in_flight()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return submitted.size();
+}
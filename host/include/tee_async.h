@@ -0,0 +1,105 @@
+#ifndef TEE_ASYNC
+#define TEE_ASYNC
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "decrypt_engine.h"
+#include "tee.h"
+
+// Awaitable TEE commands. TEEC_InvokeCommand() blocks for the whole secure
+// world call, so a tee_invoker runs the calls on a few threads of its own
+// and the caller's coroutine is suspended meanwhile:
+//
+//     size_t n = co_await tee.decrypt(ta, engine, &hdr, in, out);
+//
+// Coroutines are resumed by poll()/wait() on the thread that owns the
+// invoker, never on an invoker thread, and in the order they were
+// suspended, so the code after co_await needs no locking and frames come
+// out in order. Commands on the same session are still serialized by the
+// TA; more threads only help across sessions, or to overlap one session's
+// calls with the network.
+
+struct tee_job
+{
+    std::function<size_t()> fn;
+    std::coroutine_handle<> waiter;
+    size_t result;
+    bool done;
+};
+
+class tee_invoker;
+
+// one TEE command, co_await yields what the command returns
+class tee_call
+{
+public:
+    tee_call(tee_invoker *invoker, std::function<size_t()> fn);
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> waiter);
+    size_t await_resume() const noexcept { return job.result; }
+
+private:
+    tee_invoker *invoker;
+    tee_job job; // in the suspended coroutine's frame until it is resumed
+};
+
+// Coroutine nobody waits for, e.g. one per frame. It runs up to its first
+// co_await when called and frees itself when it returns.
+struct tee_task
+{
+    struct promise_type
+    {
+        tee_task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // the TEE wrappers return DECRYPT_FAILED or errx(), nothing is thrown
+        void unhandled_exception() { abort(); }
+    };
+};
+
+class tee_invoker
+{
+public:
+    tee_invoker(int threads);
+    ~tee_invoker();
+
+    tee_call invoke(std::function<size_t()> fn);
+    tee_call decrypt(struct tee_attrs *ta, const struct decrypt_engine *engine, const struct frame_header *hdr,
+                     char *in, char *out);
+    tee_call rsa_encrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz);
+    tee_call rsa_decrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz,
+                         uint32_t key_id = TA_RSA_KEY_ID_ACTIVE);
+
+    // resumes the coroutines whose commands finished, returns how many
+    int poll();
+    // like poll(), but waits until at least one is resumed; 0 if none is suspended
+    int wait();
+    // resumes everything in flight, including what the resumed ones start
+    void drain();
+    size_t in_flight();
+
+private:
+    friend class tee_call;
+    void submit(tee_job *job);
+    void run();
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable work;     // for the invoker threads
+    std::condition_variable finished; // for wait()
+    std::deque<tee_job *> queued;     // not picked up by a thread yet
+    std::deque<tee_job *> submitted;  // every job in flight, oldest first
+    bool stopping;
+};
+
+#endif
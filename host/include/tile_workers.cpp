@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include "decrypt_engine.h"
+#include "sched_profile.h"
+#include "tile_workers.h"
+
+tile_workers::tile_workers(struct tee_attrs *ta, int sessions, const char *key_object)
+    : ta(ta), stopping(false), generation(0), seq(0), tiles(NULL), count(0), next(0), finished(0),
+      failed(false), cipher(NULL), out(NULL), frames(0), tile_count(0), session_tiles(sessions > 1 ? sessions : 1)
+{
+    uint8_t token[TA_SHARE_TOKEN_SIZE];
+
+    // on a shared instance the keys are there already, the workers attach to them
+    if (ta->shared_keys && sessions > 1)
+        share_keys(ta, token);
+    for (int i = 1; i < sessions; i++)
+    {
+        struct tee_attrs *s = new struct tee_attrs;
+        s->key_bits = ta->key_bits;
+        s->scheme = ta->scheme;
+        s->tiles = NULL;
+        init_tee_session(s);
+        if (s->shared_keys)
+            attach_keys(s, token);
+        else
+            rsa_load_key(s, key_object);
+        this->sessions.push_back(s);
+    }
+    for (size_t i = 0; i < this->sessions.size(); i++)
+        threads.push_back(std::thread(&tile_workers::run, this, i + 1));
+}
+
+tile_workers::~tile_workers()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+    for (struct tee_attrs *s : sessions)
+    {
+        terminate_tee_session(s);
+        delete s;
+    }
+}
+
+void tile_workers::load_group_key(char *wrapped, size_t len, uint32_t wrap, uint32_t key_id)
+{
+    // only between frames, the workers are idle
+    for (struct tee_attrs *s : sessions)
+        if (!s->shared_keys)
+            aes_load_group_key(s, wrapped, len, wrap, key_id);
+}
+
+void tile_workers::take_tiles(struct tee_attrs *session, int index, std::unique_lock<std::mutex> &guard)
+{
+    while (next < count)
+    {
+        const struct frame_tile *t = &tiles[next++];
+        guard.unlock();
+
+        // out is FRAME_MAX_LEN bytes, whatever the tile claims
+        size_t n = aes_decrypt_frame(session, cipher + t->offset, t->length, out + t->offset,
+                                     FRAME_MAX_LEN - t->offset, seq, t->offset / FRAME_TILE_ALIGN);
+
+        guard.lock();
+        if (n != t->length)
+            failed = true;
+        session_tiles[index]++;
+        if (++finished == count)
+            done.notify_one();
+    }
+}
+
+void tile_workers::run(int index)
+{
+    struct tee_attrs *session = sessions[index - 1];
+    sched_enter(SCHED_STAGE_TEE);
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t seen = 0;
+
+    for (;;)
+    {
+        work.wait(guard, [&] { return generation != seen || stopping; });
+        if (stopping)
+            return;
+        seen = generation;
+        take_tiles(session, index, guard);
+    }
+}
+
+size_t tile_workers::decrypt(uint32_t frame_seq, const struct frame_tile *frame_tiles, uint32_t frame_count,
+                             char *frame_cipher, size_t len, char *frame_out)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    seq = frame_seq;
+    tiles = frame_tiles;
+    count = frame_count;
+    cipher = frame_cipher;
+    out = frame_out;
+    next = 0;
+    finished = 0;
+    failed = false;
+    generation++;
+    work.notify_all();
+
+    // the main session takes tiles too, then waits for the ones still running
+    take_tiles(ta, 0, guard);
+    done.wait(guard, [this] { return finished == count; });
+
+    frames++;
+    tile_count += count;
+    return failed ? DECRYPT_FAILED : len;
+}
+
+void tile_workers::print_stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    double n = frames ? frames : 1;
+
+    printf("Tiles: %lu frames on %zu sessions, %.1f tiles/frame, tiles per session:", (unsigned long)frames,
+           session_tiles.size(), tile_count / n);
+    for (uint64_t t : session_tiles)
+        printf(" %lu", (unsigned long)t);
+    printf("\n");
+}
@@ -0,0 +1,65 @@
+#ifndef TILE_WORKERS
+#define TILE_WORKERS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "protocol.h"
+#include "tee.h"
+
+// Decrypts the tiles of one FRAME_VIDEO_TILED frame on several TEE sessions
+// at once. The TA runs the commands of a session one at a time, so every
+// worker thread owns a session and the calling thread keeps working on the
+// main one. Tiles are handed out one by one, a slow tile does not hold the
+// others up. On a TA built for an instance per session (TA_SHARED_KEYS 0)
+// a worker loads the RSA key from secure storage and unwraps the group key
+// itself, so tiles need RSA key transport. On a shared instance (the
+// default) the workers attach to the keys of the main session, but OP-TEE
+// runs their commands one at a time.
+class tile_workers
+{
+public:
+    // sessions includes the main one, so sessions - 1 threads are started
+    tile_workers(struct tee_attrs *ta, int sessions, const char *key_object);
+    ~tile_workers();
+
+    // the main session loads it as well, by the caller
+    void load_group_key(char *wrapped, size_t len, uint32_t wrap, uint32_t key_id);
+    // returns the cipher text length or DECRYPT_FAILED if any tile fails
+    size_t decrypt(uint32_t seq, const struct frame_tile *tiles, uint32_t count, char *cipher, size_t len,
+                   char *out);
+    void print_stats();
+
+private:
+    void run(int index);
+    // decrypts tiles of the current frame until none are left, lock held on entry and exit
+    void take_tiles(struct tee_attrs *session, int index, std::unique_lock<std::mutex> &guard);
+
+    struct tee_attrs *ta;
+    std::vector<struct tee_attrs *> sessions; // worker sessions, not the main one
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable work; // a frame was posted
+    std::condition_variable done; // its last tile finished
+    bool stopping;
+
+    // the frame being decrypted
+    uint64_t generation; // bumped per frame, workers wait for a new one
+    uint32_t seq;
+    const struct frame_tile *tiles;
+    uint32_t count;
+    uint32_t next;     // first tile nobody took yet
+    uint32_t finished;
+    bool failed;
+    char *cipher;
+    char *out;
+
+    uint64_t frames;
+    uint64_t tile_count;
+    std::vector<uint64_t> session_tiles; // tiles each session decrypted, main first
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef TIMING
+#define TIMING
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+// monotonic clock in nanoseconds, used for pacing and latency numbers
+static inline uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// wall clock in microseconds, comparable across hosts as far as they are in sync
+static inline uint64_t realtime_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// sleep until an absolute CLOCK_MONOTONIC deadline
+static inline void sleep_until_ns(uint64_t deadline_ns)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ull;
+    ts.tv_nsec = deadline_ns % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include "timing.h"
+#include "video_decoder.h"
+
+#ifdef TZS_HAVE_LIBAV
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+}
+#endif
+
+video_decoder::video_decoder() : ctx(NULL), picture(NULL), packet(NULL), need_keyframe(true)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+#ifdef TZS_HAVE_LIBAV
+
+video_decoder::~video_decoder()
+{
+    avcodec_free_context(&ctx);
+    av_frame_free(&picture);
+    av_packet_free(&packet);
+}
+
+bool video_decoder::open(uint32_t codec, uint32_t width, uint32_t height)
+{
+    enum AVCodecID id;
+
+    switch (codec)
+    {
+    case STREAM_CODEC_H264:
+        id = AV_CODEC_ID_H264;
+        break;
+    case STREAM_CODEC_VP8:
+        id = AV_CODEC_ID_VP8;
+        break;
+    default:
+        return false;
+    }
+    const AVCodec *decoder = avcodec_find_decoder(id);
+    if (!decoder)
+        return false;
+
+    // a new stream, from a restarted server, starts over at its keyframe
+    avcodec_free_context(&ctx);
+    ctx = avcodec_alloc_context3(decoder);
+    ctx->width = width;
+    ctx->height = height;
+    // frame threads would hold back a picture per thread, slices do not
+    ctx->thread_type = FF_THREAD_SLICE;
+    ctx->thread_count = 0;
+    ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    if (avcodec_open2(ctx, decoder, NULL) < 0)
+    {
+        avcodec_free_context(&ctx);
+        return false;
+    }
+    if (!picture)
+        picture = av_frame_alloc();
+    if (!packet)
+        packet = av_packet_alloc();
+    need_keyframe = true;
+    return true;
+}
+
+size_t video_decoder::decode(const struct frame_header *hdr, char *frame, size_t n, size_t frame_sz)
+{
+    if (!ctx)
+        return n;
+    stats.packets++;
+    if (need_keyframe && !(hdr->flags & FRAME_FLAG_KEYFRAME))
+    {
+        stats.waited++;
+        return 0;
+    }
+    need_keyframe = false;
+
+    uint64_t t0 = monotonic_ns();
+    // not reference counted, so the decoder copies it and frame is free for the picture
+    packet->data = (uint8_t *)frame;
+    packet->size = n;
+    packet->pts = hdr->pts_us;
+    packet->flags = hdr->flags & FRAME_FLAG_KEYFRAME ? AV_PKT_FLAG_KEY : 0;
+    int ret = avcodec_send_packet(ctx, packet);
+    av_packet_unref(packet);
+
+    size_t size = 0;
+    while (ret >= 0 && (ret = avcodec_receive_frame(ctx, picture)) == 0)
+    {
+        // low delay without B frames gives one picture per packet, a late one replaces it
+        enum AVPixelFormat format = (enum AVPixelFormat)picture->format;
+        int len = av_image_get_buffer_size(format, picture->width, picture->height, 1);
+        if (len < 0 || (size_t)len > frame_sz)
+        {
+            stats.too_large++;
+            size = 0;
+        }
+        else
+        {
+            av_image_copy_to_buffer((uint8_t *)frame, frame_sz, picture->data, picture->linesize, format,
+                                    picture->width, picture->height, 1);
+            size = len;
+        }
+        av_frame_unref(picture);
+    }
+    if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+    {
+        // the references are gone, only a keyframe repairs that
+        avcodec_flush_buffers(ctx);
+        need_keyframe = true;
+        stats.errors++;
+        return 0;
+    }
+    stats.decode_ns += monotonic_ns() - t0;
+    if (size)
+        stats.pictures++;
+    return size;
+}
+
+void video_decoder::print_stats()
+{
+    if (!ctx)
+        return;
+    printf("Video (%s %dx%d): %lu packets, %lu pictures, %lu waited for a keyframe, %lu decode errors, "
+           "%lu too large, %.3f ms/packet decode\n",
+           ctx->codec->name, ctx->width, ctx->height, (unsigned long)stats.packets, (unsigned long)stats.pictures,
+           (unsigned long)stats.waited, (unsigned long)stats.errors, (unsigned long)stats.too_large,
+           stats.packets ? stats.decode_ns / 1e6 / stats.packets : 0.0);
+}
+
+#else
+
+video_decoder::~video_decoder()
+{
+}
+
+bool video_decoder::open(uint32_t, uint32_t, uint32_t)
+{
+    return false;
+}
+
+size_t video_decoder::decode(const struct frame_header *, char *, size_t n, size_t)
+{
+    return n;
+}
+
+void video_decoder::print_stats()
+{
+}
+
+#endif
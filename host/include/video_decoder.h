@@ -0,0 +1,55 @@
+#ifndef VIDEO_DECODER
+#define VIDEO_DECODER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+
+// Codec streams: each FRAME_FLAG_PACKET frame carries one encoded packet
+// (an access unit, H.264 in Annex B with its parameter sets in band on
+// keyframes), so the packet boundaries are the frame boundaries and only
+// compressed bytes go through the TEE. The decoder context lives as long
+// as the stream and decodes into frames from its own buffer pool; one
+// AVFrame and one AVPacket are reused for every packet. Nothing is fed
+// before the first keyframe, and after a decode error nothing is fed until
+// the next one, so a viewer joins or recovers at a keyframe.
+// Needs libavcodec (TZS_HAVE_LIBAV), without it packets pass undecoded.
+
+struct video_stats
+{
+    uint64_t packets;
+    uint64_t pictures;
+    uint64_t waited;    // packets dropped while waiting for a keyframe
+    uint64_t errors;
+    uint64_t too_large; // pictures that do not fit the frame buffer
+    uint64_t decode_ns;
+};
+
+class video_decoder
+{
+public:
+    video_decoder();
+    ~video_decoder();
+
+    // from FRAME_STREAM_INFO, false if the codec is not built in
+    bool open(uint32_t codec, uint32_t width, uint32_t height);
+    bool is_open() const { return ctx != NULL; }
+    // frame holds the decrypted packet, n bytes. On return it holds the
+    // picture as packed YUV 4:2:0 planes; returns its size, or 0 if there
+    // is no picture for this packet.
+    size_t decode(const struct frame_header *hdr, char *frame, size_t n, size_t frame_sz);
+    void print_stats();
+
+private:
+    struct AVCodecContext *ctx;
+    struct AVFrame *picture;
+    struct AVPacket *packet;
+    bool need_keyframe;
+    struct video_stats stats;
+};
+
+#endif
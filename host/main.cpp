@@ -7,243 +7,1082 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
-
-/* OP-TEE TEE client API (built by optee_client) */
-#include <tee_client_api.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 /* For the UUID (found in the TA's h-file(s)) */
 #include "my_test_ta.h" //#include <my_test_ta.h>
 #include "include/client.h"
+#include "include/decrypt_engine.h"
+#include "include/delta.h"
+#include "include/frame_trace.h"
+#include "include/video_decoder.h"
+#include "include/frame_ring.h"
+#include "include/hex_dump.h"
+#include "include/perf_report.h"
+#include "include/playout.h"
+#include "include/sched_profile.h"
+#include "include/tee.h"
+#include "include/tee_async.h"
+#include "include/tile_workers.h"
+#include "include/timing.h"
 
-#define RSA_KEY_SIZE 1024
-#define BUFFER_SIZE 1 << 16
-#define RSA_MAX_PLAIN_LEN_1024 (RSA_KEY_SIZE / 8) - 42
-#define RSA_CIPHER_LEN_1024 (RSA_KEY_SIZE / 8)
-
-// public key
-#define BigIntSizeInU32(n) ((((n) + 31) / 32) + 2)
+#define RSA_KEY_SIZE 2048
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_MAX_BACKOFF_MS 2000
+#define TILE_KEY_OBJECT "tiles"
+#define BENCH_SCHED_FRAME (64 * 1024)
+#define BENCH_SCHED_PERIOD_NS 5000000ull // 200 frames/s
 
 // decrypted frame
 char *decrypted_frame;
+// frames the TA failed to decrypt, skipped
+uint64_t tee_errors;
+// frames decrypted on the receive thread, for comparing modes
+uint64_t decrypt_count, decrypt_ns, max_decrypt_ns;
+// last frame shown, delta frames are patched into it
+delta_decoder delta;
+// codec streams, packets are decoded into pictures
+video_decoder video;
+// VOD prefetch window, frames and bytes, told to the server on every connection
+uint32_t prefetch[2];
 
-class pub_key
+// 0 if the connection dropped meanwhile
+int send_stream_options()
 {
-public:
-    uint32_t exponentLen;
-    uint32_t *exponent;
-    uint32_t modulusLen;
-    uint32_t *modulus;
+    if (prefetch[0] > 0 && !send_message(MSG_PREFETCH, prefetch, sizeof(prefetch)))
+        return 0;
+    // server timestamps for --trace
+    if (trace_enabled() && !send_message(MSG_TRACE, NULL, 0))
+        return 0;
+    return 1;
+}
 
-    pub_key()
-    {
-        exponentLen = BigIntSizeInU32(RSA_KEY_SIZE) * sizeof(uint32_t);
-        exponent = new uint32_t[exponentLen];
-        modulusLen = BigIntSizeInU32(RSA_KEY_SIZE) * sizeof(uint32_t);
-        modulus = new uint32_t[modulusLen];
-    }
+size_t timed_decrypt(const struct decrypt_engine *engine, struct tee_attrs *ta, const struct frame_header *hdr,
+                     char *in, char *out)
+{
+    uint64_t t0 = monotonic_ns();
+    size_t n = engine->decrypt(ta, hdr, in, out);
+    uint64_t ns = monotonic_ns() - t0;
 
-    ~pub_key()
-    {
-        delete[] exponent;
-        delete[] modulus;
-    }
-};
+    trace_record(TRACE_TEE, hdr->seq, t0, t0 + ns);
+    decrypt_count++;
+    decrypt_ns += ns;
+    if (ns > max_decrypt_ns)
+        max_decrypt_ns = ns;
+    return n;
+}
 
-struct tee_attrs
+// Startup steps, the connect runs next to the TEE ones. Reported once the
+// first frame is decrypted.
+struct startup_times
 {
-    TEEC_Context ctx;
-    TEEC_Session sess;
-};
+    uint64_t start_ns;
+    uint64_t tee_ns;     // session open
+    uint64_t keygen_ns;  // RSA or ECDH key pair
+    uint64_t connect_ns; // TCP connect, in parallel with the two above
+    uint64_t ready_ns;   // both done, handshake starts
+    uint64_t first_frame_ns;
+} startup;
 
-void init_tee_session(struct tee_attrs *ta)
+void first_frame_done()
 {
-    TEEC_UUID uuid = TA_MY_TEST_UUID;
-    uint32_t origin;
-    TEEC_Result res;
+    if (startup.first_frame_ns)
+        return;
+    startup.first_frame_ns = monotonic_ns();
+    printf("Time to first frame: %.3f ms (TEE session %.3f ms, keygen %.3f ms, connect %.3f ms in parallel, "
+           "handshake to first frame %.3f ms)\n",
+           (startup.first_frame_ns - startup.start_ns) / 1e6, startup.tee_ns / 1e6, startup.keygen_ns / 1e6,
+           startup.connect_ns / 1e6, (startup.first_frame_ns - startup.ready_ns) / 1e6);
+}
 
-    /* Initialize a context connecting us to the TEE */
-    res = TEEC_InitializeContext(NULL, &ta->ctx);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_InitializeContext failed with code 0x%x\n", res);
+// Decrypted plain text to the frame to show, in place. 0 if there is none:
+// the TEE failed, a delta frame has no base yet, or a packet gave no picture.
+size_t finish_frame(const struct frame_header *hdr, char *out, size_t n)
+{
+    uint64_t t0 = monotonic_ns();
 
-    /* Open a session with the TA */
-    res = TEEC_OpenSession(&ta->ctx, &ta->sess, &uuid,
-                           TEEC_LOGIN_PUBLIC, NULL, NULL, &origin);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_Opensession failed with code 0x%x origin 0x%x\n", res, origin);
+    if (n == DECRYPT_FAILED)
+    {
+        tee_errors++;
+        return 0;
+    }
+    if (hdr->flags & FRAME_FLAG_PACKET)
+        n = video.decode(hdr, out, n, FRAME_MAX_LEN);
+    else
+        n = delta.apply(hdr, out, n);
+    trace_record(TRACE_DECODE, hdr->seq, t0, monotonic_ns());
+    if (n)
+        perf_done(hdr->seq);
+    return n;
 }
 
-void terminate_tee_session(struct tee_attrs *ta)
+// Ephemeral ECDH with the server, the AES key is derived and kept in the TA.
+// pub is the key pair generated while connecting. Returns 0 if the server
+// did not answer with its public key.
+int ecdh_handshake(struct tee_attrs *ta, uint32_t curve, const uint8_t *pub, uint32_t pub_len)
 {
-    TEEC_CloseSession(&ta->sess);
-    TEEC_FinalizeContext(&ta->ctx);
+    uint8_t msg[8 + ECDH_MAX_PUB_LEN];
+    uint32_t peer_curve, peer_len;
+    struct frame_header hdr;
+    uint64_t t1, t2, t3;
+
+    memcpy(msg, &curve, 4);
+    memcpy(msg + 4, &pub_len, 4);
+    memcpy(msg + 8, pub, pub_len);
+    t1 = monotonic_ns();
+    if (!send_message(MSG_ECDH_PUB, msg, 8 + pub_len))
+        return 0;
+    if (receive_frame(&hdr) < 0 || hdr.type != FRAME_ECDH_PUB || hdr.length < 8)
+        return 0;
+    memcpy(&peer_curve, buffer, 4);
+    memcpy(&peer_len, buffer + 4, 4);
+    if (peer_curve != curve || peer_len != hdr.length - 8)
+        return 0;
+    t2 = monotonic_ns();
+    ecdh_derive(ta, (uint8_t *)buffer + 8, peer_len);
+    t3 = monotonic_ns();
+    printf("ECDH %s handshake: keygen %.3f ms, exchange %.3f ms, derive %.3f ms, total %.3f ms\n",
+           curve == TA_ECDH_CURVE_X25519 ? "x25519" : "p256", startup.keygen_ns / 1e6, (t2 - t1) / 1e6,
+           (t3 - t2) / 1e6, (startup.keygen_ns + t3 - t1) / 1e6);
+    return 1;
 }
 
-void prepare_op(TEEC_Operation *op, char *in, size_t in_sz, char *out, size_t out_sz)
+void test(struct tee_attrs &ta, const struct decrypt_engine &engine)
 {
-    memset(op, 0, sizeof(*op));
-
-    op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
-                                      TEEC_MEMREF_TEMP_OUTPUT,
-                                      TEEC_NONE, TEEC_NONE);
-    op->params[0].tmpref.buffer = in;
-    op->params[0].tmpref.size = in_sz;
-    op->params[1].tmpref.buffer = out;
-    op->params[1].tmpref.size = out_sz;
+    char clear[RSA_MAX_CIPHER_LEN] = "0123456789";
+    char ciph[RSA_MAX_CIPHER_LEN];
+    // print clear in hex
+    for (size_t i = 0; i < engine.plain_len; i++)
+    {
+        printf("%02x:", clear[i]);
+    }
+    printf("\n");
+    rsa_encrypt(&ta, clear, engine.plain_len, ciph, engine.cipher_len);
+    // print ciph in hex
+    for (size_t i = 0; i < engine.cipher_len; i++)
+    {
+        printf("%02x:", ciph[i]);
+    }
+    printf("\n");
+    rsa_decrypt(&ta, ciph, engine.cipher_len, clear, engine.plain_len);
 }
 
-void prepare_op_out_out(TEEC_Operation *op, void *out1, size_t out1_sz, void *out2, size_t out2_sz)
+// Per operation cost of each key size and scheme, private key operations
+// with and without the CRT parameters TEE_GenerateKey() produces.
+void bench_rsa(int iterations)
 {
-    memset(op, 0, sizeof(*op));
+    const uint32_t sizes[] = {1024, 2048, 3072};
+    const uint32_t schemes[] = {TA_RSA_SCHEME_PKCS1_V1_5, TA_RSA_SCHEME_OAEP_SHA1, TA_RSA_SCHEME_OAEP_SHA256};
+    char clear[RSA_MAX_CIPHER_LEN];
+    char ciph[RSA_MAX_CIPHER_LEN];
+    char out[RSA_MAX_CIPHER_LEN];
+
+    quiet = true;
+    memset(clear, 0x5a, sizeof(clear));
+    printf("%5s %-12s %10s %10s %10s %12s %6s %10s\n", "bits", "scheme", "keygen ms",
+           "enc us", "dec us", "dec noCRT us", "chunk", "dec KB/s");
+    for (uint32_t bits : sizes)
+    {
+        for (uint32_t scheme : schemes)
+        {
+            struct tee_attrs ta;
+            ta.key_bits = bits;
+            ta.scheme = scheme;
+            ta.tiles = NULL;
+            const struct decrypt_engine &engine = *find_decrypt_engine(FRAME_VIDEO, bits, scheme);
+            uint64_t t0, keygen_ns, enc_ns, dec_ns, dec_nocrt_ns;
+
+            init_tee_session(&ta);
+            t0 = monotonic_ns();
+            rsa_gen_keys(&ta);
+            keygen_ns = monotonic_ns() - t0;
+
+            t0 = monotonic_ns();
+            for (int i = 0; i < iterations; i++)
+                rsa_encrypt(&ta, clear, engine.plain_len, ciph, engine.cipher_len);
+            enc_ns = monotonic_ns() - t0;
+
+            t0 = monotonic_ns();
+            for (int i = 0; i < iterations; i++)
+                rsa_decrypt(&ta, ciph, engine.cipher_len, out, engine.plain_len);
+            dec_ns = monotonic_ns() - t0;
 
-    op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT,
-                                      TEEC_MEMREF_TEMP_OUTPUT,
-                                      TEEC_NONE, TEEC_NONE);
-    op->params[0].tmpref.buffer = out1;
-    op->params[0].tmpref.size = out1_sz;
-    op->params[1].tmpref.buffer = out2;
-    op->params[1].tmpref.size = out2_sz;
+            rsa_drop_crt(&ta);
+            t0 = monotonic_ns();
+            for (int i = 0; i < iterations; i++)
+                rsa_decrypt(&ta, ciph, engine.cipher_len, out, engine.plain_len);
+            dec_nocrt_ns = monotonic_ns() - t0;
+            terminate_tee_session(&ta);
+
+            printf("%5u %-12s %10.1f %10.1f %10.1f %12.1f %6zu %10.1f\n", bits, rsa_scheme_name(scheme),
+                   keygen_ns / 1e6, enc_ns / 1e3 / iterations, dec_ns / 1e3 / iterations,
+                   dec_nocrt_ns / 1e3 / iterations, engine.plain_len,
+                   engine.plain_len * iterations / (dec_ns / 1e9) / 1024);
+        }
+    }
+    quiet = false;
 }
 
-void rsa_gen_keys(struct tee_attrs *ta)
+// one frame from the main thread to the invoker thread and back
+tee_task bench_sched_frame(tee_invoker *invoker, struct tee_attrs *ta, char *in, char *out, uint32_t seq,
+                           uint64_t *latency)
 {
-    TEEC_Result res;
-
-    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_GENKEYS, NULL, NULL);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_GENKEYS) failed %#x\n", res);
-    printf("\n=========== Keys already generated. ==========\n");
+    uint64_t t0 = monotonic_ns();
+    co_await invoker->invoke(
+        [=]() { return aes_decrypt_frame(ta, in, BENCH_SCHED_FRAME, out, BENCH_SCHED_FRAME, seq); });
+    *latency = monotonic_ns() - t0;
 }
 
-void rsa_encrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz)
+// Per-frame latency of an AES frame decrypt handed to a TEE thread, as
+// with --inflight, under each scheduling profile (or only spec). Frames
+// are paced like a stream, so wakeups and migrations count too.
+void bench_sched(int iterations, const char *spec)
 {
-    TEEC_Operation op;
-    uint32_t origin;
-    TEEC_Result res;
-    printf("\n============ RSA ENCRYPT CA SIDE ============\n");
-    prepare_op(&op, in, in_sz, out, out_sz);
+    const char *builtin[] = {"none", "spread", "isolated", "realtime"};
+    std::vector<const char *> names;
+    struct sched_profile profile;
+    struct tee_attrs ta;
+    char key[16];
+    char wrapped[RSA_MAX_CIPHER_LEN];
+    std::vector<uint64_t> latency(iterations);
+
+    if (spec)
+        names.push_back(spec);
+    else
+        names.assign(builtin, builtin + sizeof(builtin) / sizeof(builtin[0]));
+
+    // a group key wrapped for our own RSA key, as a fan-out server would send it
+    quiet = true;
+    ta.key_bits = RSA_KEY_SIZE;
+    ta.scheme = TA_RSA_SCHEME_OAEP_SHA256;
+    ta.tiles = NULL;
+    init_tee_session(&ta);
+    rsa_gen_keys(&ta);
+    memset(key, 0x5a, sizeof(key));
+    rsa_encrypt(&ta, key, sizeof(key), wrapped, ta.key_bits / 8);
+    aes_load_group_key(&ta, wrapped, ta.key_bits / 8, TA_GROUP_WRAP_RSA, TA_RSA_KEY_ID_ACTIVE);
+    char *in = new char[BENCH_SCHED_FRAME];
+    char *out = new char[BENCH_SCHED_FRAME];
+    memset(in, 0xa5, BENCH_SCHED_FRAME);
+
+    for (const char *name : names)
+    {
+        if (!sched_parse(name, &profile))
+            errx(1, "unknown scheduling profile %s", name);
+        sched_use(&profile);
+        sched_enter(SCHED_STAGE_NET);
+        sched_print();
+        // its thread is placed as a tee stage when it starts
+        tee_invoker *invoker = new tee_invoker(1);
+        uint64_t next = monotonic_ns();
+        for (int i = 0; i < iterations; i++)
+        {
+            sleep_until_ns(next);
+            next += BENCH_SCHED_PERIOD_NS;
+            bench_sched_frame(invoker, &ta, in, out, i, &latency[i]);
+            invoker->wait();
+        }
+        delete invoker;
+
+        std::sort(latency.begin(), latency.end());
+        uint64_t sum = 0;
+        for (uint64_t ns : latency)
+            sum += ns;
+        printf("  %d x %d KiB: %.1f us mean, %.1f us p50, %.1f us p99, %.1f us max\n", iterations,
+               BENCH_SCHED_FRAME / 1024, sum / 1e3 / iterations, latency[iterations / 2] / 1e3,
+               latency[iterations * 99 / 100] / 1e3, latency[iterations - 1] / 1e3);
+    }
+    // back to how the process started
+    sched_parse("none", &profile);
+    sched_use(&profile);
+    sched_enter(SCHED_STAGE_NET);
 
-    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_ENCRYPT,
-                             &op, &origin);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_ENCRYPT) failed 0x%x origin 0x%x\n",
-             res, origin);
-    printf("\nThe text sent was encrypted: %s\n", out);
+    delete[] in;
+    delete[] out;
+    terminate_tee_session(&ta);
+    quiet = false;
 }
 
-void rsa_decrypt(struct tee_attrs *ta, char *in, size_t in_sz, char *out, size_t out_sz)
+void print_hex(char *tmp_buffer, int count)
 {
-    TEEC_Operation op;
-    uint32_t origin;
-    TEEC_Result res;
-    printf("\n============ RSA DECRYPT CA SIDE ============\n");
-    prepare_op(&op, in, in_sz, out, out_sz);
-
-    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_DECRYPT, &op, &origin);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_DECRYPT) failed 0x%x origin 0x%x\n",
-             res, origin);
-    printf("\nThe text sent was decrypted: %s\n", (char *)op.params[1].tmpref.buffer);
+    if (quiet)
+        return;
+    hex_dump(stdout, tmp_buffer, count);
 }
 
-void rsa_get_pub_key(struct tee_attrs *ta, pub_key *pk)
+// playout thread, at the frame's presentation time
+void present_frame(const char *data, uint32_t len, uint32_t seq, void *arg)
 {
-    TEEC_Operation op;
-    uint32_t origin;
-    TEEC_Result res;
+    frame_ring_writer *sink = (frame_ring_writer *)arg;
 
-    prepare_op_out_out(&op, pk->exponent, pk->exponentLen, pk->modulus, pk->modulusLen);
-    res = TEEC_InvokeCommand(&ta->sess, TA_RSA_CMD_GET_PUB_KEY, &op, &origin);
-    if (res != TEEC_SUCCESS)
-        errx(1, "\nTEEC_InvokeCommand(TA_RSA_CMD_GET_PUB_KEY) failed 0x%x origin 0x%x\n",
-             res, origin);
-    pk->exponentLen = op.params[0].tmpref.size;
-    pk->modulusLen = op.params[1].tmpref.size;
-    printf("\n============== Public key ==============\n");
-    // print exponent and modulus
-    printf("Exponent %d bytes:\n", op.params[0].tmpref.size);
-    for (int i = 0; i < pk->exponentLen; i++)
+    if (sink->is_open())
     {
-        printf("%02x:", ((char *)pk->exponent)[i]);
+        memcpy(sink->begin(), data, len);
+        sink->commit(len, seq);
     }
-    printf("\n");
-    printf("Modulus %d bytes:\n", op.params[1].tmpref.size);
-    for (int i = 0; i < pk->modulusLen; i++)
-    {
-        printf("%02x:", ((char *)pk->modulus)[i]);
-    }
-    printf("\n");
+    print_hex((char *)data, len);
 }
 
-void test(struct tee_attrs &ta)
+// The connection dropped: reconnect with backoff and resume with the
+// server's ticket, or repeat the key exchange if it does not take it. The
+// TA keeps its keys across connections, so no RSA key is generated again.
+int restore_session(struct tee_attrs *ta, uint32_t kex_curve, pub_key *pk, uint32_t next_seq)
 {
-    char clear[RSA_MAX_PLAIN_LEN_1024] = "0123456789";
-    char ciph[RSA_CIPHER_LEN_1024];
-    // print clear in hex
-    for (int i = 0; i < RSA_MAX_PLAIN_LEN_1024; i++)
-    {
-        printf("%02x:", clear[i]);
-    }
-    printf("\n");
-    rsa_encrypt(&ta, clear, RSA_MAX_PLAIN_LEN_1024, ciph, RSA_CIPHER_LEN_1024);
-    // print ciph in hex
-    for (int i = 0; i < RSA_CIPHER_LEN_1024; i++)
+    uint64_t t0 = monotonic_ns();
+    int backoff_ms = 50;
+
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS; attempt++)
     {
-        printf("%02x:", ciph[i]);
+        if (attempt > 0)
+        {
+            sleep_until_ns(monotonic_ns() + backoff_ms * 1000000ull);
+            backoff_ms = backoff_ms * 2 < RECONNECT_MAX_BACKOFF_MS ? backoff_ms * 2 : RECONNECT_MAX_BACKOFF_MS;
+        }
+        if (!reconnect())
+            continue;
+        int resumed = have_resume_ticket() ? resume_session(next_seq) : 0;
+        if (resumed < 0)
+            continue;
+        if (!resumed && kex_curve)
+        {
+            uint8_t pub[ECDH_MAX_PUB_LEN];
+            uint64_t t1 = monotonic_ns();
+            uint32_t pub_len = ecdh_gen_key(ta, kex_curve, pub, sizeof(pub));
+            startup.keygen_ns = monotonic_ns() - t1;
+            if (!ecdh_handshake(ta, kex_curve, pub, pub_len))
+                continue;
+        }
+        else if (!resumed &&
+                 !send_pub_key(0, ta->scheme, pk->modulus, pk->modulusLen, pk->exponent, pk->exponentLen))
+        {
+            continue;
+        }
+        // the server may drop this connection too, that is one more attempt
+        if (!send_stream_options())
+            continue;
+        printf("Reconnected in %.3f ms after %d attempts, %s at frame %u\n", (monotonic_ns() - t0) / 1e6,
+               attempt + 1, resumed ? "resumed" : "new key exchange", next_seq);
+        return 1;
     }
-    printf("\n");
-    rsa_decrypt(&ta, ciph, RSA_CIPHER_LEN_1024, clear, RSA_MAX_PLAIN_LEN_1024);
+    return 0;
 }
 
-void print_hex(char *tmp_buffer, int count)
+// A frame decrypted while the receive loop carries on, see --inflight.
+// The cipher text is copied, buffer only lasts until the next frame.
+struct frame_job
 {
-    printf("=================\n%d bytes:\n", count);
-    for (int i = 0; i < count; i++)
+    struct frame_header hdr;
+    char *in;
+    char *out;
+    bool busy;
+};
+
+// straight-line per frame: co_await hands the TEE call to the invoker
+// threads and the rest runs once the invoker resumes it, in frame order
+tee_task decode_frame(tee_invoker *tee, struct tee_attrs *ta, const struct decrypt_engine *engine,
+                      struct frame_job *job, playout *player, frame_ring_writer *sink)
+{
+    char *out = player ? player->acquire() : job->out;
+    if (out)
     {
-        printf("%02x:", tmp_buffer[i]);
+        size_t n = finish_frame(&job->hdr, out, co_await tee->decrypt(ta, engine, &job->hdr, job->in, out));
+        if (n == 0)
+        {
+            if (player)
+                player->release(out);
+        }
+        else
+        {
+            first_frame_done();
+            if (player)
+                player->submit(out, n, job->hdr.seq, job->hdr.pts_us);
+            else
+                present_frame(out, n, job->hdr.seq, sink);
+        }
     }
-    printf("\n");
+    job->busy = false;
+}
+
+// Next key for rotation. It is generated on a second session. The default
+// TA build shares one instance, which runs the generation between frames and
+// keeps the key apart from its table until it is loaded; with
+// TA_SHARED_KEYS 0 it is a separate instance, so frames keep decrypting on
+// the main session meanwhile. The key moves over through secure storage.
+struct key_rotation
+{
+    std::thread worker;
+    std::atomic<bool> ready;
+    bool running;
+    uint32_t key_id;
+    char object_id[48];
+    pub_key *pk;
+    struct tee_attrs *ta; // main session, the worker uses the same key setup
+};
+
+void generate_next_key(struct key_rotation *rot)
+{
+    struct tee_attrs worker = *rot->ta;
+
+    // RSA key generation must not compete with a real-time stage
+    sched_enter(SCHED_STAGE_BACKGROUND);
+    init_tee_session(&worker);
+    rsa_gen_keys(&worker);
+    rsa_store_key(&worker, rot->object_id);
+    rsa_get_pub_key(&worker, rot->pk);
+    terminate_tee_session(&worker);
+    rot->ready = true;
+}
+
+void start_rotation(struct tee_attrs *ta, struct key_rotation *rot, uint32_t key_id, const char *base_id)
+{
+    rot->key_id = key_id;
+    rot->ta = ta;
+    // live keys only need two objects, captures keep every key for replay
+    if (base_id)
+        snprintf(rot->object_id, sizeof(rot->object_id), "%s-k%u", base_id, key_id);
+    else
+        snprintf(rot->object_id, sizeof(rot->object_id), "rotate-%u", key_id & 1);
+    rot->pk = new pub_key;
+    rot->ready = false;
+    rot->running = true;
+    rot->worker = std::thread(generate_next_key, rot);
+}
+
+// called between frames once the next key is ready
+void finish_rotation(struct tee_attrs *ta, struct key_rotation *rot)
+{
+    rot->worker.join();
+    rot->running = false;
+    rsa_load_pending_key(ta, rot->object_id, rot->key_id);
+    capture_key_rotation(rot->key_id, rot->object_id);
+    // the server switches at its next frame, the TA when that frame arrives
+    send_pub_key(rot->key_id, ta->scheme, rot->pk->modulus, rot->pk->modulusLen, rot->pk->exponent, rot->pk->exponentLen);
+    delete rot->pk;
+    rot->pk = NULL;
+}
+
+struct tee_attrs *replay_ta;
+
+void replay_rotation(uint32_t key_id, const char *object_id)
+{
+    rsa_load_pending_key(replay_ta, object_id, key_id);
+}
+
+void usage(const char *prog)
+{
+    printf("usage: %s [--kex NAME] [--key-bits BITS] [--scheme NAME] [--rotate FRAMES]\n"
+           "          [--capture FILE | --replay FILE [--fast]] [--sink NAME] [--bench-rsa N]\n"
+           "          [--udp [--loss PCT] [--burst N] [--jitter MS]] [--playout MS] [--inflight N]\n"
+           "          [--self-test] [--reconnect] [--tiles N] [--sched PROFILE] [--bench-sched N]\n"
+           "          [--trace FILE] [--perf-baseline FILE] [--perf-record FILE] [--server ADDR] [--port PORT]\n",
+           prog);
+    printf("  --kex NAME      key exchange: rsa (default), x25519 or p256\n");
+    printf("  --key-bits BITS RSA modulus size: 1024, 2048 (default) or 3072\n");
+    printf("  --scheme NAME   pkcs1, oaep-sha1 or oaep-sha256 (default)\n");
+    printf("  --rotate FRAMES rotate the RSA key every FRAMES frames without pausing the stream\n");
+    printf("  --capture FILE  record the handshake and received stream to FILE\n");
+    printf("  --replay FILE   feed a capture through the pipeline instead of the network\n");
+    printf("  --fast          replay as fast as possible instead of at original timing\n");
+    printf("  --sink NAME     publish decrypted frames to the shared memory ring NAME\n");
+    printf("  --bench-rsa N   time N operations per key size and scheme, then exit\n");
+    printf("  --udp           receive video as FEC protected datagrams (native server)\n");
+    printf("  --loss PCT      drop PCT%% of the datagrams on arrival, for testing --udp\n");
+    printf("  --burst N       dropped datagrams come in runs of N (default 1)\n");
+    printf("  --jitter MS     delay datagrams by up to MS ms, which reorders them\n");
+    printf("  --playout MS    present frames at their capture pace, buffering at least MS ms\n");
+    printf("  --inflight N    keep receiving while up to N frames are in the TEE\n");
+    printf("  --self-test     check an RSA encrypt/decrypt round trip before connecting\n");
+    printf("  --reconnect     reconnect when the connection drops, resuming the session if possible\n");
+    printf("  --tiles N       decrypt the tiles of tiled frames on N TEE sessions at once\n");
+    printf("  --seek SECONDS  start a VOD stream (native server --vod) at SECONDS\n");
+    printf("  --prefetch FRAMES let a VOD server send up to FRAMES frames ahead of playout (at most %d)\n",
+           PLAYOUT_MAX_PREFETCH);
+    printf("  --prefetch-bytes BYTES but no more than BYTES of them (default any)\n");
+    printf("  --rebuffer MS   after a stall, buffer MS ms more before playing on (default 0)\n");
+    printf("  --sched PROFILE thread placement: none (default), spread, isolated, realtime\n");
+    printf("                  or STAGE=CPUS[@FIFO_PRIO],... with STAGE net, tee or playout\n");
+    printf("  --bench-sched N time N frames handed to a TEE thread under each profile, then exit\n");
+    printf("  --trace FILE    record per-frame stage times, written to FILE as Chrome trace JSON\n");
+    printf("                  at exit and on SIGUSR1\n");
+    printf("  --perf-baseline FILE  check frames/s, MB/s, allocations per frame and p99 latency\n");
+    printf("                  against FILE at exit, exit status 2 if one regressed\n");
+    printf("  --perf-record FILE    write them to FILE as a new baseline\n");
+    printf("  --server ADDR   server IPv4 address (default %s)\n", server_addr.c_str());
+    printf("  --port PORT     server port (default %d)\n", server_port);
 }
 
 int main(int argc, char *argv[])
 {
     struct tee_attrs ta;
+    bool self_test = false;
+    bool reconnect_enabled = false;
+    const char *capture_path = NULL;
+    const char *replay_path = NULL;
+    bool replay_fast = false;
+    char key_id[32];
+    int connected;
+    int rotate_frames = 0;
+    struct key_rotation rot;
+    uint32_t next_key_id = 1;
+    int bench_iterations = 0;
+    uint32_t kex_curve = 0; // 0 is RSA key transport
+    uint64_t t0;
+    uint8_t ecdh_pub[ECDH_MAX_PUB_LEN];
+    uint32_t ecdh_pub_len = 0;
+    std::thread connector;
+    const char *sink_name = NULL;
+    frame_ring_writer sink;
+    bool udp = false;
+    struct loss_config loss;
+    int playout_ms = -1; // no playout stage, frames are shown once decrypted
+    playout *player = NULL;
+    int inflight = 0; // decrypt on the receive thread
+    int tile_sessions = 1;
+    double seek_s = -1;
+    int rebuffer_ms = 0;
+    tee_invoker *invoker = NULL;
+    std::vector<struct frame_job> jobs;
+    const char *sched_spec = NULL;
+    struct sched_profile sched;
+    int bench_sched_iterations = 0;
+    const char *trace_file = NULL;
+    const char *perf_baseline = NULL;
+    const char *perf_record = NULL;
+    int status = 0;
+
+    // fixed seed, runs with the same settings see the same loss pattern
+    loss.loss_pct = 0;
+    loss.burst = 1;
+    loss.jitter_ms = 0;
+    loss.seed = 1;
+
+    ta.key_bits = RSA_KEY_SIZE;
+    ta.scheme = TA_RSA_SCHEME_OAEP_SHA256;
+    ta.tiles = NULL;
+
+    static struct option options[] = {
+        {"capture", required_argument, NULL, 'c'},
+        {"replay", required_argument, NULL, 'r'},
+        {"fast", no_argument, NULL, 'f'},
+        {"rotate", required_argument, NULL, 'k'},
+        {"kex", required_argument, NULL, 'x'},
+        {"key-bits", required_argument, NULL, 'b'},
+        {"scheme", required_argument, NULL, 's'},
+        {"sink", required_argument, NULL, 'S'},
+        {"bench-rsa", required_argument, NULL, 'B'},
+        {"udp", no_argument, NULL, 'u'},
+        {"loss", required_argument, NULL, 'l'},
+        {"burst", required_argument, NULL, 'n'},
+        {"jitter", required_argument, NULL, 'j'},
+        {"playout", required_argument, NULL, 'P'},
+        {"inflight", required_argument, NULL, 'I'},
+        {"self-test", no_argument, NULL, 'T'},
+        {"reconnect", no_argument, NULL, 'R'},
+        {"tiles", required_argument, NULL, 't'},
+        {"seek", required_argument, NULL, 'e'},
+        {"prefetch", required_argument, NULL, 'a'},
+        {"prefetch-bytes", required_argument, NULL, 'A'},
+        {"rebuffer", required_argument, NULL, 'E'},
+        {"sched", required_argument, NULL, 'C'},
+        {"bench-sched", required_argument, NULL, 'L'},
+        {"trace", required_argument, NULL, 'O'},
+        {"perf-baseline", required_argument, NULL, 'Y'},
+        {"perf-record", required_argument, NULL, 'W'},
+        {"server", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:fk:x:b:s:S:B:ul:n:j:P:I:TRt:e:a:A:E:C:L:O:Y:W:H:p:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            capture_path = optarg;
+            break;
+        case 'r':
+            replay_path = optarg;
+            break;
+        case 'f':
+            replay_fast = true;
+            break;
+        case 'k':
+            rotate_frames = atoi(optarg);
+            break;
+        case 'x':
+            if (!strcmp(optarg, "rsa"))
+                kex_curve = 0;
+            else if (!strcmp(optarg, "x25519"))
+                kex_curve = TA_ECDH_CURVE_X25519;
+            else if (!strcmp(optarg, "p256"))
+                kex_curve = TA_ECDH_CURVE_P256;
+            else
+                errx(1, "unknown key exchange %s", optarg);
+            break;
+        case 'b':
+            ta.key_bits = atoi(optarg);
+            break;
+        case 's':
+            if (!strcmp(optarg, "pkcs1"))
+                ta.scheme = TA_RSA_SCHEME_PKCS1_V1_5;
+            else if (!strcmp(optarg, "oaep-sha1"))
+                ta.scheme = TA_RSA_SCHEME_OAEP_SHA1;
+            else if (!strcmp(optarg, "oaep-sha256"))
+                ta.scheme = TA_RSA_SCHEME_OAEP_SHA256;
+            else
+                errx(1, "unknown scheme %s", optarg);
+            break;
+        case 'S':
+            sink_name = optarg;
+            break;
+        case 'B':
+            bench_iterations = atoi(optarg);
+            break;
+        case 'u':
+            udp = true;
+            break;
+        case 'l':
+            loss.loss_pct = atof(optarg);
+            break;
+        case 'n':
+            loss.burst = atoi(optarg);
+            break;
+        case 'j':
+            loss.jitter_ms = atoi(optarg);
+            break;
+        case 'P':
+            playout_ms = atoi(optarg);
+            break;
+        case 'I':
+            inflight = atoi(optarg);
+            break;
+        case 'T':
+            self_test = true;
+            break;
+        case 'R':
+            reconnect_enabled = true;
+            break;
+        case 't':
+            tile_sessions = atoi(optarg);
+            break;
+        case 'e':
+            seek_s = atof(optarg);
+            break;
+        case 'a':
+            prefetch[0] = atoi(optarg);
+            break;
+        case 'A':
+            prefetch[1] = atoi(optarg);
+            break;
+        case 'E':
+            rebuffer_ms = atoi(optarg);
+            break;
+        case 'C':
+            sched_spec = optarg;
+            break;
+        case 'L':
+            bench_sched_iterations = atoi(optarg);
+            break;
+        case 'O':
+            trace_file = optarg;
+            break;
+        case 'Y':
+            perf_baseline = optarg;
+            break;
+        case 'W':
+            perf_record = optarg;
+            break;
+        case 'H':
+            server_addr = optarg;
+            break;
+        case 'p':
+            server_port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (capture_path && replay_path)
+        errx(1, "--capture and --replay are exclusive");
+    // ephemeral keys cannot be loaded again, which is the point of them
+    if (kex_curve && (capture_path || replay_path || rotate_frames || tile_sessions > 1))
+        errx(1, "--capture, --replay, --rotate and --tiles need --kex rsa");
+    // tile sessions load the key once, rotated keys would not reach them
+    if (tile_sessions < 1 || (tile_sessions > 1 && rotate_frames))
+        errx(1, "bad --tiles, or combined with --rotate");
+    // captures record the TCP byte stream only
+    if (udp && (capture_path || replay_path))
+        errx(1, "--udp cannot be combined with --capture or --replay");
+    if ((loss.loss_pct > 0 || loss.jitter_ms > 0) && !udp)
+        errx(1, "--loss and --jitter need --udp");
+    // a capture is one connection, and rotated keys are not what the server has after a drop
+    if (reconnect_enabled && (capture_path || replay_path || rotate_frames))
+        errx(1, "--reconnect cannot be combined with --capture, --replay or --rotate");
+    if (reconnect_enabled)
+        signal(SIGPIPE, SIG_IGN);
+    // frames sent early wait in the playout buffer, without one they would be shown early
+    if (prefetch[0] > 0 && playout_ms < 0)
+        errx(1, "--prefetch needs --playout");
+    // each frame ahead is a FRAME_MAX_LEN playout buffer, whatever --prefetch-bytes says
+    if ((int32_t)prefetch[0] < 0 || prefetch[0] > PLAYOUT_MAX_PREFETCH)
+        errx(1, "bad --prefetch, at most %d frames", PLAYOUT_MAX_PREFETCH);
+    if ((int32_t)prefetch[1] < 0)
+        errx(1, "bad --prefetch-bytes");
+    if (rebuffer_ms < 0)
+        errx(1, "bad --rebuffer");
+    if (playout_ms >= 0 && replay_fast)
+        errx(1, "--playout paces frames, it cannot be combined with --fast");
+    // the frames are not what is measured, printing them would be
+    if (perf_baseline || perf_record)
+        quiet = true;
+    if (bench_iterations > 0)
+    {
+        bench_rsa(bench_iterations);
+        return 0;
+    }
+    if (bench_sched_iterations > 0)
+    {
+        bench_sched(bench_sched_iterations, sched_spec);
+        return 0;
+    }
+    // threads started from here on are placed by their stage, main is net
+    if (!sched_parse(sched_spec ? sched_spec : "none", &sched))
+        errx(1, "bad --sched %s", sched_spec);
+    sched_use(&sched);
+    sched_enter(SCHED_STAGE_NET);
+    sched_print();
+    if (trace_file && !trace_open(trace_file))
+        err(1, "%s", trace_file);
+
+    // ==========================Connection================================
+    // the connect does not need the TEE, it runs while the TA loads and
+    // generates keys
+    startup.start_ns = monotonic_ns();
+    if (replay_path)
+        connected = 1;
+    else
+        connector = std::thread([&connected]() {
+            uint64_t t = monotonic_ns();
+            connected = open_connection();
+            startup.connect_ns = monotonic_ns() - t;
+        });
 
     // ========================== init TEE================================
+    t0 = monotonic_ns();
     init_tee_session(&ta);
-    // generate key and get public key from TA
-    rsa_gen_keys(&ta);
+    startup.tee_ns = monotonic_ns() - t0;
     pub_key pk;
-    rsa_get_pub_key(&ta, &pk);
-    // ========================== test encrypt &decrypt ================================
-    test(ta);
-    // ==========================Connection================================
-    if (open_connection())
+    // the frame kernel is picked once, the loop only calls through it
+    const struct decrypt_engine *engine = find_decrypt_engine(kex_curve ? FRAME_VIDEO_AES : FRAME_VIDEO,
+                                                              ta.key_bits, ta.scheme);
+    if (!engine)
+        errx(1, "no decrypt engine for RSA-%u %s", ta.key_bits, rsa_scheme_name(ta.scheme));
+    if (kex_curve)
+    {
+        // ephemeral key pair now, the agreement needs the server
+        t0 = monotonic_ns();
+        ecdh_pub_len = ecdh_gen_key(&ta, kex_curve, ecdh_pub, sizeof(ecdh_pub));
+        startup.keygen_ns = monotonic_ns() - t0;
+    }
+    else if (replay_path)
+    {
+        // the capture is only decryptable with the key it was recorded for
+        if (!open_replay(replay_path, !replay_fast))
+            errx(1, "cannot replay %s", replay_path);
+        printf("Replaying %s (%s)\n", replay_path, replay_fast ? "as fast as possible" : "original timing");
+        rsa_load_key(&ta, replay_key_id());
+        // rotations are replayed from the capture, not generated again
+        replay_ta = &ta;
+        set_replay_key_hook(replay_rotation);
+        rotate_frames = 0;
+    }
+    else
+    {
+        // generate key and get public key from TA
+        t0 = monotonic_ns();
+        rsa_gen_keys(&ta);
+        startup.keygen_ns = monotonic_ns() - t0;
+        if (capture_path)
+        {
+            snprintf(key_id, sizeof(key_id), "tzsc-%d-%lx", getpid(), (unsigned long)time(NULL));
+            rsa_store_key(&ta, key_id);
+        }
+    }
+    if (tile_sessions > 1)
     {
-        decrypted_frame = new char[BUFFER_SIZE];
-        send_pub_key(pk.modulus, pk.modulusLen, pk.exponent, pk.exponentLen);
-        int cnt = 3;
+        // separate TA instances get the key through secure storage, the
+        // workers attach to the key table of a shared one
+        const char *object = replay_path ? replay_key_id() : capture_path ? key_id : TILE_KEY_OBJECT;
+        if (!replay_path && !capture_path && !ta.shared_keys)
+            rsa_store_key(&ta, TILE_KEY_OBJECT);
+        if (ta.shared_keys)
+            printf("Tiles: the TA instance is shared, its sessions decrypt one at a time"
+                   " (a TA built with TA_SHARED_KEYS 0 decrypts tiles in parallel)\n");
+        ta.tiles = new tile_workers(&ta, tile_sessions, object);
+    }
+    if (!kex_curve)
+    {
+        rsa_get_pub_key(&ta, &pk);
+        printf("RSA-%u %s: %zu byte blocks carry %zu bytes\n", ta.key_bits, rsa_scheme_name(ta.scheme),
+               engine->cipher_len, engine->plain_len);
+        // ========================== test encrypt &decrypt ================================
+        if (self_test)
+            test(ta, *engine);
+    }
+    if (connector.joinable())
+        connector.join();
+    startup.ready_ns = monotonic_ns();
+    if (connected)
+    {
+        if (capture_path && !start_capture(capture_path, key_id))
+            errx(1, "cannot capture to %s", capture_path);
+        if (udp && !open_udp(&loss))
+            errx(1, "cannot open the UDP socket");
+        decrypted_frame = (char *)aligned_alloc(engine->alignment, FRAME_MAX_LEN);
+        // slots are cache line aligned, frames decrypt straight into them
+        if (sink_name && !sink.open(sink_name, FRAME_RING_SLOTS, FRAME_MAX_LEN))
+            errx(1, "cannot create frame ring %s", sink_name);
+        // with a playout stage frames decrypt into its buffers and reach the
+        // sink at their presentation time instead
+        if (playout_ms >= 0)
+            player = new playout(FRAME_MAX_LEN, PLAYOUT_SLOTS + prefetch[0], engine->alignment, playout_ms,
+                                 rebuffer_ms, present_frame, &sink);
+        if (inflight > 0)
+        {
+            // one session, so one invoker thread; the TA would serialize more
+            invoker = new tee_invoker(1);
+            jobs.resize(inflight);
+            for (struct frame_job &job : jobs)
+            {
+                // a tiled frame's table comes on top of the video
+                job.in = new char[FRAME_MAX_PAYLOAD];
+                job.out = (char *)aligned_alloc(engine->alignment, FRAME_MAX_LEN);
+                job.busy = false;
+            }
+        }
+        if (kex_curve)
+        {
+            if (!ecdh_handshake(&ta, kex_curve, ecdh_pub, ecdh_pub_len))
+                errx(1, "server did not answer the ECDH handshake");
+        }
+        else
+        {
+            // RSA key transport has no round trip, the server starts streaming
+            t0 = monotonic_ns();
+            if (!send_pub_key(0, ta.scheme, pk.modulus, pk.modulusLen, pk.exponent, pk.exponentLen))
+                errx(1, "\nthe server closed the connection before the key exchange\n");
+            uint64_t exchange_ns = monotonic_ns() - t0;
+            if (!replay_path)
+                printf("RSA-%u handshake: keygen %.3f ms, exchange %.3f ms, total %.3f ms\n", ta.key_bits,
+                       startup.keygen_ns / 1e6, exchange_ns / 1e6, (startup.keygen_ns + exchange_ns) / 1e6);
+        }
+        if (!replay_path && !send_stream_options())
+            errx(1, "\nthe server closed the connection before streaming\n");
+        if (seek_s >= 0 && !replay_path)
+        {
+            // the server answers with frames from the keyframe before it
+            uint64_t pts_us = seek_s * 1e6;
+            if (!send_message(MSG_SEEK, &pts_us, sizeof(pts_us)))
+                errx(1, "\nthe server closed the connection before the seek\n");
+        }
+        uint64_t frames = 0, bytes = 0;
+        if (perf_baseline || perf_record)
+            perf_start();
+        uint64_t start_ns = monotonic_ns();
+        struct frame_header hdr;
+        uint32_t next_seq = 0;
+        int reconnects = 0;
+        rot.running = false;
         while (1)
         {
             // receive frame
-            int count = receive_frame();
-            if (cnt-- > 0)
+            int count = receive_frame(&hdr);
+            if (count < 0)
+            {
+                if (!reconnect_enabled)
+                    break;
+                if (invoker)
+                    invoker->drain();
+                if (!restore_session(&ta, kex_curve, &pk, next_seq))
+                    break;
+                reconnects++;
+                continue;
+            }
+            frames++;
+            bytes += count;
+            trace_poll();
+            if (hdr.type == FRAME_TRACE && count >= (int)sizeof(struct frame_trace))
+            {
+                struct frame_trace t;
+                memcpy(&t, buffer, sizeof(t));
+                trace_server(hdr.seq, &t);
+                continue;
+            }
+            // key rotation happens between frames
+            if (rotate_frames > 0 && !rot.running && frames % rotate_frames == 0)
+            {
+                if (ta.shared_keys && next_key_id == 1)
+                    printf("Key rotation: the TA instance is shared, frames wait while the next key"
+                           " is generated (a TA built with TA_SHARED_KEYS 0 avoids it)\n");
+                start_rotation(&ta, &rot, next_key_id++, capture_path ? key_id : NULL);
+            }
+            // frames in flight were sent for the keys loaded now, or for the old stream
+            if (invoker &&
+                ((rot.running && rot.ready) || hdr.type == FRAME_GROUP_KEY || hdr.type == FRAME_STREAM_INFO))
+                invoker->drain();
+            if (rot.running && rot.ready)
+                finish_rotation(&ta, &rot);
+            if (hdr.type == FRAME_GROUP_KEY && count > 4)
+            {
+                uint32_t wrap;
+                memcpy(&wrap, buffer, 4);
+                aes_load_group_key(&ta, buffer + 4, count - 4, wrap, hdr.key_id);
+                if (ta.tiles)
+                    ta.tiles->load_group_key(buffer + 4, count - 4, wrap, hdr.key_id);
+                // frames from a fan-out server are AES even after an RSA handshake
+                engine = find_decrypt_engine(FRAME_VIDEO_AES, 0, 0);
                 continue;
+            }
+            if (hdr.type == FRAME_TICKET && count >= 4)
+            {
+                set_resume_ticket(buffer + 4, count - 4);
+                continue;
+            }
+            if (hdr.type == FRAME_STREAM_INFO && count >= 12)
+            {
+                uint32_t info[3];
+                memcpy(info, buffer, sizeof(info));
+                if (!video.open(info[0], info[1], info[2]))
+                    printf("Codec %u is not supported, packets are passed on undecoded\n", info[0]);
+                continue;
+            }
+            // a fan-out server sends whole or tiled frames under the same group key
+            if (engine->frame_type != FRAME_VIDEO && (hdr.type == FRAME_VIDEO_AES || hdr.type == FRAME_VIDEO_TILED))
+                engine = find_decrypt_engine(hdr.type, 0, 0);
+            if (hdr.type != engine->frame_type)
+                continue;
+            trace_received(hdr.seq, frame_arrival_ns(), monotonic_ns());
+            perf_arrived(hdr.seq, frame_arrival_ns());
+            next_seq = hdr.seq + 1;
             print_hex(buffer, count);
-            // decrypt
-            int input_chunk_size = 64;
-            int output_chunk_size = 128;
-            printf("chunk number %d", count / input_chunk_size);
-            for (int i = 0; i < count / input_chunk_size; i++)
+            if (invoker)
+            {
+                struct frame_job *job = NULL;
+                while (!job)
+                {
+                    for (struct frame_job &j : jobs)
+                        if (!j.busy)
+                        {
+                            job = &j;
+                            break;
+                        }
+                    if (!job)
+                        invoker->wait();
+                }
+                job->hdr = hdr;
+                memcpy(job->in, buffer, count);
+                job->busy = true;
+                decode_frame(invoker, &ta, engine, job, player, &sink);
+                invoker->poll();
+                continue;
+            }
+            if (player)
             {
-                print_hex(buffer + i * input_chunk_size, input_chunk_size);
-                rsa_decrypt(&ta, buffer + i * input_chunk_size, RSA_CIPHER_LEN_1024, decrypted_frame + i * output_chunk_size, RSA_MAX_PLAIN_LEN_1024);
+                // dropped if the buffer already holds PLAYOUT_SLOTS frames
+                char *out = player->acquire();
+                size_t n = out ? finish_frame(&hdr, out, timed_decrypt(engine, &ta, &hdr, buffer, out)) : 0;
+                if (out && n == 0)
+                    player->release(out);
+                else if (out)
+                {
+                    player->submit(out, n, hdr.seq, hdr.pts_us);
+                    first_frame_done();
+                }
+                continue;
             }
-            int decrypted_count = count * output_chunk_size / input_chunk_size;
-            print_hex(decrypted_frame, decrypted_count);
+            char *out = sink.is_open() ? sink.begin() : decrypted_frame;
+            size_t decrypted_count = finish_frame(&hdr, out, timed_decrypt(engine, &ta, &hdr, buffer, out));
+            // the sink slot is simply reused by the next frame
+            if (decrypted_count == 0)
+                continue;
+            first_frame_done();
+            if (sink.is_open())
+                sink.commit(decrypted_count, hdr.seq);
+            print_hex(out, decrypted_count);
         }
+        double secs = (monotonic_ns() - start_ns) / 1e9;
+        printf("\n%" PRIu64 " frames, %" PRIu64 " bytes in %.3f s (%.1f frames/s, %.3f MB/s)\n",
+               frames, bytes, secs, frames / secs, bytes / secs / 1e6);
+        if (invoker)
+        {
+            invoker->drain();
+            delete invoker;
+            for (struct frame_job &job : jobs)
+            {
+                delete[] job.in;
+                free(job.out);
+            }
+        }
+        if (reconnects)
+            printf("%d reconnects\n", reconnects);
+        if (tee_errors)
+            printf("%lu frames failed to decrypt in the TEE\n", (unsigned long)tee_errors);
+        if (decrypt_count)
+            printf("Decrypt (%s): %.3f ms/frame mean, %.3f ms max\n", engine->name,
+                   decrypt_ns / 1e6 / decrypt_count, max_decrypt_ns / 1e6);
+        struct ta_arena_stats arena;
+        if (ta_arena_stats(&ta, &arena))
+            printf("TA scratch arena: %u of %u bytes at most, %u allocations, %u did not fit\n",
+                   arena.high_water, arena.size, arena.allocs, arena.refused);
+        if (ta.tiles)
+            ta.tiles->print_stats();
+        delta.print_stats();
+        video.print_stats();
+        print_receive_stats();
+        if (player)
+        {
+            player->stop();
+            player->print_stats();
+            delete player;
+        }
+        if (perf_enabled())
+        {
+            struct perf_metrics m;
+            perf_finish(frames, bytes, secs, &m);
+            if (perf_record && !perf_write(perf_record, &m))
+                err(1, "%s", perf_record);
+            if (perf_baseline)
+            {
+                int ok = perf_check(perf_baseline, &m);
+                if (ok < 0)
+                    err(1, "%s", perf_baseline);
+                if (!ok)
+                    status = 2;
+            }
+        }
+        if (rot.running)
+        {
+            rot.worker.join();
+            delete rot.pk;
+        }
+        stop_capture();
+        sink.close();
+    }
+    if (trace_enabled())
+    {
+        int n = trace_dump();
+        if (n >= 0)
+            printf("Trace: %d events written to %s\n", n, trace_file);
     }
 
+    delete ta.tiles;
     terminate_tee_session(&ta);
-    return 0;
+    return status;
 }
@@ -0,0 +1,431 @@
+// Microbenchmarks of the client's per-frame components, each on its own,
+// so a drop in the end-to-end numbers of host/perf can be pinned on one of
+// them. Every benchmark runs its operation over the same frame sizes, one
+// keyframe of 48-80 KiB in 30 and delta frames of 2-12 KiB in between,
+// from a fixed seed, and is repeated until it runs for --min-ms. Reported
+// are the time per operation, the frame bytes per second it gets through
+// and the operator new calls per operation, in any thread.
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+#include "include/capture.h"
+#include "include/client.h"
+#include "include/crc32c.h"
+#include "include/fec.h"
+#include "include/frame_ring.h"
+#include "include/hex_dump.h"
+#include "include/perf_report.h"
+#include "include/playout.h"
+#include "include/protocol.h"
+#include "include/tee_async.h"
+#include "include/timing.h"
+
+#define FRAMES 2048          // distinct frame sizes, and frames in the replayed capture
+#define KEYFRAME_INTERVAL 30
+#define MAX_FRAME (80 << 10)
+#define PAYLOAD_SPREAD 64    // frames start at one of this many 4 KiB offsets, not all in cache
+#define FEC_FRAMES 256       // frames cut into datagrams once and fed again with new seqs
+#define FEC_LOSS_EVERY 10    // every 10th frame loses a datagram and is rebuilt from parity
+#define MSS 1448             // the replayed recv()s return a few TCP segments each
+
+struct bench
+{
+    const char *name;
+    const char *what;
+    void (*setup)();
+    // runs ops operations, returns the frame bytes they went through
+    uint64_t (*run)(uint64_t ops);
+};
+
+static uint32_t sizes[FRAMES];
+static char *payload;
+static volatile uint32_t sink; // keeps results the compiler could drop
+static uint32_t rng = 0x9e3779b9;
+
+static uint32_t next_random()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static const char *frame_data(uint64_t i)
+{
+    return payload + (i % PAYLOAD_SPREAD) * 4096;
+}
+
+static void make_frames()
+{
+    payload = new char[MAX_FRAME + PAYLOAD_SPREAD * 4096];
+    for (size_t i = 0; i < MAX_FRAME + PAYLOAD_SPREAD * 4096; i++)
+        payload[i] = next_random();
+    for (int i = 0; i < FRAMES; i++)
+    {
+        if (i % KEYFRAME_INTERVAL == 0)
+            sizes[i] = (48 << 10) + next_random() % (32 << 10);
+        else
+            sizes[i] = (2 << 10) + next_random() % (10 << 10);
+    }
+}
+
+// frame_header + payload as the server sends it
+static uint32_t build_frame(char *out, uint32_t i)
+{
+    struct frame_header hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FRAME_MAGIC;
+    hdr.type = FRAME_VIDEO;
+    hdr.seq = i;
+    hdr.length = sizes[i % FRAMES];
+    hdr.pts_us = (uint64_t)i * 33333;
+    hdr.crc32c = crc32c(frame_data(i), hdr.length);
+    hdr.flags = i % KEYFRAME_INTERVAL == 0 ? FRAME_FLAG_KEYFRAME : FRAME_FLAG_DELTA;
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), frame_data(i), hdr.length);
+    return sizeof(hdr) + hdr.length;
+}
+
+// CRC32C check of every received payload
+
+static uint64_t run_crc32c(uint64_t ops)
+{
+    uint64_t bytes = 0;
+    uint32_t crc = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        crc ^= crc32c(frame_data(i), sizes[i % FRAMES]);
+        bytes += sizes[i % FRAMES];
+    }
+    sink = crc;
+    return bytes;
+}
+
+// TCP: reassembly of recv() chunks and header parsing, receive_frame() on a capture
+
+static char capture_path[] = "/tmp/tzs_microbench.XXXXXX";
+static bool have_capture;
+
+static void setup_tcp()
+{
+    std::vector<char> stream;
+    std::vector<char> frame(sizeof(struct frame_header) + MAX_FRAME);
+    capture_writer capture;
+    int fd = mkstemp(capture_path);
+
+    if (fd < 0)
+        err(1, "mkstemp");
+    close(fd);
+    have_capture = true;
+    for (uint32_t i = 0; i < FRAMES; i++)
+    {
+        uint32_t len = build_frame(frame.data(), i);
+        stream.insert(stream.end(), frame.data(), frame.data() + len);
+    }
+    if (!capture.open(capture_path))
+        errx(1, "cannot write %s", capture_path);
+    capture.write(CAPTURE_RECORD_KEY_ID, "microbench", 10);
+    for (size_t pos = 0; pos < stream.size();)
+    {
+        size_t len = std::min<size_t>(MSS * (1 + next_random() % 45), stream.size() - pos);
+        capture.write(CAPTURE_RECORD_DATA, stream.data() + pos, len);
+        pos += len;
+    }
+    capture.close();
+    if (!open_replay(capture_path, false))
+        errx(1, "cannot replay %s", capture_path);
+}
+
+static uint64_t run_tcp(uint64_t ops)
+{
+    struct frame_header hdr;
+    uint64_t bytes = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        // start over at the end of the capture
+        while (receive_frame(&hdr) < 0)
+            if (!open_replay(capture_path, false))
+                errx(1, "cannot replay %s", capture_path);
+        bytes += sizeof(hdr) + hdr.length;
+    }
+    return bytes;
+}
+
+// UDP: FEC reassembly of the datagrams of a frame
+
+struct fec_datagram
+{
+    size_t offset; // into fec_bytes
+    size_t len;
+};
+
+static std::vector<char> fec_bytes;
+static std::vector<struct fec_datagram> fec_datagrams;
+static size_t fec_first[FEC_FRAMES + 1]; // datagrams of frame f are [fec_first[f], fec_first[f + 1])
+static fec_decoder *decoder;
+
+static void setup_fec()
+{
+    std::vector<char> frame(sizeof(struct frame_header) + MAX_FRAME);
+    fec_encoder encoder(FEC_FRAG_SIZE, FEC_GROUP);
+
+    for (uint32_t f = 0; f < FEC_FRAMES; f++)
+    {
+        uint32_t len = build_frame(frame.data(), f);
+        int count = encoder.encode(frame.data(), len, f);
+
+        fec_first[f] = fec_datagrams.size();
+        for (int k = 0; k < count; k++)
+        {
+            const struct iovec *iov = encoder.datagram(k);
+            // the first data fragment of every FEC_LOSS_EVERY-th frame never arrives
+            if (k == 0 && f % FEC_LOSS_EVERY == FEC_LOSS_EVERY - 1)
+                continue;
+            struct fec_datagram d = {fec_bytes.size(), iov[0].iov_len + iov[1].iov_len};
+            fec_bytes.insert(fec_bytes.end(), (char *)iov[0].iov_base, (char *)iov[0].iov_base + iov[0].iov_len);
+            fec_bytes.insert(fec_bytes.end(), (char *)iov[1].iov_base, (char *)iov[1].iov_base + iov[1].iov_len);
+            fec_datagrams.push_back(d);
+        }
+    }
+    fec_first[FEC_FRAMES] = fec_datagrams.size();
+    decoder = new fec_decoder();
+}
+
+static uint64_t run_fec(uint64_t ops)
+{
+    static uint32_t seq;
+    uint64_t bytes = 0;
+    uint32_t len;
+
+    for (uint64_t i = 0; i < ops; i++, seq++)
+    {
+        uint32_t f = seq % FEC_FRAMES;
+        for (size_t k = fec_first[f]; k < fec_first[f + 1]; k++)
+        {
+            char *dgram = fec_bytes.data() + fec_datagrams[k].offset;
+            // every pass over the frames continues the sequence, or they are late
+            memcpy(dgram + offsetof(struct datagram_header, frame_seq), &seq, 4);
+            if (decoder->add(dgram, fec_datagrams[k].len, &len))
+                bytes += len;
+        }
+    }
+    return bytes;
+}
+
+// playout buffer pool
+
+static playout *player;
+
+static void present_nothing(const char *, uint32_t, uint32_t, void *)
+{
+}
+
+static void setup_playout()
+{
+    player = new playout(MAX_FRAME, PLAYOUT_SLOTS, FRAME_RING_ALIGN, 0, 0, present_nothing, NULL);
+}
+
+static uint64_t run_playout(uint64_t ops)
+{
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        char *buf = player->acquire();
+        if (!buf)
+            errx(1, "playout: no free buffer");
+        player->release(buf);
+    }
+    return 0;
+}
+
+// hand-off to a TEE invoker thread and back
+
+static tee_invoker *invoker;
+
+static size_t no_command()
+{
+    return 0;
+}
+
+static tee_task handoff(uint64_t ops)
+{
+    for (uint64_t i = 0; i < ops; i++)
+        co_await invoker->invoke(no_command);
+}
+
+static void setup_invoker()
+{
+    invoker = new tee_invoker(1);
+}
+
+static uint64_t run_invoker(uint64_t ops)
+{
+    handoff(ops);
+    invoker->drain();
+    return 0;
+}
+
+// shared-memory frame ring: publish a frame, read it back in place
+
+static frame_ring_writer ring;
+static frame_ring_reader ring_reader;
+
+static void setup_ring()
+{
+    if (!ring.open("tzs-microbench", FRAME_RING_SLOTS, MAX_FRAME) || !ring_reader.open("tzs-microbench"))
+        errx(1, "cannot open the frame ring");
+}
+
+static uint64_t run_ring(uint64_t ops)
+{
+    struct frame_view view;
+    uint64_t bytes = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        uint32_t len = sizes[i % FRAMES];
+        memcpy(ring.begin(), frame_data(i), len);
+        ring.commit(len, i);
+        if (ring_reader.next(&view, 0) != 1 || !ring_reader.validate(&view))
+            errx(1, "frame ring: frame %llu not read back", (unsigned long long)i);
+        bytes += view.length;
+    }
+    return bytes;
+}
+
+// hex dump main.cpp prints for every frame unless a perf option is given
+
+static FILE *devnull;
+
+static void setup_hex()
+{
+    devnull = fopen("/dev/null", "w");
+    if (!devnull)
+        err(1, "/dev/null");
+}
+
+static uint64_t run_hex(uint64_t ops)
+{
+    uint64_t bytes = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        hex_dump(devnull, frame_data(i), sizes[i % FRAMES]);
+        bytes += sizes[i % FRAMES];
+    }
+    return bytes;
+}
+
+static const struct bench benches[] = {
+    {"crc32c", "payload CRC32C check", NULL, run_crc32c},
+    {"tcp_receive", "recv() reassembly and header parsing", setup_tcp, run_tcp},
+    {"fec_reassembly", "datagrams to a frame, 1 in 10 rebuilt", setup_fec, run_fec},
+    {"playout_pool", "playout buffer acquire + release", setup_playout, run_playout},
+    {"tee_handoff", "co_await an empty TEE command", setup_invoker, run_invoker},
+    {"frame_ring", "ring publish + read back", setup_ring, run_ring},
+    {"hex_dump", "per-frame hex output", setup_hex, run_hex},
+};
+#define BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static void run_bench(const struct bench *b, double min_ms)
+{
+    uint64_t ops = 1, bytes, allocs;
+    double secs;
+
+    if (b->setup)
+        b->setup();
+    // the first rounds are the warm-up
+    for (;;)
+    {
+        perf_count_allocs(true);
+        uint64_t t0 = monotonic_ns();
+        bytes = b->run(ops);
+        secs = (monotonic_ns() - t0) / 1e9;
+        perf_count_allocs(false);
+        allocs = perf_allocs();
+        if (secs * 1000 >= min_ms)
+            break;
+        uint64_t next = secs > 0 ? ops * (min_ms * 1.2 / (secs * 1000)) : ops * 100;
+        ops = std::min(std::max(next, ops * 2), ops * 100);
+    }
+    printf("%-16s %10llu %12.1f", b->name, (unsigned long long)ops, secs * 1e9 / ops);
+    if (bytes)
+        printf(" %10.1f", bytes / secs / 1e6);
+    else
+        printf(" %10s", "-");
+    printf(" %10.3f   %s\n", (double)allocs / ops, b->what);
+}
+
+void usage(const char *prog)
+{
+    printf("usage: %s [--filter TEXT] [--min-ms MS] [--list]\n", prog);
+    printf("  --filter TEXT  only the benchmarks whose name contains TEXT\n");
+    printf("  --min-ms MS    run each benchmark for at least MS milliseconds (default 500)\n");
+    printf("  --list         print the benchmarks and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    double min_ms = 500;
+
+    static struct option options[] = {
+        {"filter", required_argument, NULL, 'f'},
+        {"min-ms", required_argument, NULL, 'm'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:m:lh", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            filter = optarg;
+            break;
+        case 'm':
+            min_ms = atof(optarg);
+            if (min_ms <= 0)
+                errx(1, "--min-ms must be positive");
+            break;
+        case 'l':
+            for (size_t i = 0; i < BENCHES; i++)
+                printf("%-16s %s\n", benches[i].name, benches[i].what);
+            return 0;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    make_frames();
+    uint64_t total = 0;
+    for (int i = 0; i < FRAMES; i++)
+        total += sizes[i];
+    printf("frames: 1 keyframe of 48-80 KiB in %d, 2-12 KiB deltas, %llu bytes on average; crc32c %s\n",
+           KEYFRAME_INTERVAL, (unsigned long long)(total / FRAMES), crc32c_impl_name());
+    printf("%-16s %10s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "MB/s", "allocs/op");
+    for (size_t i = 0; i < BENCHES; i++)
+        if (!filter || strstr(benches[i].name, filter))
+            run_bench(&benches[i], min_ms);
+
+    if (have_capture)
+        unlink(capture_path);
+    ring.close();
+    if (player)
+        player->stop();
+    return 0;
+}
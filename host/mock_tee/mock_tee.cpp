@@ -0,0 +1,687 @@
+// Software stand-in for libteec and the my_test TA (ta/my_test_ta.c,
+// ta/ecdh_ta.c), so the client builds and runs on a machine without
+// OP-TEE: the perf suite (host/perf) and development hosts. Every command
+// does what the TA does, with OpenSSL, on the calling thread; nothing is
+// isolated, so it is never a replacement for the TEE. Secure storage is a
+// directory of PEM files, $TZS_MOCK_TEE_DIR or /tmp/tzs_mock_tee.
+// Like the TA's default build, all sessions of the process share one
+// instance, kept after the last one closes, and take turns on its lock;
+// TZS_MOCK_TEE_SHARED=0 gives each session an instance of its own, as
+// TA_SHARED_KEYS 0 does.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/param_build.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include "tee_client_api.h"
+#include "my_test_ta.h"
+
+#define MOCK_TEE_DIR "/tmp/tzs_mock_tee"
+#define MOCK_KEY_SLOTS 2
+#define ECDH_COORD_LEN 32
+
+struct mock_key_slot
+{
+    uint32_t key_id;
+    EVP_PKEY *key;
+};
+
+struct mock_session;
+
+// struct key_table and struct ecdh_state of the TA
+struct mock_instance
+{
+    std::mutex lock; // a TA instance runs one command at a time
+    uint32_t sessions;
+    uint32_t key_bits;
+    uint32_t scheme;
+    struct mock_key_slot slots[MOCK_KEY_SLOTS];
+    uint32_t active;
+    uint32_t curve;
+    EVP_PKEY *ecdh_key;
+    EVP_CIPHER_CTX *aes; // NULL until a key is derived or loaded
+    struct mock_session *owner;
+    uint8_t token[TA_SHARE_TOKEN_SIZE];
+    bool shared;    // token is set
+    uint32_t epoch; // bumped whenever the table is cleared
+};
+
+// struct rsa_session of the TA
+struct mock_session
+{
+    struct mock_instance *ta;
+    struct mock_key_slot own; // generated while another session owned the table
+    uint32_t epoch;           // of the table it attached to, 0 if it did not
+};
+
+// the instance every session opens on unless TZS_MOCK_TEE_SHARED=0, kept alive
+static struct mock_instance *shared_instance;
+static std::mutex shared_instance_lock;
+
+#define ACTIVE_SLOT(ta) (&(ta)->slots[(ta)->active])
+#define PENDING_SLOT(ta) (&(ta)->slots[(ta)->active ^ 1])
+
+static bool uses_table(struct mock_session *s)
+{
+    return s->ta->owner == s || (s->epoch != 0 && s->epoch == s->ta->epoch);
+}
+
+// the key a session's commands use, as SESSION_SLOT() in the TA
+static struct mock_key_slot *session_slot(struct mock_session *s)
+{
+    return s->own.key || !uses_table(s) ? &s->own : ACTIVE_SLOT(s->ta);
+}
+
+static bool claim_table(struct mock_session *s)
+{
+    if (s->ta->owner && s->ta->owner != s)
+        return false;
+    s->ta->owner = s;
+    return true;
+}
+
+static bool param_types_are(uint32_t types, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+    return types == TEEC_PARAM_TYPES(p0, p1, p2, p3);
+}
+
+static void fill_slot(struct mock_key_slot *slot, EVP_PKEY *key, uint32_t key_id)
+{
+    EVP_PKEY_free(slot->key);
+    slot->key = key;
+    slot->key_id = key_id;
+}
+
+static struct mock_key_slot *select_slot(struct mock_session *s, uint32_t key_id)
+{
+    struct mock_key_slot *slot = &s->own;
+
+    if (slot->key && (key_id == TA_RSA_KEY_ID_ACTIVE || key_id == slot->key_id))
+        return slot;
+    if (!uses_table(s))
+        return NULL;
+    slot = ACTIVE_SLOT(s->ta);
+    if (key_id == TA_RSA_KEY_ID_ACTIVE || key_id == slot->key_id)
+        return slot->key ? slot : NULL;
+    slot = PENDING_SLOT(s->ta);
+    if (!slot->key || slot->key_id != key_id)
+        return NULL;
+    // first frame under the next key, for every session
+    s->ta->active ^= 1;
+    return slot;
+}
+
+static void reset_table(struct mock_instance *ta)
+{
+    for (int i = 0; i < MOCK_KEY_SLOTS; i++)
+        fill_slot(&ta->slots[i], NULL, 0);
+    ta->active = 0;
+    EVP_PKEY_free(ta->ecdh_key);
+    ta->ecdh_key = NULL;
+    EVP_CIPHER_CTX_free(ta->aes);
+    ta->aes = NULL;
+    ta->owner = NULL;
+    OPENSSL_cleanse(ta->token, sizeof(ta->token));
+    ta->shared = false;
+    if (++ta->epoch == 0)
+        ta->epoch = 1;
+}
+
+static int set_rsa_padding(EVP_PKEY_CTX *ctx, uint32_t scheme)
+{
+    const EVP_MD *md = scheme == TA_RSA_SCHEME_OAEP_SHA1 ? EVP_sha1() : EVP_sha256();
+
+    if (scheme == TA_RSA_SCHEME_PKCS1_V1_5)
+        return EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0;
+    // OP-TEE's OAEP variants use MGF1 with the same hash
+    return EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) > 0 &&
+           EVP_PKEY_CTX_set_rsa_oaep_md(ctx, md) > 0 && EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, md) > 0;
+}
+
+static TEEC_Result rsa_crypt(struct mock_session *s, EVP_PKEY *key, bool decrypt, const void *in, size_t in_len,
+                             void *out, size_t *out_len)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+    int ok;
+
+    if (decrypt)
+        ok = ctx && EVP_PKEY_decrypt_init(ctx) > 0 && set_rsa_padding(ctx, s->ta->scheme) &&
+             EVP_PKEY_decrypt(ctx, (uint8_t *)out, out_len, (const uint8_t *)in, in_len) > 0;
+    else
+        ok = ctx && EVP_PKEY_encrypt_init(ctx) > 0 && set_rsa_padding(ctx, s->ta->scheme) &&
+             EVP_PKEY_encrypt(ctx, (uint8_t *)out, out_len, (const uint8_t *)in, in_len) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok ? TEEC_SUCCESS : TEEC_ERROR_GENERIC;
+}
+
+static TEEC_Result aes_set_key(struct mock_instance *ta, const uint8_t *key, size_t key_len)
+{
+    if (key_len != TA_ECDH_AES_KEY_SIZE)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!ta->aes)
+        ta->aes = EVP_CIPHER_CTX_new();
+    if (!ta->aes || EVP_DecryptInit_ex(ta->aes, EVP_aes_128_ctr(), NULL, key, NULL) <= 0)
+        return TEEC_ERROR_GENERIC;
+    return TEEC_SUCCESS;
+}
+
+// AES-CTR from iv, keeping the key schedule
+static TEEC_Result aes_ctr(struct mock_instance *ta, const uint8_t iv[16], const void *in, size_t len, void *out)
+{
+    int out_len;
+
+    if (!ta->aes)
+        return TEEC_ERROR_BAD_STATE;
+    if (EVP_DecryptInit_ex(ta->aes, NULL, NULL, NULL, iv) <= 0 ||
+        EVP_DecryptUpdate(ta->aes, (uint8_t *)out, &out_len, (const uint8_t *)in, len) <= 0)
+        return TEEC_ERROR_GENERIC;
+    return TEEC_SUCCESS;
+}
+
+// secure storage object id to a file, NULL if the id would leave the directory
+static const char *object_path(const TEEC_TempMemoryReference *id, char *path, size_t path_sz)
+{
+    const char *dir = getenv("TZS_MOCK_TEE_DIR");
+    const char *name = (const char *)id->buffer;
+
+    if (!dir || !*dir)
+        dir = MOCK_TEE_DIR;
+    if (id->size == 0 || memchr(name, '/', id->size) || (name[0] == '.'))
+        return NULL;
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+        return NULL;
+    snprintf(path, path_sz, "%s/%.*s.pem", dir, (int)id->size, name);
+    return path;
+}
+
+static TEEC_Result load_stored_key(const TEEC_TempMemoryReference *id, EVP_PKEY **key)
+{
+    char path[512];
+    FILE *f;
+
+    if (!object_path(id, path, sizeof(path)))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    f = fopen(path, "r");
+    if (!f)
+        return TEEC_ERROR_ITEM_NOT_FOUND;
+    *key = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+    return *key ? TEEC_SUCCESS : TEEC_ERROR_GENERIC;
+}
+
+static TEEC_Result rsa_gen_keys(struct mock_session *s)
+{
+    EVP_PKEY *key = EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t)s->ta->key_bits);
+
+    if (!key)
+        return TEEC_ERROR_GENERIC;
+    // a rotation worker's key stays with it until the owner loads it
+    fill_slot(claim_table(s) ? ACTIVE_SLOT(s->ta) : &s->own, key, 0);
+    return TEEC_SUCCESS;
+}
+
+static TEEC_Result get_bn(EVP_PKEY *key, const char *name, TEEC_TempMemoryReference *out)
+{
+    BIGNUM *bn = NULL;
+    TEEC_Result res = TEEC_SUCCESS;
+
+    if (EVP_PKEY_get_bn_param(key, name, &bn) <= 0)
+        return TEEC_ERROR_GENERIC;
+    if ((size_t)BN_num_bytes(bn) > out->size)
+        res = TEEC_ERROR_SHORT_BUFFER;
+    else
+        out->size = BN_bn2bin(bn, (uint8_t *)out->buffer);
+    BN_free(bn);
+    return res;
+}
+
+static TEEC_Result rsa_get_pub_key(struct mock_session *s, TEEC_Operation *op)
+{
+    TEEC_Result res;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_OUTPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!session_slot(s)->key)
+        return TEEC_ERROR_BAD_STATE;
+    res = get_bn(session_slot(s)->key, OSSL_PKEY_PARAM_RSA_E, &op->params[0].tmpref);
+    if (res == TEEC_SUCCESS)
+        res = get_bn(session_slot(s)->key, OSSL_PKEY_PARAM_RSA_N, &op->params[1].tmpref);
+    return res;
+}
+
+static TEEC_Result rsa_encrypt(struct mock_session *s, TEEC_Operation *op)
+{
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!session_slot(s)->key)
+        return TEEC_ERROR_BAD_STATE;
+    return rsa_crypt(s, session_slot(s)->key, false, op->params[0].tmpref.buffer, op->params[0].tmpref.size,
+                     op->params[1].tmpref.buffer, &op->params[1].tmpref.size);
+}
+
+static TEEC_Result rsa_decrypt(struct mock_session *s, TEEC_Operation *op)
+{
+    uint32_t types = op->paramTypes;
+    uint32_t key_id = TA_RSA_KEY_ID_ACTIVE;
+    struct mock_key_slot *slot;
+
+    // param[2] is optional, as in the TA
+    if (TEEC_PARAM_TYPE_GET(types, 2) == TEEC_VALUE_INPUT)
+    {
+        key_id = op->params[2].value.a;
+        types &= ~TEEC_PARAM_TYPES(0, 0, 0xf, 0);
+    }
+    if (!param_types_are(types, TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    slot = select_slot(s, key_id);
+    if (!slot)
+        return TEEC_ERROR_ITEM_NOT_FOUND;
+    return rsa_crypt(s, slot->key, true, op->params[0].tmpref.buffer, op->params[0].tmpref.size,
+                     op->params[1].tmpref.buffer, &op->params[1].tmpref.size);
+}
+
+static TEEC_Result rsa_store_key(struct mock_session *s, TEEC_Operation *op)
+{
+    char path[512];
+    FILE *f;
+    int ok;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!session_slot(s)->key)
+        return TEEC_ERROR_BAD_STATE;
+    if (!object_path(&op->params[0].tmpref, path, sizeof(path)))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    f = fopen(path, "w");
+    if (!f)
+        return TEEC_ERROR_GENERIC;
+    ok = PEM_write_PrivateKey(f, session_slot(s)->key, NULL, NULL, 0, NULL, NULL);
+    if (fclose(f) != 0)
+        ok = 0;
+    return ok ? TEEC_SUCCESS : TEEC_ERROR_GENERIC;
+}
+
+static TEEC_Result rsa_load_key(struct mock_session *s, TEEC_Operation *op)
+{
+    EVP_PKEY *key;
+    TEEC_Result res;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!claim_table(s))
+        return TEEC_ERROR_ACCESS_CONFLICT;
+    res = load_stored_key(&op->params[0].tmpref, &key);
+    if (res == TEEC_SUCCESS)
+        fill_slot(ACTIVE_SLOT(s->ta), key, 0);
+    return res;
+}
+
+static TEEC_Result rsa_load_pending_key(struct mock_session *s, TEEC_Operation *op)
+{
+    uint32_t key_id = op->params[1].value.a;
+    EVP_PKEY *key;
+    TEEC_Result res;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (key_id == TA_RSA_KEY_ID_ACTIVE || key_id == ACTIVE_SLOT(s->ta)->key_id)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!claim_table(s))
+        return TEEC_ERROR_ACCESS_CONFLICT;
+    res = load_stored_key(&op->params[0].tmpref, &key);
+    if (res == TEEC_SUCCESS)
+        fill_slot(PENDING_SLOT(s->ta), key, key_id);
+    return res;
+}
+
+static TEEC_Result ecdh_gen_key(struct mock_instance *ta, TEEC_Operation *op)
+{
+    TEEC_TempMemoryReference *pub = &op->params[1].tmpref;
+    int ok;
+
+    if (!param_types_are(op->paramTypes, TEEC_VALUE_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    EVP_PKEY_free(ta->ecdh_key);
+    ta->ecdh_key = NULL;
+    ta->curve = op->params[0].value.a;
+    if (ta->curve == TA_ECDH_CURVE_X25519)
+    {
+        if (pub->size < ECDH_COORD_LEN)
+            return TEEC_ERROR_SHORT_BUFFER;
+        ta->ecdh_key = EVP_PKEY_Q_keygen(NULL, NULL, "X25519");
+        ok = ta->ecdh_key && EVP_PKEY_get_raw_public_key(ta->ecdh_key, (uint8_t *)pub->buffer, &pub->size) > 0;
+    }
+    else if (ta->curve == TA_ECDH_CURVE_P256)
+    {
+        if (pub->size < 1 + 2 * ECDH_COORD_LEN)
+            return TEEC_ERROR_SHORT_BUFFER;
+        ta->ecdh_key = EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+        // uncompressed point, like the TA writes it
+        ok = ta->ecdh_key && EVP_PKEY_get_octet_string_param(ta->ecdh_key, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                                            (uint8_t *)pub->buffer, pub->size, &pub->size) > 0;
+    }
+    else
+        return TEEC_ERROR_BAD_PARAMETERS;
+    return ok ? TEEC_SUCCESS : TEEC_ERROR_GENERIC;
+}
+
+static EVP_PKEY *ecdh_peer_key(uint32_t curve, const uint8_t *peer, size_t peer_len)
+{
+    EVP_PKEY *pkey = NULL;
+
+    if (curve == TA_ECDH_CURVE_X25519)
+        return EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer, peer_len);
+
+    char group[] = "prime256v1";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, group, 0),
+        OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, (void *)peer, peer_len),
+        OSSL_PARAM_construct_end(),
+    };
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+    if (ctx && EVP_PKEY_fromdata_init(ctx) > 0)
+        EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params);
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+// HKDF-SHA256 with a zero salt, as hkdf_sha256() in ta/ecdh_ta.c
+static int hkdf_sha256(const uint8_t *secret, size_t secret_len, uint8_t *key, size_t key_len)
+{
+    static const uint8_t salt[32] = {0};
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    int ok = ctx && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, sizeof(salt)) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_len) > 0 &&
+             EVP_PKEY_CTX_add1_hkdf_info(ctx, (const uint8_t *)TA_ECDH_HKDF_INFO, strlen(TA_ECDH_HKDF_INFO)) > 0 &&
+             EVP_PKEY_derive(ctx, key, &key_len) > 0;
+
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+static TEEC_Result ecdh_derive(struct mock_instance *ta, TEEC_Operation *op)
+{
+    EVP_PKEY *peer;
+    EVP_PKEY_CTX *ctx = NULL;
+    uint8_t secret[ECDH_COORD_LEN];
+    size_t secret_len = sizeof(secret);
+    uint8_t key[TA_ECDH_AES_KEY_SIZE];
+    TEEC_Result res = TEEC_ERROR_GENERIC;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!ta->ecdh_key)
+        return TEEC_ERROR_BAD_STATE;
+    peer = ecdh_peer_key(ta->curve, (const uint8_t *)op->params[0].tmpref.buffer, op->params[0].tmpref.size);
+    if (!peer)
+        res = TEEC_ERROR_BAD_PARAMETERS;
+    else if ((ctx = EVP_PKEY_CTX_new(ta->ecdh_key, NULL)) && EVP_PKEY_derive_init(ctx) > 0 &&
+             EVP_PKEY_derive_set_peer(ctx, peer) > 0 && EVP_PKEY_derive(ctx, secret, &secret_len) > 0 &&
+             hkdf_sha256(secret, secret_len, key, sizeof(key)))
+        res = aes_set_key(ta, key, sizeof(key));
+    OPENSSL_cleanse(secret, sizeof(secret));
+    OPENSSL_cleanse(key, sizeof(key));
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    // forward secrecy: the ephemeral key is single use
+    EVP_PKEY_free(ta->ecdh_key);
+    ta->ecdh_key = NULL;
+    return res;
+}
+
+static TEEC_Result aes_decrypt_frame(struct mock_instance *ta, TEEC_Operation *op)
+{
+    uint8_t iv[16] = {0};
+    uint32_t seq = op->params[2].value.a;
+    uint32_t block = op->params[2].value.b;
+    TEEC_Result res;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_INPUT,
+                         TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (op->params[1].tmpref.size < op->params[0].tmpref.size)
+        return TEEC_ERROR_SHORT_BUFFER;
+    // seq (64 bit big endian) || block (64 bit big endian)
+    for (int i = 0; i < 4; i++)
+    {
+        iv[4 + i] = seq >> (24 - 8 * i);
+        iv[12 + i] = block >> (24 - 8 * i);
+    }
+    res = aes_ctr(ta, iv, op->params[0].tmpref.buffer, op->params[0].tmpref.size, op->params[1].tmpref.buffer);
+    if (res == TEEC_SUCCESS)
+        op->params[1].tmpref.size = op->params[0].tmpref.size;
+    return res;
+}
+
+static TEEC_Result aes_load_group_key(struct mock_session *s, TEEC_Operation *op)
+{
+    // nonce reserved for key wrapping, frame seqs never get there
+    static const uint8_t wrap_iv[16] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    const TEEC_TempMemoryReference *wrapped = &op->params[0].tmpref;
+    uint8_t key[3072 / 8]; // largest RSA block
+    size_t key_len = sizeof(key);
+    struct mock_key_slot *slot;
+    TEEC_Result res;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!claim_table(s))
+        return TEEC_ERROR_ACCESS_CONFLICT;
+    switch (op->params[1].value.a)
+    {
+    case TA_GROUP_WRAP_RSA:
+        slot = select_slot(s, op->params[1].value.b);
+        if (!slot)
+            return TEEC_ERROR_ITEM_NOT_FOUND;
+        res = rsa_crypt(s, slot->key, true, wrapped->buffer, wrapped->size, key, &key_len);
+        break;
+    case TA_GROUP_WRAP_ECDH:
+        if (wrapped->size > sizeof(key))
+            return TEEC_ERROR_BAD_PARAMETERS;
+        key_len = wrapped->size;
+        res = aes_ctr(s->ta, wrap_iv, wrapped->buffer, key_len, key);
+        break;
+    default:
+        return TEEC_ERROR_BAD_PARAMETERS;
+    }
+    if (res == TEEC_SUCCESS)
+        res = aes_set_key(s->ta, key, key_len);
+    OPENSSL_cleanse(key, sizeof(key));
+    return res;
+}
+
+static TEEC_Result share_keys(struct mock_session *s, TEEC_Operation *op)
+{
+    TEEC_TempMemoryReference *token = &op->params[0].tmpref;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (s->ta->owner != s)
+        return TEEC_ERROR_ACCESS_DENIED;
+    if (token->size < TA_SHARE_TOKEN_SIZE)
+        return TEEC_ERROR_SHORT_BUFFER;
+    if (RAND_bytes(s->ta->token, sizeof(s->ta->token)) <= 0)
+        return TEEC_ERROR_GENERIC;
+    s->ta->shared = true;
+    memcpy(token->buffer, s->ta->token, sizeof(s->ta->token));
+    token->size = sizeof(s->ta->token);
+    return TEEC_SUCCESS;
+}
+
+static TEEC_Result attach_keys(struct mock_session *s, TEEC_Operation *op)
+{
+    const TEEC_TempMemoryReference *token = &op->params[0].tmpref;
+
+    if (!param_types_are(op->paramTypes, TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE) ||
+        token->size != TA_SHARE_TOKEN_SIZE)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (!s->ta->shared || CRYPTO_memcmp(token->buffer, s->ta->token, TA_SHARE_TOKEN_SIZE) != 0)
+        return TEEC_ERROR_ACCESS_DENIED;
+    s->epoch = s->ta->epoch;
+    return TEEC_SUCCESS;
+}
+
+extern "C" {
+
+TEEC_Result TEEC_InitializeContext(const char *, TEEC_Context *context)
+{
+    context->fd = -1;
+    return TEEC_SUCCESS;
+}
+
+void TEEC_FinalizeContext(TEEC_Context *)
+{
+}
+
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session, const TEEC_UUID *destination,
+                             uint32_t, const void *, TEEC_Operation *operation,
+                             uint32_t *returnOrigin)
+{
+    static const TEEC_UUID uuid = TA_MY_TEST_UUID;
+    const char *shared = getenv("TZS_MOCK_TEE_SHARED");
+    struct mock_instance *ta;
+    struct mock_session *s;
+    // sessions opened without parameters keep the TA's original setup
+    uint32_t key_bits = 1024, scheme = TA_RSA_SCHEME_PKCS1_V1_5;
+    bool report = false;
+
+    if (returnOrigin)
+        *returnOrigin = TEEC_ORIGIN_TRUSTED_APP;
+    if (memcmp(destination, &uuid, sizeof(uuid)) != 0)
+        return TEEC_ERROR_ITEM_NOT_FOUND;
+    if (operation && (param_types_are(operation->paramTypes, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE) ||
+                      param_types_are(operation->paramTypes, TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE)))
+    {
+        key_bits = operation->params[0].value.a;
+        scheme = operation->params[0].value.b;
+        report = TEEC_PARAM_TYPE_GET(operation->paramTypes, 1) == TEEC_VALUE_OUTPUT;
+    }
+    if ((key_bits != 1024 && key_bits != 2048 && key_bits != 3072) || scheme > TA_RSA_SCHEME_OAEP_SHA256)
+        return TEEC_ERROR_NOT_SUPPORTED;
+
+    if (shared && strcmp(shared, "0") == 0)
+        ta = new mock_instance();
+    else
+    {
+        std::lock_guard<std::mutex> guard(shared_instance_lock);
+        if (!shared_instance)
+            shared_instance = new mock_instance();
+        ta = shared_instance;
+    }
+    std::lock_guard<std::mutex> hold(ta->lock);
+    // the keys in the table are of the size and scheme they were negotiated with
+    if (ta->sessions > 0 && (ta->key_bits != key_bits || ta->scheme != scheme))
+        return TEEC_ERROR_ACCESS_CONFLICT;
+    if (ta->key_bits != key_bits || ta->scheme != scheme)
+    {
+        reset_table(ta);
+        ta->key_bits = key_bits;
+        ta->scheme = scheme;
+    }
+    ta->sessions++;
+    if (report)
+    {
+        operation->params[1].value.a = ta == shared_instance;
+        operation->params[1].value.b = ta->sessions;
+    }
+
+    s = new mock_session();
+    s->ta = ta;
+    session->ctx = context;
+    session->ta = s;
+    return TEEC_SUCCESS;
+}
+
+void TEEC_CloseSession(TEEC_Session *session)
+{
+    struct mock_session *s = (struct mock_session *)session->ta;
+    struct mock_instance *ta = s->ta;
+    bool last;
+
+    {
+        std::lock_guard<std::mutex> hold(ta->lock);
+        EVP_PKEY_free(s->own.key);
+        ta->sessions--;
+        // the shared instance is kept, but not with this client's keys
+        if (ta->owner == s)
+            reset_table(ta);
+        last = ta->sessions == 0 && ta != shared_instance;
+    }
+    if (last)
+    {
+        reset_table(ta);
+        delete ta;
+    }
+    delete s;
+    session->ta = NULL;
+}
+
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t commandID, TEEC_Operation *operation,
+                               uint32_t *returnOrigin)
+{
+    struct mock_session *s = (struct mock_session *)session->ta;
+    TEEC_Operation none;
+    std::lock_guard<std::mutex> hold(s->ta->lock);
+
+    if (returnOrigin)
+        *returnOrigin = TEEC_ORIGIN_TRUSTED_APP;
+    if (!operation)
+    {
+        memset(&none, 0, sizeof(none));
+        operation = &none;
+    }
+    switch (commandID)
+    {
+    case TA_RSA_CMD_GENKEYS:
+        return rsa_gen_keys(s);
+    case TA_RSA_CMD_ENCRYPT:
+        return rsa_encrypt(s, operation);
+    case TA_RSA_CMD_DECRYPT:
+        return rsa_decrypt(s, operation);
+    case TA_RSA_CMD_GET_PUB_KEY:
+        return rsa_get_pub_key(s, operation);
+    case TA_RSA_CMD_STORE_KEY:
+        return rsa_store_key(s, operation);
+    case TA_RSA_CMD_LOAD_KEY:
+        return rsa_load_key(s, operation);
+    case TA_RSA_CMD_LOAD_PENDING_KEY:
+        return rsa_load_pending_key(s, operation);
+    case TA_RSA_CMD_DROP_CRT:
+        // OpenSSL keeps the CRT parameters, nothing to measure here
+        if (session_slot(s) != &s->own && !claim_table(s))
+            return TEEC_ERROR_ACCESS_CONFLICT;
+        return session_slot(s)->key ? TEEC_SUCCESS : TEEC_ERROR_BAD_STATE;
+    case TA_ECDH_CMD_GEN_KEY:
+        if (!claim_table(s))
+            return TEEC_ERROR_ACCESS_CONFLICT;
+        return ecdh_gen_key(s->ta, operation);
+    case TA_ECDH_CMD_DERIVE:
+        if (!claim_table(s))
+            return TEEC_ERROR_ACCESS_CONFLICT;
+        return ecdh_derive(s->ta, operation);
+    case TA_AES_CMD_DECRYPT_FRAME:
+        if (!uses_table(s))
+            return TEEC_ERROR_ACCESS_DENIED;
+        return aes_decrypt_frame(s->ta, operation);
+    case TA_AES_CMD_LOAD_GROUP_KEY:
+        return aes_load_group_key(s, operation);
+    case TA_CMD_SHARE_KEYS:
+        return share_keys(s, operation);
+    case TA_CMD_ATTACH_KEYS:
+        return attach_keys(s, operation);
+    default:
+        return TEEC_ERROR_NOT_SUPPORTED;
+    }
+}
+
+}
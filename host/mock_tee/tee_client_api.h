@@ -0,0 +1,103 @@
+#ifndef TEE_CLIENT_API_H
+#define TEE_CLIENT_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The part of the GlobalPlatform TEE Client API the client uses, for
+// builds with -DTZS_MOCK_TEE=ON. The commands run in mock_tee.cpp, in
+// this process, instead of in the TA. Constants and layouts are those of
+// optee_client, so host/include/tee.cpp builds unchanged against either.
+
+typedef uint32_t TEEC_Result;
+
+typedef struct
+{
+    uint32_t timeLow;
+    uint16_t timeMid;
+    uint16_t timeHiAndVersion;
+    uint8_t clockSeqAndNode[8];
+} TEEC_UUID;
+
+typedef struct
+{
+    int fd; // unused
+} TEEC_Context;
+
+typedef struct
+{
+    TEEC_Context *ctx;
+    void *ta; // struct mock_session
+} TEEC_Session;
+
+typedef struct
+{
+    void *buffer;
+    size_t size;
+} TEEC_TempMemoryReference;
+
+typedef struct
+{
+    uint32_t a;
+    uint32_t b;
+} TEEC_Value;
+
+typedef union
+{
+    TEEC_TempMemoryReference tmpref;
+    TEEC_Value value;
+} TEEC_Parameter;
+
+typedef struct
+{
+    uint32_t started;
+    uint32_t paramTypes;
+    TEEC_Parameter params[4];
+    TEEC_Session *session;
+} TEEC_Operation;
+
+#define TEEC_SUCCESS 0x00000000
+#define TEEC_ERROR_GENERIC 0xFFFF0000
+#define TEEC_ERROR_ACCESS_DENIED 0xFFFF0001
+#define TEEC_ERROR_ACCESS_CONFLICT 0xFFFF0003
+#define TEEC_ERROR_BAD_PARAMETERS 0xFFFF0006
+#define TEEC_ERROR_BAD_STATE 0xFFFF0007
+#define TEEC_ERROR_ITEM_NOT_FOUND 0xFFFF0008
+#define TEEC_ERROR_NOT_SUPPORTED 0xFFFF000A
+#define TEEC_ERROR_OUT_OF_MEMORY 0xFFFF000C
+#define TEEC_ERROR_SHORT_BUFFER 0xFFFF0010
+
+#define TEEC_ORIGIN_API 0x00000001
+#define TEEC_ORIGIN_TRUSTED_APP 0x00000004
+
+#define TEEC_NONE 0x00000000
+#define TEEC_VALUE_INPUT 0x00000001
+#define TEEC_VALUE_OUTPUT 0x00000002
+#define TEEC_VALUE_INOUT 0x00000003
+#define TEEC_MEMREF_TEMP_INPUT 0x00000005
+#define TEEC_MEMREF_TEMP_OUTPUT 0x00000006
+#define TEEC_MEMREF_TEMP_INOUT 0x00000007
+
+#define TEEC_LOGIN_PUBLIC 0x00000000
+
+#define TEEC_PARAM_TYPES(p0, p1, p2, p3) ((p0) | ((p1) << 4) | ((p2) << 8) | ((p3) << 12))
+#define TEEC_PARAM_TYPE_GET(p, i) (((p) >> ((i) * 4)) & 0xF)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context);
+void TEEC_FinalizeContext(TEEC_Context *context);
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session, const TEEC_UUID *destination,
+                             uint32_t connectionMethod, const void *connectionData, TEEC_Operation *operation,
+                             uint32_t *returnOrigin);
+void TEEC_CloseSession(TEEC_Session *session);
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t commandID, TEEC_Operation *operation,
+                               uint32_t *returnOrigin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
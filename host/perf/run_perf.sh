@@ -0,0 +1,109 @@
+#!/bin/sh
+# Perf suite: replays a recorded stream through the client built with
+# -DTZS_MOCK_TEE=ON and holds each run to a baseline, see section 22 of
+# the README. ctest runs it as the perf test.
+#
+#   host/perf/run_perf.sh CLIENT_BUILD_DIR SERVER_BUILD_DIR [--record]
+#
+# The stream is recorded from the native server once and kept in
+# $TZS_PERF_DIR (default /tmp/tzs_perf) with the key it was sent for.
+# The baseline is $TZS_PERF_BASELINE, default baseline.txt next to this
+# script. Its numbers only mean something on the machine they came from.
+# Runs are noisy, so the suite passes if most of $RUNS (default 5) runs
+# are within the baseline. --record writes the baseline instead, each
+# metric the median of $RUNS runs.
+
+set -e
+if [ $# -lt 2 ]; then
+    echo "usage: $0 CLIENT_BUILD_DIR SERVER_BUILD_DIR [--record]" >&2
+    exit 1
+fi
+here=$(cd "$(dirname "$0")" && pwd)
+client=$1/optee_example_my_test
+server=$2/tzs_server
+work=${TZS_PERF_DIR:-/tmp/tzs_perf}
+runs=${RUNS:-5}
+port=${PERF_PORT:-47999}
+stream=$work/stream.tzsc
+baseline=${TZS_PERF_BASELINE:-$here/baseline.txt}
+
+# the mock TEE's secure storage, the stream's RSA key is kept there
+export TZS_MOCK_TEE_DIR=$work/storage
+mkdir -p "$work"
+
+if [ ! -f "$stream" ]; then
+    # 64 KiB frames at 1000 frames/s, delta coded, until the server drops us;
+    # --perf-record keeps the client from printing every frame
+    "$server" --port "$port" --fps 1000 --frame-size 65536 --keyframe 30 --motion 10 --storm 10000 \
+        >"$work/server.log" 2>&1 &
+    server_pid=$!
+    sleep 1
+    "$client" --server 127.0.0.1 --port "$port" --capture "$stream.tmp" --perf-record "$work/live.txt" \
+        >"$work/record.log" 2>&1 || true
+    kill "$server_pid"
+    mv "$stream.tmp" "$stream"
+    echo "Recorded $stream"
+fi
+
+if [ "$3" = "--record" ]; then
+    i=1
+    while [ "$i" -le "$runs" ]; do
+        "$client" --replay "$stream" --fast --perf-record "$work/record$i.txt" >"$work/run$i.log"
+        i=$((i + 1))
+    done
+    {
+        echo "# metric value tolerance, median of $runs runs by run_perf.sh --record"
+        echo "# on $(uname -n): $(uname -m), $(getconf _NPROCESSORS_ONLN 2>/dev/null || echo '?') CPUs"
+        # perf_write() puts the metrics in the same order in every file
+        cat "$work"/record*.txt | awk '
+            !/^#/ {
+                if (!($1 in n))
+                    order[++metrics] = $1
+                v[$1, ++n[$1]] = $2 + 0
+                tolerance[$1] = $3
+            }
+            END {
+                for (k = 1; k <= metrics; k++) {
+                    name = order[k]
+                    for (i = 1; i <= n[name]; i++)
+                        a[i] = v[name, i]
+                    for (i = 2; i <= n[name]; i++)
+                        for (j = i; j > 1 && a[j - 1] > a[j]; j--) {
+                            t = a[j]; a[j] = a[j - 1]; a[j - 1] = t
+                        }
+                    printf "%-17s %.4f %s\n", name, a[int((n[name] + 1) / 2)], tolerance[name]
+                }
+            }'
+    } >"$baseline"
+    rm -f "$work"/record*.txt
+    cat "$baseline"
+    exit 0
+fi
+
+i=1
+passed=0
+failed=0
+while [ "$i" -le "$runs" ]; do
+    status=0
+    "$client" --replay "$stream" --fast --perf-baseline "$baseline" >"$work/run$i.log" || status=$?
+    sed -n '/^metric /,/^$/p' "$work/run$i.log"
+    if [ "$status" -eq 0 ]; then
+        passed=$((passed + 1))
+    elif [ "$status" -eq 2 ]; then
+        failed=$((failed + 1))
+    else
+        echo "Run $i failed with status $status, see $work/run$i.log" >&2
+        exit 1
+    fi
+    # decided once either side has a majority
+    if [ $((2 * passed)) -gt "$runs" ]; then
+        echo "$passed of $runs runs are within the baseline"
+        exit 0
+    fi
+    if [ $((2 * failed)) -ge "$runs" ]; then
+        break
+    fi
+    i=$((i + 1))
+done
+echo "$failed of $runs runs regressed" >&2
+exit 1
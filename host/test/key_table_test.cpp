@@ -0,0 +1,107 @@
+// Who may use the key table of a shared TA instance (TA_SHARED_KEYS 1, the
+// mock TEE's default): the session that provisioned it and the sessions it
+// attached with TA_CMD_SHARE_KEYS' token, until it closes. Another session
+// on the kept instance, or one attached before the owner closed, must not
+// decrypt with them. Run by ctest, see CMakeLists.txt.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "decrypt_engine.h"
+
+#define TEST_FRAME 4096
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "WRONG");
+    if (!ok)
+        failures++;
+}
+
+static void open_session(struct tee_attrs *ta)
+{
+    ta->key_bits = 2048;
+    ta->scheme = TA_RSA_SCHEME_OAEP_SHA256;
+    ta->tiles = NULL;
+    init_tee_session(ta);
+}
+
+// an RSA key and a group key wrapped for it, as the client provisions the table
+static void provision(struct tee_attrs *ta, uint8_t fill)
+{
+    uint8_t key[TA_ECDH_AES_KEY_SIZE];
+    char wrapped[RSA_MAX_KEY_SIZE / 8];
+
+    rsa_gen_keys(ta);
+    memset(key, fill, sizeof(key));
+    rsa_encrypt(ta, (char *)key, sizeof(key), wrapped, ta->key_bits / 8);
+    aes_load_group_key(ta, wrapped, ta->key_bits / 8, TA_GROUP_WRAP_RSA, TA_RSA_KEY_ID_ACTIVE);
+}
+
+static bool decrypts(struct tee_attrs *ta, const char *in, char *out)
+{
+    return aes_decrypt_frame(ta, (char *)in, TEST_FRAME, out, TEST_FRAME, 1) == TEST_FRAME;
+}
+
+static TEEC_Result try_attach(struct tee_attrs *ta, const uint8_t *token)
+{
+    TEEC_Operation op;
+    uint32_t origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)token;
+    op.params[0].tmpref.size = TA_SHARE_TOKEN_SIZE;
+    return TEEC_InvokeCommand(&ta->sess, TA_CMD_ATTACH_KEYS, &op, &origin);
+}
+
+int main()
+{
+    struct tee_attrs owner, worker, stranger, next;
+    uint8_t token[TA_SHARE_TOKEN_SIZE], wrong[TA_SHARE_TOKEN_SIZE];
+    std::vector<char> in(TEST_FRAME, 0x3c), plain(TEST_FRAME), out(TEST_FRAME);
+
+    quiet = true;
+    open_session(&owner);
+    if (!owner.shared_keys)
+    {
+        printf("The TEE gives every session an instance of its own, nothing to check\n");
+        terminate_tee_session(&owner);
+        return 0;
+    }
+    provision(&owner, 0x5a);
+    check(decrypts(&owner, in.data(), plain.data()), "owner decrypts");
+
+    open_session(&worker);
+    open_session(&stranger);
+    check(!decrypts(&stranger, in.data(), out.data()), "session that did not attach is refused");
+
+    share_keys(&owner, token);
+    memcpy(wrong, token, sizeof(wrong));
+    wrong[TA_SHARE_TOKEN_SIZE - 1] ^= 1;
+    check(try_attach(&stranger, wrong) == TEEC_ERROR_ACCESS_DENIED, "wrong token is refused");
+    check(!decrypts(&stranger, in.data(), out.data()), "... and it still cannot decrypt");
+
+    attach_keys(&worker, token);
+    check(decrypts(&worker, in.data(), out.data()) && out == plain, "attached session decrypts with the owner's key");
+
+    // the instance is kept, its next client must start from an empty table
+    terminate_tee_session(&owner);
+    check(!decrypts(&worker, in.data(), out.data()), "attached session is refused once the owner closed");
+    check(try_attach(&stranger, token) == TEEC_ERROR_ACCESS_DENIED, "old token is refused once the owner closed");
+
+    open_session(&next);
+    provision(&next, 0xa5);
+    check(decrypts(&next, in.data(), out.data()) && out != plain, "next client decrypts with its own key");
+    check(!decrypts(&worker, in.data(), out.data()), "session attached to the old owner is refused");
+    check(!decrypts(&stranger, in.data(), out.data()), "session that did not attach is refused");
+
+    terminate_tee_session(&next);
+    terminate_tee_session(&stranger);
+    terminate_tee_session(&worker);
+    if (failures)
+        printf("%d checks failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Reconnect storm: the native server drops every connection every
+# $STORM_MS ms (default 700) and a --reconnect client must resume the
+# session with its ticket each time, for $SECONDS_RUN seconds (default 4).
+# Run by ctest with the mock TEE client, see section 12 of the README.
+#
+#   host/test/reconnect_storm.sh CLIENT_BUILD_DIR SERVER_BUILD_DIR
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 CLIENT_BUILD_DIR SERVER_BUILD_DIR" >&2
+    exit 1
+fi
+client=$1/optee_example_my_test
+server=$2/tzs_server
+work=${TZS_TEST_DIR:-/tmp/tzs_test}
+port=${STORM_PORT:-47998}
+storm_ms=${STORM_MS:-700}
+seconds=${SECONDS_RUN:-4}
+
+# the mock TEE's secure storage
+export TZS_MOCK_TEE_DIR=$work/storage
+mkdir -p "$work"
+
+"$server" --port "$port" --fps 30 --frame-size 1024 --storm "$storm_ms" >"$work/storm_server.log" 2>&1 &
+server_pid=$!
+sleep 1
+status=0
+timeout "$seconds" "$client" --server 127.0.0.1 --port "$port" --reconnect >"$work/storm_client.log" 2>&1 ||
+    status=$?
+kill "$server_pid"
+wait "$server_pid" 2>/dev/null
+
+grep -a '^Reconnected' "$work/storm_client.log"
+# still streaming when timeout stopped it, not dead on a dropped connection
+if [ "$status" -ne 124 ]; then
+    echo "The client exited with status $status during the storm, see $work/storm_client.log" >&2
+    exit 1
+fi
+drops=$((seconds * 1000 / storm_ms - 1))
+resumed=$(grep -ac '^Reconnected.*, resumed at frame' "$work/storm_client.log")
+if [ "$resumed" -lt "$drops" ]; then
+    echo "$resumed sessions resumed, expected at least $drops" >&2
+    exit 1
+fi
+echo "$resumed sessions resumed"
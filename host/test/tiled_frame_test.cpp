@@ -0,0 +1,86 @@
+// FRAME_VIDEO_TILED frames through decrypt_frame<aes_ctr_tiled_policy>() and
+// tile workers on the mock TEE. Tile tables that do not lay the tiles back
+// to back over at most FRAME_MAX_LEN bytes must be turned down before a
+// tile reaches a worker, the others decrypt. Run by ctest, see
+// CMakeLists.txt.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "decrypt_engine.h"
+#include "tile_workers.h"
+
+#define TEST_KEY_OBJECT "tiled-frame-test"
+#define TEST_SESSIONS 3
+
+static int failures;
+
+// one FRAME_VIDEO_TILED payload with the given tiles over len bytes of cipher text
+static void expect(bool accepted, struct tee_attrs *ta, const char *what, const std::vector<struct frame_tile> &tiles,
+                   size_t len)
+{
+    struct frame_header hdr;
+    uint32_t count = tiles.size();
+    size_t table = 4 + count * sizeof(struct frame_tile);
+    std::vector<char> in(table + len, 0x3c);
+    // the decrypted_frame, playout and ring slots are this big
+    std::vector<char> out(FRAME_MAX_LEN);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FRAME_MAGIC;
+    hdr.type = FRAME_VIDEO_TILED;
+    hdr.length = in.size();
+    memcpy(in.data(), &count, 4);
+    memcpy(in.data() + 4, tiles.data(), count * sizeof(struct frame_tile));
+
+    size_t n = decrypt_frame<aes_ctr_tiled_policy>(ta, &hdr, in.data(), out.data());
+    bool ok = accepted ? n == len : n == DECRYPT_FAILED;
+    printf("%-40s %-9s %s\n", what, n == DECRYPT_FAILED ? "rejected" : "decrypted", ok ? "ok" : "WRONG");
+    if (!ok)
+        failures++;
+}
+
+int main()
+{
+    struct tee_attrs ta;
+    uint8_t key[TA_ECDH_AES_KEY_SIZE];
+    char wrapped[RSA_MAX_KEY_SIZE / 8];
+    size_t quarter = FRAME_MAX_LEN / 4;
+
+    // a group key wrapped for our own RSA key, as a fan-out server would send it
+    quiet = true;
+    ta.key_bits = 2048;
+    ta.scheme = TA_RSA_SCHEME_OAEP_SHA256;
+    ta.tiles = NULL;
+    init_tee_session(&ta);
+    rsa_gen_keys(&ta);
+    rsa_store_key(&ta, TEST_KEY_OBJECT);
+    memset(key, 0x5a, sizeof(key));
+    rsa_encrypt(&ta, (char *)key, sizeof(key), wrapped, ta.key_bits / 8);
+    aes_load_group_key(&ta, wrapped, ta.key_bits / 8, TA_GROUP_WRAP_RSA, TA_RSA_KEY_ID_ACTIVE);
+    ta.tiles = new tile_workers(&ta, TEST_SESSIONS, TEST_KEY_OBJECT);
+    ta.tiles->load_group_key(wrapped, ta.key_bits / 8, TA_GROUP_WRAP_RSA, TA_RSA_KEY_ID_ACTIVE);
+
+    expect(true, &ta, "two tiles", {{0, 4096}, {4096, 1000}}, 5096);
+    expect(true, &ta, "four tiles of a full frame",
+           {{0, (uint32_t)quarter}, {(uint32_t)quarter, (uint32_t)quarter},
+            {(uint32_t)(2 * quarter), (uint32_t)quarter}, {(uint32_t)(3 * quarter), (uint32_t)quarter}},
+           FRAME_MAX_LEN);
+
+    // what parse_rx_frame() lets through: FRAME_MAX_PAYLOAD with one tile
+    size_t oversized = FRAME_MAX_PAYLOAD - 4 - sizeof(struct frame_tile);
+    expect(false, &ta, "one tile past FRAME_MAX_LEN", {{0, (uint32_t)oversized}}, oversized);
+    expect(false, &ta, "two tiles past FRAME_MAX_LEN",
+           {{0, FRAME_MAX_LEN}, {FRAME_MAX_LEN, FRAME_TILE_ALIGN}}, FRAME_MAX_LEN + FRAME_TILE_ALIGN);
+    expect(false, &ta, "gap between tiles", {{0, 16}, {32, 16}}, 48);
+    expect(false, &ta, "overlapping tiles", {{0, 32}, {16, 16}}, 32);
+    expect(false, &ta, "tiles short of the frame end", {{0, 16}}, 32);
+    expect(false, &ta, "first tile not at 0", {{16, 16}}, 32);
+    expect(false, &ta, "tile offset not aligned", {{0, 8}, {8, 8}}, 16);
+
+    delete ta.tiles;
+    terminate_tee_session(&ta);
+    if (failures)
+        printf("%d frames were handled wrongly\n", failures);
+    return failures != 0;
+}
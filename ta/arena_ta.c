@@ -0,0 +1,52 @@
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+#include "arena_ta.h"
+
+#define ARENA_ALIGN 8
+
+TEE_Result arena_init(struct arena *a, uint32_t size)
+{
+    a->base = TEE_Malloc(size, TEE_MALLOC_FILL_ZERO);
+    if (!a->base)
+        return TEE_ERROR_OUT_OF_MEMORY;
+    a->size = size;
+    a->used = 0;
+    a->high_water = 0;
+    a->allocs = 0;
+    a->refused = 0;
+    return TEE_SUCCESS;
+}
+
+void arena_release(struct arena *a)
+{
+    if (a->base)
+    {
+        arena_reset(a);
+        TEE_Free(a->base);
+    }
+    a->base = NULL;
+    a->size = 0;
+}
+
+void *arena_alloc(struct arena *a, uint32_t len)
+{
+    uint32_t start = (a->used + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+
+    if (start > a->size || len > a->size - start)
+    {
+        EMSG("\nScratch arena full: %u bytes wanted, %u of %u used\n", len, a->used, a->size);
+        a->refused++;
+        return NULL;
+    }
+    a->used = start + len;
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+    a->allocs++;
+    return a->base + start;
+}
+
+void arena_reset(struct arena *a)
+{
+    TEE_MemFill(a->base, 0, a->used);
+    a->used = 0;
+}
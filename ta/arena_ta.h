@@ -0,0 +1,30 @@
+#ifndef ARENA_TA_H
+#define ARENA_TA_H
+
+#include <tee_internal_api.h>
+
+/*
+ * Per-session scratch memory. It is reserved with one TEE_Malloc() when the
+ * session opens and handed out by bumping an offset, and arena_reset() at
+ * the end of every command gives all of it back. Commands never call
+ * TEE_Malloc() themselves, so sustained load does not fragment the TA heap
+ * (TA_DATA_SIZE).
+ */
+struct arena
+{
+    uint8_t *base;
+    uint32_t size;
+    uint32_t used;
+    uint32_t high_water; /* most bytes in use at once since the session opened */
+    uint32_t allocs;     /* served since the session opened */
+    uint32_t refused;    /* did not fit, the command failed with TEE_ERROR_OUT_OF_MEMORY */
+};
+
+TEE_Result arena_init(struct arena *a, uint32_t size);
+void arena_release(struct arena *a);
+/* len bytes aligned to 8, NULL if the arena is full */
+void *arena_alloc(struct arena *a, uint32_t len);
+/* zeroes what was used, it may have held key material */
+void arena_reset(struct arena *a);
+
+#endif /* ARENA_TA_H */
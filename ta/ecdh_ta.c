@@ -0,0 +1,346 @@
+#include <string.h>
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+#include <my_test_ta.h>
+#include "ecdh_ta.h"
+
+#define ECDH_KEY_SIZE 256
+#define ECDH_COORD_LEN (ECDH_KEY_SIZE / 8)
+#define SHA256_LEN 32
+
+void ecdh_init(struct ecdh_state *st)
+{
+    st->curve = 0;
+    st->key_pair = TEE_HANDLE_NULL;
+    st->aes_handle = TEE_HANDLE_NULL;
+}
+
+void ecdh_release(struct ecdh_state *st)
+{
+    if (st->key_pair != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(st->key_pair);
+    if (st->aes_handle != TEE_HANDLE_NULL)
+        TEE_FreeOperation(st->aes_handle);
+    ecdh_init(st);
+}
+
+/* reads a P-256 coordinate, left padded to ECDH_COORD_LEN bytes */
+static TEE_Result get_coordinate(TEE_ObjectHandle key, uint32_t attr_id, uint8_t *out)
+{
+    TEE_Result ret;
+    uint8_t tmp[ECDH_COORD_LEN];
+    uint32_t len = sizeof(tmp);
+
+    ret = TEE_GetObjectBufferAttribute(key, attr_id, tmp, &len);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    TEE_MemFill(out, 0, ECDH_COORD_LEN - len);
+    TEE_MemMove(out + ECDH_COORD_LEN - len, tmp, len);
+    return ret;
+}
+
+TEE_Result ecdh_gen_key(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    TEE_Attribute attr;
+    uint8_t *pub;
+    uint32_t len;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_MEMREF_OUTPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+
+    if (st->key_pair != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(st->key_pair);
+    st->key_pair = TEE_HANDLE_NULL;
+    st->curve = params[0].value.a;
+    pub = params[1].memref.buffer;
+
+    switch (st->curve)
+    {
+    case TA_ECDH_CURVE_X25519:
+        if (params[1].memref.size < ECDH_COORD_LEN)
+            return TEE_ERROR_SHORT_BUFFER;
+        ret = TEE_AllocateTransientObject(TEE_TYPE_X25519_KEYPAIR, ECDH_KEY_SIZE, &st->key_pair);
+        if (ret != TEE_SUCCESS)
+            break;
+        ret = TEE_GenerateKey(st->key_pair, ECDH_KEY_SIZE, NULL, 0);
+        if (ret != TEE_SUCCESS)
+            break;
+        len = ECDH_COORD_LEN;
+        ret = TEE_GetObjectBufferAttribute(st->key_pair, TEE_ATTR_X25519_PUBLIC_VALUE, pub, &len);
+        params[1].memref.size = len;
+        break;
+    case TA_ECDH_CURVE_P256:
+        if (params[1].memref.size < 1 + 2 * ECDH_COORD_LEN)
+            return TEE_ERROR_SHORT_BUFFER;
+        ret = TEE_AllocateTransientObject(TEE_TYPE_ECDH_KEYPAIR, ECDH_KEY_SIZE, &st->key_pair);
+        if (ret != TEE_SUCCESS)
+            break;
+        TEE_InitValueAttribute(&attr, TEE_ATTR_ECC_CURVE, TEE_ECC_CURVE_NIST_P256, 0);
+        ret = TEE_GenerateKey(st->key_pair, ECDH_KEY_SIZE, &attr, 1);
+        if (ret != TEE_SUCCESS)
+            break;
+        /* uncompressed point */
+        pub[0] = 0x04;
+        ret = get_coordinate(st->key_pair, TEE_ATTR_ECC_PUBLIC_VALUE_X, pub + 1);
+        if (ret != TEE_SUCCESS)
+            break;
+        ret = get_coordinate(st->key_pair, TEE_ATTR_ECC_PUBLIC_VALUE_Y, pub + 1 + ECDH_COORD_LEN);
+        params[1].memref.size = 1 + 2 * ECDH_COORD_LEN;
+        break;
+    default:
+        EMSG("\nInvalid ECDH curve %u\n", st->curve);
+        return TEE_ERROR_BAD_PARAMETERS;
+    }
+
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to generate ECDH key: 0x%x\n", ret);
+        if (st->key_pair != TEE_HANDLE_NULL)
+            TEE_FreeTransientObject(st->key_pair);
+        st->key_pair = TEE_HANDLE_NULL;
+        return ret;
+    }
+    DMSG("\n========== ECDH key generated. ==========\n");
+    return ret;
+}
+
+/* HMAC-SHA256(key, d1 || d2) */
+static TEE_Result hmac_sha256(const uint8_t *key, uint32_t key_len,
+                              const void *d1, uint32_t l1, const void *d2, uint32_t l2,
+                              uint8_t out[SHA256_LEN])
+{
+    TEE_Result ret;
+    TEE_OperationHandle op = TEE_HANDLE_NULL;
+    TEE_ObjectHandle key_obj = TEE_HANDLE_NULL;
+    TEE_Attribute attr;
+    size_t out_len = SHA256_LEN;
+
+    ret = TEE_AllocateOperation(&op, TEE_ALG_HMAC_SHA256, TEE_MODE_MAC, key_len * 8);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    ret = TEE_AllocateTransientObject(TEE_TYPE_HMAC_SHA256, key_len * 8, &key_obj);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, key_len);
+    ret = TEE_PopulateTransientObject(key_obj, &attr, 1);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    ret = TEE_SetOperationKey(op, key_obj);
+    if (ret != TEE_SUCCESS)
+        goto out;
+
+    TEE_MACInit(op, NULL, 0);
+    TEE_MACUpdate(op, d1, l1);
+    ret = TEE_MACComputeFinal(op, d2, l2, out, &out_len);
+
+out:
+    if (key_obj != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(key_obj);
+    TEE_FreeOperation(op);
+    return ret;
+}
+
+/* RFC 5869 with an all zero salt, one block of output is enough for AES */
+static TEE_Result hkdf_sha256(const uint8_t *ikm, uint32_t ikm_len, const char *info,
+                              uint8_t *okm, uint32_t okm_len)
+{
+    TEE_Result ret;
+    uint8_t salt[SHA256_LEN] = {0};
+    uint8_t prk[SHA256_LEN];
+    uint8_t t[SHA256_LEN];
+    const uint8_t one = 1;
+
+    if (okm_len > SHA256_LEN)
+        return TEE_ERROR_BAD_PARAMETERS;
+
+    ret = hmac_sha256(salt, sizeof(salt), ikm, ikm_len, NULL, 0, prk);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    ret = hmac_sha256(prk, sizeof(prk), info, strlen(info), &one, 1, t);
+    if (ret == TEE_SUCCESS)
+        TEE_MemMove(okm, t, okm_len);
+
+    TEE_MemFill(prk, 0, sizeof(prk));
+    TEE_MemFill(t, 0, sizeof(t));
+    return ret;
+}
+
+TEE_Result aes_set_key(struct ecdh_state *st, const uint8_t *key, uint32_t key_len)
+{
+    TEE_Result ret;
+    TEE_ObjectHandle key_obj = TEE_HANDLE_NULL;
+    TEE_Attribute attr;
+
+    if (st->aes_handle != TEE_HANDLE_NULL)
+        TEE_FreeOperation(st->aes_handle);
+    st->aes_handle = TEE_HANDLE_NULL;
+
+    ret = TEE_AllocateOperation(&st->aes_handle, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT, key_len * 8);
+    if (ret != TEE_SUCCESS)
+    {
+        st->aes_handle = TEE_HANDLE_NULL;
+        return ret;
+    }
+    ret = TEE_AllocateTransientObject(TEE_TYPE_AES, key_len * 8, &key_obj);
+    if (ret != TEE_SUCCESS)
+        goto err;
+    TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, key_len);
+    ret = TEE_PopulateTransientObject(key_obj, &attr, 1);
+    if (ret != TEE_SUCCESS)
+        goto err;
+    /* the operation keeps its own copy of the key */
+    ret = TEE_SetOperationKey(st->aes_handle, key_obj);
+    if (ret != TEE_SUCCESS)
+        goto err;
+    TEE_FreeTransientObject(key_obj);
+    return ret;
+
+err:
+    if (key_obj != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(key_obj);
+    TEE_FreeOperation(st->aes_handle);
+    st->aes_handle = TEE_HANDLE_NULL;
+    return ret;
+}
+
+TEE_Result ecdh_derive(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    TEE_OperationHandle op = TEE_HANDLE_NULL;
+    TEE_ObjectHandle secret = TEE_HANDLE_NULL;
+    TEE_Attribute attrs[2];
+    uint32_t attr_count;
+    uint32_t alg;
+    uint8_t shared[ECDH_COORD_LEN];
+    uint32_t shared_len = sizeof(shared);
+    uint8_t aes_key[TA_ECDH_AES_KEY_SIZE];
+    const uint8_t *peer = params[0].memref.buffer;
+    size_t peer_len = params[0].memref.size;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (st->key_pair == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
+
+    if (st->curve == TA_ECDH_CURVE_X25519)
+    {
+        if (peer_len != ECDH_COORD_LEN)
+            return TEE_ERROR_BAD_PARAMETERS;
+        alg = TEE_ALG_X25519;
+        TEE_InitRefAttribute(&attrs[0], TEE_ATTR_X25519_PUBLIC_VALUE, peer, ECDH_COORD_LEN);
+        attr_count = 1;
+    }
+    else
+    {
+        if (peer_len != 1 + 2 * ECDH_COORD_LEN || peer[0] != 0x04)
+            return TEE_ERROR_BAD_PARAMETERS;
+        alg = TEE_ALG_ECDH_P256;
+        TEE_InitRefAttribute(&attrs[0], TEE_ATTR_ECC_PUBLIC_VALUE_X, peer + 1, ECDH_COORD_LEN);
+        TEE_InitRefAttribute(&attrs[1], TEE_ATTR_ECC_PUBLIC_VALUE_Y, peer + 1 + ECDH_COORD_LEN, ECDH_COORD_LEN);
+        attr_count = 2;
+    }
+
+    ret = TEE_AllocateOperation(&op, alg, TEE_MODE_DERIVE, ECDH_KEY_SIZE);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to alloc ECDH operation: 0x%x\n", ret);
+        return ret;
+    }
+    ret = TEE_SetOperationKey(op, st->key_pair);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    ret = TEE_AllocateTransientObject(TEE_TYPE_GENERIC_SECRET, ECDH_KEY_SIZE, &secret);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    TEE_DeriveKey(op, attrs, attr_count, secret);
+    ret = TEE_GetObjectBufferAttribute(secret, TEE_ATTR_SECRET_VALUE, shared, &shared_len);
+    if (ret != TEE_SUCCESS)
+        goto out;
+
+    ret = hkdf_sha256(shared, shared_len, TA_ECDH_HKDF_INFO, aes_key, sizeof(aes_key));
+    if (ret != TEE_SUCCESS)
+        goto out;
+    ret = aes_set_key(st, aes_key, sizeof(aes_key));
+    DMSG("\n========== AES key derived. ==========\n");
+
+out:
+    TEE_MemFill(shared, 0, sizeof(shared));
+    TEE_MemFill(aes_key, 0, sizeof(aes_key));
+    if (secret != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(secret);
+    TEE_FreeOperation(op);
+    /* forward secrecy: the ephemeral key is single use */
+    TEE_FreeTransientObject(st->key_pair);
+    st->key_pair = TEE_HANDLE_NULL;
+    if (ret != TEE_SUCCESS)
+        EMSG("\nECDH derivation failed: 0x%x\n", ret);
+    return ret;
+}
+
+TEE_Result ecdh_unwrap_key(struct ecdh_state *st, const void *wrapped, uint32_t len, uint8_t *key)
+{
+    /* nonce reserved for key wrapping, frame seqs never get there */
+    uint8_t iv[16] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    size_t out_len = len;
+
+    if (st->aes_handle == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
+    TEE_CipherInit(st->aes_handle, iv, sizeof(iv));
+    return TEE_CipherDoFinal(st->aes_handle, wrapped, len, key, &out_len);
+}
+
+TEE_Result aes_decrypt_frame(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4])
+{
+    uint8_t iv[16] = {0};
+    uint32_t seq;
+    uint32_t block;
+    size_t out_len;
+    TEE_Result ret;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_MEMREF_OUTPUT,
+                        TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (st->aes_handle == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
+    if (params[1].memref.size < params[0].memref.size)
+        return TEE_ERROR_SHORT_BUFFER;
+
+    /* nonce = seq as 64 bit big endian, counter starts at the tile's block */
+    seq = params[2].value.a;
+    iv[4] = seq >> 24;
+    iv[5] = seq >> 16;
+    iv[6] = seq >> 8;
+    iv[7] = seq;
+    block = params[2].value.b;
+    iv[12] = block >> 24;
+    iv[13] = block >> 16;
+    iv[14] = block >> 8;
+    iv[15] = block;
+    TEE_CipherInit(st->aes_handle, iv, sizeof(iv));
+
+    out_len = params[1].memref.size;
+    ret = TEE_CipherDoFinal(st->aes_handle, params[0].memref.buffer, params[0].memref.size,
+                            params[1].memref.buffer, &out_len);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nAES frame decryption failed: 0x%x\n", ret);
+        return ret;
+    }
+    params[1].memref.size = out_len;
+    return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef ECDH_TA_H
+#define ECDH_TA_H
+
+#include <tee_internal_api.h>
+
+/*
+ * ECDH key agreement with the server. The shared secret goes through
+ * HKDF-SHA256 straight into an AES-CTR operation, so neither the secret
+ * nor the derived key ever leaves the TA.
+ */
+struct ecdh_state
+{
+    uint32_t curve;                 /* TA_ECDH_CURVE_xxx of key_pair */
+    TEE_ObjectHandle key_pair;      /* Ephemeral key, freed once derived */
+    TEE_OperationHandle aes_handle; /* AES-CTR decrypt keyed from the agreement or group key */
+};
+
+void ecdh_init(struct ecdh_state *st);
+void ecdh_release(struct ecdh_state *st);
+TEE_Result ecdh_gen_key(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4]);
+TEE_Result ecdh_derive(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4]);
+TEE_Result aes_set_key(struct ecdh_state *st, const uint8_t *key, uint32_t key_len);
+/* decrypts a key the server wrapped with the agreed key */
+TEE_Result ecdh_unwrap_key(struct ecdh_state *st, const void *wrapped, uint32_t len, uint8_t *key);
+TEE_Result aes_decrypt_frame(struct ecdh_state *st, uint32_t param_types, TEE_Param params[4]);
+
+#endif /* ECDH_TA_H */
@@ -13,9 +13,92 @@
         }                                                  \
     }
 
+/*
+ * TEEC_OpenSession() parameters, optional
+ * param[0] (value) a: key size in bits (1024, 2048, 3072), b: TA_RSA_SCHEME_xxx
+ * param[1] (value, out, optional) a: 1 if the sessions share one instance and
+ *          its key table, b: sessions open on the instance, this one included
+ * Sessions on a shared instance must agree on param[0] while any is open.
+ * The first session to load or generate keys owns the table until it
+ * closes, which clears it. Commands from other sessions that would replace
+ * the table's keys fail with TEE_ERROR_ACCESS_CONFLICT. A key they generate
+ * stays with them. They use the table's keys only once attached to it with
+ * TA_CMD_ATTACH_KEYS, until then those commands fail with
+ * TEE_ERROR_ACCESS_DENIED or find no key.
+ */
+#define TA_RSA_SCHEME_PKCS1_V1_5 0
+#define TA_RSA_SCHEME_OAEP_SHA1 1
+#define TA_RSA_SCHEME_OAEP_SHA256 2
+
 #define TA_RSA_CMD_GENKEYS 0
 #define TA_RSA_CMD_ENCRYPT 1
+/* param[2] (value, optional) a: key id from the frame header */
 #define TA_RSA_CMD_DECRYPT 2
 #define TA_RSA_CMD_GET_PUB_KEY 3
+/* param[0] (memref) secure storage object id, used to replay captures */
+#define TA_RSA_CMD_STORE_KEY 4
+#define TA_RSA_CMD_LOAD_KEY 5
+/* param[0] (memref) object id, param[1] (value) a: key id of the next key */
+#define TA_RSA_CMD_LOAD_PENDING_KEY 6
+/* rebuild the active key without CRT parameters, for benchmarking */
+#define TA_RSA_CMD_DROP_CRT 7
+
+/*
+ * TA_ECDH_CMD_GEN_KEY - new ephemeral key pair
+ * param[0] (value) a: TA_ECDH_CURVE_xxx
+ * param[1] (memref) public key out: X25519 32 bytes, P-256 0x04 || X || Y
+ */
+#define TA_ECDH_CMD_GEN_KEY 8
+/*
+ * TA_ECDH_CMD_DERIVE - agree with the server public key (same encoding) and
+ * load HKDF-SHA256(secret, info = TA_ECDH_HKDF_INFO) into the AES operation
+ * param[0] (memref) server public key
+ */
+#define TA_ECDH_CMD_DERIVE 9
+/*
+ * TA_AES_CMD_DECRYPT_FRAME - AES-CTR decrypt a frame
+ * param[0] (memref) cipher text
+ * param[1] (memref) plain text
+ * param[2] (value) a: frame seq, b: first block, the IV is seq (64 bit big
+ *                  endian) || b (64 bit big endian); b is 0 for a whole frame
+ *                  and offset / 16 for one tile of it
+ */
+#define TA_AES_CMD_DECRYPT_FRAME 10
+/*
+ * TA_AES_CMD_LOAD_GROUP_KEY - unwrap the server's group content key and use
+ * it for TA_AES_CMD_DECRYPT_FRAME from then on
+ * param[0] (memref) wrapped key
+ * param[1] (value) a: TA_GROUP_WRAP_xxx, b: RSA key id for TA_GROUP_WRAP_RSA
+ */
+#define TA_AES_CMD_LOAD_GROUP_KEY 11
+/*
+ * TA_CMD_ARENA_STATS - the session's scratch arena, see arena_ta.h
+ * param[0] (value) a: arena bytes, b: high-water mark in bytes
+ * param[1] (value) a: allocations served, b: allocations that did not fit
+ */
+#define TA_CMD_ARENA_STATS 12
+/*
+ * TA_CMD_SHARE_KEYS - from the session owning the key table, a token that
+ * lets other sessions of the client attach to it; a new one on every call
+ * param[0] (memref) token out, TA_SHARE_TOKEN_SIZE bytes
+ */
+#define TA_CMD_SHARE_KEYS 13
+/*
+ * TA_CMD_ATTACH_KEYS - decrypt with the key table's keys from this session
+ * until its owner closes
+ * param[0] (memref) token from TA_CMD_SHARE_KEYS
+ */
+#define TA_CMD_ATTACH_KEYS 14
+#define TA_SHARE_TOKEN_SIZE 16
+
+#define TA_ECDH_CURVE_X25519 1
+#define TA_ECDH_CURVE_P256 2
+#define TA_ECDH_HKDF_INFO "TZStreaming AES-128-CTR"
+#define TA_ECDH_AES_KEY_SIZE 16
+
+#define TA_GROUP_WRAP_RSA 1  /* RSA encrypted with the session scheme */
+#define TA_GROUP_WRAP_ECDH 2 /* AES-CTR under the agreed key, IV 0xff^8 || 0^64 */
+
+#define TA_RSA_KEY_ID_ACTIVE 0xffffffff
 
 #endif /*TA_MY_TEST_H*/
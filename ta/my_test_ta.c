@@ -3,16 +3,112 @@
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
 #include <my_test_ta.h>
+#include <user_ta_header_defines.h>
+#include "arena_ta.h"
+#include "ecdh_ta.h"
+/* Sessions opened without parameters keep the original setup */
 #define RSA_KEY_SIZE 1024
-#define MAX_PLAIN_LEN_1024 86 // (1024/8) - 42 (padding)
-#define RSA_CIPHER_LEN_1024 (RSA_KEY_SIZE / 8)
+#define RSA_SCHEME TA_RSA_SCHEME_PKCS1_V1_5
+
+/*
+ * Keys are double buffered: frames are decrypted with the active slot while
+ * the next key is loaded into the pending one. The first frame tagged with
+ * the pending key id swaps the two, so rotation happens at a frame boundary.
+ */
+#define RSA_KEY_SLOTS 2
+
+/*
+ * Scratch a command may need at once: the three key sized attributes
+ * TA_RSA_CMD_DROP_CRT copies. The group key needs one RSA block.
+ */
+#define SCRATCH_SIZE(key_size) (3 * ((key_size) / 8) + 64)
+
+struct rsa_key_slot
+{
+    uint32_t key_id;                /* Key id carried in the frame header */
+    TEE_ObjectHandle key_handle;    /* Key handle */
+    TEE_OperationHandle dec_handle; /* Decrypt operation prepared for key_handle */
+    TEE_OperationHandle enc_handle; /* Encrypt operation prepared for key_handle */
+};
+
+/*
+ * Keys of the instance. With TA_SHARED_KEYS every session of the client
+ * opens on one instance that stays loaded after the last session closes,
+ * so a worker session attaches to the keys already here and nothing is
+ * provisioned again. The keys go when the session that provisioned them
+ * closes, the next client on the kept instance starts from an empty table.
+ * Otherwise each session is an instance of its own and the table is only its.
+ */
+struct key_table
+{
+    uint32_t sessions;             /* Open on this instance */
+    uint32_t key_size;             /* Modulus size in bits, chosen by the first session */
+    uint32_t alg;                  /* RSAES algorithm, chosen by the first session */
+    struct rsa_key_slot slots[RSA_KEY_SLOTS];
+    uint32_t active;               /* Slot frames are decrypted with */
+    struct ecdh_state ecdh;        /* Key agreement alternative to RSA transport, and the content key */
+    struct rsa_session *owner;     /* Provisioned the keys above, NULL once it closed */
+    uint8_t token[TA_SHARE_TOKEN_SIZE]; /* Handed to the owner by TA_CMD_SHARE_KEYS */
+    bool shared;                   /* token is set */
+    uint32_t epoch;                /* Bumped whenever the table is cleared, never 0 */
+};
 
 struct rsa_session
 {
-    TEE_OperationHandle op_handle; /* RSA operation */
-    TEE_ObjectHandle key_handle;   /* Key handle */
+    struct arena scratch;          /* Per-command buffers, reset after each command */
+    struct rsa_key_slot own;       /* Generated while another session owned the table */
+    uint32_t epoch;                /* Of the table it attached to, 0 if it did not */
 };
 
+static struct key_table table;
+
+#define ACTIVE_SLOT(keys) (&(keys)->slots[(keys)->active])
+#define PENDING_SLOT(keys) (&(keys)->slots[(keys)->active ^ 1])
+
+/* The owner and the sessions it let attach use the table's keys, no one else */
+#define USES_TABLE(sess) \
+    (table.owner == (sess) || ((sess)->epoch != 0 && (sess)->epoch == table.epoch))
+
+/* The key a session's commands use: one it generated for itself, else the table's */
+#define SESSION_SLOT(sess) \
+    ((sess)->own.key_handle != TEE_HANDLE_NULL || !USES_TABLE(sess) ? &(sess)->own : ACTIVE_SLOT(&table))
+
+/*
+ * Only one session replaces keys in the table, the first to provision it.
+ * Sessions it attached (tile workers) use its keys; a second client
+ * sharing the instance must not swap the content key under the first
+ * one's frames.
+ */
+static TEE_Result claim_table(struct rsa_session *sess)
+{
+    if (table.owner && table.owner != sess)
+    {
+        EMSG("\nKey table is provisioned by session %p\n", (void *)table.owner);
+        return TEE_ERROR_ACCESS_CONFLICT;
+    }
+    table.owner = sess;
+    return TEE_SUCCESS;
+}
+
+TEE_Result ta2tee_rsa_scheme(uint32_t scheme, uint32_t *alg)
+{
+    switch (scheme)
+    {
+    case TA_RSA_SCHEME_PKCS1_V1_5:
+        *alg = TEE_ALG_RSAES_PKCS1_V1_5;
+        return TEE_SUCCESS;
+    case TA_RSA_SCHEME_OAEP_SHA1:
+        *alg = TEE_ALG_RSAES_PKCS1_OAEP_MGF1_SHA1;
+        return TEE_SUCCESS;
+    case TA_RSA_SCHEME_OAEP_SHA256:
+        *alg = TEE_ALG_RSAES_PKCS1_OAEP_MGF1_SHA256;
+        return TEE_SUCCESS;
+    default:
+        EMSG("\nInvalid RSA scheme %u\n", scheme);
+        return TEE_ERROR_BAD_PARAMETERS;
+    }
+}
+
 TEE_Result prepare_rsa_operation(TEE_OperationHandle *handle, uint32_t alg, TEE_OperationMode mode, TEE_ObjectHandle key)
 {
     TEE_Result ret = TEE_SUCCESS;
@@ -43,6 +139,63 @@ TEE_Result prepare_rsa_operation(TEE_OperationHandle *handle, uint32_t alg, TEE_
     return ret;
 }
 
+void free_key_slot(struct rsa_key_slot *slot)
+{
+    if (slot->dec_handle != TEE_HANDLE_NULL)
+        TEE_FreeOperation(slot->dec_handle);
+    if (slot->enc_handle != TEE_HANDLE_NULL)
+        TEE_FreeOperation(slot->enc_handle);
+    if (slot->key_handle != TEE_HANDLE_NULL)
+        TEE_FreeTransientObject(slot->key_handle);
+    slot->dec_handle = TEE_HANDLE_NULL;
+    slot->enc_handle = TEE_HANDLE_NULL;
+    slot->key_handle = TEE_HANDLE_NULL;
+}
+
+/*
+ * Takes ownership of key. Both operations are prepared here, so switching
+ * slots costs nothing and no command allocates operation state.
+ */
+TEE_Result fill_key_slot(struct rsa_key_slot *slot, uint32_t alg, TEE_ObjectHandle key, uint32_t key_id)
+{
+    TEE_Result ret;
+
+    free_key_slot(slot);
+    slot->key_handle = key;
+    slot->key_id = key_id;
+    ret = prepare_rsa_operation(&slot->dec_handle, alg, TEE_MODE_DECRYPT, key);
+    if (ret == TEE_SUCCESS)
+        ret = prepare_rsa_operation(&slot->enc_handle, alg, TEE_MODE_ENCRYPT, key);
+    if (ret != TEE_SUCCESS)
+        free_key_slot(slot);
+    return ret;
+}
+
+struct rsa_key_slot *select_key_slot(struct rsa_session *sess, struct key_table *keys, uint32_t key_id)
+{
+    struct rsa_key_slot *slot = &sess->own;
+
+    /* a second client sharing the instance decrypts with the key it generated */
+    if (slot->key_handle != TEE_HANDLE_NULL && (key_id == TA_RSA_KEY_ID_ACTIVE || key_id == slot->key_id))
+        return slot;
+    if (!USES_TABLE(sess))
+        return NULL;
+
+    slot = ACTIVE_SLOT(keys);
+
+    if (key_id == TA_RSA_KEY_ID_ACTIVE || key_id == slot->key_id)
+        return slot->key_handle != TEE_HANDLE_NULL ? slot : NULL;
+
+    slot = PENDING_SLOT(keys);
+    if (slot->key_handle == TEE_HANDLE_NULL || slot->key_id != key_id)
+        return NULL;
+
+    /* First frame under the next key: it becomes the active one, for every session */
+    DMSG("\n========== Switching to key %u ==========\n", key_id);
+    keys->active ^= 1;
+    return slot;
+}
+
 TEE_Result check_params(uint32_t param_types)
 {
     const uint32_t exp_param_types =
@@ -60,10 +213,12 @@ TEE_Result check_params(uint32_t param_types)
 TEE_Result RSA_create_key_pair(void *session)
 {
     TEE_Result ret;
-    size_t key_size = RSA_KEY_SIZE;
+    struct key_table *keys = &table;
     struct rsa_session *sess = (struct rsa_session *)session;
+    size_t key_size = keys->key_size;
+    TEE_ObjectHandle key_handle;
 
-    ret = TEE_AllocateTransientObject(TEE_TYPE_RSA_KEYPAIR, key_size, &sess->key_handle);
+    ret = TEE_AllocateTransientObject(TEE_TYPE_RSA_KEYPAIR, key_size, &key_handle);
     if (ret != TEE_SUCCESS)
     {
         EMSG("\nFailed to alloc transient object handle: 0x%x\n", ret);
@@ -71,14 +226,22 @@ TEE_Result RSA_create_key_pair(void *session)
     }
     DMSG("\n========== Transient object allocated. ==========\n");
 
-    ret = TEE_GenerateKey(sess->key_handle, key_size, (TEE_Attribute *)NULL, 0);
+    ret = TEE_GenerateKey(key_handle, key_size, (TEE_Attribute *)NULL, 0);
     if (ret != TEE_SUCCESS)
     {
         EMSG("\nGenerate key failure: 0x%x\n", ret);
+        TEE_FreeTransientObject(key_handle);
         return ret;
     }
     DMSG("\n========== Keys generated. ==========\n");
-    return ret;
+    /*
+     * The active key belongs to another session, e.g. this is a key
+     * rotation worker: keep the new one out of the table until the owner
+     * has stored and loaded it as the pending key.
+     */
+    if (claim_table(sess) != TEE_SUCCESS)
+        return fill_key_slot(&sess->own, keys->alg, key_handle, 0);
+    return fill_key_slot(ACTIVE_SLOT(keys), keys->alg, key_handle, 0);
 }
 
 TEE_Result RSA_get_public_key_exponent_modulus(void *session, uint32_t param_types, TEE_Param params[4])
@@ -87,7 +250,7 @@ TEE_Result RSA_get_public_key_exponent_modulus(void *session, uint32_t param_typ
     struct rsa_session *sess = (struct rsa_session *)session;
 
     TEE_Result result = TEE_SUCCESS;
-    TEE_ObjectHandle rsa_keypair = sess->key_handle;
+    TEE_ObjectHandle rsa_keypair = SESSION_SLOT(sess)->key_handle;
 
     uint8_t *buffer1;
     uint32_t buffer_len1 = 0;
@@ -103,6 +266,8 @@ TEE_Result RSA_get_public_key_exponent_modulus(void *session, uint32_t param_typ
 
     if (param_types != exp_param_types)
         return TEE_ERROR_BAD_PARAMETERS;
+    if (rsa_keypair == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
 
     buffer1 = params[0].memref.buffer;
     buffer2 = params[1].memref.buffer;
@@ -137,8 +302,8 @@ TEE_Result RSA_get_public_key_exponent_modulus(void *session, uint32_t param_typ
 TEE_Result RSA_encrypt(void *session, uint32_t param_types, TEE_Param params[4])
 {
     TEE_Result ret;
-    uint32_t rsa_alg = TEE_ALG_RSAES_PKCS1_V1_5;
     struct rsa_session *sess = (struct rsa_session *)session;
+    struct rsa_key_slot *slot = SESSION_SLOT(sess);
 
     if (check_params(param_types) != TEE_SUCCESS)
         return TEE_ERROR_BAD_PARAMETERS;
@@ -148,38 +313,36 @@ TEE_Result RSA_encrypt(void *session, uint32_t param_types, TEE_Param params[4])
     void *cipher = params[1].memref.buffer;
     size_t cipher_len = params[1].memref.size;
 
-    DMSG("\n========== Preparing encryption operation ==========\n");
-    ret = prepare_rsa_operation(&sess->op_handle, rsa_alg, TEE_MODE_ENCRYPT, sess->key_handle);
-    if (ret != TEE_SUCCESS)
-    {
-        EMSG("\nFailed to prepare RSA operation: 0x%x\n", ret);
-        goto err;
-    }
+    if (slot->key_handle == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
 
     DMSG("\nData to encrypt: %s\n", (char *)plain_txt);
-    ret = TEE_AsymmetricEncrypt(sess->op_handle, (TEE_Attribute *)NULL, 0,
+    ret = TEE_AsymmetricEncrypt(slot->enc_handle, (TEE_Attribute *)NULL, 0,
                                 plain_txt, plain_len, cipher, &cipher_len);
     if (ret != TEE_SUCCESS)
     {
         EMSG("\nFailed to encrypt the passed buffer: 0x%x\n", ret);
-        goto err;
+        return ret;
     }
     DMSG("\nEncrypted data: %s\n", (char *)cipher);
     DMSG("\n========== Encryption successfully ==========\n");
     return ret;
-
-err:
-    TEE_FreeOperation(sess->op_handle);
-    TEE_FreeOperation(sess->key_handle);
-    return ret;
 }
 
 TEE_Result RSA_decrypt(void *session, uint32_t param_types, TEE_Param params[4])
 {
     TEE_Result ret;
-    uint32_t rsa_alg = TEE_ALG_RSAES_PKCS1_V1_5;
+    struct key_table *keys = &table;
     struct rsa_session *sess = (struct rsa_session *)session;
+    struct rsa_key_slot *slot;
+    uint32_t key_id = TA_RSA_KEY_ID_ACTIVE;
 
+    /* param[2] is optional so callers without a frame header keep working */
+    if (TEE_PARAM_TYPE_GET(param_types, 2) == TEE_PARAM_TYPE_VALUE_INPUT)
+    {
+        key_id = params[2].value.a;
+        param_types &= ~TEE_PARAM_TYPES(0, 0, 0xf, 0);
+    }
     if (check_params(param_types) != TEE_SUCCESS)
         return TEE_ERROR_BAD_PARAMETERS;
 
@@ -188,57 +351,373 @@ TEE_Result RSA_decrypt(void *session, uint32_t param_types, TEE_Param params[4])
     void *cipher = params[0].memref.buffer;
     size_t cipher_len = params[0].memref.size;
 
-    DMSG("\n========== Preparing decryption operation ==========\n");
-    ret = prepare_rsa_operation(&sess->op_handle, rsa_alg, TEE_MODE_DECRYPT, sess->key_handle);
-    if (ret != TEE_SUCCESS)
+    slot = select_key_slot(sess, keys, key_id);
+    if (!slot)
     {
-        EMSG("\nFailed to prepare RSA operation: 0x%x\n", ret);
-        goto err;
+        EMSG("\nNo key loaded for key id %u\n", key_id);
+        return TEE_ERROR_ITEM_NOT_FOUND;
     }
 
     DMSG("\nData to decrypt: %s\n", (char *)cipher);
-    ret = TEE_AsymmetricDecrypt(sess->op_handle, (TEE_Attribute *)NULL, 0,
+    ret = TEE_AsymmetricDecrypt(slot->dec_handle, (TEE_Attribute *)NULL, 0,
                                 cipher, cipher_len, plain_txt, &plain_len);
     if (ret != TEE_SUCCESS)
     {
         EMSG("\nFailed to decrypt the passed buffer: 0x%x\n", ret);
-        goto err;
+        return ret;
     }
+    params[1].memref.size = plain_len;
     DMSG("\nDecrypted data: %s\n", (char *)plain_txt);
     DMSG("\n========== Decryption successfully ==========\n");
     return ret;
+}
+
+TEE_Result check_id_params(uint32_t param_types)
+{
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    return TEE_SUCCESS;
+}
+
+/* Persist the key pair so a captured stream can be decrypted again later */
+TEE_Result RSA_store_key(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    TEE_ObjectHandle object;
+    struct rsa_key_slot *slot = SESSION_SLOT((struct rsa_session *)session);
+
+    if (check_id_params(param_types) != TEE_SUCCESS)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (slot->key_handle == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
+
+    ret = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+                                     params[0].memref.buffer, params[0].memref.size,
+                                     TEE_DATA_FLAG_ACCESS_READ | TEE_DATA_FLAG_OVERWRITE,
+                                     slot->key_handle, NULL, 0, &object);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to store key pair: 0x%x\n", ret);
+        return ret;
+    }
+    TEE_CloseObject(object);
+    DMSG("\n========== Key pair stored. ==========\n");
+    return ret;
+}
+
+TEE_Result open_stored_key(void *id, size_t id_len, TEE_ObjectHandle *key)
+{
+    TEE_Result ret;
+    TEE_ObjectHandle object;
+    TEE_ObjectInfo info;
+
+    ret = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, id, id_len,
+                                   TEE_DATA_FLAG_ACCESS_READ, &object);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to open stored key pair: 0x%x\n", ret);
+        return ret;
+    }
+
+    ret = TEE_GetObjectInfo1(object, &info);
+    if (ret != TEE_SUCCESS)
+        goto out;
+
+    ret = TEE_AllocateTransientObject(TEE_TYPE_RSA_KEYPAIR, info.keySize, key);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    ret = TEE_CopyObjectAttributes1(*key, object);
+    if (ret != TEE_SUCCESS)
+    {
+        TEE_FreeTransientObject(*key);
+        *key = TEE_HANDLE_NULL;
+    }
+
+out:
+    TEE_CloseObject(object);
+    return ret;
+}
+
+TEE_Result RSA_load_key(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    TEE_ObjectHandle key;
+    struct key_table *keys = &table;
+
+    if (check_id_params(param_types) != TEE_SUCCESS)
+        return TEE_ERROR_BAD_PARAMETERS;
+    ret = claim_table((struct rsa_session *)session);
+    if (ret != TEE_SUCCESS)
+        return ret;
+
+    ret = open_stored_key(params[0].memref.buffer, params[0].memref.size, &key);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    DMSG("\n========== Key pair loaded. ==========\n");
+    return fill_key_slot(ACTIVE_SLOT(keys), keys->alg, key, 0);
+}
+
+/* Stage the next key; it is used once a frame carries its key id */
+TEE_Result RSA_load_pending_key(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    TEE_ObjectHandle key;
+    struct key_table *keys = &table;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[1].value.a == TA_RSA_KEY_ID_ACTIVE || params[1].value.a == ACTIVE_SLOT(keys)->key_id)
+        return TEE_ERROR_BAD_PARAMETERS;
+    ret = claim_table((struct rsa_session *)session);
+    if (ret != TEE_SUCCESS)
+        return ret;
+
+    ret = open_stored_key(params[0].memref.buffer, params[0].memref.size, &key);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    DMSG("\n========== Pending key %u loaded. ==========\n", params[1].value.a);
+    return fill_key_slot(PENDING_SLOT(keys), keys->alg, key, params[1].value.a);
+}
 
-err:
-    TEE_FreeOperation(sess->op_handle);
-    TEE_FreeTransientObject(sess->key_handle);
+/*
+ * Replace the active key by a copy holding only modulus and exponents, so
+ * private key operations run without the CRT speed-up. Used to measure it.
+ */
+TEE_Result RSA_drop_crt(void *session)
+{
+    TEE_Result ret;
+    TEE_ObjectHandle key = TEE_HANDLE_NULL;
+    TEE_Attribute attrs[3];
+    const uint32_t ids[3] = {TEE_ATTR_RSA_MODULUS,
+                             TEE_ATTR_RSA_PUBLIC_EXPONENT,
+                             TEE_ATTR_RSA_PRIVATE_EXPONENT};
+    uint32_t lens[3];
+    uint8_t *bufs;
+    struct key_table *keys = &table;
+    struct rsa_session *sess = (struct rsa_session *)session;
+    struct rsa_key_slot *slot = SESSION_SLOT(sess);
+    size_t max_len = keys->key_size / 8;
+
+    if (slot->key_handle == TEE_HANDLE_NULL)
+        return TEE_ERROR_BAD_STATE;
+    if (slot != &sess->own && claim_table(sess) != TEE_SUCCESS)
+        return TEE_ERROR_ACCESS_CONFLICT;
+
+    /* too big for the TA stack with 3072 bit keys */
+    bufs = arena_alloc(&sess->scratch, 3 * max_len);
+    if (!bufs)
+        return TEE_ERROR_OUT_OF_MEMORY;
+
+    for (int i = 0; i < 3; i++)
+    {
+        lens[i] = max_len;
+        ret = TEE_GetObjectBufferAttribute(slot->key_handle, ids[i], bufs + i * max_len, &lens[i]);
+        if (ret != TEE_SUCCESS)
+        {
+            EMSG("\nFailed to read key attribute 0x%x: 0x%x\n", ids[i], ret);
+            goto out;
+        }
+        TEE_InitRefAttribute(&attrs[i], ids[i], bufs + i * max_len, lens[i]);
+    }
+
+    ret = TEE_AllocateTransientObject(TEE_TYPE_RSA_KEYPAIR, keys->key_size, &key);
+    if (ret != TEE_SUCCESS)
+        goto out;
+    ret = TEE_PopulateTransientObject(key, attrs, 3);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to populate key without CRT: 0x%x\n", ret);
+        TEE_FreeTransientObject(key);
+        goto out;
+    }
+    ret = fill_key_slot(slot, keys->alg, key, slot->key_id);
+    DMSG("\n========== CRT parameters dropped. ==========\n");
+
+out:
     return ret;
 }
 
+/* frees every key, these tests are mandatory to avoid PANIC TA (TEE_HANDLE_NULL) */
+void reset_key_table(struct key_table *keys)
+{
+    for (int i = 0; i < RSA_KEY_SLOTS; i++)
+    {
+        free_key_slot(&keys->slots[i]);
+        keys->slots[i].key_id = 0;
+    }
+    keys->active = 0;
+    ecdh_release(&keys->ecdh);
+    keys->owner = NULL;
+    TEE_MemFill(keys->token, 0, sizeof(keys->token));
+    keys->shared = false;
+    /* sessions attached so far do not get the next owner's keys */
+    if (++keys->epoch == 0)
+        keys->epoch = 1;
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
-    /* Nothing to do */
+    for (int i = 0; i < RSA_KEY_SLOTS; i++)
+    {
+        table.slots[i].key_handle = TEE_HANDLE_NULL;
+        table.slots[i].dec_handle = TEE_HANDLE_NULL;
+        table.slots[i].enc_handle = TEE_HANDLE_NULL;
+    }
+    reset_key_table(&table);
     return TEE_SUCCESS;
 }
 
 void TA_DestroyEntryPoint(void)
 {
-    /* Nothing to do */
+    /* only once no session is left, and never while kept alive */
+    reset_key_table(&table);
 }
 
-TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
-                                    TEE_Param __unused params[4],
-                                    void __unused **session)
+TEE_Result AES_load_group_key(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    TEE_Result ret;
+    struct key_table *keys = &table;
+    struct rsa_session *sess = (struct rsa_session *)session;
+    struct rsa_key_slot *slot;
+    uint8_t *key;
+    size_t key_len = keys->key_size / 8; /* one RSA block */
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    ret = claim_table(sess);
+    if (ret != TEE_SUCCESS)
+        return ret;
+    /* off the 2 KiB TA stack */
+    key = arena_alloc(&sess->scratch, key_len);
+    if (!key)
+        return TEE_ERROR_OUT_OF_MEMORY;
+
+    switch (params[1].value.a)
+    {
+    case TA_GROUP_WRAP_RSA:
+        slot = select_key_slot(sess, keys, params[1].value.b);
+        if (!slot)
+            return TEE_ERROR_ITEM_NOT_FOUND;
+        ret = TEE_AsymmetricDecrypt(slot->dec_handle, (TEE_Attribute *)NULL, 0,
+                                    params[0].memref.buffer, params[0].memref.size, key, &key_len);
+        break;
+    case TA_GROUP_WRAP_ECDH:
+        if (params[0].memref.size > key_len)
+            return TEE_ERROR_BAD_PARAMETERS;
+        key_len = params[0].memref.size;
+        ret = ecdh_unwrap_key(&keys->ecdh, params[0].memref.buffer, key_len, key);
+        break;
+    default:
+        return TEE_ERROR_BAD_PARAMETERS;
+    }
+    if (ret == TEE_SUCCESS && key_len != TA_ECDH_AES_KEY_SIZE)
+        ret = TEE_ERROR_BAD_FORMAT;
+    if (ret == TEE_SUCCESS)
+        ret = aes_set_key(&keys->ecdh, key, key_len);
+    TEE_MemFill(key, 0, keys->key_size / 8);
+    if (ret != TEE_SUCCESS)
+    {
+        EMSG("\nFailed to load the group key: 0x%x\n", ret);
+        return ret;
+    }
+    DMSG("\n========== Group key loaded. ==========\n");
+    return ret;
+}
+
+TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
+                                    TEE_Param params[4],
+                                    void **session)
 {
     struct rsa_session *sess;
+    uint32_t key_size = RSA_KEY_SIZE;
+    uint32_t scheme = RSA_SCHEME;
+    uint32_t alg;
+    bool report = false;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+    const uint32_t report_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+                        TEE_PARAM_TYPE_VALUE_OUTPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    /* Key size and padding scheme are negotiated once per session */
+    if (param_types == exp_param_types || param_types == report_param_types)
+    {
+        key_size = params[0].value.a;
+        scheme = params[0].value.b;
+        report = param_types == report_param_types;
+    }
+    else if (param_types != TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE,
+                                            TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE))
+    {
+        return TEE_ERROR_BAD_PARAMETERS;
+    }
+    if (key_size != 1024 && key_size != 2048 && key_size != 3072)
+    {
+        EMSG("\nUnsupported RSA key size %u\n", key_size);
+        return TEE_ERROR_NOT_SUPPORTED;
+    }
+    if (ta2tee_rsa_scheme(scheme, &alg) != TEE_SUCCESS)
+        return TEE_ERROR_NOT_SUPPORTED;
+    /* the keys in the table are of the size and scheme they were negotiated with */
+    if (table.sessions > 0 && (table.key_size != key_size || table.alg != alg))
+    {
+        EMSG("\nKey table holds RSA-%u keys of another scheme, %u sessions open\n",
+             table.key_size, table.sessions);
+        return TEE_ERROR_ACCESS_CONFLICT;
+    }
+
     sess = TEE_Malloc(sizeof(*sess), 0);
     if (!sess)
         return TEE_ERROR_OUT_OF_MEMORY;
-
-    sess->key_handle = TEE_HANDLE_NULL;
-    sess->op_handle = TEE_HANDLE_NULL;
+    /* the only other allocation of the session, commands take from it */
+    if (arena_init(&sess->scratch, SCRATCH_SIZE(key_size)) != TEE_SUCCESS)
+    {
+        TEE_Free(sess);
+        return TEE_ERROR_OUT_OF_MEMORY;
+    }
+    sess->own.key_handle = TEE_HANDLE_NULL;
+    sess->own.dec_handle = TEE_HANDLE_NULL;
+    sess->own.enc_handle = TEE_HANDLE_NULL;
+    sess->own.key_id = 0;
+    sess->epoch = 0;
+
+    /* no keys are left over, only the setup of the last session */
+    if (table.key_size != key_size || table.alg != alg)
+    {
+        reset_key_table(&table);
+        table.key_size = key_size;
+        table.alg = alg;
+    }
+    table.sessions++;
+    if (report)
+    {
+        params[1].value.a = TA_SHARED_KEYS;
+        params[1].value.b = table.sessions;
+    }
 
     *session = (void *)sess;
-    DMSG("\nSession %p: newly allocated\n", *session);
+    DMSG("\nSession %p: newly allocated, %u open\n", *session, table.sessions);
 
     return TEE_SUCCESS;
 }
@@ -251,19 +730,89 @@ void TA_CloseSessionEntryPoint(void *session)
     DMSG("Session %p: release session", session);
     sess = (struct rsa_session *)session;
 
-    /* Release the session resources
-       These tests are mandatories to avoid PANIC TA (TEE_HANDLE_NULL) */
-    if (sess->key_handle != TEE_HANDLE_NULL)
-        TEE_FreeTransientObject(sess->key_handle);
-    if (sess->op_handle != TEE_HANDLE_NULL)
-        TEE_FreeOperation(sess->op_handle);
+    /* Release the session resources */
+    free_key_slot(&sess->own);
+    arena_release(&sess->scratch);
+    table.sessions--;
+    /* a kept instance must not hand this client's keys to whoever opens next */
+    if (table.owner == sess)
+        reset_key_table(&table);
     TEE_Free(sess);
 }
 
-TEE_Result TA_InvokeCommandEntryPoint(void *session,
-                                      uint32_t cmd,
-                                      uint32_t param_types,
-                                      TEE_Param params[4])
+/* A token the owner's other sessions attach to the table with */
+TEE_Result share_keys(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (table.owner != (struct rsa_session *)session)
+        return TEE_ERROR_ACCESS_DENIED;
+    if (params[0].memref.size < TA_SHARE_TOKEN_SIZE)
+        return TEE_ERROR_SHORT_BUFFER;
+
+    TEE_GenerateRandom(table.token, sizeof(table.token));
+    table.shared = true;
+    TEE_MemMove(params[0].memref.buffer, table.token, sizeof(table.token));
+    params[0].memref.size = sizeof(table.token);
+    return TEE_SUCCESS;
+}
+
+TEE_Result attach_keys(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    struct rsa_session *sess = (struct rsa_session *)session;
+    uint8_t *token = params[0].memref.buffer;
+    uint8_t diff = 0;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types || params[0].memref.size != TA_SHARE_TOKEN_SIZE)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (!table.shared)
+        return TEE_ERROR_ACCESS_DENIED;
+    /* every byte, so the time taken does not tell how much of it matched */
+    for (int i = 0; i < TA_SHARE_TOKEN_SIZE; i++)
+        diff |= token[i] ^ table.token[i];
+    if (diff)
+    {
+        EMSG("\nSession %p: wrong key table token\n", session);
+        return TEE_ERROR_ACCESS_DENIED;
+    }
+    sess->epoch = table.epoch;
+    DMSG("\nSession %p: attached to the key table\n", session);
+    return TEE_SUCCESS;
+}
+
+TEE_Result arena_stats(void *session, uint32_t param_types, TEE_Param params[4])
+{
+    struct arena *a = &((struct rsa_session *)session)->scratch;
+    const uint32_t exp_param_types =
+        TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+                        TEE_PARAM_TYPE_VALUE_OUTPUT,
+                        TEE_PARAM_TYPE_NONE,
+                        TEE_PARAM_TYPE_NONE);
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    params[0].value.a = a->size;
+    params[0].value.b = a->high_water;
+    params[1].value.a = a->allocs;
+    params[1].value.b = a->refused;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result dispatch_command(void *session,
+                                   uint32_t cmd,
+                                   uint32_t param_types,
+                                   TEE_Param params[4])
 {
     switch (cmd)
     {
@@ -276,8 +825,47 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session,
     case TA_RSA_CMD_GET_PUB_KEY:
         // return Get_Pub_key(session, param_types, params);
         return RSA_get_public_key_exponent_modulus(session, param_types, params);
+    case TA_RSA_CMD_STORE_KEY:
+        return RSA_store_key(session, param_types, params);
+    case TA_RSA_CMD_LOAD_KEY:
+        return RSA_load_key(session, param_types, params);
+    case TA_RSA_CMD_LOAD_PENDING_KEY:
+        return RSA_load_pending_key(session, param_types, params);
+    case TA_RSA_CMD_DROP_CRT:
+        return RSA_drop_crt(session);
+    case TA_ECDH_CMD_GEN_KEY:
+        if (claim_table((struct rsa_session *)session) != TEE_SUCCESS)
+            return TEE_ERROR_ACCESS_CONFLICT;
+        return ecdh_gen_key(&table.ecdh, param_types, params);
+    case TA_ECDH_CMD_DERIVE:
+        if (claim_table((struct rsa_session *)session) != TEE_SUCCESS)
+            return TEE_ERROR_ACCESS_CONFLICT;
+        return ecdh_derive(&table.ecdh, param_types, params);
+    case TA_AES_CMD_DECRYPT_FRAME:
+        if (!USES_TABLE((struct rsa_session *)session))
+            return TEE_ERROR_ACCESS_DENIED;
+        return aes_decrypt_frame(&table.ecdh, param_types, params);
+    case TA_AES_CMD_LOAD_GROUP_KEY:
+        return AES_load_group_key(session, param_types, params);
+    case TA_CMD_ARENA_STATS:
+        return arena_stats(session, param_types, params);
+    case TA_CMD_SHARE_KEYS:
+        return share_keys(session, param_types, params);
+    case TA_CMD_ATTACH_KEYS:
+        return attach_keys(session, param_types, params);
     default:
         EMSG("Command ID 0x%x is not supported", cmd);
         return TEE_ERROR_NOT_SUPPORTED;
     }
+}
+
+TEE_Result TA_InvokeCommandEntryPoint(void *session,
+                                      uint32_t cmd,
+                                      uint32_t param_types,
+                                      TEE_Param params[4])
+{
+    TEE_Result ret = dispatch_command(session, cmd, param_types, params);
+
+    arena_reset(&((struct rsa_session *)session)->scratch);
+    return ret;
 }
\ No newline at end of file
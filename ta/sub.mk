@@ -1,5 +1,7 @@
 global-incdirs-y += include
 srcs-y += my_test_ta.c
+srcs-y += ecdh_ta.c
+srcs-y += arena_ta.c
 
 # To remove a certain compiler flag, add a line like this
 #cflags-template_ta.c-y += -Wno-strict-prototypes
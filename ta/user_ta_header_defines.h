@@ -38,10 +38,24 @@
 #define TA_UUID				TA_MY_TEST_UUID
 
 /*
- * TA properties: multi-instance TA, no specific attribute
+ * TA properties: one instance for every session, kept loaded once the last
+ * session closes, so the TA is not reloaded on reconnects and worker
+ * sessions attach to the keys in its table instead of provisioning their
+ * own. OP-TEE runs one command at a time in a single-instance TA, so tiles
+ * take turns and a rotation key generation pauses decryption; README.md
+ * section 25 has the numbers. TA_SHARED_KEYS 0 gives an instance per
+ * session again, each with keys of its own.
  * TA_FLAG_EXEC_DDR is meaningless but mandated.
  */
+#ifndef TA_SHARED_KEYS
+#define TA_SHARED_KEYS			1
+#endif
+#if TA_SHARED_KEYS
+#define TA_FLAGS			(TA_FLAG_EXEC_DDR | TA_FLAG_SINGLE_INSTANCE | \
+					 TA_FLAG_MULTI_SESSION | TA_FLAG_INSTANCE_KEEP_ALIVE)
+#else
 #define TA_FLAGS			TA_FLAG_EXEC_DDR
+#endif
 
 /* Provisioned stack size */
 #define TA_STACK_SIZE			(2 * 1024)